@@ -0,0 +1,34 @@
+#ifndef AUTOSCALE_H
+#define AUTOSCALE_H
+
+#include <stdint.h>
+
+// Sizing the chat worker pool (chat_pool.h) to its load. The wrapper calls
+// autoscale_tick each time it samples the stats pages: it reads every
+// accepting worker's connection count and how busy its event loop has
+// been since the previous sample, and the loop stalls the watchdog caught
+// (metrics.h). When the workers are, on average, fuller or busier than the
+// policy's upper thresholds, or any of them stalled, one more worker is
+// started; new connections reach it through the shared SO_REUSEPORT port.
+// When one worker fewer would still sit under the lower thresholds for the
+// whole idle period, the emptiest worker is drained. One step at a time,
+// at most once per cooldown.
+
+struct AutoscalePolicy
+{
+    int      min_workers;
+    int      max_workers;
+    int64_t  up_connections;      // per worker, on average
+    int64_t  down_connections;    // per worker if one fewer took them all
+    uint32_t up_busy_percent;     // event loop busy time, averaged over the workers
+    uint32_t down_busy_percent;
+    uint64_t idle_ns;
+    uint64_t cooldown_ns;
+};
+
+void     autoscale_init(const struct AutoscalePolicy *policy);
+void     autoscale_tick(uint64_t now_ns);
+uint64_t autoscale_ups(void);
+uint64_t autoscale_downs(void);
+
+#endif    // AUTOSCALE_H
@@ -0,0 +1,33 @@
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+// What the load generators (chatbench, connscale) share: number and
+// address parsing, the monotonic clock, and the chat protocol's framing,
+// a version byte and a big-endian 16-bit length ahead of the text.
+
+#define UNKNOWN_OPTION_MESSAGE_LEN 24
+#define BASE_TEN 10
+#define PROTOCOL_VERSION 1
+#define HEADER_SIZE 3
+#define MAX_CONTENT 1023    // the server reads frames into a 1 KiB buffer
+#define NANOS_PER_SECOND UINT64_C(1000000000)
+#define NANOS_PER_MILLI UINT64_C(1000000)
+#define NANOS_PER_MICRO UINT64_C(1000)
+#define WELCOME_PREFIX "\nWelcome to the chat"
+#define SERVER_FULL_PREFIX "Server: server is full"
+
+// The tool's usage message; expected not to return
+typedef void (*BenchUsage)(const char *program_name, int exit_code, const char *message);
+
+uint64_t bench_parse_number(const char *binary_name, const char *str, uint64_t max, BenchUsage usage);
+void     bench_convert_address(const char *address, in_port_t port, struct sockaddr_storage *addr, socklen_t *addr_len);
+uint64_t bench_now_ns(void);
+void     bench_frame_header(uint8_t *header, size_t content_len);
+uint16_t bench_frame_size(const uint8_t *header);
+
+#endif    // BENCH_COMMON_H
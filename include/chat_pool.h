@@ -0,0 +1,118 @@
+#ifndef CHAT_POOL_H
+#define CHAT_POOL_H
+
+#include <signal.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Pre-forked group chat workers. The wrapper opens the chat port once per
+// worker with SO_REUSEPORT and forks a worker onto each socket, so the
+// kernel spreads new connections across them. A worker that dies is forked
+// again onto the same socket: only its own clients are cut off, and
+// connections that arrive meanwhile wait in its backlog.
+//
+// Workers relay room messages and whispers through one ring in shared
+// memory. A worker appends under a process-shared robust mutex and takes
+// the next room sequence number in the same step, then pokes the others'
+// eventfds; every worker applies the ring in order, its own messages
+// included. A worker that dies half way through an append publishes
+// nothing, so the room numbering has no holes. Worker 0 continues the
+// numbering from the write-ahead log before any worker serves a client.
+// Usernames are kept in a shared directory, one row per worker, for /ul,
+// /u and /w, and the resume sessions in a shared table (session.h), so a
+// client can resume on whichever worker its new connection lands.
+//
+// A hot restart replaces the workers one at a time without dropping
+// anyone, and rolls out whatever build is now at the wrapper's path: the
+// successor is forked and execs that binary, and the wrapper sends it the
+// memfds of the ring, the name directory and the session table, its
+// listen socket (so the backlog keeps filling in the meantime), the
+// eventfds and its end of a handoff channel over its control socket
+// (SCM_RIGHTS). Once it says it is ready, the wrapper passes the old
+// worker the other end. The old worker sends its state and client sockets
+// down the channel (handoff.h) and exits; the successor applies the ring
+// up to where the old worker stopped, adopts the clients and carries on
+// from there. A build whose shared memory does not match
+// (CHAT_POOL_EXEC_VERSION and the sizes of what is shared) refuses, and
+// the old worker keeps serving.
+//
+// The number of workers can follow the load (autoscale.h): chat_pool_grow
+// forks one more onto a fresh SO_REUSEPORT socket, and a drained worker
+// closes its socket, so the kernel steers new connections to the rest,
+// and exits once its last client has left.
+//
+// The wrapper side runs in the wrapper only; the worker side only in a
+// worker, from its event loop thread.
+
+#define CHAT_POOL_MAX_WORKERS 64
+#define CHAT_POOL_RING_SLOTS 4096    // relayed messages kept; a worker that falls further behind skips ahead
+#define CHAT_POOL_NAME_SIZE 16
+#define CHAT_POOL_TEXT_SIZE 1024
+#define CHAT_POOL_RESTART_DELAY_MS 1000    // a worker that dies sooner than this after starting waits this long
+#define CHAT_POOL_STOP_TIMEOUT_MS 5000     // a stopping worker still running after this is killed
+#define CHAT_POOL_CONTROL_HANDOFF 1          // control record: hand the clients over on the passed channel
+#define CHAT_POOL_CONTROL_DRAIN 2            // control record: stop accepting, exit when the last client leaves
+#define CHAT_POOL_CONTROL_STATE 3            // control record to an exec'd successor: the pool it joins
+#define CHAT_POOL_CONTROL_FD 4               // control record to an exec'd successor: one of its descriptors
+#define CHAT_POOL_CONTROL_READY 5            // control record from an exec'd successor: waiting for its predecessor
+#define CHAT_POOL_EXEC_ARG "--chat-worker"   // argv[1] of an exec'd successor; argv[2] is its control socket
+#define CHAT_POOL_EXEC_VERSION 2             // bump when the handoff records (server.h) or the shared memory change
+
+enum ChatRelayKind
+{
+    CHAT_RELAY_ROOM,
+    CHAT_RELAY_DIRECT
+};
+
+struct ChatRelayMessage
+{
+    uint32_t kind;
+    int32_t  origin;    // worker that appended it
+    uint64_t seq;       // room sequence number (room messages only)
+    char     sender[CHAT_POOL_NAME_SIZE];
+    char     target[CHAT_POOL_NAME_SIZE];    // whisper recipient
+    char     text[CHAT_POOL_TEXT_SIZE];
+};
+
+typedef int (*ChatPoolOpenListener)(void *ctx);
+typedef void (*ChatPoolRun)(int worker, void *ctx);
+typedef void (*ChatRelayHandler)(const struct ChatRelayMessage *message);
+typedef void (*ChatPoolNameVisitor)(const char *name, int worker, void *ctx);
+
+// Wrapper side
+int      chat_pool_init(int workers, int names_per_worker, int sessions_per_worker);
+int      chat_pool_size(void);
+int      chat_pool_start(ChatPoolOpenListener open_listener, ChatPoolRun run, void *ctx, int count);
+int      chat_pool_grow(void);    // the worker started, or -1
+int      chat_pool_drain_worker(int worker);
+int      chat_pool_accepting(int worker);
+int      chat_pool_active(void);
+void     chat_pool_supervise(void);
+void     chat_pool_signal(int signum);
+void     chat_pool_stop(void);
+uint64_t chat_pool_restarts(void);
+int      chat_pool_hot_restart(void);
+
+// Worker side
+int      chat_pool_resume(int control);    // in an exec'd successor, before anything else: its worker, or -1
+int      chat_pool_worker(void);    // -1 outside the pool
+void    *chat_pool_sessions(void);
+int      chat_pool_listen_socket(void);
+int      chat_pool_event_fd(void);
+int      chat_pool_control_fd(void);
+int      chat_pool_take_control(int *channel);    // CHAT_POOL_CONTROL_*, or -1
+int      chat_pool_draining(void);
+int      chat_pool_handoff_fd(void);              // the predecessor's channel in a successor, else -1
+void     chat_pool_handoff_done(void);
+uint64_t chat_pool_position(void);
+void     chat_pool_attach(ChatRelayHandler handler);
+void     chat_pool_attach_at(ChatRelayHandler handler, uint64_t position);
+uint64_t chat_pool_append(enum ChatRelayKind kind, const char *sender, const char *target, const char *text);
+void     chat_pool_drain(ChatRelayHandler handler);
+void     chat_pool_restore_seq(uint64_t last_seq);
+void     chat_pool_await_seq(const volatile sig_atomic_t *stop);
+void     chat_pool_name_set(int slot, const char *name);    // "" clears the slot
+int      chat_pool_name_find(const char *name);             // the worker that has the name, or -1
+void     chat_pool_names_visit(ChatPoolNameVisitor visitor, void *ctx);
+
+#endif    // CHAT_POOL_H
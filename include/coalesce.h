@@ -0,0 +1,27 @@
+#ifndef COALESCE_H
+#define COALESCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Per-connection output coalescing for the group chat event loop.
+// While the server is quiet every frame is written as soon as it is produced.
+// Once connections start receiving more than one frame per loop iteration the
+// frames are queued and each connection gets a single write at the end of the
+// iteration, or earlier if its oldest queued frame exceeds the delay cap.
+// All functions must be called from the event loop thread. How much gets
+// batched shows up in the coalesce_* counters of metrics.h.
+
+#define COALESCE_BUFFER_SIZE (64 * 1024)
+#define COALESCE_MAX_DELAY_US 2000
+#define COALESCE_RATIO_SCALE 256
+#define COALESCE_BATCH_RATIO (COALESCE_RATIO_SCALE * 3 / 2)    // 1.5 frames per touched connection per tick
+#define COALESCE_EWMA_SHIFT 3
+
+void coalesce_register(int fd);
+void coalesce_release(int fd);
+int  coalesce_submit(int fd, const uint8_t *header, size_t header_len, const char *payload, size_t payload_len);
+int  coalesce_flush(int fd);
+void coalesce_end_tick(void);
+
+#endif    // COALESCE_H
@@ -0,0 +1,76 @@
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Always-on flight recorder. Every thread keeps the last events_per_thread
+// server events (accepts, disconnects, commands, errors, queue limits) in a
+// ring of fixed-size records; recording one is a cycle-counter read and a
+// 32-byte store. flight_dump writes every ring to the path given to
+// flight_init with nothing but open/write/close, so it is safe to call
+// from a signal handler, including on a crash. flightdecode turns a dump
+// into text.
+
+enum FlightEvent
+{
+    FLIGHT_START,             // a: port
+    FLIGHT_ACCEPT,            // a: slot, b: population
+    FLIGHT_REJECT,            // b: population
+    FLIGHT_DISCONNECT,        // a: slot, b: bytes received over the connection
+    FLIGHT_COMMAND,           // a: up to 8 characters of the command name
+    FLIGHT_ROOM_MESSAGE,      // a: sequence number, b: bytes
+    FLIGHT_DIRECT_MESSAGE,    // a: receiver fd, b: bytes
+    FLIGHT_RESUME,            // a: slot, b: first missed sequence number
+    FLIGHT_SEND_ERROR,        // a: slot, b: errno
+    FLIGHT_THROTTLED,         // a: slot, b: frames received so far
+    FLIGHT_DELIVERY_SKIP,     // a: skipped sequence number
+    FLIGHT_WAL_WAIT,          // a: sequence number, b: staged bytes
+    FLIGHT_STOP,              // b: population
+    FLIGHT_STALL,             // a: milliseconds the event loop iteration had been running
+    FLIGHT_EVENT_COUNT
+};
+
+struct FlightRecord
+{
+    uint64_t clock;    // flight_clock() ticks
+    uint16_t event;
+    uint16_t reserved;
+    int32_t  fd;
+    int64_t  a;
+    int64_t  b;
+};
+
+// Dump layout: one FlightDumpHeader, then per thread a FlightThreadHeader and events_per_thread records
+#define FLIGHT_MAGIC "GCFLIGHT"
+#define FLIGHT_VERSION 1
+
+struct FlightDumpHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t threads;
+    uint32_t events_per_thread;
+    int32_t  signal;         // what triggered the dump (0 = called directly)
+    int64_t  pid;
+    uint64_t clock_start;    // flight_clock() and CLOCK_MONOTONIC at flight_init ...
+    uint64_t ns_start;
+    uint64_t clock_dump;     // ... and at the dump, to turn ticks into nanoseconds
+    uint64_t ns_dump;
+    int64_t  wall_start_ns;    // CLOCK_REALTIME at flight_init
+};
+
+struct FlightThreadHeader
+{
+    int64_t  tid;
+    uint64_t head;    // events ever recorded; the newest events_per_thread of them are in the ring
+};
+
+int         flight_init(const char *path, uint32_t events_per_thread);
+void        flight_record(enum FlightEvent event, int fd, int64_t a, int64_t b);
+int64_t     flight_pack_name(const char *name);
+int         flight_dump(int signum);
+const char *flight_event_name(uint16_t event);
+size_t      flight_format_args(char *out, size_t size, const struct FlightRecord *record);
+
+#endif    // FLIGHT_H
@@ -0,0 +1,23 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Passing a running group chat process's state to its successor. Each
+// record is one message on a SOCK_SEQPACKET Unix socket: a kind, a payload
+// and at most one descriptor (SCM_RIGHTS). The successor ends up with the
+// very same sockets, so established connections and listen backlogs live
+// through the swap. The caller decides what the records mean; receiving
+// blocks for at most the channel's timeout.
+
+#define HANDOFF_TIMEOUT_MS 5000
+#define HANDOFF_RECORD_MAX (8 * 1024)    // largest payload
+
+int     handoff_channel(int fds[2]);
+int     handoff_set_timeout(int channel, int timeout_ms);
+int     handoff_send(int channel, uint32_t kind, const void *payload, size_t len, int fd);
+ssize_t handoff_recv(int channel, uint32_t *kind, void *payload, size_t size, int *fd);
+
+#endif    // HANDOFF_H
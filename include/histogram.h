@@ -0,0 +1,32 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+// Plain log-linear latency histogram for the benchmark tools: 8 buckets per
+// power of two, so every reported value is within 12.5% of the real one.
+// One owner per histogram; per-thread histograms are merged at the end.
+// The server's shared-memory histograms (metrics.h) use the same buckets.
+
+#define HISTOGRAM_SUB_BUCKET_BITS 3
+#define HISTOGRAM_SUB_BUCKETS (1U << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+struct Histogram
+{
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+};
+
+uint32_t histogram_bucket(uint64_t value);
+uint64_t histogram_bucket_top(uint32_t bucket);
+void     histogram_reset(struct Histogram *histogram);
+void     histogram_record(struct Histogram *histogram, uint64_t value);
+void     histogram_merge(struct Histogram *into, const struct Histogram *from);
+uint64_t histogram_percentile(const struct Histogram *histogram, uint32_t permille);
+uint64_t histogram_mean(const struct Histogram *histogram);
+
+#endif    // HISTOGRAM_H
@@ -0,0 +1,33 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+// Recent room history kept as already-encoded frames (header + content) in
+// one pre-allocated byte ring, so a joiner can be caught up with a single
+// write straight out of the ring. Oldest frames are evicted when either the
+// byte or the entry limit is reached. Event loop thread only.
+
+#define HISTORY_SEGMENTS 2    // a selection wraps the ring at most once
+
+struct HistoryStats
+{
+    size_t   capacity_bytes;
+    size_t   used_bytes;
+    size_t   entries;
+    uint64_t oldest_seq;
+    uint64_t newest_seq;
+    uint64_t evicted;
+};
+
+int    history_init(size_t capacity_bytes, size_t max_entries);
+void   history_free(void);
+void   history_append(uint64_t seq, const uint8_t *header, size_t header_len, const char *payload, size_t payload_len);
+size_t history_select(size_t max_messages, uint64_t max_age_seconds, uint64_t last_seq, struct iovec iov[HISTORY_SEGMENTS], int *iov_count, uint64_t *first_seq);
+size_t history_select_range(uint64_t first_seq, uint64_t last_seq, struct iovec iov[HISTORY_SEGMENTS], int *iov_count);
+int    history_lookup(uint64_t seq, char *out, size_t out_size);
+void   history_get_stats(struct HistoryStats *stats);
+
+#endif    // HISTORY_H
@@ -0,0 +1,44 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+
+// Asynchronous logger. A log call only captures its arguments in binary
+// form (strings are copied) into the calling thread's own lock-free ring;
+// a background thread formats the records, in timestamp order across
+// threads, and writes them out in batches. The format must be a string
+// literal: only the pointer is kept. '*' widths are not supported. Before
+// log_start and after log_stop, calls print synchronously instead.
+// LOG_DEBUG calls are compiled out when NDEBUG is defined.
+
+enum LogLevel
+{
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,     // WARN and ERROR go to stderr
+    LOG_LEVEL_ERROR
+};
+
+void     log_start(void);
+void     log_stop(void);
+void     log_set_level(enum LogLevel level);
+uint64_t log_dropped(void);
+void     log_write(enum LogLevel level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+#ifdef NDEBUG
+    #define LOG_DEBUG(...)                              \
+        do                                              \
+        {                                               \
+            if(0)                                       \
+            {                                           \
+                log_write(LOG_LEVEL_DEBUG, __VA_ARGS__); \
+            }                                           \
+        } while(0)
+#else
+    #define LOG_DEBUG(...) log_write(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#endif
+#define LOG_INFO(...) log_write(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...) log_write(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) log_write(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+#endif    // LOG_H
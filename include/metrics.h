@@ -0,0 +1,103 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "histogram.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Runtime metrics of the chat server: counters, gauges and log-linear
+// (HDR-style) latency histograms. The chat server records into a private
+// registry; every metric has a single writer thread, so an update is a
+// plain relaxed load and store and never a syscall. The event loop copies
+// the registry into a shared page at most once per publish interval,
+// under a seqlock, and the wrapper (which mapped the page before forking
+// the chat server) reads consistent snapshots from it for /stats and the
+// client count it reports to the server manager. With a pool of chat
+// workers each has its own page, and readers sum them.
+
+enum MetricCounter
+{
+    METRIC_FRAMES_IN,
+    METRIC_BYTES_IN,
+    METRIC_FRAMES_OUT,
+    METRIC_BYTES_OUT,
+    METRIC_REPLAYED_FRAMES,
+    METRIC_BROADCASTS,
+    METRIC_DIRECT_MESSAGES,
+    METRIC_CONNECTIONS_ACCEPTED,
+    METRIC_CONNECTIONS_REJECTED,
+    METRIC_SEND_FAILURES,
+    METRIC_DELIVERY_SKIPS,       // room frames a recipient never got (sequencer window)
+    METRIC_HISTORY_EVICTIONS,    // room frames pushed out of the history ring
+    METRIC_SEARCH_EVICTIONS,     // index blocks dropped over the memory budget
+    METRIC_LOOP_STALLS,          // event loop iterations the watchdog caught over its threshold
+    METRIC_RELAYED_IN,           // room messages and whispers applied from other workers (see chat_pool.h)
+    METRIC_RELAY_SKIPS,          // relayed messages a worker fell too far behind to apply
+    // Output coalescing (see coalesce.h); queued frames / writes is frames per write
+    METRIC_COALESCE_BATCHED_TICKS,    // event loop iterations that ended in batching mode
+    METRIC_COALESCE_QUEUED_FRAMES,    // frames held for the end of the tick instead of written at once
+    METRIC_COALESCE_WRITES,           // send calls that flushed queued frames
+    // Broadcast fan-out (see zerocopy.h)
+    METRIC_COPY_SENDS,                // broadcast frames sent the ordinary way
+    METRIC_COPY_BYTES,
+    METRIC_ZEROCOPY_SENDS,            // send() calls made with MSG_ZEROCOPY
+    METRIC_ZEROCOPY_BYTES,
+    METRIC_ZEROCOPY_COMPLETIONS,      // zero-copy sends the error queue reported complete
+    METRIC_ZEROCOPY_KERNEL_COPIED,    // completions where the kernel copied after all (e.g. loopback)
+    METRIC_ZEROCOPY_FALLBACKS,        // zero-copy attempts that had to be sent by copy instead
+    METRIC_COUNTER_COUNT
+};
+
+enum MetricGauge
+{
+    METRIC_CONNECTIONS,
+    METRIC_OUTPUT_QUEUED_BYTES,    // coalesced output waiting for the end of the tick
+    METRIC_WAL_STAGED_BYTES,       // room log bytes waiting for the writer thread
+    METRIC_GAUGE_COUNT
+};
+
+enum MetricHistogram
+{
+    METRIC_DISPATCH_NS,      // handling one client frame
+    METRIC_BROADCAST_NS,     // fanning one room message out
+    METRIC_WAL_COMMIT_NS,    // write + fdatasync of one room log batch
+    METRIC_LOOP_BUSY_NS,     // one event loop iteration, from select returning to the next select
+    // Kernel timestamps (opt-in, see timestamping.h)
+    METRIC_KERNEL_RX_TO_APP_NS,    // packet received by the kernel -> its frame decoded
+    METRIC_APP_TO_KERNEL_TX_NS,    // frame queued by the server -> handed to the device
+    METRIC_KERNEL_TX_QUEUE_NS,     // entered the kernel's queueing layer -> handed to the device
+    METRIC_KERNEL_TX_TO_ACK_NS,    // handed to the device -> acknowledged by the peer
+    METRIC_HISTOGRAM_COUNT
+};
+
+#define METRICS_BUCKETS HISTOGRAM_BUCKETS    // histogram.h's buckets: values within 12.5%
+
+// One chat server process's load as last published, for scaling decisions; the counters only ever grow
+// while the process lives
+struct MetricsLoad
+{
+    int64_t  connections;
+    uint64_t loop_iterations;
+    uint64_t loop_busy_ns;
+    uint64_t loop_stalls;
+};
+
+int     metrics_init(int count);
+int     metrics_attach(int fd, int count);
+int     metrics_fd(void);
+int     metrics_page_count(void);
+size_t  metrics_page_size(void);
+void    metrics_use_page(int index);
+void    metrics_reset_page(int index);
+void    metrics_start(uint64_t publish_interval_ns);
+int     metrics_publish(uint64_t now_ns);
+void    metrics_publish_now(uint64_t now_ns);
+void    metrics_adopt_page(void);
+void    metrics_add(enum MetricCounter counter, uint64_t amount);
+void    metrics_set(enum MetricGauge gauge, int64_t value);
+void    metrics_record(enum MetricHistogram histogram, uint64_t value);
+int64_t metrics_gauge(enum MetricGauge gauge);
+int     metrics_load(int index, struct MetricsLoad *out);
+size_t  metrics_format(char *out, size_t size, uint64_t now_ns);
+
+#endif    // METRICS_H
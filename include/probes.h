@@ -0,0 +1,32 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+// USDT probes (provider "groupchat") for perf, bpftrace and SystemTap, e.g.
+//   bpftrace -e 'usdt:./wrapper:groupchat:dispatch { @[arg2] = count(); }'
+// Every probe carries (fd, size, client index); the index is -1 where the
+// code does not know the client. size is the frame content for
+// frame_header/frame_decode/dispatch, the bytes written for send_done, the
+// population for connection_accept and the bytes received over the whole
+// connection for connection_close. An unattached probe is a single nop, so
+// they stay in production builds. Without <sys/sdt.h> (systemtap-sdt-dev)
+// or with -DPROBES_ENABLED=0 they compile to nothing.
+
+#ifndef PROBES_ENABLED
+    #if defined(__has_include)
+        #if __has_include(<sys/sdt.h>)
+            #define PROBES_ENABLED 1
+        #endif
+    #endif
+#endif
+#ifndef PROBES_ENABLED
+    #define PROBES_ENABLED 0
+#endif
+
+#if PROBES_ENABLED
+    #include <sys/sdt.h>
+    #define GROUPCHAT_PROBE(name, fd, size, client_index) DTRACE_PROBE3(groupchat, name, fd, size, client_index)
+#else
+    #define GROUPCHAT_PROBE(name, fd, size, client_index) ((void)(fd), (void)(size), (void)(client_index))
+#endif
+
+#endif    // PROBES_H
@@ -8,19 +8,24 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #define PROTOCOL_VERSION 1
+#define PROTOCOL_HEADER_SIZE 3
 
 // Function prototypes
 ssize_t send_byte(int sockfd, uint8_t byte);
 ssize_t send_uint16(int sockfd, uint16_t value);
+void    encode_header(uint8_t header[PROTOCOL_HEADER_SIZE], uint8_t version, uint16_t content_size);
 int     send_header(int sockfd, uint8_t version, uint16_t content_size);
 int     send_with_protocol(int sockfd, uint8_t version, const char *message);
+int     send_iov_all(int sockfd, struct iovec *iov, int iov_count);
 
 ssize_t recv_byte(int sockfd, uint8_t *byte);
 ssize_t recv_uint16(int sockfd, uint16_t *value);
 int     read_header(int sockfd, uint8_t *version, uint16_t *content_size);
 ssize_t read_with_protocol(int sockfd, uint8_t *version, char *buffer, size_t buffer_size);
+int     parse_frame(const uint8_t *data, size_t len, uint8_t *version, char *buffer, size_t buffer_size, size_t *consumed);
 
 #endif    // PROTOCOL_H
@@ -0,0 +1,33 @@
+#ifndef SEARCH_INDEX_H
+#define SEARCH_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Inverted index over room messages for /search. Messages are indexed as
+// they are sequenced, into blocks of consecutive sequence numbers; each
+// block maps term -> posting list of delta/varint-encoded message numbers.
+// When the memory budget is exceeded the oldest block is dropped whole.
+// Queries AND their terms and walk blocks newest first, stopping once they
+// have enough results or have used up their work budget. Event loop only.
+
+#define SEARCH_MAX_TERM 32       // longer words are indexed by their prefix
+#define SEARCH_MAX_QUERY_TERMS 8
+
+struct SearchStats
+{
+    size_t   memory_bytes;
+    size_t   blocks;
+    size_t   terms;
+    uint64_t messages;
+    uint64_t oldest_seq;
+    uint64_t evicted_blocks;
+};
+
+int    search_index_init(size_t memory_budget, uint32_t block_messages);
+void   search_index_free(void);
+void   search_index_add(uint64_t seq, const char *text);
+size_t search_index_query(const char *query, uint64_t *results, size_t max_results, uint64_t oldest_seq);
+void   search_index_get_stats(struct SearchStats *stats);
+
+#endif    // SEARCH_INDEX_H
@@ -0,0 +1,40 @@
+#ifndef SEQUENCER_H
+#define SEQUENCER_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+// Room message sequencing. Every [All] message takes the next number from a
+// single atomic counter, and each recipient has a DeliveryOrder that only
+// lets frames out in sequence order. Fan-out may therefore run on any number
+// of threads: a frame that arrives early is held back until the ones before
+// it have been sent. If a hole outlives the window the recipient skips it,
+// and the client sees the gap in the numbers.
+
+#define SEQUENCER_WINDOW 64    // frames a recipient may hold back while waiting for an earlier one
+
+typedef void (*SequencedSend)(int recipient, const char *message, void *ctx);
+
+struct HeldFrame
+{
+    uint64_t seq;
+    char    *message;
+};
+
+struct DeliveryOrder
+{
+    pthread_mutex_t  lock;
+    uint64_t         next_seq;
+    uint64_t         skipped;    // sequence numbers this recipient will never get
+    struct HeldFrame held[SEQUENCER_WINDOW];
+};
+
+uint64_t sequencer_next(void);
+uint64_t sequencer_last(void);
+void     sequencer_restore(uint64_t last_seq);
+
+void delivery_order_init(struct DeliveryOrder *order, uint64_t next_seq);
+void delivery_order_reset(struct DeliveryOrder *order, uint64_t next_seq);
+void delivery_order_submit(struct DeliveryOrder *order, uint64_t seq, const char *message, SequencedSend send, int recipient, void *ctx);
+
+#endif    // SEQUENCER_H
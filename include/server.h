@@ -1,5 +1,6 @@
 #ifndef SERVER_SERVER_H
 #define SERVER_SERVER_H
+#include "sequencer.h"
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -20,6 +21,10 @@
 void      admin_sigint_handler(int signum);
 void      admin_setup_signal_handler(void);
 void      group_chat_sigint_handler(int signum);
+void      group_chat_trace_handler(int signum);
+void      group_chat_flight_handler(int signum);
+void      group_chat_term_handler(int signum);
+void      group_chat_fatal_handler(int signum);
 void      group_chat_setup_signal_handler(void);
 void      handle_arguments(const char *ip_address, const char *port_str, in_port_t *port);
 in_port_t parse_in_port_t(const char *port_str);
@@ -33,26 +38,129 @@ void      socket_close(int sockfd);
 // Admin Server Methods
 void    start_admin_server(struct sockaddr_storage *addr, in_port_t port);
 void    handle_prompt(char **address, char **port_str);
-int     handle_new_server_manager(int server_socket, struct sockaddr_storage *client_addr, socklen_t *client_addr_len, const int pipe_fds[2], struct sockaddr_storage *addr, in_port_t port);
-ssize_t read_from_pipe(int pipe_fd, int server_manager_socket);
+int     handle_new_server_manager(int server_socket, struct sockaddr_storage *client_addr, socklen_t *client_addr_len, in_port_t port);
+void    report_client_count(int server_manager_socket, int64_t *reported_count);
 
 // GroupChat Methods
-void *handle_client(const void *arg);
-void  start_groupChat_server(struct sockaddr_storage *addr, in_port_t port, int sm_socket, int pipe_write_fd);
-void  free_usernames(void);
+int   handle_client_input(int client_index);
+void  start_groupChat_server(struct sockaddr_storage *addr, in_port_t port, int sm_socket);
+int   admit_client(int client_socket);
+void  replay_history(int client_socket, uint64_t last_seq);
+void  replay_range(int client_socket, uint64_t first_seq, uint64_t last_seq);
+void  resume_session(int sender_fd, const char *buffer);
+void  search_history(int sender_fd, const char *buffer);
+void  recover_history_frame(uint64_t seq, const uint8_t *frame, size_t len);
+void  release_client(int client_index);
+void  allocate_client_buffers(void);
+void  free_client_buffers(void);
 //  void         print_users(void);
 void handle_message(const char *buffer, int sender_fd);
 void send_user_list(int sender_fd);
 void set_username(int sender_fd, const char *buffer);
 void direct_message(int sender_fd, const char *buffer);
+void send_room_frame(int client_index, const char *message, void *ctx);
 
 // GENERAL USE
 #define BASE_TEN 10
 #define MAX_USERNAME_SIZE 15
-#define MAX_CLIENTS 32
+#ifndef MAX_CLIENTS
+    #define MAX_CLIENTS 32    // the event loop uses select, so the server stays under FD_SETSIZE (wrapper.c checks)
+#endif
 #define TWO_FIFTY_SIX 256
 #define BUFFER_SIZE 1024
-#define MESSAGE_SIZE (BUFFER_SIZE + MAX_USERNAME_SIZE + BASE_TEN)
+#define SEQUENCE_DIGITS 20
+#define MESSAGE_SIZE (BUFFER_SIZE + MAX_USERNAME_SIZE + BASE_TEN + SEQUENCE_DIGITS)
+#define CLIENT_INPUT_SIZE (4 * BUFFER_SIZE)
+#define NANOS_PER_SECOND 1000000000LL
+#define NANOS_PER_MICRO 1000U
+#define NANOS_PER_MILLI 1000000ULL
+#define MICROS_PER_MILLI 1000
+#define MILLIS_PER_SECOND 1000
+
+// FAIR READ SCHEDULING (per client, per event loop iteration)
+#define READ_BUDGET_BYTES (8 * BUFFER_SIZE)
+#define READ_BUDGET_FRAMES 16
+#define CLIENT_GONE (-1)
+#define CLIENT_IDLE 0
+#define CLIENT_THROTTLED 1
+
+// ROOM HISTORY (ring of encoded frames, replayed to joiners)
+#define HISTORY_CAPACITY_BYTES (256 * 1024)
+#define HISTORY_MAX_ENTRIES 4096
+#define HISTORY_REPLAY_MESSAGES 50
+#define HISTORY_REPLAY_SECONDS (15 * 60)
+
+// SESSION RESUME; a joiner's history waits this long for a /resume <token> <last seq>
+#define SESSION_MAX (8 * MAX_CLIENTS)
+#define SESSION_TTL_SECONDS 300
+#define SESSION_RESUME_GRACE_MS 50
+
+// ROOM SEARCH (/search); the oldest index blocks are dropped past the memory budget
+#define SEARCH_MEMORY_BYTES (64 * 1024 * 1024)
+#define SEARCH_BLOCK_MESSAGES 65536
+#define SEARCH_MAX_RESULTS 10
+
+// WRITE-AHEAD LOG OF ROOM MESSAGES (opt-in, e.g. -DWAL_ENABLED=1); fsync'd in batches every few ms or N messages
+#ifndef WAL_ENABLED
+    #define WAL_ENABLED 0
+#endif
+#define WAL_DIRECTORY_FORMAT "groupchat-wal-%u"
+#define WAL_SEGMENT_BYTES (16 * 1024 * 1024)
+#define WAL_MAX_SEGMENTS 8    // once a rotation goes past this many, the oldest segments are deleted (0 keeps them all)
+#define WAL_COMMIT_INTERVAL_MS 5
+#define WAL_COMMIT_MESSAGES 256
+
+// ZERO-COPY FAN-OUT (opt-in, e.g. -DZEROCOPY_ENABLED=1); room frames at or above the threshold (bytes, header
+// included; -DZEROCOPY_THRESHOLD=N) use MSG_ZEROCOPY
+#ifndef ZEROCOPY_ENABLED
+    #define ZEROCOPY_ENABLED 0
+#endif
+#ifndef ZEROCOPY_THRESHOLD
+    #define ZEROCOPY_THRESHOLD (BUFFER_SIZE / 2)
+#endif
+#if ZEROCOPY_ENABLED && ZEROCOPY_THRESHOLD > MESSAGE_SIZE
+    #error "ZEROCOPY_THRESHOLD is larger than any room frame, so nothing would use MSG_ZEROCOPY"
+#endif
+
+// KERNEL SOCKET TIMESTAMPS (opt-in, e.g. -DTIMESTAMPING_ENABLED=1); RX and TX/ACK stage latencies go to the stats
+#ifndef TIMESTAMPING_ENABLED
+    #define TIMESTAMPING_ENABLED 0
+#endif
+#if TIMESTAMPING_ENABLED && ZEROCOPY_ENABLED
+    #error "TIMESTAMPING_ENABLED and ZEROCOPY_ENABLED both drain the socket error queue; enable one"
+#endif
+
+// SHARED-MEMORY TRANSPORT (local clients attach via /tmp/groupchat-<port>.sock, mode 0600; -DSHM_TRANSPORT_ENABLED=0 turns it off)
+#ifndef SHM_TRANSPORT_ENABLED
+    #define SHM_TRANSPORT_ENABLED 1
+#endif
+
+// CHAT WORKER POOL (the server manager's /s forks this many workers onto one SO_REUSEPORT port; 0 = one per CPU)
+#ifndef CHAT_WORKERS
+    #define CHAT_WORKERS 0
+#endif
+#define FLIGHT_WORKER_FILE_FORMAT "groupchat-flight-%u-w%d.bin"
+#define TRACE_WORKER_FILE_FORMAT "groupchat-trace-%u-w%d.json"
+#define TRACE_POOL_REQUESTED_MSG "TRACE writing groupchat-trace-%u-w<worker>.json for %d workers\n"
+#define WORKER_RESTARTS_FORMAT "worker_restarts %" PRIu64 "\n"
+
+// HOT RESTART (the server manager's /r; each worker passes its clients to a fresh fork, see chat_pool.h)
+#define HOT_RESTART_MSG "RESTARTED %d of %d workers\n"
+#define HOT_RESTART_UNAVAILABLE_MSG "RESTART unavailable: the group chat server is not running\n"
+
+// AUTOSCALING (> 0: the chat workers start when a server manager logs in and follow the load up to this many; see autoscale.h)
+#ifndef CHAT_AUTOSCALE_MAX_WORKERS
+    #define CHAT_AUTOSCALE_MAX_WORKERS 0
+#endif
+#define CHAT_AUTOSCALE_MIN_WORKERS 1
+#define CHAT_AUTOSCALE_UP_CONNECTIONS (MAX_CLIENTS * 3 / 4)    // per worker, on average
+#define CHAT_AUTOSCALE_DOWN_CONNECTIONS (MAX_CLIENTS / 4)      // per worker if one fewer took them all
+#define CHAT_AUTOSCALE_UP_BUSY_PERCENT 70                      // event loop busy time, averaged over the workers
+#define CHAT_AUTOSCALE_DOWN_BUSY_PERCENT 20
+#define CHAT_AUTOSCALE_IDLE_MS 10000       // load stays under the drain thresholds this long before a worker drains
+#define CHAT_AUTOSCALE_COOLDOWN_MS 2000    // between two scaling steps
+#define TCP_MIGRATE_REQ_PATH "/proc/sys/net/ipv4/tcp_migrate_req"    // 1: a closed listener's backlog moves to the port's others
+#define AUTOSCALE_STATS_FORMAT "workers_active %d\nscale_ups %" PRIu64 "\nscale_downs %" PRIu64 "\n"
 
 // SERVER MANAGER WRAPPER MESSAGES
 #define PASSKEY "hellyabrother"
@@ -63,29 +171,103 @@ void direct_message(int sender_fd, const char *buffer);
 #define INCORRECT_PASSKEY_MSG "Incorrect passkey. Attempts remaining: %d\n"
 #define AUTH_FAILED_MSG "Passkey authentication failed. Closing connection.\n"
 #define PASSKEY_MATCHED_MSG "ACCEPTED\n"
-#define WELCOME_SERVER_MSG "Welcome Server Manager\n </s> Would you like to start group chat server \n </q>Would you like to stop group chat server\n"
+#define WELCOME_SERVER_MSG "Welcome Server Manager\n </s> Would you like to start group chat server \n </q>Would you like to stop group chat server\n </stats>Snapshot of the chat server metrics\n </trace>Export sampled message traces\n </r>Hot restart the group chat workers without dropping clients\n"
 #define STARTING_SERVER_MSG "STARTED\n"
 #define STOPPING_SERVER_MSG "STOPPED\n"
 
 #define MAX_INPUT_LENGTH 256
+#define METRICS_REPORT_SIZE (4 * BUFFER_SIZE)
+
+// MESSAGE TRACING (1 in TRACE_SAMPLE_INTERVAL frames; SIGUSR2 or the server manager's /trace exports)
+#define TRACE_SAMPLE_INTERVAL 100
+#define TRACE_SPANS_PER_THREAD 65536
+#define TRACE_FILE_FORMAT "groupchat-trace-%u.json"
+#define TRACE_UNAVAILABLE_MSG "TRACE unavailable: the group chat server is not running\n"
+
+// FLIGHT RECORDER (always on; SIGUSR1, a crash or the server manager's /q dumps it, flightdecode reads it)
+#define FLIGHT_EVENTS_PER_THREAD 8192
+#define FLIGHT_FILE_FORMAT "groupchat-flight-%u.bin"
+
+// EVENT LOOP WATCHDOG (iterations running longer than the threshold are logged with the loop's stack)
+#define WATCHDOG_THRESHOLD_MS 250
+#define WATCHDOG_INTERVAL_MS 100
+
+// STATS PAGE (chat server publishes, wrapper samples; no syscalls on the chat server's side)
+#define METRICS_PUBLISH_INTERVAL_MS 100
+#define STATS_SAMPLE_INTERVAL_MS 500
 
 // CLIENT SERVER MESSAGES
 #define WELCOME_MESSAGE "\nWelcome to the chat, "
-#define COMMAND_LIST "COMMAND LIST\n/h ----------------------> list of commands\n/ul ---------------------> list of users\n/u <username> -----------> set username (MAX 15 chars, no spaces)\n/w <receiver username> <message> -> whisper\n\n"
+#define COMMAND_LIST "COMMAND LIST\n/h ----------------------> list of commands\n/ul ---------------------> list of users\n/u <username> -----------> set username (MAX 15 chars, no spaces)\n/w <receiver username> <message> -> whisper\n/search <words> ---------> find recent room messages\n/ping [token] -----------> server receive and send times, in ns\n\n"
 #define SHUTDOWN_MESSAGE "Server is now offline. Please join back later.\n"
 #define SERVER_FULL "Server: server is full, please join back later\n"
 #define USERNAME_FAILURE "Server: Sorry that username is already taken\n"
+#define RESUME_TOKEN_FORMAT "Server: Resume token %s\n"
+#define RESUME_SUCCESS "Server: Welcome back, "
+#define RESUME_FAILURE "Server: Session expired, continuing as a new user.\n"
 #define USERNAME_SUCCESS "Server: Success! You will now go by "
 #define COMMAND_NOT_FOUND "Server: Invalid Command. /h for help\n"
 #define INVALID_NUM_ARGS "Server: Error! Invalid # Arguments. /h for command list.\n"
 #define INVALID_RECEIVER "Server: Non Existent Receiver\n"
 #define USERNAME_TOO_LONG "Server: Error, username too long. 15 is the MAX.\n"
+#define PING_TOKEN_SIZE 32
+#define PONG_FORMAT "PONG %s %" PRIu64 " %" PRIu64 "\n"    // token, receive ns, send ns
+#define ROOM_MESSAGE_FORMAT "[All #%" PRIu64 "] %s: %s"
 
 struct ClientInfo
 {
-    int   client_socket;
-    int   client_index;
-    char *username;
+    int      client_socket;
+    int      client_index;
+    char    *username;
+    uint8_t *input;        // bytes received but not yet parsed into frames
+    size_t   input_len;
+    int      throttled_pending;    // ran out of budget last iteration and still has input
+    uint64_t join_replay_ns;       // when to send the join history unless the client resumes (0 = sent)
+    uint64_t join_seq;             // newest room frame from before the join; later ones arrive live
+    uint64_t input_recv_ns;        // when the newest input bytes were read (transport clock)
+    uint64_t input_kernel_rx_ns;   // when the kernel received them (0 without timestamping)
+
+    // Accounting, reset on join
+    uint64_t frames_in;
+    uint64_t bytes_in;
+    uint64_t busy_ns;      // wall time spent servicing this client
+    uint64_t cpu_ns;       // thread CPU time spent servicing this client
+    uint64_t throttled;    // iterations that ended with the budget used up
+
+    struct DeliveryOrder order;    // keeps room frames in sequence for this client
+};
+
+// Records a worker sends its successor in a hot restart (see handoff.h), in this order
+enum HandoffRecord
+{
+    HANDOFF_BEGIN,       // struct HandoffBegin
+    HANDOFF_LISTENER,    // the shared-memory listen socket, no payload
+    HANDOFF_CLIENT,      // struct ClientHandoff, cut off after input_len bytes of input, and the client's socket
+    HANDOFF_END
+};
+
+struct HandoffBegin
+{
+    uint64_t ring_position;    // first relayed message the successor applies for the clients it takes over
+    uint64_t room_seq;
+};
+
+struct ClientHandoff
+{
+    int32_t  client_index;
+    int32_t  throttled_pending;
+    char     username[MAX_USERNAME_SIZE];
+    uint64_t join_replay_ns;
+    uint64_t join_seq;
+    uint64_t next_seq;    // next room frame the client gets
+    uint64_t frames_in;
+    uint64_t bytes_in;
+    uint64_t busy_ns;
+    uint64_t cpu_ns;
+    uint64_t throttled;
+    uint32_t ts_bytes_sent;    // timestamping offset: the kernel's OPT_ID counter goes on across the handoff
+    uint32_t input_len;
+    uint8_t  input[CLIENT_INPUT_SIZE];
 };
 
 // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
@@ -94,6 +276,10 @@ static struct ClientInfo clients[MAX_CLIENTS];
 // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
 static int client_count = 0;
 
+// Order in which the event loop services client slots
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+static int service_order[MAX_CLIENTS];
+
 // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
 static pthread_mutex_t clients_mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -103,4 +289,7 @@ static volatile sig_atomic_t admin_exit_flag = 0;
 // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
 static volatile sig_atomic_t group_chat_exit_flag = 0;
 
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+static volatile sig_atomic_t trace_export_flag = 0;
+
 #endif    // SERVER_SERVER_H
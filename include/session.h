@@ -0,0 +1,40 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Resume tokens. Every client is given a session at join; when its
+// connection drops the session is kept (detached) for a while, and a
+// reconnect that presents the token gets the session's name back and only
+// the room frames it missed. Event loop thread only.
+//
+// In a pool of chat workers the table lives in memory the wrapper shares
+// with all of them (chat_pool.h), under a robust process-shared mutex, so a
+// token can be presented to any worker; each session notes the worker that
+// holds its client. Outside a pool the table is private to the process.
+
+#define SESSION_TOKEN_LENGTH 32    // hex characters
+#define SESSION_NAME_SIZE 32
+
+struct Session
+{
+    char     token[SESSION_TOKEN_LENGTH + 1];    // empty when the slot is free
+    char     username[SESSION_NAME_SIZE];
+    int32_t  worker;                             // pool worker holding the client, -1 outside a pool
+    int32_t  client_index;                       // -1 while detached
+    uint64_t expires_ns;                         // when a detached session is forgotten
+};
+
+size_t          session_table_size(int max_sessions);
+int             session_table_init(void *table, int max_sessions);
+int             session_init(int max_sessions, uint64_t ttl_ns);
+int             session_share(void *table, int worker, uint64_t ttl_ns);
+void            session_free(void);
+int             session_create(int client_index, const char *username, char *token);
+int             session_take(const char *token, int client_index, struct Session *taken, int *previous);
+void            session_detach(int client_index);
+void            session_detach_all(void);
+void            session_rename(int client_index, const char *username);
+
+#endif    // SESSION_H
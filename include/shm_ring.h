@@ -0,0 +1,71 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <netinet/in.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// Shared-memory transport for co-located clients. A client connects to a
+// Unix socket, receives a memfd holding two SPSC rings (one per direction)
+// plus an eventfd per direction over SCM_RIGHTS, and from then on exchanges
+// the exact frames send_with_protocol/read_with_protocol put on the wire.
+// The eventfd is only written when a ring goes from empty to non-empty.
+
+#define SHM_RING_CAPACITY (1U << 20)    // bytes per direction, must be a power of two
+#define SHM_FRAME_HEADER_SIZE 3         // version + uint16 size, same as the TCP header
+#define SHM_CACHE_LINE_SIZE 64
+#define SHM_SOCKET_PATH_SIZE 108
+#define SHM_SOCKET_PATH_FORMAT "/tmp/groupchat-%u.sock"
+#define SHM_SOCKET_MODE 0600    // only the server's own user may attach
+
+struct ShmRing
+{
+    _Atomic uint32_t head;    // written by the producer only
+    char             head_pad[SHM_CACHE_LINE_SIZE - sizeof(uint32_t)];
+    _Atomic uint32_t tail;    // written by the consumer only
+    char             tail_pad[SHM_CACHE_LINE_SIZE - sizeof(uint32_t)];
+    uint8_t          data[SHM_RING_CAPACITY];
+};
+
+struct ShmRegion
+{
+    struct ShmRing to_server;
+    struct ShmRing to_client;
+};
+
+struct ShmChannel
+{
+    struct ShmRegion *region;
+    struct ShmRing   *tx;
+    struct ShmRing   *rx;
+    int               tx_event_fd;
+    int               rx_event_fd;
+    int               control_fd;    // Unix socket, used for liveness and as the client's identity
+};
+
+// Ring primitives
+int     shm_ring_push(struct ShmRing *ring, uint8_t version, const char *message, uint16_t content_size, int *was_empty);
+ssize_t shm_ring_pop(struct ShmRing *ring, uint8_t *version, char *buffer, size_t buffer_size);
+
+// Channel setup
+int  shm_listener_create(in_port_t port);
+void shm_listener_close(int listen_fd, in_port_t port);
+int  shm_channel_accept(int listen_fd, struct ShmChannel *channel);
+int  shm_channel_attach(const char *path, struct ShmChannel *channel);
+void shm_channel_close(struct ShmChannel *channel);
+
+// Framed I/O over a channel
+int     shm_channel_send(struct ShmChannel *channel, uint8_t version, const char *message);
+int     shm_channel_send_raw(struct ShmChannel *channel, const struct iovec *iov, int iov_count);
+ssize_t shm_channel_recv(struct ShmChannel *channel, uint8_t *version, char *buffer, size_t buffer_size);
+ssize_t shm_channel_try_recv(struct ShmChannel *channel, uint8_t *version, char *buffer, size_t buffer_size);
+
+// fd -> channel routing used by the protocol layer
+void               shm_transport_register(int fd, struct ShmChannel *channel);
+struct ShmChannel *shm_transport_lookup(int fd);
+void               shm_transport_release(int fd);
+
+#endif    // SHM_RING_H
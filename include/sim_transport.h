@@ -0,0 +1,35 @@
+#ifndef SIM_TRANSPORT_H
+#define SIM_TRANSPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// In-memory transport for benchmarks. A simulated connection is a pair of
+// byte queues: the driver writes a client's frames into one and the server
+// reads them with the same recv it uses on a socket, and everything the
+// server sends lands in the other. Server ends are descriptors from
+// SIM_FD_BASE up, far above what the kernel hands out; every other
+// descriptor goes to the kernel untouched. Time is a virtual clock that
+// only moves when the driver advances it, so join deadlines are
+// reproducible. Single-threaded: the driver and the server code it calls
+// must share one thread.
+
+#define SIM_FD_BASE (1 << 24)
+#define SIM_LISTEN_FD SIM_FD_BASE
+#define SIM_QUEUE_LIMIT (1024 * 1024)    // bytes per direction; past it sends are cut short, like a full socket buffer
+
+int      sim_transport_init(int max_connections);    // and installs it
+void     sim_transport_free(void);                   // and puts the kernel back
+int      sim_connect(void);                          // a client id; the server end waits for accept on SIM_LISTEN_FD
+int      sim_server_fd(int client);                  // -1 until the server accepted it
+int      sim_client_send(int client, const void *data, size_t len);
+ssize_t  sim_client_recv(int client, void *buffer, size_t len);
+size_t   sim_client_discard(int client);
+size_t   sim_discard_all(void);    // drops what every client received since the last call; returns the bytes
+void     sim_client_close(int client);
+int      sim_client_closed(int client);    // the server closed its end
+uint64_t sim_clock_now(void);
+void     sim_clock_advance(uint64_t ns);
+
+#endif    // SIM_TRANSPORT_H
@@ -0,0 +1,41 @@
+#ifndef TIMESTAMPING_H
+#define TIMESTAMPING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Kernel socket timestamps (SO_TIMESTAMPING) on group chat client sockets.
+// Received data carries the software RX timestamp of the packet it arrived
+// in; every send is tagged with its byte offset so the SCHED (entered the
+// queueing layer), SND (handed to the device) and ACK (acknowledged by the
+// peer) timestamps the kernel later posts to the socket's error queue can
+// be matched with when the application queued the bytes. Kernel times are
+// converted to CLOCK_MONOTONIC, the clock of the application timestamps
+// and the metrics. The stage latencies go to the metrics histograms.
+// Every byte sent on a timestamped socket has to be reported through
+// timestamping_note_send, or the offsets stop lining up. Must be used from
+// the event loop thread only.
+
+#define TIMESTAMPING_MAX_PENDING 64    // sends per socket waiting on their TX timestamps
+
+struct TimestampingStats
+{
+    uint64_t sends_tracked;      // sends that were put on a socket's pending list
+    uint64_t sends_untracked;    // sends made while the pending list was full
+    uint64_t tx_timestamps;      // SCHED, SND and ACK timestamps read off error queues
+    uint64_t rx_timestamps;      // reads that carried an RX timestamp
+};
+
+int      timestamping_enable(int fd);
+int      timestamping_adopt(int fd, uint32_t bytes_sent);
+uint32_t timestamping_bytes_sent(int fd);
+void     timestamping_release(int fd);
+int      timestamping_active(int fd);
+uint64_t timestamping_now_ns(void);
+ssize_t  timestamping_recv(int fd, void *buffer, size_t len, int flags, uint64_t *kernel_rx_ns);
+void     timestamping_note_send(int fd, size_t bytes, uint64_t enqueue_ns);    // enqueue_ns 0: count the bytes only
+void     timestamping_reap(int fd);
+void     timestamping_get_stats(struct TimestampingStats *stats);
+
+#endif    // TIMESTAMPING_H
@@ -0,0 +1,32 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Sampled per-message tracing. One in every sample_interval received
+// frames gets a trace id, and each stage it goes through (recv, decode,
+// dispatch, then enqueue and flush per recipient) is recorded as a span in
+// a buffer owned by the recording thread, overwriting the oldest spans once
+// full. Unsampled frames cost a counter increment. trace_export writes
+// every buffered span as Chrome trace JSON (chrome://tracing, Perfetto);
+// call it from a thread that is not recording at the same time.
+
+enum TraceStage
+{
+    TRACE_RECV,
+    TRACE_DECODE,
+    TRACE_DISPATCH,
+    TRACE_ENQUEUE,    // frame queued for a recipient (coalesced output)
+    TRACE_FLUSH,      // frame written to a recipient
+    TRACE_STAGE_COUNT
+};
+
+void     trace_init(uint32_t sample_interval, uint32_t spans_per_thread);
+uint64_t trace_sample(void);
+uint64_t trace_now_ns(void);
+void     trace_record(uint64_t trace_id, enum TraceStage stage, uint64_t start_ns, uint64_t end_ns, int fd);
+void     trace_set_current(uint64_t trace_id);
+uint64_t trace_current(void);
+int      trace_export(const char *path);
+
+#endif    // TRACE_H
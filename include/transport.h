@@ -0,0 +1,42 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+// The I/O calls the server makes on client connections: the send, sendmsg
+// and recv behind the protocol layer and the fan-out, the accept in
+// socket_accept_connection, the setsockopt/close around a connection's
+// life, and the clock behind join deadlines. By default they go straight
+// to the kernel. A benchmark may install another implementation (see
+// sim_transport.h) before the first connection is accepted; it sees every
+// descriptor, so it has to pass the ones it does not own on to the kernel.
+// Zero-copy sends and WAL replay (sendfile) always use the kernel.
+
+struct Transport
+{
+    const char *name;
+    ssize_t (*send)(int fd, const void *data, size_t len, int flags);
+    ssize_t (*sendmsg)(int fd, const struct msghdr *msg, int flags);
+    ssize_t (*recv)(int fd, void *buffer, size_t len, int flags);
+    int (*accept)(int fd, struct sockaddr *addr, socklen_t *addr_len);
+    int (*setsockopt)(int fd, int level, int option, const void *value, socklen_t len);
+    int (*close)(int fd);
+    uint64_t (*now_ns)(void);    // monotonic nanoseconds
+};
+
+const struct Transport *transport_kernel(void);
+void                    transport_install(const struct Transport *transport);    // NULL puts the kernel back
+const char             *transport_name(void);
+
+ssize_t  transport_send(int fd, const void *data, size_t len, int flags);
+ssize_t  transport_sendmsg(int fd, const struct msghdr *msg, int flags);
+ssize_t  transport_recv(int fd, void *buffer, size_t len, int flags);
+int      transport_accept(int fd, struct sockaddr *addr, socklen_t *addr_len);
+int      transport_setsockopt(int fd, int level, int option, const void *value, socklen_t len);
+int      transport_close(int fd);
+uint64_t transport_now_ns(void);
+
+#endif    // TRANSPORT_H
@@ -0,0 +1,40 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Write-ahead log of room traffic. Frames are stored exactly as they go on
+// the wire, back to back, in segment files named after the sequence number
+// of their first frame (frame k of a segment is first_seq + k). The event
+// loop only copies into a staging buffer; a writer thread appends whole
+// batches and issues one fdatasync per batch (group commit), once the batch
+// is old enough or big enough. Replay sends frames from the files with
+// sendfile, and wal_open rebuilds the room state from the newest segments.
+// With a segment limit the oldest segments are deleted as new ones are
+// started, so the log, and the scan at startup, stay bounded.
+
+typedef void (*WalRecoveredFrame)(uint64_t seq, const uint8_t *frame, size_t len);
+
+struct WalStats
+{
+    uint64_t frames;              // frames handed to the log
+    uint64_t commits;             // batches written and synced
+    uint64_t bytes;
+    uint64_t max_batch;           // frames in the largest batch
+    uint64_t appender_waits;      // times the event loop had to wait for the writer
+    uint64_t segments;
+    uint64_t deleted_segments;    // dropped over the segment limit
+    uint64_t recovered_frames;
+    uint64_t truncated_bytes;     // torn tail dropped during recovery
+};
+
+int      wal_open(const char *directory, size_t segment_bytes, size_t max_segments, long commit_interval_ms, size_t commit_frames, WalRecoveredFrame on_frame, uint64_t *last_seq);
+void     wal_close(void);
+void     wal_append(uint64_t seq, const uint8_t *header, size_t header_len, const char *payload, size_t payload_len);
+uint64_t wal_replay(int sockfd, uint64_t first_seq, uint64_t last_seq);
+uint64_t wal_oldest_seq(void);
+int      wal_lookup(uint64_t seq, char *out, size_t out_size);
+void     wal_get_stats(struct WalStats *stats);
+
+#endif    // WAL_H
@@ -0,0 +1,20 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <stdint.h>
+
+// Event-loop stall detector. The loop marks when each iteration starts
+// and when it goes back to sleep in select, and names what it is doing
+// (a string literal and an fd) as it goes; all three are relaxed stores.
+// A watchdog thread checks every interval and, once an iteration has run
+// past the threshold, counts a stall, logs the operation and the loop
+// thread's stack (captured by signalling it with SIGRTMIN) and records it
+// in the flight recorder. Each stall is reported once.
+
+int  watchdog_start(uint64_t threshold_ns, uint64_t interval_ns);
+void watchdog_stop(void);
+void watchdog_busy(uint64_t now_ns);
+void watchdog_idle(void);
+void watchdog_operation(const char *operation, int fd);
+
+#endif    // WATCHDOG_H
@@ -0,0 +1,43 @@
+#ifndef ZEROCOPY_H
+#define ZEROCOPY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// MSG_ZEROCOPY fan-out for large broadcast frames. The frame is encoded once
+// into a reference-counted buffer, every recipient's send() pins it, and each
+// reference is only dropped once that socket's error queue reports the send
+// as complete. Must be used from the event loop thread only.
+
+#define ZEROCOPY_MAX_PENDING 64    // in-flight zero-copy sends per socket before falling back to copying
+
+struct ZeroCopyBuffer
+{
+    int     refs;
+    size_t  len;
+    uint8_t data[];
+};
+
+struct ZeroCopyStats
+{
+    uint64_t copy_sends;            // broadcast frames sent the ordinary way
+    uint64_t copy_bytes;
+    uint64_t zerocopy_sends;        // send() calls made with MSG_ZEROCOPY
+    uint64_t zerocopy_bytes;
+    uint64_t completions;           // sends the error queue reported complete
+    uint64_t kernel_copied;         // completions where the kernel fell back to copying (e.g. loopback)
+    uint64_t fallbacks;             // zero-copy attempts that had to be sent by copy instead
+    uint64_t buffers_pinned;        // buffers still waiting on completions
+};
+
+int                    zerocopy_enable(int fd);
+void                   zerocopy_release(int fd);
+int                    zerocopy_pending(int fd);
+struct ZeroCopyBuffer *zerocopy_buffer_create(const uint8_t *header, size_t header_len, const char *payload, size_t payload_len);
+void                   zerocopy_buffer_put(struct ZeroCopyBuffer *buffer);
+int                    zerocopy_send(int fd, struct ZeroCopyBuffer *buffer);
+void                   zerocopy_reap(int fd);
+void                   zerocopy_note_copy(size_t bytes);
+void                   zerocopy_get_stats(struct ZeroCopyStats *stats);
+
+#endif    // ZEROCOPY_H
@@ -0,0 +1,148 @@
+#include "../include/autoscale.h"
+#include "../include/chat_pool.h"
+#include "../include/metrics.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#define AUTOSCALE_PERCENT 100U
+
+// A worker's counters at the previous tick
+struct AutoscaleSample
+{
+    int      valid;
+    uint64_t at_ns;
+    uint64_t loop_busy_ns;
+    uint64_t loop_stalls;
+};
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables)
+static struct AutoscalePolicy autoscale_policy;
+static int                    autoscale_enabled = 0;
+static struct AutoscaleSample samples[CHAT_POOL_MAX_WORKERS];
+static uint64_t               low_since_ns = 0;    // when the load went under the drain thresholds (0 = it is not)
+static uint64_t               next_step_ns = 0;    // end of the cooldown
+static uint64_t               scale_ups    = 0;
+static uint64_t               scale_downs  = 0;
+
+// NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables)
+
+// Function to start scaling the pool with policy; called each time the pool is started
+void autoscale_init(const struct AutoscalePolicy *policy)
+{
+    autoscale_policy  = *policy;
+    autoscale_enabled = 1;
+    memset(samples, 0, sizeof(samples));
+    low_since_ns = 0;
+    next_step_ns = 0;
+    scale_ups    = 0;
+    scale_downs  = 0;
+}
+
+// Function to look at the accepting workers' load and start or drain one worker if the policy says so
+void autoscale_tick(uint64_t now_ns)
+{
+    struct MetricsLoad load;
+    int                accepting   = 0;
+    int                measured    = 0;
+    int                stalled     = 0;
+    int                emptiest    = -1;
+    int64_t            connections = 0;
+    int64_t            fewest      = INT64_MAX;
+    uint64_t           busy_sum    = 0;
+    uint64_t           busy_percent;
+    int                worker;
+
+    if(!autoscale_enabled)
+    {
+        return;
+    }
+
+    for(int i = 0; i < chat_pool_size() && i < CHAT_POOL_MAX_WORKERS; ++i)
+    {
+        struct AutoscaleSample *previous = &samples[i];
+
+        if(!chat_pool_accepting(i))
+        {
+            previous->valid = 0;
+            continue;
+        }
+        accepting++;
+        if(metrics_load(i, &load) == -1)
+        {
+            continue;    // just started, nothing published yet
+        }
+
+        connections += load.connections;
+        if(i != 0 && load.connections < fewest)
+        {
+            fewest   = load.connections;
+            emptiest = i;
+        }
+
+        // Busy share of the time since the previous tick; counters that went back mean the worker was replaced
+        if(previous->valid && now_ns > previous->at_ns && load.loop_busy_ns >= previous->loop_busy_ns && load.loop_stalls >= previous->loop_stalls)
+        {
+            busy_sum += (load.loop_busy_ns - previous->loop_busy_ns) * AUTOSCALE_PERCENT / (now_ns - previous->at_ns);
+            measured++;
+            stalled |= load.loop_stalls > previous->loop_stalls;
+        }
+        previous->valid        = 1;
+        previous->at_ns        = now_ns;
+        previous->loop_busy_ns = load.loop_busy_ns;
+        previous->loop_stalls  = load.loop_stalls;
+    }
+    busy_percent = measured > 0 ? busy_sum / (uint64_t)measured : 0;
+
+    // Short of capacity: one more worker, and the kernel starts handing it connections
+    if(accepting < autoscale_policy.max_workers &&
+       (accepting < autoscale_policy.min_workers || connections >= (int64_t)accepting * autoscale_policy.up_connections || busy_percent >= autoscale_policy.up_busy_percent || stalled))
+    {
+        low_since_ns = 0;
+        if(now_ns < next_step_ns)
+        {
+            return;
+        }
+        next_step_ns = now_ns + autoscale_policy.cooldown_ns;
+        worker       = chat_pool_grow();
+        if(worker != -1)
+        {
+            scale_ups++;
+            printf("Autoscale: started worker %d (%d were taking %" PRId64 " connections, %" PRIu64 "%% busy%s).\n", worker, accepting, connections, busy_percent, stalled ? ", stalled" : "");
+        }
+        return;
+    }
+
+    // Idle enough that one worker fewer would do, for the whole idle period: drain the emptiest
+    if(accepting > autoscale_policy.min_workers && emptiest != -1 && connections <= (int64_t)(accepting - 1) * autoscale_policy.down_connections &&
+       busy_percent <= autoscale_policy.down_busy_percent && !stalled)
+    {
+        if(low_since_ns == 0)
+        {
+            low_since_ns = now_ns;
+        }
+        if(now_ns - low_since_ns < autoscale_policy.idle_ns || now_ns < next_step_ns)
+        {
+            return;
+        }
+        low_since_ns = 0;
+        next_step_ns = now_ns + autoscale_policy.cooldown_ns;
+        if(chat_pool_drain_worker(emptiest) == 0)
+        {
+            scale_downs++;
+            printf("Autoscale: draining worker %d (%" PRId64 " connections left on it, %d accepting).\n", emptiest, fewest, accepting - 1);
+        }
+        return;
+    }
+    low_since_ns = 0;
+}
+
+uint64_t autoscale_ups(void)
+{
+    return scale_ups;
+}
+
+uint64_t autoscale_downs(void)
+{
+    return scale_downs;
+}
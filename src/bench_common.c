@@ -0,0 +1,81 @@
+#include "../include/bench_common.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Function to parse a decimal option value no larger than max; anything else ends in usage
+uint64_t bench_parse_number(const char *binary_name, const char *str, uint64_t max, BenchUsage usage)
+{
+    char     *endptr;
+    uintmax_t parsed_value;
+
+    errno        = 0;
+    parsed_value = strtoumax(str, &endptr, BASE_TEN);
+    if(errno != 0 || *endptr != '\0' || endptr == str)
+    {
+        usage(binary_name, EXIT_FAILURE, "Invalid number.");
+        exit(EXIT_FAILURE);
+    }
+    if(parsed_value > max)
+    {
+        usage(binary_name, EXIT_FAILURE, "Number out of range.");
+        exit(EXIT_FAILURE);
+    }
+    return (uint64_t)parsed_value;
+}
+
+// Function to fill addr with an IPv4 or IPv6 address and port; exits if address is neither
+void bench_convert_address(const char *address, in_port_t port, struct sockaddr_storage *addr, socklen_t *addr_len)
+{
+    struct sockaddr_in  *ipv4 = (struct sockaddr_in *)addr;
+    struct sockaddr_in6 *ipv6 = (struct sockaddr_in6 *)addr;
+
+    memset(addr, 0, sizeof(*addr));
+    if(inet_pton(AF_INET, address, &ipv4->sin_addr) == 1)
+    {
+        ipv4->sin_family = AF_INET;
+        ipv4->sin_port   = htons(port);
+        *addr_len        = sizeof(struct sockaddr_in);
+    }
+    else if(inet_pton(AF_INET6, address, &ipv6->sin6_addr) == 1)
+    {
+        ipv6->sin6_family = AF_INET6;
+        ipv6->sin6_port   = htons(port);
+        *addr_len         = sizeof(struct sockaddr_in6);
+    }
+    else
+    {
+        fprintf(stderr, "%s is not an IPv4 or IPv6 address\n", address);
+        exit(EXIT_FAILURE);
+    }
+}
+
+uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NANOS_PER_SECOND + (uint64_t)ts.tv_nsec;
+}
+
+// Function to write the HEADER_SIZE bytes that go ahead of content_len bytes of text
+void bench_frame_header(uint8_t *header, size_t content_len)
+{
+    uint16_t size = htons((uint16_t)content_len);
+
+    header[0] = PROTOCOL_VERSION;
+    memcpy(header + 1, &size, sizeof(size));
+}
+
+// Function to read the text length from a frame header
+uint16_t bench_frame_size(const uint8_t *header)
+{
+    uint16_t size;
+
+    memcpy(&size, header + 1, sizeof(size));
+    return ntohs(size);
+}
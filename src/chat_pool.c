@@ -0,0 +1,1092 @@
+// memfd_create and MFD_CLOEXEC are only declared with _GNU_SOURCE
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+#include "../include/chat_pool.h"
+#include "../include/handoff.h"
+#include "../include/metrics.h"
+#include "../include/session.h"
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CHAT_POOL_NANOS_PER_MILLI 1000000ULL
+#define CHAT_POOL_POLL_NS 1000000L    // how often a hot restart or a waiting worker checks again
+#define CHAT_POOL_NANOS_PER_SECOND 1000000000ULL
+#define CHAT_POOL_WRITING UINT64_MAX    // slot position while an append is rewriting it
+#define CHAT_POOL_LAYOUT_PRIME 1099511628211ULL
+#define CHAT_POOL_FD_ARG_SIZE 16
+#define CHAT_POOL_EXEC_FDS 5    // passed to an exec'd successor before the eventfds: names, sessions, stats, listen socket, channel
+
+struct ChatPoolSlot
+{
+    _Atomic uint64_t        position;    // ring position of the message in the slot
+    struct ChatRelayMessage message;
+};
+
+struct ChatPoolShared
+{
+    pthread_mutex_t     lock;        // robust and process-shared; held while appending
+    _Atomic uint64_t    head;        // next ring position; only ever grows
+    _Atomic uint64_t    first;       // first position of the current run
+    _Atomic uint64_t    room_seq;    // last room sequence number handed out
+    _Atomic int         seq_ready;   // worker 0 has restored room_seq; the others wait for it before serving
+    struct ChatPoolSlot slots[CHAT_POOL_RING_SLOTS];
+};
+
+// What a hot restart's successor is told after exec: the first record on its control socket, with the ring's
+// memfd; then one record each with the names' memfd, the session table's memfd, the stats pages' memfd (none
+// without stats), its listen socket, its end of the handoff channel and every worker's eventfd
+struct ChatPoolExecState
+{
+    uint64_t layout;
+    int32_t  worker;
+    int32_t  workers;
+    int32_t  names_per_worker;
+    int32_t  sessions;
+    int32_t  metrics_pages;
+};
+
+struct ChatPoolWorker
+{
+    pid_t    pid;
+    int      listen_fd;
+    int      event_fd;
+    int      control_fd;    // wrapper's end of the worker's control socket
+    uint64_t started_ns;
+    uint64_t restart_at_ns;    // 0 unless waiting to be forked again
+};
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables)
+static struct ChatPoolShared *pool_shared           = NULL;
+static char                  *pool_names            = NULL;    // [worker][slot][CHAT_POOL_NAME_SIZE]
+static void                  *pool_sessions         = NULL;    // session.h's table, shared by every worker
+static int                    pool_workers          = 0;
+static int                    pool_names_per_worker = 0;
+static int                    pool_session_count    = 0;
+static struct ChatPoolWorker  workers[CHAT_POOL_MAX_WORKERS];
+static int                    pool_shared_fd   = -1;    // memfds behind the mappings, passed to exec'd successors
+static int                    pool_names_fd    = -1;
+static int                    pool_sessions_fd = -1;
+static char                   pool_image[PATH_MAX];    // this binary's path at startup; a new build replaces the file
+
+// Wrapper side
+static ChatPoolOpenListener pool_open       = NULL;
+static ChatPoolRun          pool_run        = NULL;
+static void                *pool_ctx        = NULL;
+static int                  pool_running    = 0;
+static uint64_t             pool_restarts   = 0;
+static int                  successor_end   = -1;    // while forking a hot restart's successor: its end of the handoff channel
+static int                  predecessor_end = -1;    // and the old worker's
+
+// Worker side
+static int      this_worker = -1;
+static uint64_t cursor      = 0;     // next ring position to apply
+static int      control_fd  = -1;    // requests from the wrapper
+static int      handoff_fd  = -1;    // the predecessor's state, in a hot restart's successor
+static int      draining    = 0;     // told to stop accepting and leave once its clients have
+
+// NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables)
+
+static uint64_t chat_pool_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * CHAT_POOL_NANOS_PER_SECOND + (uint64_t)ts.tv_nsec;
+}
+
+static char *name_entry(int worker, int slot)
+{
+    return pool_names + ((size_t)worker * (size_t)pool_names_per_worker + (size_t)slot) * CHAT_POOL_NAME_SIZE;
+}
+
+static void clear_names(int worker)
+{
+    memset(name_entry(worker, 0), 0, (size_t)pool_names_per_worker * CHAT_POOL_NAME_SIZE);
+}
+
+// Takes the append lock; a holder that died mid-append never published, but may have taken a room number
+static void pool_lock(void)
+{
+    if(pthread_mutex_lock(&pool_shared->lock) == EOWNERDEAD)
+    {
+        uint64_t head = atomic_load_explicit(&pool_shared->head, memory_order_relaxed);
+
+        if(head > atomic_load_explicit(&pool_shared->first, memory_order_relaxed))
+        {
+            const struct ChatRelayMessage *last = &pool_shared->slots[(head - 1) % CHAT_POOL_RING_SLOTS].message;
+
+            if(last->kind == CHAT_RELAY_ROOM && last->seq > atomic_load_explicit(&pool_shared->room_seq, memory_order_relaxed))
+            {
+                atomic_store_explicit(&pool_shared->room_seq, last->seq, memory_order_relaxed);
+            }
+        }
+        pthread_mutex_consistent(&pool_shared->lock);
+    }
+}
+
+static size_t names_size(int worker_count, int names_per_worker)
+{
+    return (size_t)worker_count * (size_t)names_per_worker * CHAT_POOL_NAME_SIZE;
+}
+
+// What an exec'd successor has to agree on with the running build to share its memory and take its clients
+static uint64_t pool_layout(void)
+{
+    const uint64_t parts[] = {CHAT_POOL_EXEC_VERSION, sizeof(struct ChatPoolShared), sizeof(struct ChatRelayMessage), CHAT_POOL_NAME_SIZE, sizeof(struct Session), metrics_page_size()};
+    uint64_t       layout  = 0;
+
+    for(size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); ++i)
+    {
+        layout = layout * CHAT_POOL_LAYOUT_PRIME + parts[i];
+    }
+    return layout;
+}
+
+// Maps size bytes of a new memfd, left in *fd so a successor can map the same memory after exec
+static void *pool_create_mapping(const char *name, size_t size, int *fd)
+{
+    void *mapping;
+
+    *fd = memfd_create(name, MFD_CLOEXEC);
+    if(*fd == -1 || ftruncate(*fd, (off_t)size) == -1)
+    {
+        perror("chat_pool_init: memfd");
+        mapping = MAP_FAILED;
+    }
+    else
+    {
+        mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+        if(mapping == MAP_FAILED)
+        {
+            perror("chat_pool_init: mmap");
+        }
+    }
+    if(mapping == MAP_FAILED && *fd != -1)
+    {
+        close(*fd);
+        *fd = -1;
+    }
+    return mapping;
+}
+
+// Maps a memfd the wrapper passed, which must be exactly size bytes; the descriptor is closed either way
+static void *pool_attach_mapping(int fd, size_t size)
+{
+    struct stat st;
+    void       *mapping = MAP_FAILED;
+
+    if(fstat(fd, &st) == 0 && (size_t)st.st_size == size)
+    {
+        mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    return mapping;
+}
+
+// Function to map the ring, the name directory and the session table and make the eventfds; called once, before
+// any worker is forked
+int chat_pool_init(int worker_count, int names_per_worker, int sessions_per_worker)
+{
+    pthread_mutexattr_t attr;
+    void               *shared;
+    void               *names;
+    void               *sessions;
+    ssize_t             length;
+
+    if(pool_shared != NULL)
+    {
+        return 0;
+    }
+    if(worker_count < 1)
+    {
+        worker_count = 1;
+    }
+    if(worker_count > CHAT_POOL_MAX_WORKERS)
+    {
+        worker_count = CHAT_POOL_MAX_WORKERS;
+    }
+
+    shared = pool_create_mapping("groupchat-pool", sizeof(struct ChatPoolShared), &pool_shared_fd);
+    if(shared == MAP_FAILED)
+    {
+        return -1;
+    }
+    names = pool_create_mapping("groupchat-names", names_size(worker_count, names_per_worker), &pool_names_fd);
+    if(names == MAP_FAILED)
+    {
+        munmap(shared, sizeof(struct ChatPoolShared));
+        close(pool_shared_fd);
+        pool_shared_fd = -1;
+        return -1;
+    }
+    sessions = pool_create_mapping("groupchat-sessions", session_table_size(worker_count * sessions_per_worker), &pool_sessions_fd);
+    if(sessions == MAP_FAILED || session_table_init(sessions, worker_count * sessions_per_worker) == -1)
+    {
+        munmap(shared, sizeof(struct ChatPoolShared));
+        munmap(names, names_size(worker_count, names_per_worker));
+        close(pool_shared_fd);
+        close(pool_names_fd);
+        pool_shared_fd = -1;
+        pool_names_fd  = -1;
+        return -1;
+    }
+
+    // A hot restart runs whatever is at this path by then
+    length = readlink("/proc/self/exe", pool_image, sizeof(pool_image) - 1);
+    pool_image[length > 0 ? length : 0] = '\0';
+
+    pool_shared = (struct ChatPoolShared *)shared;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&pool_shared->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    pool_names            = (char *)names;
+    pool_names_per_worker = names_per_worker;
+    pool_sessions         = sessions;
+    pool_session_count    = worker_count * sessions_per_worker;
+    pool_workers          = worker_count;
+    for(int i = 0; i < pool_workers; ++i)
+    {
+        workers[i].listen_fd  = -1;
+        workers[i].control_fd = -1;
+        workers[i].event_fd   = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if(workers[i].event_fd == -1)
+        {
+            perror("chat_pool_init: eventfd");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int chat_pool_size(void)
+{
+    return pool_workers;
+}
+
+// In a hot restart's successor, just forked: runs the binary now on disk, which reads the rest from control
+static void pool_exec(int control)
+{
+    char  flag[] = CHAT_POOL_EXEC_ARG;
+    char  control_arg[CHAT_POOL_FD_ARG_SIZE];
+    char *argv[] = {pool_image, flag, control_arg, NULL};
+
+    snprintf(control_arg, sizeof(control_arg), "%d", control);
+    execv(pool_image, argv);
+    perror("Failed to run the new group chat worker");
+    _exit(EXIT_FAILURE);
+}
+
+// Sends an exec'd successor the pool's memory and its descriptors (struct ChatPoolExecState)
+static int pool_send_state(int worker, int control)
+{
+    struct ChatPoolExecState state;
+    const int                fds[] = {pool_names_fd, pool_sessions_fd, metrics_fd(), workers[worker].listen_fd, successor_end};
+
+    state.layout           = pool_layout();
+    state.worker           = worker;
+    state.workers          = pool_workers;
+    state.names_per_worker = pool_names_per_worker;
+    state.sessions         = pool_session_count;
+    state.metrics_pages    = metrics_page_count();
+    if(handoff_send(control, CHAT_POOL_CONTROL_STATE, &state, sizeof(state), pool_shared_fd) == -1)
+    {
+        return -1;
+    }
+    for(size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); ++i)
+    {
+        if(handoff_send(control, CHAT_POOL_CONTROL_FD, NULL, 0, fds[i]) == -1)
+        {
+            return -1;
+        }
+    }
+    for(int i = 0; i < pool_workers; ++i)
+    {
+        if(handoff_send(control, CHAT_POOL_CONTROL_FD, NULL, 0, workers[i].event_fd) == -1)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int pool_spawn(int worker)
+{
+    pid_t pid;
+    int   control[2];
+
+    if(handoff_channel(control) == -1)
+    {
+        workers[worker].restart_at_ns = chat_pool_now_ns() + CHAT_POOL_RESTART_DELAY_MS * CHAT_POOL_NANOS_PER_MILLI;
+        return -1;
+    }
+
+    // A successor takes over the names its predecessor published
+    if(successor_end == -1)
+    {
+        clear_names(worker);
+    }
+    fflush(NULL);
+    pid = fork();
+    if(pid == 0)
+    {
+        this_worker = worker;
+        control_fd  = control[1];
+        handoff_fd  = successor_end;
+        close(control[0]);
+        if(predecessor_end != -1)
+        {
+            close(predecessor_end);
+        }
+        for(int i = 0; i < pool_workers; ++i)
+        {
+            if(i != worker && workers[i].listen_fd != -1)
+            {
+                close(workers[i].listen_fd);
+            }
+            if(workers[i].control_fd != -1)
+            {
+                close(workers[i].control_fd);
+            }
+        }
+
+        // A successor gets its listen socket and channel again after exec, over the control socket
+        if(successor_end != -1)
+        {
+            close(successor_end);
+            close(workers[worker].listen_fd);
+            pool_exec(control[1]);
+        }
+        pool_run(worker, pool_ctx);
+        fflush(NULL);
+        _exit(EXIT_SUCCESS);
+    }
+    close(control[1]);
+    if(pid == -1)
+    {
+        perror("Failed to start group chat worker");
+        close(control[0]);
+        workers[worker].restart_at_ns = chat_pool_now_ns() + CHAT_POOL_RESTART_DELAY_MS * CHAT_POOL_NANOS_PER_MILLI;
+        return -1;
+    }
+    if(successor_end != -1 && pool_send_state(worker, control[0]) == -1)
+    {
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        close(control[0]);
+        return -1;
+    }
+    workers[worker].pid           = pid;
+    workers[worker].control_fd    = control[0];
+    workers[worker].started_ns    = chat_pool_now_ns();
+    workers[worker].restart_at_ns = 0;
+    return 0;
+}
+
+static void close_control(int worker)
+{
+    if(workers[worker].control_fd != -1)
+    {
+        close(workers[worker].control_fd);
+        workers[worker].control_fd = -1;
+    }
+}
+
+// Function to open a listen socket for each of the first count workers and fork them (the others wait for
+// chat_pool_grow); run is what a worker executes
+int chat_pool_start(ChatPoolOpenListener open_listener, ChatPoolRun run, void *ctx, int count)
+{
+    if(pool_shared == NULL || pool_running)
+    {
+        return -1;
+    }
+    if(count < 1 || count > pool_workers)
+    {
+        count = pool_workers;
+    }
+
+    for(int i = 0; i < count; ++i)
+    {
+        workers[i].listen_fd = open_listener(ctx);
+        if(workers[i].listen_fd == -1)
+        {
+            for(int j = 0; j < i; ++j)
+            {
+                close(workers[j].listen_fd);
+                workers[j].listen_fd = -1;
+            }
+            return -1;
+        }
+    }
+
+    // A new run starts the room over; what an earlier run left in the ring is not replayed
+    pool_lock();
+    atomic_store_explicit(&pool_shared->first, atomic_load_explicit(&pool_shared->head, memory_order_relaxed), memory_order_relaxed);
+    atomic_store_explicit(&pool_shared->room_seq, 0, memory_order_relaxed);
+    atomic_store_explicit(&pool_shared->seq_ready, 0, memory_order_relaxed);
+    pthread_mutex_unlock(&pool_shared->lock);
+
+    pool_open    = open_listener;
+    pool_run     = run;
+    pool_ctx     = ctx;
+    pool_running = 1;
+    for(int i = 0; i < count; ++i)
+    {
+        pool_spawn(i);
+    }
+    return 0;
+}
+
+// Function to start one more worker on a fresh listen socket in the first free slot; a slot whose worker is
+// still draining is not free. Returns the worker, or -1.
+int chat_pool_grow(void)
+{
+    if(!pool_running)
+    {
+        return -1;
+    }
+
+    for(int i = 0; i < pool_workers; ++i)
+    {
+        if(workers[i].listen_fd != -1 || workers[i].pid != 0)
+        {
+            continue;
+        }
+
+        workers[i].listen_fd = pool_open(pool_ctx);
+        if(workers[i].listen_fd == -1)
+        {
+            return -1;
+        }
+        if(pool_spawn(i) == -1)
+        {
+            close(workers[i].listen_fd);
+            workers[i].listen_fd     = -1;
+            workers[i].restart_at_ns = 0;
+            return -1;
+        }
+        return i;
+    }
+    return -1;
+}
+
+// Function to retire a worker: it is told to stop accepting and exits once its last client has left, and
+// its listen socket leaves the port, so new connections go to the others. Worker 0 (the room log and the
+// shared-memory socket) and the last accepting worker stay.
+int chat_pool_drain_worker(int worker)
+{
+    if(!pool_running || worker <= 0 || worker >= pool_workers || !chat_pool_accepting(worker) || chat_pool_active() < 2)
+    {
+        return -1;
+    }
+    if(handoff_send(workers[worker].control_fd, CHAT_POOL_CONTROL_DRAIN, NULL, 0, -1) == -1)
+    {
+        return -1;
+    }
+    close(workers[worker].listen_fd);
+    workers[worker].listen_fd = -1;
+    return 0;
+}
+
+// Function to tell whether a worker is running and taking new connections
+int chat_pool_accepting(int worker)
+{
+    return worker >= 0 && worker < pool_workers && workers[worker].listen_fd != -1 && workers[worker].pid > 0;
+}
+
+// Function to count the workers taking new connections (or about to again, after a crash)
+int chat_pool_active(void)
+{
+    int active = 0;
+
+    for(int i = 0; i < pool_workers; ++i)
+    {
+        if(workers[i].listen_fd != -1)
+        {
+            active++;
+        }
+    }
+    return active;
+}
+
+// Function to collect workers that exited and fork replacements; one that crash-loops is held back
+void chat_pool_supervise(void)
+{
+    pid_t    pid;
+    int      status;
+    uint64_t now;
+
+    while((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    {
+        for(int i = 0; i < pool_workers; ++i)
+        {
+            if(workers[i].pid != pid)
+            {
+                continue;
+            }
+
+            workers[i].pid = 0;
+            close_control(i);
+            clear_names(i);
+            metrics_reset_page(i);
+            if(!pool_running || workers[i].listen_fd == -1 || (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS))
+            {
+                printf("Group chat worker %d exited.\n", i);
+                break;
+            }
+
+            now = chat_pool_now_ns();
+            pool_restarts++;
+            if(WIFSIGNALED(status))
+            {
+                printf("Group chat worker %d died (signal %d), restarting.\n", i, WTERMSIG(status));
+            }
+            else
+            {
+                printf("Group chat worker %d died (exit %d), restarting.\n", i, WEXITSTATUS(status));
+            }
+            workers[i].restart_at_ns = now;
+            if(now - workers[i].started_ns < CHAT_POOL_RESTART_DELAY_MS * CHAT_POOL_NANOS_PER_MILLI)
+            {
+                workers[i].restart_at_ns = workers[i].started_ns + CHAT_POOL_RESTART_DELAY_MS * CHAT_POOL_NANOS_PER_MILLI;
+            }
+            break;
+        }
+    }
+
+    if(!pool_running)
+    {
+        return;
+    }
+    now = chat_pool_now_ns();
+    for(int i = 0; i < pool_workers; ++i)
+    {
+        if(workers[i].pid == 0 && workers[i].restart_at_ns != 0 && workers[i].restart_at_ns <= now)
+        {
+            pool_spawn(i);
+        }
+    }
+}
+
+void chat_pool_signal(int signum)
+{
+    for(int i = 0; i < pool_workers; ++i)
+    {
+        if(workers[i].pid > 0)
+        {
+            kill(workers[i].pid, signum);
+        }
+    }
+}
+
+// Waits for a worker that was asked to hand over or stop; one still running after timeout_ms is killed.
+// Returns 0 if it exited cleanly.
+static int await_worker(pid_t pid, uint64_t timeout_ms)
+{
+    struct timespec pause = {0, CHAT_POOL_POLL_NS};
+    uint64_t        deadline = chat_pool_now_ns() + timeout_ms * CHAT_POOL_NANOS_PER_MILLI;
+    int             status;
+    pid_t           reaped;
+
+    while((reaped = waitpid(pid, &status, WNOHANG)) == 0)
+    {
+        if(chat_pool_now_ns() > deadline)
+        {
+            kill(pid, SIGKILL);
+            waitpid(pid, &status, 0);
+            return -1;
+        }
+        nanosleep(&pause, NULL);
+    }
+    return reaped == pid && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS ? 0 : -1;
+}
+
+// Function to stop every worker and close the listen sockets
+void chat_pool_stop(void)
+{
+    pool_running = 0;
+    chat_pool_signal(SIGTERM);
+    for(int i = 0; i < pool_workers; ++i)
+    {
+        if(workers[i].pid > 0)
+        {
+            await_worker(workers[i].pid, CHAT_POOL_STOP_TIMEOUT_MS);
+            workers[i].pid = 0;
+        }
+        close_control(i);
+        workers[i].restart_at_ns = 0;
+        if(workers[i].listen_fd != -1)
+        {
+            close(workers[i].listen_fd);
+            workers[i].listen_fd = -1;
+        }
+        clear_names(i);
+    }
+}
+
+uint64_t chat_pool_restarts(void)
+{
+    return pool_restarts;
+}
+
+// Waits for an exec'd successor to say it has mapped the pool and is waiting for its predecessor
+static int await_ready(int control)
+{
+    uint32_t kind;
+    char     payload;
+    int      fd;
+
+    if(handoff_set_timeout(control, HANDOFF_TIMEOUT_MS) == -1 || handoff_recv(control, &kind, &payload, sizeof(payload), &fd) == -1)
+    {
+        return -1;
+    }
+    if(fd != -1)
+    {
+        close(fd);
+    }
+    return kind == CHAT_POOL_CONTROL_READY ? 0 : -1;
+}
+
+// Function to replace the running workers one at a time: each successor runs the binary now on disk on the
+// same listen socket, and once it is ready the old worker passes it its clients and exits. A successor that
+// cannot start (say a build whose shared memory does not match) is killed and the old worker keeps serving.
+// Returns how many workers handed over cleanly.
+int chat_pool_hot_restart(void)
+{
+    int handed = 0;
+
+    if(!pool_running)
+    {
+        return 0;
+    }
+
+    for(int i = 0; i < pool_workers; ++i)
+    {
+        pid_t    old_pid     = workers[i].pid;
+        int      old_control = workers[i].control_fd;
+        uint64_t old_started = workers[i].started_ns;
+        int      channel[2];
+        int      spawned;
+        int      sent;
+
+        if(old_pid <= 0 || old_control == -1 || workers[i].listen_fd == -1 || handoff_channel(channel) == -1)
+        {
+            continue;
+        }
+
+        successor_end   = channel[1];
+        predecessor_end = channel[0];
+        spawned         = pool_spawn(i);
+        successor_end   = -1;
+        predecessor_end = -1;
+        close(channel[1]);
+        if(spawned == -1)
+        {
+            close(channel[0]);
+            workers[i].restart_at_ns = 0;
+            continue;
+        }
+        if(await_ready(workers[i].control_fd) == -1)
+        {
+            printf("Group chat worker %d: the new build did not start, the old one keeps serving.\n", i);
+            kill(workers[i].pid, SIGKILL);
+            waitpid(workers[i].pid, NULL, 0);
+            close(workers[i].control_fd);
+            close(channel[0]);
+            workers[i].pid        = old_pid;
+            workers[i].control_fd = old_control;
+            workers[i].started_ns = old_started;
+            continue;
+        }
+
+        // Until it has the channel the old worker keeps serving; the successor waits on its end
+        sent = handoff_send(old_control, CHAT_POOL_CONTROL_HANDOFF, NULL, 0, channel[0]);
+        if(sent == -1)
+        {
+            kill(old_pid, SIGTERM);
+        }
+        close(channel[0]);
+        close(old_control);
+        if(await_worker(old_pid, HANDOFF_TIMEOUT_MS) == 0 && sent != -1)
+        {
+            handed++;
+        }
+        else
+        {
+            printf("Group chat worker %d did not hand over all of its clients.\n", i);
+        }
+    }
+    return handed;
+}
+
+// Function to take over, in a hot restart's successor that exec'd the binary now on disk, the pool memory and
+// the descriptors the wrapper sends on control (pool_send_state), and tell the wrapper it is ready. Returns the
+// worker to run, or -1 if this build cannot share the running one's memory.
+int chat_pool_resume(int control)
+{
+    struct ChatPoolExecState state;
+    int                      fds[CHAT_POOL_EXEC_FDS + CHAT_POOL_MAX_WORKERS];
+    int                      count = 0;
+    int                      shared_fd;
+    uint32_t                 kind;
+    char                     payload;
+    void                    *shared;
+    void                    *names;
+    void                    *sessions;
+
+    handoff_set_timeout(control, HANDOFF_TIMEOUT_MS);
+    if(handoff_recv(control, &kind, &state, sizeof(state), &shared_fd) != (ssize_t)sizeof(state) || kind != CHAT_POOL_CONTROL_STATE)
+    {
+        fprintf(stderr, "chat_pool_resume: no pool state from the wrapper\n");
+        if(shared_fd != -1)
+        {
+            close(shared_fd);
+        }
+        return -1;
+    }
+    if(state.layout != pool_layout() || state.workers < 1 || state.workers > CHAT_POOL_MAX_WORKERS || state.worker < 0 || state.worker >= state.workers ||
+       state.names_per_worker < 1 || state.sessions < 1 || shared_fd == -1)
+    {
+        fprintf(stderr, "chat_pool_resume: this build does not match the running pool's memory\n");
+        if(shared_fd != -1)
+        {
+            close(shared_fd);
+        }
+        return -1;
+    }
+    while(count < CHAT_POOL_EXEC_FDS + state.workers && handoff_recv(control, &kind, &payload, sizeof(payload), &fds[count]) != -1 && kind == CHAT_POOL_CONTROL_FD &&
+          (fds[count] != -1 || count == 2))
+    {
+        count++;
+    }
+
+    shared   = pool_attach_mapping(shared_fd, sizeof(struct ChatPoolShared));
+    names    = count > 0 ? pool_attach_mapping(fds[0], names_size(state.workers, state.names_per_worker)) : MAP_FAILED;
+    sessions = count > 1 ? pool_attach_mapping(fds[1], session_table_size(state.sessions)) : MAP_FAILED;
+    if(count < CHAT_POOL_EXEC_FDS + state.workers || shared == MAP_FAILED || names == MAP_FAILED || sessions == MAP_FAILED)
+    {
+        fprintf(stderr, "chat_pool_resume: the wrapper's pool state is incomplete\n");
+        for(int i = 2; i < count; ++i)
+        {
+            if(fds[i] != -1)
+            {
+                close(fds[i]);
+            }
+        }
+        return -1;
+    }
+    if(fds[2] != -1)
+    {
+        metrics_attach(fds[2], state.metrics_pages);
+    }
+
+    pool_shared           = (struct ChatPoolShared *)shared;
+    pool_names            = (char *)names;
+    pool_sessions         = sessions;
+    pool_workers          = state.workers;
+    pool_names_per_worker = state.names_per_worker;
+    pool_session_count    = state.sessions;
+    for(int i = 0; i < pool_workers; ++i)
+    {
+        workers[i].listen_fd  = -1;
+        workers[i].control_fd = -1;
+        workers[i].event_fd   = fds[CHAT_POOL_EXEC_FDS + i];
+    }
+    this_worker                     = state.worker;
+    workers[this_worker].listen_fd  = fds[3];
+    handoff_fd                      = fds[4];
+    control_fd                      = control;
+    handoff_set_timeout(control, 0);
+    if(handoff_send(control, CHAT_POOL_CONTROL_READY, NULL, 0, -1) == -1)
+    {
+        return -1;
+    }
+    return this_worker;
+}
+
+int chat_pool_worker(void)
+{
+    return this_worker;
+}
+
+// Function to give a worker the pool's session table, for session_share; NULL outside the pool
+void *chat_pool_sessions(void)
+{
+    return this_worker >= 0 ? pool_sessions : NULL;
+}
+
+int chat_pool_listen_socket(void)
+{
+    return this_worker >= 0 ? workers[this_worker].listen_fd : -1;
+}
+
+int chat_pool_event_fd(void)
+{
+    return this_worker >= 0 ? workers[this_worker].event_fd : -1;
+}
+
+int chat_pool_control_fd(void)
+{
+    return control_fd;
+}
+
+// Function to read the wrapper's request once the control socket is readable. Returns its kind, with the
+// channel to hand this worker's clients over on in *channel for CHAT_POOL_CONTROL_HANDOFF, or -1 if there
+// is nothing to do.
+int chat_pool_take_control(int *channel)
+{
+    uint32_t kind;
+    char     payload;
+    int      fd;
+
+    *channel = -1;
+    if(handoff_recv(control_fd, &kind, &payload, sizeof(payload), &fd) == -1)
+    {
+        // The wrapper is gone, nothing more will come
+        close(control_fd);
+        control_fd = -1;
+        return -1;
+    }
+    if(kind == CHAT_POOL_CONTROL_HANDOFF && fd != -1)
+    {
+        *channel = fd;
+        return (int)kind;
+    }
+    if(fd != -1)
+    {
+        close(fd);
+    }
+    if(kind == CHAT_POOL_CONTROL_DRAIN)
+    {
+        draining = 1;
+        return (int)kind;
+    }
+    return -1;
+}
+
+int chat_pool_draining(void)
+{
+    return draining;
+}
+
+int chat_pool_handoff_fd(void)
+{
+    return handoff_fd;
+}
+
+// Function to forget the predecessor's channel once its records are read
+void chat_pool_handoff_done(void)
+{
+    if(handoff_fd != -1)
+    {
+        close(handoff_fd);
+        handoff_fd = -1;
+    }
+}
+
+uint64_t chat_pool_position(void)
+{
+    return cursor;
+}
+
+// Applies the ring in order from the cursor up to (not including) limit or the head, whichever comes first
+static void pool_apply(ChatRelayHandler handler, uint64_t limit)
+{
+    while(1)
+    {
+        const struct ChatPoolSlot *slot;
+        struct ChatRelayMessage    message;
+        uint64_t                   head = atomic_load_explicit(&pool_shared->head, memory_order_acquire);
+
+        if(cursor >= head || cursor >= limit)
+        {
+            return;
+        }
+
+        slot = &pool_shared->slots[cursor % CHAT_POOL_RING_SLOTS];
+        if(atomic_load_explicit(&slot->position, memory_order_acquire) == cursor)
+        {
+            message = slot->message;
+            atomic_thread_fence(memory_order_acquire);
+            if(atomic_load_explicit(&slot->position, memory_order_relaxed) == cursor)
+            {
+                cursor++;
+                handler(&message);
+                continue;
+            }
+        }
+
+        // Lapped: the oldest messages the ring still has are what is left to apply
+        metrics_add(METRIC_RELAY_SKIPS, head - CHAT_POOL_RING_SLOTS + 1 - cursor);
+        cursor = head - CHAT_POOL_RING_SLOTS + 1;
+    }
+}
+
+// Function to join the relay: applies what the ring still holds from this run (so history is not empty
+// after a restart), then everything from here on
+void chat_pool_attach(ChatRelayHandler handler)
+{
+    chat_pool_attach_at(handler, UINT64_MAX);
+    clear_names(this_worker);
+}
+
+// Function to join the relay as a hot restart's successor: applies the retained history only up to where
+// the predecessor stopped (position), so the clients it passes on get the rest live
+void chat_pool_attach_at(ChatRelayHandler handler, uint64_t position)
+{
+    uint64_t head  = atomic_load_explicit(&pool_shared->head, memory_order_acquire);
+    uint64_t first = atomic_load_explicit(&pool_shared->first, memory_order_relaxed);
+
+    cursor = head - first > CHAT_POOL_RING_SLOTS ? head - CHAT_POOL_RING_SLOTS : first;
+    pool_apply(handler, position);
+}
+
+// Publishes a message to every worker; returns its room sequence number (0 for whispers)
+uint64_t chat_pool_append(enum ChatRelayKind kind, const char *sender, const char *target, const char *text)
+{
+    struct ChatPoolSlot *slot;
+    uint64_t             position;
+    uint64_t             seq = 0;
+    uint64_t             one = 1;
+
+    pool_lock();
+    position = atomic_load_explicit(&pool_shared->head, memory_order_relaxed);
+    slot     = &pool_shared->slots[position % CHAT_POOL_RING_SLOTS];
+
+    // Readers still on the lapped message see it change under them and skip ahead
+    atomic_store_explicit(&slot->position, CHAT_POOL_WRITING, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    if(kind == CHAT_RELAY_ROOM)
+    {
+        seq = atomic_load_explicit(&pool_shared->room_seq, memory_order_relaxed) + 1;
+    }
+    slot->message.kind   = (uint32_t)kind;
+    slot->message.origin = this_worker;
+    slot->message.seq    = seq;
+    snprintf(slot->message.sender, sizeof(slot->message.sender), "%s", sender);
+    snprintf(slot->message.target, sizeof(slot->message.target), "%s", target);
+    snprintf(slot->message.text, sizeof(slot->message.text), "%s", text);
+    atomic_store_explicit(&slot->position, position, memory_order_release);
+    atomic_store_explicit(&pool_shared->head, position + 1, memory_order_release);
+    if(seq != 0)
+    {
+        atomic_store_explicit(&pool_shared->room_seq, seq, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&pool_shared->lock);
+
+    for(int i = 0; i < pool_workers; ++i)
+    {
+        if(i != this_worker && write(workers[i].event_fd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+        {
+            perror("chat_pool_append: eventfd");
+        }
+    }
+    return seq;
+}
+
+// Function to apply every message appended since the last call, in ring order
+void chat_pool_drain(ChatRelayHandler handler)
+{
+    uint64_t events;
+
+    if(read(workers[this_worker].event_fd, &events, sizeof(events)) == -1 && errno != EAGAIN)
+    {
+        perror("chat_pool_drain: eventfd");
+    }
+    pool_apply(handler, UINT64_MAX);
+}
+
+// Function to continue the room numbering after last_seq (recovered from the write-ahead log, 0 without one);
+// worker 0 calls it once it knows, which lets the other workers start serving
+void chat_pool_restore_seq(uint64_t last_seq)
+{
+    pool_lock();
+    if(last_seq > atomic_load_explicit(&pool_shared->room_seq, memory_order_relaxed))
+    {
+        atomic_store_explicit(&pool_shared->room_seq, last_seq, memory_order_relaxed);
+    }
+    atomic_store_explicit(&pool_shared->seq_ready, 1, memory_order_release);
+    pthread_mutex_unlock(&pool_shared->lock);
+}
+
+// Function to wait until worker 0 has restored the room numbering, so no message takes a number the log already
+// holds; connections meanwhile wait in the backlog. Returns early once *stop is set.
+void chat_pool_await_seq(const volatile sig_atomic_t *stop)
+{
+    struct timespec pause = {0, CHAT_POOL_POLL_NS};
+
+    while(!atomic_load_explicit(&pool_shared->seq_ready, memory_order_acquire) && !*stop)
+    {
+        nanosleep(&pause, NULL);
+    }
+}
+
+// Readers may catch a name half rewritten; every entry stays NUL-terminated, so at worst they see a mix for an instant
+void chat_pool_name_set(int slot, const char *name)
+{
+    char *entry;
+
+    if(this_worker < 0 || slot < 0 || slot >= pool_names_per_worker)
+    {
+        return;
+    }
+    entry = name_entry(this_worker, slot);
+    memset(entry, 0, CHAT_POOL_NAME_SIZE);
+    strncpy(entry, name, CHAT_POOL_NAME_SIZE - 1);
+}
+
+int chat_pool_name_find(const char *name)
+{
+    if(this_worker < 0 || name[0] == '\0' || strlen(name) >= CHAT_POOL_NAME_SIZE)
+    {
+        return -1;
+    }
+    for(int worker = 0; worker < pool_workers; ++worker)
+    {
+        for(int slot = 0; slot < pool_names_per_worker; ++slot)
+        {
+            if(strncmp(name_entry(worker, slot), name, CHAT_POOL_NAME_SIZE) == 0)
+            {
+                return worker;
+            }
+        }
+    }
+    return -1;
+}
+
+void chat_pool_names_visit(ChatPoolNameVisitor visitor, void *ctx)
+{
+    char name[CHAT_POOL_NAME_SIZE];
+
+    if(this_worker < 0)
+    {
+        return;
+    }
+    for(int worker = 0; worker < pool_workers; ++worker)
+    {
+        for(int slot = 0; slot < pool_names_per_worker; ++slot)
+        {
+            memcpy(name, name_entry(worker, slot), sizeof(name));
+            name[sizeof(name) - 1] = '\0';
+            if(name[0] != '\0')
+            {
+                visitor(name, worker, ctx);
+            }
+        }
+    }
+}
@@ -0,0 +1,804 @@
+// Loopback load generator for the group chat server.
+// Opens many protocol-compliant sessions from a few epoll threads, drives a
+// weighted mix of room messages, /w, /u and /ul at a target rate, and
+// reports throughput and the latency from when a message was due to be sent
+// to when each recipient had it. Every chat message carries its scheduled
+// send time, so delays inside chatbench count too (no coordinated omission).
+
+// Data Types and Limits
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Error Handling
+#include <errno.h>
+
+// Network Programming
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+// Standard Library
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/bench_common.h"
+#include "../include/histogram.h"
+
+// Macros
+#define INPUT_SIZE (4 * 1024)
+#define OUTPUT_SIZE (16 * 1024)
+#define EPOLL_BATCH 256
+#define MAX_SESSIONS 65536
+#define WARMUP_MS 500    // lets every session join and get past the server's resume grace period
+#define DRAIN_MS 1000    // how long to keep reading after the last send
+#define NAME_FORMAT "b%d"
+#define NAME_SIZE 16
+#define ROOM_PREFIX "[All #"
+#define DIRECT_PREFIX "[Direct] "
+#define NOTE_PREFIX "[Note] "
+
+enum BenchOp
+{
+    OP_BROADCAST,
+    OP_DIRECT,
+    OP_RENAME,
+    OP_LIST,
+    OP_COUNT
+};
+
+struct BenchConfig
+{
+    struct sockaddr_storage addr;
+    socklen_t               addr_len;
+    int                     sessions;
+    int                     threads;
+    uint64_t                rate;    // messages per second over all threads
+    uint64_t                duration_ms;
+    size_t                  payload;
+    uint32_t                weights[OP_COUNT];
+    uint32_t                weight_total;
+    uint64_t                start_ns;    // traffic runs from start_ns to end_ns
+    uint64_t                end_ns;
+};
+
+struct BenchSession
+{
+    int     fd;
+    int     index;
+    uint8_t input[INPUT_SIZE];
+    size_t  input_len;
+    uint8_t output[OUTPUT_SIZE];
+    size_t  output_len;
+    int     want_write;
+};
+
+struct BenchThread
+{
+    pthread_t            thread;
+    int                  id;
+    int                  epoll_fd;
+    struct BenchSession *sessions;
+    int                  session_count;
+    int                  next_sender;
+    uint64_t             rng;
+
+    // Results
+    uint64_t         sent[OP_COUNT];
+    uint64_t         send_blocked;    // messages dropped because a session's output buffer was full
+    uint64_t         bytes_out;
+    uint64_t         frames_in;
+    uint64_t         bytes_in;
+    uint64_t         deliveries[OP_COUNT];
+    uint64_t         rejected;
+    uint64_t         closed;
+    struct Histogram latency[OP_COUNT];    // only room messages and /w carry timestamps
+};
+
+static const char *const op_names[OP_COUNT] = {"broadcast", "w", "u", "ul"};
+
+// ----- Function Headers -----
+
+// Argument Parsing
+static void parse_arguments(int argc, char *argv[], struct BenchConfig *config);
+static void parse_mix(const char *binary_name, char *mix, struct BenchConfig *config);
+
+// Error Handling
+_Noreturn static void usage(const char *program_name, int exit_code, const char *message);
+
+// Network Handling
+static int  session_connect(const struct BenchConfig *config);
+static int  session_queue(struct BenchThread *thread, struct BenchSession *session, const char *content, size_t len);
+static void session_flush(struct BenchThread *thread, struct BenchSession *session);
+static void session_close(struct BenchThread *thread, struct BenchSession *session);
+static void session_read(struct BenchThread *thread, struct BenchSession *session, uint64_t now);
+static void handle_frame(struct BenchThread *thread, struct BenchSession *session, const char *content, uint64_t now);
+
+// Traffic
+static uint64_t next_random(struct BenchThread *thread);
+static void     send_next(struct BenchThread *thread, uint64_t due_ns);
+static void    *bench_thread(void *arg);
+
+// Reporting
+static void report(const struct BenchConfig *config, struct BenchThread *threads);
+
+// Read-only once the threads start, apart from the ready flags
+// NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables)
+static struct BenchConfig config;
+static _Atomic char       ready[MAX_SESSIONS];    // per session: the server welcomed it, so it can receive /w
+// NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables)
+
+// ----- Main Function -----
+
+int main(int argc, char *argv[])
+{
+    struct BenchThread *threads;
+    int                 connected = 0;
+
+    parse_arguments(argc, argv, &config);
+
+    threads = (struct BenchThread *)calloc((size_t)config.threads, sizeof(struct BenchThread));
+    if(threads == NULL)
+    {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+
+    for(int t = 0; t < config.threads; ++t)
+    {
+        threads[t].id       = t;
+        threads[t].rng      = UINT64_C(0x9E3779B97F4A7C15) * (uint64_t)(t + 1);
+        threads[t].epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        threads[t].sessions = (struct BenchSession *)calloc((size_t)(config.sessions / config.threads + 1), sizeof(struct BenchSession));
+        if(threads[t].epoll_fd == -1 || threads[t].sessions == NULL)
+        {
+            perror("thread setup");
+            return EXIT_FAILURE;
+        }
+        for(int op = 0; op < OP_COUNT; ++op)
+        {
+            histogram_reset(&threads[t].latency[op]);
+        }
+    }
+
+    // Sessions are dealt out round-robin; session i is named b<i>
+    for(int i = 0; i < config.sessions; ++i)
+    {
+        struct BenchThread  *thread  = &threads[i % config.threads];
+        struct BenchSession *session = &thread->sessions[thread->session_count];
+        struct epoll_event   event;
+        char                 rename[NAME_SIZE + 4];
+        int                  length;
+
+        session->fd = session_connect(&config);
+        if(session->fd == -1)
+        {
+            fprintf(stderr, "Stopped opening sessions after %d\n", connected);
+            break;
+        }
+        session->index = i;
+        thread->session_count++;
+        connected++;
+
+        memset(&event, 0, sizeof(event));
+        event.events   = EPOLLIN;
+        event.data.ptr = session;
+        if(epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, session->fd, &event) == -1)
+        {
+            perror("epoll_ctl");
+            return EXIT_FAILURE;
+        }
+        length = snprintf(rename, sizeof(rename), "/u " NAME_FORMAT, i);
+        session_queue(thread, session, rename, (size_t)length);
+    }
+    if(connected < config.sessions)
+    {
+        config.sessions = connected;
+    }
+
+    config.start_ns = bench_now_ns() + WARMUP_MS * NANOS_PER_MILLI;
+    config.end_ns   = config.start_ns + config.duration_ms * NANOS_PER_MILLI;
+    for(int t = 0; t < config.threads; ++t)
+    {
+        if(pthread_create(&threads[t].thread, NULL, bench_thread, &threads[t]) != 0)
+        {
+            perror("pthread_create");
+            return EXIT_FAILURE;
+        }
+    }
+    for(int t = 0; t < config.threads; ++t)
+    {
+        pthread_join(threads[t].thread, NULL);
+    }
+
+    report(&config, threads);
+
+    for(int t = 0; t < config.threads; ++t)
+    {
+        for(int s = 0; s < threads[t].session_count; ++s)
+        {
+            if(threads[t].sessions[s].fd != -1)
+            {
+                close(threads[t].sessions[s].fd);
+            }
+        }
+        close(threads[t].epoll_fd);
+        free(threads[t].sessions);
+    }
+    free(threads);
+    return EXIT_SUCCESS;
+}
+
+// ----- Argument Parsing -----
+
+static void parse_arguments(int argc, char *argv[], struct BenchConfig *cfg)
+{
+    int  opt;
+    char default_mix[] = "broadcast=90,w=5,u=3,ul=2";
+    char *mix          = default_mix;
+
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->sessions    = 16;
+    cfg->threads     = 2;
+    cfg->rate        = 1000;
+    cfg->duration_ms = 10 * 1000;
+    cfg->payload     = 64;
+    opterr           = 0;
+
+    while((opt = getopt(argc, argv, "hc:t:r:d:s:m:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'h':
+            {
+                usage(argv[0], EXIT_SUCCESS, NULL);
+            }
+            case 'c':
+            {
+                cfg->sessions = (int)bench_parse_number(argv[0], optarg, MAX_SESSIONS, usage);
+                break;
+            }
+            case 't':
+            {
+                cfg->threads = (int)bench_parse_number(argv[0], optarg, INT32_MAX, usage);
+                break;
+            }
+            case 'r':
+            {
+                cfg->rate = bench_parse_number(argv[0], optarg, NANOS_PER_SECOND, usage);
+                break;
+            }
+            case 'd':
+            {
+                cfg->duration_ms = bench_parse_number(argv[0], optarg, UINT32_MAX, usage) * 1000;
+                break;
+            }
+            case 's':
+            {
+                cfg->payload = (size_t)bench_parse_number(argv[0], optarg, MAX_CONTENT - BASE_TEN - 2 * NAME_SIZE, usage);
+                break;
+            }
+            case 'm':
+            {
+                mix = optarg;
+                break;
+            }
+            case '?':
+            {
+                char message[UNKNOWN_OPTION_MESSAGE_LEN];
+
+                snprintf(message, sizeof(message), "Unknown option '-%c'.", optopt);
+                usage(argv[0], EXIT_FAILURE, message);
+            }
+            default:
+            {
+                usage(argv[0], EXIT_FAILURE, NULL);
+            }
+        }
+    }
+
+    if(optind + 2 != argc)
+    {
+        usage(argv[0], EXIT_FAILURE, "The ip address and port are required.");
+    }
+    if(cfg->sessions == 0 || cfg->threads == 0 || cfg->rate == 0)
+    {
+        usage(argv[0], EXIT_FAILURE, "Sessions, threads and rate must be at least 1.");
+    }
+    if(cfg->threads > cfg->sessions)
+    {
+        cfg->threads = cfg->sessions;
+    }
+    parse_mix(argv[0], mix, cfg);
+    bench_convert_address(argv[optind], (in_port_t)bench_parse_number(argv[0], argv[optind + 1], UINT16_MAX, usage), &cfg->addr, &cfg->addr_len);
+}
+
+// Parses "broadcast=90,w=5,u=3,ul=2"; operations left out get no traffic
+static void parse_mix(const char *binary_name, char *mix, struct BenchConfig *cfg)
+{
+    char *save = NULL;
+
+    for(char *item = strtok_r(mix, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save))
+    {
+        char *weight = strchr(item, '=');
+        int   op;
+
+        if(weight == NULL)
+        {
+            usage(binary_name, EXIT_FAILURE, "The mix is a list of op=weight.");
+        }
+        *weight++ = '\0';
+        op = 0;
+        while(op < OP_COUNT && strcmp(item, op_names[op]) != 0)
+        {
+            op++;
+        }
+        if(op == OP_COUNT)
+        {
+            usage(binary_name, EXIT_FAILURE, "Mix operations are broadcast, w, u and ul.");
+        }
+        cfg->weights[op] = (uint32_t)bench_parse_number(binary_name, weight, UINT16_MAX, usage);
+    }
+    for(int op = 0; op < OP_COUNT; ++op)
+    {
+        cfg->weight_total += cfg->weights[op];
+    }
+    if(cfg->weight_total == 0)
+    {
+        usage(binary_name, EXIT_FAILURE, "The mix needs at least one weight above 0.");
+    }
+}
+
+// ----- Error Handling -----
+
+_Noreturn static void usage(const char *program_name, int exit_code, const char *message)
+{
+    if(message)
+    {
+        fprintf(stderr, "%s\n", message);
+    }
+
+    fprintf(stderr, "Usage: %s [-h] [-c sessions] [-t threads] [-r msg/s] [-d seconds] [-s bytes] [-m mix] <ip address> <port>\n", program_name);
+    fputs("Options:\n", stderr);
+    fputs(" -h Display this help message\n", stderr);
+    fputs(" -c Sessions to open (default 16, at most 65536)\n", stderr);
+    fputs(" -t Epoll threads (default 2)\n", stderr);
+    fputs(" -r Messages per second over all sessions (default 1000)\n", stderr);
+    fputs(" -d Seconds of traffic (default 10)\n", stderr);
+    fputs(" -s Message payload in bytes (default 64)\n", stderr);
+    fputs(" -m Traffic mix (default broadcast=90,w=5,u=3,ul=2)\n", stderr);
+    exit(exit_code);
+}
+
+// ----- Network Handling -----
+
+// Connects one session and makes it non-blocking; returns its fd or -1
+static int session_connect(const struct BenchConfig *cfg)
+{
+    int fd  = socket(cfg->addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int opt = 1;
+
+    if(fd == -1)
+    {
+        perror("socket");
+        return -1;
+    }
+    if(connect(fd, (const struct sockaddr *)&cfg->addr, cfg->addr_len) == -1)
+    {
+        perror("connect");
+        close(fd);
+        return -1;
+    }
+    if(setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt)) == -1 || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1)
+    {
+        perror("session setup");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Frames content and writes as much as the socket takes; the rest waits for EPOLLOUT.
+// Returns -1 if the output buffer had no room and the message was dropped.
+static int session_queue(struct BenchThread *thread, struct BenchSession *session, const char *content, size_t len)
+{
+    if(session->output_len + HEADER_SIZE + len > OUTPUT_SIZE)
+    {
+        thread->send_blocked++;
+        return -1;
+    }
+    bench_frame_header(session->output + session->output_len, len);
+    memcpy(session->output + session->output_len + HEADER_SIZE, content, len);
+    session->output_len += HEADER_SIZE + len;
+    thread->bytes_out += HEADER_SIZE + len;
+    if(!session->want_write)
+    {
+        session_flush(thread, session);
+    }
+    return 0;
+}
+
+static void session_flush(struct BenchThread *thread, struct BenchSession *session)
+{
+    size_t             sent = 0;
+    struct epoll_event event;
+    int                want_write;
+
+    while(sent < session->output_len)
+    {
+        ssize_t result = send(session->fd, session->output + sent, session->output_len - sent, MSG_NOSIGNAL);
+
+        if(result == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            if(errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                session_close(thread, session);
+                return;
+            }
+            break;
+        }
+        sent += (size_t)result;
+    }
+    memmove(session->output, session->output + sent, session->output_len - sent);
+    session->output_len -= sent;
+
+    want_write = session->output_len > 0;
+    if(want_write != session->want_write)
+    {
+        memset(&event, 0, sizeof(event));
+        event.events   = EPOLLIN | (want_write ? (uint32_t)EPOLLOUT : 0U);
+        event.data.ptr = session;
+        epoll_ctl(thread->epoll_fd, EPOLL_CTL_MOD, session->fd, &event);
+        session->want_write = want_write;
+    }
+}
+
+static void session_close(struct BenchThread *thread, struct BenchSession *session)
+{
+    if(session->fd == -1)
+    {
+        return;
+    }
+    epoll_ctl(thread->epoll_fd, EPOLL_CTL_DEL, session->fd, NULL);
+    close(session->fd);
+    session->fd         = -1;
+    session->output_len = 0;
+    atomic_store_explicit(&ready[session->index], 0, memory_order_relaxed);
+    thread->closed++;
+}
+
+// Reads whatever arrived and handles every complete frame
+static void session_read(struct BenchThread *thread, struct BenchSession *session, uint64_t now)
+{
+    for(;;)
+    {
+        size_t  offset = 0;
+        ssize_t bytes;
+
+        // Whole frames are taken out below and any frame fits, so a full buffer means the stream is out of step
+        if(session->input_len == INPUT_SIZE)
+        {
+            session_close(thread, session);
+            return;
+        }
+        bytes = recv(session->fd, session->input + session->input_len, INPUT_SIZE - session->input_len, 0);
+        if(bytes == 0 || (bytes == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        {
+            session_close(thread, session);
+            return;
+        }
+        if(bytes == -1)
+        {
+            return;
+        }
+        session->input_len += (size_t)bytes;
+        if(now >= config.start_ns)
+        {
+            thread->bytes_in += (size_t)bytes;
+        }
+
+        while(session->input_len - offset >= HEADER_SIZE)
+        {
+            uint16_t size = bench_frame_size(session->input + offset);
+            char     content[MAX_CONTENT + 1];
+
+            if(size > MAX_CONTENT)
+            {
+                session_close(thread, session);
+                return;
+            }
+            if(session->input_len - offset < HEADER_SIZE + (size_t)size)
+            {
+                break;
+            }
+            memcpy(content, session->input + offset + HEADER_SIZE, size);
+            content[size] = '\0';
+            offset += HEADER_SIZE + (size_t)size;
+            if(now >= config.start_ns)
+            {
+                thread->frames_in++;
+            }
+            handle_frame(thread, session, content, now);
+            if(session->fd == -1)
+            {
+                return;
+            }
+        }
+        memmove(session->input, session->input + offset, session->input_len - offset);
+        session->input_len -= offset;
+    }
+}
+
+// Timestamped messages ("[All #n] name: T<ns> ..." and "[Direct] name: T<ns> ...") feed the latency histograms
+static void handle_frame(struct BenchThread *thread, struct BenchSession *session, const char *content, uint64_t now)
+{
+    enum BenchOp op;
+    const char  *body;
+    uint64_t     due;
+
+    if(strncmp(content, ROOM_PREFIX, strlen(ROOM_PREFIX)) == 0)
+    {
+        op = OP_BROADCAST;
+    }
+    else if(strncmp(content, DIRECT_PREFIX, strlen(DIRECT_PREFIX)) == 0 || strncmp(content, NOTE_PREFIX, strlen(NOTE_PREFIX)) == 0)
+    {
+        op = OP_DIRECT;
+    }
+    else
+    {
+        if(strncmp(content, WELCOME_PREFIX, strlen(WELCOME_PREFIX)) == 0)
+        {
+            atomic_store_explicit(&ready[session->index], 1, memory_order_relaxed);
+        }
+        else if(strncmp(content, SERVER_FULL_PREFIX, strlen(SERVER_FULL_PREFIX)) == 0)
+        {
+            thread->rejected++;
+            session_close(thread, session);
+        }
+        return;
+    }
+
+    body = strstr(content, ": T");
+    if(body == NULL)
+    {
+        return;
+    }
+    due = strtoull(body + strlen(": T"), NULL, BASE_TEN);
+
+    // Room history replayed to a joiner is from before the measurement
+    if(due < config.start_ns || due > now)
+    {
+        return;
+    }
+    thread->deliveries[op]++;
+    histogram_record(&thread->latency[op], now - due);
+}
+
+// ----- Traffic -----
+
+// xorshift64*
+static uint64_t next_random(struct BenchThread *thread)
+{
+    thread->rng ^= thread->rng >> 12;
+    thread->rng ^= thread->rng << 25;
+    thread->rng ^= thread->rng >> 27;
+    return thread->rng * UINT64_C(0x2545F4914F6CDD1D);
+}
+
+// Sends the message due at due_ns from this thread's next live session
+static void send_next(struct BenchThread *thread, uint64_t due_ns)
+{
+    struct BenchSession *session = NULL;
+    char                 message[MAX_CONTENT + 1];
+    char                 payload[MAX_CONTENT + 1];
+    uint32_t             pick;
+    enum BenchOp         op     = OP_BROADCAST;
+    int                  length = 0;
+
+    for(int tries = 0; tries < thread->session_count && session == NULL; ++tries)
+    {
+        struct BenchSession *candidate = &thread->sessions[thread->next_sender];
+
+        thread->next_sender = (thread->next_sender + 1) % thread->session_count;
+        if(candidate->fd != -1 && atomic_load_explicit(&ready[candidate->index], memory_order_relaxed))
+        {
+            session = candidate;
+        }
+    }
+    if(session == NULL)
+    {
+        return;
+    }
+
+    pick = (uint32_t)(next_random(thread) % config.weight_total);
+    while(pick >= config.weights[op])
+    {
+        pick -= config.weights[op];
+        op = (enum BenchOp)(op + 1);
+    }
+
+    length = snprintf(payload, sizeof(payload), "T%" PRIu64 " ", due_ns);
+    while((size_t)length < config.payload)
+    {
+        payload[length++] = 'x';
+    }
+    payload[length] = '\0';
+
+    switch(op)
+    {
+        case OP_BROADCAST:
+        {
+            length = snprintf(message, sizeof(message), "%s", payload);
+            break;
+        }
+        case OP_DIRECT:
+        {
+            int target = (int)(next_random(thread) % (uint64_t)config.sessions);
+
+            // Aim at a session the server took; fall back to whisper to ourselves
+            if(!atomic_load_explicit(&ready[target], memory_order_relaxed))
+            {
+                target = session->index;
+            }
+            length = snprintf(message, sizeof(message), "/w " NAME_FORMAT " %s", target, payload);
+            break;
+        }
+        case OP_RENAME:
+        {
+            length = snprintf(message, sizeof(message), "/u " NAME_FORMAT, session->index);
+            break;
+        }
+        case OP_LIST:
+        case OP_COUNT:
+        default:
+        {
+            length = snprintf(message, sizeof(message), "/ul");
+            break;
+        }
+    }
+    if(session_queue(thread, session, message, (size_t)length) == 0)
+    {
+        thread->sent[op]++;
+    }
+}
+
+static void *bench_thread(void *arg)
+{
+    struct BenchThread *thread   = (struct BenchThread *)arg;
+    uint64_t            interval = NANOS_PER_SECOND * (uint64_t)config.threads / config.rate;
+    uint64_t            next_due = config.start_ns + interval * (uint64_t)thread->id / (uint64_t)config.threads;
+    uint64_t            stop     = config.end_ns + DRAIN_MS * NANOS_PER_MILLI;
+    struct epoll_event  events[EPOLL_BATCH];
+
+    if(interval == 0)
+    {
+        interval = 1;
+    }
+
+    for(;;)
+    {
+        uint64_t now = bench_now_ns();
+        int      timeout_ms;
+        int      ready_count;
+
+        if(now >= stop)
+        {
+            break;
+        }
+
+        // Open loop: everything that has come due goes out, however late
+        while(next_due <= now && next_due < config.end_ns)
+        {
+            send_next(thread, next_due);
+            next_due += interval;
+        }
+
+        if(next_due < config.end_ns)
+        {
+            timeout_ms = (int)((next_due - now) / NANOS_PER_MILLI);
+        }
+        else
+        {
+            timeout_ms = (int)((stop - now) / NANOS_PER_MILLI) + 1;
+        }
+
+        ready_count = epoll_wait(thread->epoll_fd, events, EPOLL_BATCH, timeout_ms);
+        now         = bench_now_ns();
+        for(int e = 0; e < ready_count; ++e)
+        {
+            struct BenchSession *session = (struct BenchSession *)events[e].data.ptr;
+
+            if(session->fd != -1 && (events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+            {
+                session_read(thread, session, now);
+            }
+            if(session->fd != -1 && (events[e].events & EPOLLOUT))
+            {
+                session_flush(thread, session);
+            }
+        }
+    }
+    return NULL;
+}
+
+// ----- Reporting -----
+
+static void report(const struct BenchConfig *cfg, struct BenchThread *threads)
+{
+    struct BenchThread total;
+    double             seconds = (double)cfg->duration_ms / 1000.0;
+    uint64_t           sent    = 0;
+
+    memset(&total, 0, sizeof(total));
+    for(int op = 0; op < OP_COUNT; ++op)
+    {
+        histogram_reset(&total.latency[op]);
+    }
+    for(int t = 0; t < cfg->threads; ++t)
+    {
+        for(int op = 0; op < OP_COUNT; ++op)
+        {
+            total.sent[op] += threads[t].sent[op];
+            total.deliveries[op] += threads[t].deliveries[op];
+            histogram_merge(&total.latency[op], &threads[t].latency[op]);
+        }
+        total.send_blocked += threads[t].send_blocked;
+        total.bytes_out += threads[t].bytes_out;
+        total.frames_in += threads[t].frames_in;
+        total.bytes_in += threads[t].bytes_in;
+        total.rejected += threads[t].rejected;
+        total.closed += threads[t].closed;
+    }
+    for(int op = 0; op < OP_COUNT; ++op)
+    {
+        sent += total.sent[op];
+    }
+
+    printf("sessions   %d opened on %d threads, %" PRIu64 " rejected as full, %" PRIu64 " closed\n", cfg->sessions, cfg->threads, total.rejected, total.closed - total.rejected);
+    printf("load       %" PRIu64 " msg/s target for %.1f s, %zu-byte payloads, mix broadcast=%u w=%u u=%u ul=%u\n",
+           cfg->rate,
+           seconds,
+           cfg->payload,
+           cfg->weights[OP_BROADCAST],
+           cfg->weights[OP_DIRECT],
+           cfg->weights[OP_RENAME],
+           cfg->weights[OP_LIST]);
+    printf("sent       %" PRIu64 " messages (%" PRIu64 " broadcast, %" PRIu64 " /w, %" PRIu64 " /u, %" PRIu64 " /ul, %" PRIu64 " dropped on full buffers): %.1f msg/s, %.1f bytes/s\n",
+           sent,
+           total.sent[OP_BROADCAST],
+           total.sent[OP_DIRECT],
+           total.sent[OP_RENAME],
+           total.sent[OP_LIST],
+           total.send_blocked,
+           (double)sent / seconds,
+           (double)total.bytes_out / seconds);
+    printf("received   %" PRIu64 " frames: %.1f msg/s, %.1f bytes/s\n", total.frames_in, (double)total.frames_in / seconds, (double)total.bytes_in / seconds);
+    for(int op = 0; op <= OP_DIRECT; ++op)
+    {
+        const struct Histogram *latency = &total.latency[op];
+        uint64_t                mean    = histogram_mean(latency);
+        uint64_t                p50     = histogram_percentile(latency, 500);
+        uint64_t                p99     = histogram_percentile(latency, 990);
+        uint64_t                p999    = histogram_percentile(latency, 999);
+
+        printf("%-10s %" PRIu64 " deliveries, latency us: mean %.1f p50 %.1f p99 %.1f p99.9 %.1f max %.1f\n",
+               op == OP_BROADCAST ? "fan-out" : "/w",
+               total.deliveries[op],
+               (double)mean / (double)NANOS_PER_MICRO,
+               (double)p50 / (double)NANOS_PER_MICRO,
+               (double)p99 / (double)NANOS_PER_MICRO,
+               (double)p999 / (double)NANOS_PER_MICRO,
+               (double)latency->max / (double)NANOS_PER_MICRO);
+    }
+}
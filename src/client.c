@@ -19,17 +19,38 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "../include/histogram.h"
+
 // Macros
 #define UNKNOWN_OPTION_MESSAGE_LEN 24
 #define BASE_TEN 10
 #define LINE_LENGTH 1024
+#define RESUME_TOKEN_PREFIX "Server: Resume token "
+#define RESUME_TOKEN_LENGTH 32
+#define SERVER_OFFLINE_PREFIX "Server is now offline."
+#define RECONNECT_ATTEMPTS 5
+#define RECONNECT_DELAY_SECONDS 1
+#define PONG_PREFIX "PONG "
+#define PING_DEFAULT_INTERVAL_MS 1000
+#define PING_TIMEOUT_MS 2000
+#define FRAME_HEADER_SIZE 3
+#define MAX_CONTENT (LINE_LENGTH - 1)    // the server reads frames into a 1 KiB buffer, terminator included
+#define NANOS_PER_MILLI 1000000ULL
+#define NANOS_PER_MICRO 1000ULL
+#define PERMILLE_P50 500
+#define PERMILLE_P90 900
+#define PERMILLE_P99 990
+#define MILLIS_PER_SECOND 1000
+#define MICROS_PER_MILLI 1000
 
 // ----- Function Headers -----
 
 // Argument Parsing
-static void      parse_arguments(int argc, char *argv[], char **ip_address, char **port);
+static void      parse_arguments(int argc, char *argv[], char **ip_address, char **port, long *ping_count, long *ping_interval_ms);
+static long      parse_count(const char *binary_name, const char *count_str);
 static void      handle_arguments(const char *binary_name, const char *ip_address, const char *port_str, in_port_t *port);
 static in_port_t parse_in_port_t(const char *binary_name, const char *port_str);
 
@@ -41,8 +62,18 @@ static void convert_address(const char *address, struct sockaddr_storage *addr);
 static int  socket_create(int domain, int type, int protocol);
 static void socket_connect(int sockfd, struct sockaddr_storage *addr, in_port_t port);
 static void socket_close(int sockfd);
-static void write_to_socket(int sockfd, const char *message);
+static int  write_to_socket(int sockfd, const char *message);
 static int  read_from_socket(int sockfd);
+static void check_room_sequence(const char *message);
+static int  check_session_message(const char *message);
+static int  reconnect_to_server(int sockfd);
+
+// Ping Mode
+static uint64_t now_ns(void);
+static int      read_frame(int sockfd, char *buffer, size_t buffer_size);
+static int      await_pong(int sockfd, long seq, uint64_t *server_recv_ns, uint64_t *server_send_ns);
+static int      run_ping(int sockfd, long count, long interval_ms);
+static void     print_latency(const char *label, const struct Histogram *histogram, uint64_t unit_ns, const char *unit, int decimals);
 
 // Signal Handling Functions
 static void setup_signal_handler(void);
@@ -53,6 +84,14 @@ static void *write_message(void *arg);
 static void *read_message(void *arg);
 
 static volatile sig_atomic_t sigtstp_flag = 0;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+static uint64_t              last_room_seq = 0;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+
+// Where to reconnect to, and the token that gets this session back
+// NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables)
+static struct sockaddr_storage server_addr;
+static char                    session_token[RESUME_TOKEN_LENGTH + 1];
+static int                     server_offline = 0;
+// NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables)
 
 // ----- Main Function -----
 
@@ -62,6 +101,8 @@ int main(int argc, char *argv[])
     char     *port_str;
     in_port_t port;
     int       sock_fd;
+    long      ping_count       = -1;
+    long      ping_interval_ms = PING_DEFAULT_INTERVAL_MS;
     //    int                     receiver_sockfd;
     struct sockaddr_storage addr;
 
@@ -74,16 +115,25 @@ int main(int argc, char *argv[])
     ip_address = NULL;
     port_str   = NULL;
 
-    parse_arguments(argc, argv, &ip_address, &port_str);
+    parse_arguments(argc, argv, &ip_address, &port_str, &ping_count, &ping_interval_ms);
     handle_arguments(argv[0], ip_address, port_str, &port);
     convert_address(ip_address, &addr);
 
     sock_fd = socket_create(addr.ss_family, SOCK_STREAM, 0);
 
     socket_connect(sock_fd, &addr, port);
+    server_addr = addr;    // now carries the port as well
 
     setup_signal_handler();
 
+    if(ping_count >= 0)
+    {
+        int ping_result = run_ping(sock_fd, ping_count, ping_interval_ms);
+
+        socket_close(sock_fd);
+        return ping_result;
+    }
+
     write_thread_result = pthread_create(&write_message_thread, NULL, write_message, (void *)&sock_fd);
     read_thread_result  = pthread_create(&read_message_thread, NULL, read_message, (void *)&sock_fd);
 
@@ -130,13 +180,13 @@ int main(int argc, char *argv[])
 // ----- Function Definitions -----
 
 // Argument Parsing Functions
-static void parse_arguments(const int argc, char *argv[], char **ip_address, char **port)
+static void parse_arguments(const int argc, char *argv[], char **ip_address, char **port, long *ping_count, long *ping_interval_ms)
 {
     int opt;
     opterr = 0;
 
     // Option parsing
-    while((opt = getopt(argc, argv, "h")) != -1)
+    while((opt = getopt(argc, argv, "hp:i:")) != -1)
     {
         switch(opt)
         {
@@ -144,6 +194,16 @@ static void parse_arguments(const int argc, char *argv[], char **ip_address, cha
             {
                 usage(argv[0], EXIT_SUCCESS, NULL);
             }
+            case 'p':    // Ping mode, number of pings (0 = until Ctrl+C)
+            {
+                *ping_count = parse_count(argv[0], optarg);
+                break;
+            }
+            case 'i':    // Milliseconds between pings
+            {
+                *ping_interval_ms = parse_count(argv[0], optarg);
+                break;
+            }
             case '?':    // Unknown argument
             {
                 char message[UNKNOWN_OPTION_MESSAGE_LEN];
@@ -222,6 +282,22 @@ static in_port_t parse_in_port_t(const char *binary_name, const char *port_str)
     return (in_port_t)parsed_value;
 }
 
+static long parse_count(const char *binary_name, const char *count_str)
+{
+    char     *endptr;
+    uintmax_t parsed_value;
+
+    errno        = 0;
+    parsed_value = strtoumax(count_str, &endptr, BASE_TEN);
+
+    if(errno != 0 || *endptr != '\0' || endptr == count_str || parsed_value > INT32_MAX)
+    {
+        usage(binary_name, EXIT_FAILURE, "Counts and intervals must be whole numbers.");
+    }
+
+    return (long)parsed_value;
+}
+
 // Error Handling Functions
 
 _Noreturn static void usage(const char *program_name, int exit_code, const char *message)
@@ -231,9 +307,11 @@ _Noreturn static void usage(const char *program_name, int exit_code, const char
         fprintf(stderr, "%s\n", message);
     }
 
-    fprintf(stderr, "Usage: %s [-h] <ip address> <port>\n", program_name);
+    fprintf(stderr, "Usage: %s [-h] [-p count] [-i ms] <ip address> <port>\n", program_name);
     fputs("Options:\n", stderr);
     fputs(" -h Display this help message\n", stderr);
+    fputs(" -p Ping the server count times (0 = until Ctrl+C) and print latency percentiles\n", stderr);
+    fputs(" -i Milliseconds between pings (default 1000)\n", stderr);
     exit(exit_code);
 }
 
@@ -389,6 +467,21 @@ static void setup_signal_handler(void)
         perror("sigaction");
         exit(EXIT_FAILURE);
     }
+
+    // Writing to a dropped connection must not kill the client before it can reconnect
+#if defined(__clang__)
+    #pragma clang diagnostic push
+    #pragma clang diagnostic ignored "-Wdisabled-macro-expansion"
+#endif
+    sa.sa_handler = SIG_IGN;
+#if defined(__clang__)
+    #pragma clang diagnostic pop
+#endif
+    if(sigaction(SIGPIPE, &sa, NULL) == -1)
+    {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
 }
 
 #pragma GCC diagnostic push
@@ -411,10 +504,23 @@ static void *write_message(void *arg)
 
     while(!sigtstp_flag)
     {
-        char input[LINE_LENGTH];
+        char   input[LINE_LENGTH];
+        size_t input_len;
 
         if(fgets(input, sizeof(input), stdin) != NULL)
         {
+            // A line fgets could not hold is refused whole instead of going out in pieces
+            input_len = strlen(input);
+            if(input_len == sizeof(input) - 1 && input[input_len - 1] != '\n')
+            {
+                int c;
+
+                while((c = getchar()) != '\n' && c != EOF)
+                {
+                }
+                fprintf(stderr, "Message too long (at most %d bytes); not sent\n", MAX_CONTENT);
+                continue;
+            }
             //            printf("Output: %s\n", input);
             write_to_socket(sockfd, input);
         }
@@ -437,8 +543,15 @@ static void *read_message(void *arg)
         int read_result;
         read_result = read_from_socket(sockfd);
 
+        // A dropped connection is picked back up where it left off if the server still knows us
+        if(read_result == 1 && !sigtstp_flag && reconnect_to_server(sockfd) == 0)
+        {
+            continue;
+        }
+
         if(read_result == 1 || sigtstp_flag == 1)
         {
+            sigtstp_flag = 1;
             exit(0);
         }
     }
@@ -447,27 +560,30 @@ static void *read_message(void *arg)
 }
 
 /**
- * Writes a command string to a socket.
+ * Writes a command string to a socket as one frame.
  * @param sockfd   the file descriptor of the socket to write to
+ * @return         0, or -1 if the message is longer than the server takes (it is not sent)
  */
-static void write_to_socket(int sockfd, const char *message)
+static int write_to_socket(int sockfd, const char *message)
 {
     size_t   message_len;
     uint16_t size;
-    uint8_t  version = 1;
+    uint8_t  frame[FRAME_HEADER_SIZE + MAX_CONTENT];
 
     message_len = strlen(message);
-    size        = htons((uint16_t)message_len);
-
-    //    printf("sockfd: %d\n", sockfd);
-
-    write(sockfd, &version, sizeof(uint8_t));    // Write protocol version
-    write(sockfd, &size, sizeof(uint16_t));      // Write the size of the command
-    write(sockfd, message, message_len);         // Write the command string
-
-    //    write(STDOUT_FILENO, &version, sizeof(uint8_t));    // Write protocol version
-    //    write(STDOUT_FILENO, &size, sizeof(uint16_t));      // Write the size of the command
-    //    write(STDOUT_FILENO, message, message_len);         // Write the command string
+    if(message_len > MAX_CONTENT)
+    {
+        fprintf(stderr, "Message too long (%zu bytes, at most %d); not sent\n", message_len, MAX_CONTENT);
+        return -1;
+    }
+    size = htons((uint16_t)message_len);
+
+    // One write per frame: split writes leave the tail waiting on Nagle for the server's delayed ACK
+    frame[0] = 1;    // protocol version
+    memcpy(&frame[1], &size, sizeof(size));
+    memcpy(&frame[FRAME_HEADER_SIZE], message, message_len);
+    write(sockfd, frame, FRAME_HEADER_SIZE + message_len);
+    return 0;
 }
 
 /**
@@ -488,18 +604,22 @@ static int read_from_socket(int sockfd)
 
     if(bytes_read < 1 && version != 1)    // Check if connection is closed
     {
-        sigtstp_flag = 1;
         return EXIT_FAILURE;
     }
 
     if(bytes_read < 1)    // Check if connection is closed
     {
-        sigtstp_flag = 1;
         return EXIT_FAILURE;
     }
 
     buffer[(int)bytes_read] = '\0';
 
+    if(check_session_message(buffer))
+    {
+        return EXIT_SUCCESS;
+    }
+    check_room_sequence(buffer);
+
     if(write(STDOUT_FILENO, buffer, strlen(buffer)) == -1)
     {
         //        perror("write");
@@ -511,3 +631,279 @@ static int read_from_socket(int sockfd)
 
     return EXIT_SUCCESS;
 }
+
+/**
+ * Room messages carry the server's sequence number ("[All #42] ...").
+ * Warns the user when numbers were skipped, i.e. messages were lost.
+ * @param message the message just received
+ */
+static void check_room_sequence(const char *message)
+{
+    uint64_t seq;
+
+    if(sscanf(message, "[All #%" SCNu64 "]", &seq) != 1)
+    {
+        return;
+    }
+
+    if(last_room_seq != 0 && seq > last_room_seq + 1)
+    {
+        printf("*** missed %" PRIu64 " room message(s) ***\n", seq - last_room_seq - 1);
+        fflush(stdout);
+    }
+    last_room_seq = seq;
+}
+
+/**
+ * Remembers the resume token the server hands out and notices when the
+ * server is going away for good.
+ * @param message the message just received
+ * @return        1 if the message was for the client only and should not be shown
+ */
+static int check_session_message(const char *message)
+{
+    if(strncmp(message, RESUME_TOKEN_PREFIX, strlen(RESUME_TOKEN_PREFIX)) == 0)
+    {
+        snprintf(session_token, sizeof(session_token), "%.*s", RESUME_TOKEN_LENGTH, message + strlen(RESUME_TOKEN_PREFIX));
+        return 1;
+    }
+
+    if(strncmp(message, SERVER_OFFLINE_PREFIX, strlen(SERVER_OFFLINE_PREFIX)) == 0)
+    {
+        server_offline = 1;
+    }
+    return 0;
+}
+
+/**
+ * Connects again after the connection dropped and asks the server to resume
+ * the session, so only the missed room messages are sent. The new connection
+ * takes over the old descriptor number, so the writer thread carries on as is.
+ * @param sockfd the file descriptor of the dropped connection
+ * @return       0 once resumed, -1 if the server could not be reached
+ */
+static int reconnect_to_server(int sockfd)
+{
+    socklen_t addr_len = server_addr.ss_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+    char      resume[LINE_LENGTH];
+
+    if(session_token[0] == '\0' || server_offline)
+    {
+        return -1;
+    }
+
+    printf("*** connection lost, reconnecting ***\n");
+    fflush(stdout);
+
+    for(int attempt = 0; attempt < RECONNECT_ATTEMPTS && !sigtstp_flag; ++attempt)
+    {
+        int new_fd = socket(server_addr.ss_family, SOCK_STREAM, 0);
+
+        if(new_fd == -1)
+        {
+            return -1;
+        }
+        if(connect(new_fd, (struct sockaddr *)&server_addr, addr_len) == 0 && dup2(new_fd, sockfd) != -1)
+        {
+            close(new_fd);
+            snprintf(resume, sizeof(resume), "/resume %s %" PRIu64 "\n", session_token, last_room_seq);
+            write_to_socket(sockfd, resume);
+            printf("*** reconnected ***\n");
+            fflush(stdout);
+            return 0;
+        }
+        close(new_fd);
+        sleep(RECONNECT_DELAY_SECONDS);
+    }
+    return -1;
+}
+
+// Ping Mode Functions
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NANOS_PER_MILLI * MILLIS_PER_SECOND + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Reads one whole frame, waiting at most until the socket's receive timeout.
+ * @param sockfd      the file descriptor of the socket to read from
+ * @param buffer      where the NUL-terminated content goes
+ * @param buffer_size size of buffer
+ * @return            0 on a frame, 1 on timeout before the frame started, -1 if the connection is unusable
+ */
+static int read_frame(int sockfd, char *buffer, size_t buffer_size)
+{
+    uint8_t  header[FRAME_HEADER_SIZE];
+    uint16_t size;
+    ssize_t  bytes_read;
+
+    bytes_read = recv(sockfd, header, sizeof(header), MSG_WAITALL);
+    if(bytes_read == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    {
+        return 1;
+    }
+    if(bytes_read != (ssize_t)sizeof(header))
+    {
+        return -1;
+    }
+
+    memcpy(&size, &header[1], sizeof(size));
+    size = ntohs(size);
+    if(size >= buffer_size)
+    {
+        return -1;
+    }
+
+    // The rest of the frame is already on its way, so a timeout here means the stream is out of step
+    bytes_read = recv(sockfd, buffer, size, MSG_WAITALL);
+    if(bytes_read != (ssize_t)size)
+    {
+        return -1;
+    }
+    buffer[size] = '\0';
+    return 0;
+}
+
+/**
+ * Waits for the pong to ping number seq, skipping room messages and late pongs.
+ * @return 0 with the server's timestamps filled in, 1 on timeout, -1 if the connection is unusable
+ */
+static int await_pong(int sockfd, long seq, uint64_t *server_recv_ns, uint64_t *server_send_ns)
+{
+    char buffer[LINE_LENGTH];
+
+    while(!sigtstp_flag)
+    {
+        long pong_seq;
+        int  result = read_frame(sockfd, buffer, sizeof(buffer));
+
+        if(result != 0)
+        {
+            return result;
+        }
+        if(sscanf(buffer, PONG_PREFIX "%ld %" SCNu64 " %" SCNu64, &pong_seq, server_recv_ns, server_send_ns) == 3 && pong_seq == seq)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Pings the server every interval_ms and prints each round trip split into the time the
+ * server held the ping (its send minus receive timestamp) and the rest (network and
+ * kernel), then percentiles of all three.
+ * @param sockfd      a connected socket
+ * @param count       number of pings, 0 for until Ctrl+C
+ * @param interval_ms time from one ping to the next
+ * @return            EXIT_SUCCESS if at least one pong came back
+ */
+static int run_ping(int sockfd, long count, long interval_ms)
+{
+    struct Histogram rtt;
+    struct Histogram server;
+    struct Histogram network;
+    struct timeval   timeout;
+    long             sent     = 0;
+    long             received = 0;
+
+    histogram_reset(&rtt);
+    histogram_reset(&server);
+    histogram_reset(&network);
+
+    timeout.tv_sec  = PING_TIMEOUT_MS / MILLIS_PER_SECOND;
+    timeout.tv_usec = (suseconds_t)(PING_TIMEOUT_MS % MILLIS_PER_SECOND) * MICROS_PER_MILLI;
+    if(setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1)
+    {
+        perror("setsockopt");
+        return EXIT_FAILURE;
+    }
+
+    while(!sigtstp_flag && (count == 0 || sent < count))
+    {
+        char            ping[LINE_LENGTH];
+        uint64_t        start;
+        uint64_t        elapsed;
+        uint64_t        server_recv_ns;
+        uint64_t        server_send_ns;
+        struct timespec pause;
+        int             result;
+
+        snprintf(ping, sizeof(ping), "/ping %ld", ++sent);
+        start = now_ns();
+        write_to_socket(sockfd, ping);
+        result  = await_pong(sockfd, sent, &server_recv_ns, &server_send_ns);
+        elapsed = now_ns() - start;
+
+        if(result == -1)
+        {
+            fprintf(stderr, "connection lost\n");
+            break;
+        }
+        if(result == 0)
+        {
+            uint64_t held = server_send_ns - server_recv_ns;
+            uint64_t rest = elapsed > held ? elapsed - held : 0;
+
+            received++;
+            histogram_record(&rtt, elapsed);
+            histogram_record(&server, held);
+            histogram_record(&network, rest);
+            printf("ping %ld: rtt %.3f ms, server %.1f us, network %.3f ms\n", sent, (double)elapsed / NANOS_PER_MILLI, (double)held / NANOS_PER_MICRO, (double)rest / NANOS_PER_MILLI);
+        }
+        else if(!sigtstp_flag)
+        {
+            printf("ping %ld: no reply within %d ms\n", sent, PING_TIMEOUT_MS);
+        }
+        fflush(stdout);
+
+        if(elapsed < (uint64_t)interval_ms * NANOS_PER_MILLI && (count == 0 || sent < count))
+        {
+            uint64_t remaining = (uint64_t)interval_ms * NANOS_PER_MILLI - elapsed;
+
+            pause.tv_sec  = (time_t)(remaining / (NANOS_PER_MILLI * MILLIS_PER_SECOND));
+            pause.tv_nsec = (long)(remaining % (NANOS_PER_MILLI * MILLIS_PER_SECOND));
+            nanosleep(&pause, NULL);
+        }
+    }
+
+    printf("--- %ld sent, %ld received, %ld lost ---\n", sent, received, sent - received);
+    if(received > 0)
+    {
+        print_latency("rtt", &rtt, NANOS_PER_MILLI, "ms", 3);
+        print_latency("server", &server, NANOS_PER_MICRO, "us", 1);
+        print_latency("network", &network, NANOS_PER_MILLI, "ms", 3);
+    }
+    fflush(stdout);
+    return received > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * Prints a histogram's p50, p90, p99 and max.
+ * @param unit_ns  nanoseconds per printed unit
+ */
+static void print_latency(const char *label, const struct Histogram *histogram, uint64_t unit_ns, const char *unit, int decimals)
+{
+    uint64_t p50 = histogram_percentile(histogram, PERMILLE_P50);
+    uint64_t p90 = histogram_percentile(histogram, PERMILLE_P90);
+    uint64_t p99 = histogram_percentile(histogram, PERMILLE_P99);
+
+    printf("%-7s p50 %.*f %s  p90 %.*f %s  p99 %.*f %s  max %.*f %s\n",
+           label,
+           decimals,
+           (double)p50 / (double)unit_ns,
+           unit,
+           decimals,
+           (double)p90 / (double)unit_ns,
+           unit,
+           decimals,
+           (double)p99 / (double)unit_ns,
+           unit,
+           decimals,
+           (double)histogram->max / (double)unit_ns,
+           unit);
+}
@@ -0,0 +1,203 @@
+#include "../include/coalesce.h"
+#include "../include/metrics.h"
+#include "../include/probes.h"
+#include "../include/timestamping.h"
+#include "../include/trace.h"
+#include "../include/transport.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#define NANOS_PER_MICRO 1000ULL
+#define NANOS_PER_SECOND 1000000000ULL
+
+struct OutputQueue
+{
+    size_t   len;
+    uint64_t oldest_ns;      // when the first byte now in data was queued
+    uint32_t tick_frames;    // frames submitted for this fd during the current tick
+    uint64_t trace_id;       // a sampled frame is waiting in data
+    uint8_t  data[COALESCE_BUFFER_SIZE];
+};
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables)
+static struct OutputQueue *output_queues[FD_SETSIZE];
+static int                 touched_fds[FD_SETSIZE];
+static int                 touched_count = 0;
+static uint32_t            ratio_ewma    = 0;    // frames per touched connection per tick, scaled by COALESCE_RATIO_SCALE
+static int                 batching      = 0;    // 1 while the loop is in batching mode
+
+// NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables)
+
+static uint64_t coalesce_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NANOS_PER_SECOND + (uint64_t)ts.tv_nsec;
+}
+
+void coalesce_register(int fd)
+{
+    if(fd < 0 || fd >= FD_SETSIZE || output_queues[fd] != NULL)
+    {
+        return;
+    }
+
+    output_queues[fd] = (struct OutputQueue *)calloc(1, sizeof(struct OutputQueue));
+    if(output_queues[fd] == NULL)
+    {
+        perror("coalesce_register: calloc");
+    }
+}
+
+// Flushes whatever is still queued and forgets the fd
+void coalesce_release(int fd)
+{
+    if(fd < 0 || fd >= FD_SETSIZE || output_queues[fd] == NULL)
+    {
+        return;
+    }
+
+    coalesce_flush(fd);
+    free(output_queues[fd]);
+    output_queues[fd] = NULL;
+}
+
+int coalesce_flush(int fd)
+{
+    struct OutputQueue *queue;
+    size_t              sent = 0;
+    uint64_t            start;
+
+    if(fd < 0 || fd >= FD_SETSIZE)
+    {
+        return 0;
+    }
+    queue = output_queues[fd];
+    if(queue == NULL || queue->len == 0)
+    {
+        return 0;
+    }
+    start = queue->trace_id != 0 ? trace_now_ns() : 0;
+
+    while(sent < queue->len)
+    {
+        ssize_t result = transport_send(fd, queue->data + sent, queue->len - sent, MSG_NOSIGNAL);
+        if(result == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            queue->len      = 0;
+            queue->trace_id = 0;
+            return -1;
+        }
+        timestamping_note_send(fd, (size_t)result, queue->oldest_ns);
+        sent += (size_t)result;
+        metrics_add(METRIC_COALESCE_WRITES, 1);
+    }
+
+    // Frames that waited in the queue are only sent now
+    GROUPCHAT_PROBE(send_done, fd, sent, -1);
+    if(queue->trace_id != 0)
+    {
+        trace_record(queue->trace_id, TRACE_FLUSH, start, trace_now_ns(), fd);
+        queue->trace_id = 0;
+    }
+    queue->len = 0;
+    return 0;
+}
+
+// Returns 1 if the frame was queued, 0 if the caller should write it directly, -1 on a failed flush
+int coalesce_submit(int fd, const uint8_t *header, size_t header_len, const char *payload, size_t payload_len)
+{
+    struct OutputQueue *queue;
+    size_t              frame_len = header_len + payload_len;
+    uint64_t            now;
+
+    if(fd < 0 || fd >= FD_SETSIZE || output_queues[fd] == NULL)
+    {
+        return 0;
+    }
+
+    queue = output_queues[fd];
+    if(queue->tick_frames++ == 0)
+    {
+        touched_fds[touched_count++] = fd;
+    }
+
+    if(!batching || frame_len > COALESCE_BUFFER_SIZE)
+    {
+        return coalesce_flush(fd) == -1 ? -1 : 0;
+    }
+
+    now = coalesce_now_ns();
+    if(queue->len > 0 && (queue->len + frame_len > COALESCE_BUFFER_SIZE || now - queue->oldest_ns > COALESCE_MAX_DELAY_US * NANOS_PER_MICRO))
+    {
+        if(coalesce_flush(fd) == -1)
+        {
+            return -1;
+        }
+    }
+
+    if(queue->len == 0)
+    {
+        queue->oldest_ns = now;
+    }
+    metrics_add(METRIC_COALESCE_QUEUED_FRAMES, 1);
+
+    memcpy(queue->data + queue->len, header, header_len);
+    memcpy(queue->data + queue->len + header_len, payload, payload_len);
+    queue->len += frame_len;
+    if(trace_current() != 0)
+    {
+        queue->trace_id = trace_current();
+        trace_record(queue->trace_id, TRACE_ENQUEUE, now, trace_now_ns(), fd);
+    }
+    return 1;
+}
+
+// Called once per event loop iteration: flushes queued output and re-evaluates the load; an iteration
+// without output counts as a ratio of 0, so batching winds down after a burst
+void coalesce_end_tick(void)
+{
+    uint32_t frames = 0;
+    uint64_t queued = 0;
+    uint32_t ratio  = 0;
+
+    for(int i = 0; i < touched_count; ++i)
+    {
+        int fd = touched_fds[i];
+
+        if(output_queues[fd] == NULL)
+        {
+            continue;
+        }
+        frames += output_queues[fd]->tick_frames;
+        queued += output_queues[fd]->len;
+        output_queues[fd]->tick_frames = 0;
+        if(coalesce_flush(fd) == -1)
+        {
+            perror("coalesce_end_tick: flush failed");
+        }
+    }
+
+    if(touched_count > 0)
+    {
+        ratio         = frames * COALESCE_RATIO_SCALE / (uint32_t)touched_count;
+        touched_count = 0;
+        metrics_set(METRIC_OUTPUT_QUEUED_BYTES, (int64_t)queued);
+    }
+    if(batching)
+    {
+        metrics_add(METRIC_COALESCE_BATCHED_TICKS, 1);
+    }
+    ratio_ewma = ratio_ewma - (ratio_ewma >> COALESCE_EWMA_SHIFT) + (ratio >> COALESCE_EWMA_SHIFT);
+    batching   = ratio_ewma >= COALESCE_BATCH_RATIO;
+}
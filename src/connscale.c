@@ -0,0 +1,958 @@
+// Connection-scaling memory benchmark for the group chat server.
+// Ramps loopback connections up in steps (1k, 10k, 50k, 100k by default),
+// keeps a share of them sending room messages while the rest sit idle, and
+// at every step records the server's RSS, heap, anonymous memory and thread
+// count (from /proc/<pid>), the kernel's TCP socket memory, and how long
+// each connection took from connect() to the server's welcome. Prints a
+// table and optionally writes the same numbers as JSON; -l turns it into a
+// regression gate on memory per connection.
+
+// Data Types and Limits
+#include <inttypes.h>
+#include <stdint.h>
+
+// Error Handling
+#include <errno.h>
+
+// Network Programming
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+// Standard Library
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/bench_common.h"
+#include "../include/histogram.h"
+
+// Macros
+#define BASE_SIXTEEN 16
+#define MAX_STEPS 16
+#define MAX_SESSIONS 1000000
+#define EPOLL_BATCH 1024
+#define CONNECT_WINDOW 256         // connections waiting for their welcome at any time
+#define SETTLE_TIMEOUT_MS 10000    // give up on a step when no connection settles for this long
+#define FD_SLACK 32
+#define SOURCE_PORTS 16384    // connections per loopback source address
+#define LINE_SIZE 512
+#define PATH_SIZE 64
+#define KIB 1024
+#define MIB (1024.0 * 1024.0)
+#define TCP_LISTEN_STATE 0x0A
+#define FIRST_FRAME_SIZE 32    // enough of the first frame to tell a welcome from a rejection
+#define MAX_SERVER_PROCESSES 128    // the wrapper and its chat workers
+
+enum SessionState
+{
+    SESSION_WAITING,    // connect() issued, no frame from the server yet
+    SESSION_JOINED,
+    SESSION_CLOSED
+};
+
+struct ScaleConfig
+{
+    struct sockaddr_storage addr;
+    socklen_t               addr_len;
+    in_port_t               port;
+    int                     steps[MAX_STEPS];
+    int                     step_count;
+    uint32_t                active_percent;    // share of the connections that send room messages
+    uint64_t                rate;              // messages per second over all active connections
+    uint64_t                hold_ms;           // how long each step runs before it is measured
+    size_t                  payload;
+    long                    server_pid;
+    uint64_t                limit_bytes;    // 0, or the most RSS per connection before the run fails
+    const char             *report_path;
+};
+
+// Kept small: at 100k connections this array is the benchmark's own footprint
+struct ScaleSession
+{
+    int      fd;
+    uint8_t  state;
+    uint8_t  input_len;
+    uint8_t  input[FIRST_FRAME_SIZE];
+    uint64_t connect_ns;
+};
+
+struct ScaleSample
+{
+    int              target;
+    int              joined;       // connections the server welcomed and still holds
+    int              rejected;     // turned away as full
+    int              failed;       // refused, reset or never answered
+    int              processes;    // server processes measured: the -p pid, or the wrapper and its chat workers
+    long long        rss_kb;       // summed over them; -1 when no /proc entry is readable
+    long long        heap_kb;      // resident part of the brk heap
+    long long        anon_kb;      // all anonymous memory: heap, mmap'd allocations, thread stacks
+    long long        threads;
+    long long        tcp_sockets;      // system-wide, so both ends of every loopback connection
+    long long        tcp_mem_bytes;    // system-wide TCP buffer memory
+    uint64_t         sent;
+    uint64_t         dropped;    // messages not sent because the socket was full
+    struct Histogram accept;     // connect() to welcome, in nanoseconds
+};
+
+// ----- Function Headers -----
+
+// Argument Parsing
+static void parse_arguments(int argc, char *argv[], struct ScaleConfig *config);
+static void parse_steps(const char *binary_name, char *steps, struct ScaleConfig *config);
+
+// Error Handling
+_Noreturn static void usage(const char *program_name, int exit_code, const char *message);
+
+// Network Handling
+static int  session_open(struct ScaleSession *session, int index);
+static void session_close(struct ScaleSession *session, struct ScaleSample *sample);
+static void session_read(struct ScaleSession *session, struct ScaleSample *sample, uint64_t now);
+static void poll_sessions(int timeout_ms, struct ScaleSample *sample);
+
+// Ramp
+static int  raise_fd_limit(void);
+static int  ramp_to(int target, struct ScaleSample *sample);
+static void hold(struct ScaleSample *sample);
+
+// Measurement
+static int         find_server_pids(in_port_t port, long *pids, int max);
+static long long   read_field_kb(const char *path, const char *field, const char *after);
+static void        read_tcp_sockstat(struct ScaleSample *sample);
+static void        add_reading(long long *total, long long value);
+static void        take_sample(struct ScaleSample *sample);
+static long long   per_connection_bytes(const struct ScaleSample *sample, const struct ScaleSample *baseline);
+static void        print_sample(const struct ScaleSample *sample, const struct ScaleSample *baseline);
+static void        write_report(const struct ScaleSample *samples, int count, const struct ScaleSample *baseline, const char *stop_reason);
+static const char *format_kb(char *out, size_t size, long long kb);
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables)
+static struct ScaleConfig   config;
+static struct ScaleSession *sessions;
+static int                  session_count = 0;    // sessions opened so far, in every state
+static int                  waiting       = 0;    // sessions in SESSION_WAITING
+static int                  epoll_fd;
+// NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables)
+
+// ----- Main Function -----
+
+int main(int argc, char *argv[])
+{
+    struct ScaleSample *samples;
+    struct ScaleSample  baseline;
+    int                 fd_sessions;
+    int                 measured    = 0;
+    int                 exit_code   = EXIT_SUCCESS;
+    const char         *stop_reason = NULL;
+    char                reason[LINE_SIZE];
+    char                server[PATH_SIZE];
+
+    parse_arguments(argc, argv, &config);
+
+
+    fd_sessions = raise_fd_limit();
+    sessions    = (struct ScaleSession *)calloc((size_t)config.steps[config.step_count - 1], sizeof(struct ScaleSession));
+    samples     = (struct ScaleSample *)calloc((size_t)config.step_count, sizeof(struct ScaleSample));
+    epoll_fd    = epoll_create1(EPOLL_CLOEXEC);
+    if(sessions == NULL || samples == NULL || epoll_fd == -1)
+    {
+        perror("setup");
+        return EXIT_FAILURE;
+    }
+
+    memset(&baseline, 0, sizeof(baseline));
+    histogram_reset(&baseline.accept);
+    take_sample(&baseline);
+    if(baseline.processes == 0)
+    {
+        fprintf(stderr, "No process here listens on port %u; server memory will not be measured (use -p)\n", (unsigned)config.port);
+    }
+    if(config.server_pid != 0)
+    {
+        snprintf(server, sizeof(server), "pid %ld", config.server_pid);
+    }
+    else
+    {
+        snprintf(server, sizeof(server), "%d process(es) listening on port %u", baseline.processes, (unsigned)config.port);
+    }
+    printf("server     %s, %u%% of connections sending %" PRIu64 " msg/s in total, %" PRIu64 " s hold per step\n",
+           server,
+           config.active_percent,
+           config.rate,
+           config.hold_ms / 1000);
+    printf("%10s %8s %8s %8s %10s %10s %10s %8s %10s %10s %12s %12s %12s\n",
+           "target",
+           "joined",
+           "rejected",
+           "failed",
+           "rss",
+           "heap",
+           "anon",
+           "threads",
+           "tcp_mem",
+           "rss/conn",
+           "accept_p50us",
+           "accept_p99us",
+           "accept_maxus");
+    print_sample(&baseline, &baseline);
+
+    for(int s = 0; s < config.step_count; ++s)
+    {
+        struct ScaleSample *sample = &samples[s];
+
+        if(config.steps[s] > fd_sessions)
+        {
+            snprintf(reason, sizeof(reason), "the descriptor limit allows %d connections", fd_sessions);
+            stop_reason = reason;
+            break;
+        }
+
+        histogram_reset(&sample->accept);
+        sample->target = config.steps[s];
+        if(s > 0)
+        {
+            sample->joined   = samples[s - 1].joined;
+            sample->rejected = samples[s - 1].rejected;
+            sample->failed   = samples[s - 1].failed;
+        }
+        if(ramp_to(config.steps[s], sample) == -1)
+        {
+            snprintf(reason, sizeof(reason), "could not open more than %d connections", session_count);
+            stop_reason = reason;
+        }
+        hold(sample);
+        take_sample(sample);
+        print_sample(sample, &baseline);
+        measured++;
+
+        if(config.limit_bytes > 0 && per_connection_bytes(sample, &baseline) > (long long)config.limit_bytes)
+        {
+            fprintf(stderr, "RSS per connection is over the %" PRIu64 "-byte limit at %d connections\n", config.limit_bytes, sample->joined);
+            exit_code = EXIT_FAILURE;
+        }
+        if(stop_reason != NULL)
+        {
+            break;
+        }
+        if(stop_reason == NULL && sample->joined < sample->target)
+        {
+            snprintf(reason, sizeof(reason), "the server took %d of %d connections", sample->joined, sample->target);
+            stop_reason = reason;
+            break;
+        }
+    }
+    if(stop_reason != NULL)
+    {
+        printf("stopped    %s\n", stop_reason);
+    }
+
+    if(config.report_path != NULL)
+    {
+        write_report(samples, measured, &baseline, stop_reason);
+    }
+
+    for(int i = 0; i < session_count; ++i)
+    {
+        if(sessions[i].fd != -1)
+        {
+            close(sessions[i].fd);
+        }
+    }
+    close(epoll_fd);
+    free(sessions);
+    free(samples);
+    return exit_code;
+}
+
+// ----- Argument Parsing -----
+
+static void parse_arguments(int argc, char *argv[], struct ScaleConfig *cfg)
+{
+    int   opt;
+    char  default_steps[] = "1000,10000,50000,100000";
+    char *steps           = default_steps;
+
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->active_percent = 10;
+    cfg->rate           = 100;
+    cfg->hold_ms        = 5 * 1000;
+    cfg->payload        = 64;
+    opterr              = 0;
+
+    while((opt = getopt(argc, argv, "hs:a:r:H:S:p:l:o:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'h':
+            {
+                usage(argv[0], EXIT_SUCCESS, NULL);
+            }
+            case 's':
+            {
+                steps = optarg;
+                break;
+            }
+            case 'a':
+            {
+                cfg->active_percent = (uint32_t)bench_parse_number(argv[0], optarg, 100, usage);
+                break;
+            }
+            case 'r':
+            {
+                cfg->rate = bench_parse_number(argv[0], optarg, NANOS_PER_SECOND, usage);
+                break;
+            }
+            case 'H':
+            {
+                cfg->hold_ms = bench_parse_number(argv[0], optarg, UINT32_MAX, usage) * 1000;
+                break;
+            }
+            case 'S':
+            {
+                cfg->payload = (size_t)bench_parse_number(argv[0], optarg, MAX_CONTENT, usage);
+                break;
+            }
+            case 'p':
+            {
+                cfg->server_pid = (long)bench_parse_number(argv[0], optarg, INT32_MAX, usage);
+                break;
+            }
+            case 'l':
+            {
+                cfg->limit_bytes = bench_parse_number(argv[0], optarg, UINT32_MAX, usage);
+                break;
+            }
+            case 'o':
+            {
+                cfg->report_path = optarg;
+                break;
+            }
+            case '?':
+            {
+                char message[UNKNOWN_OPTION_MESSAGE_LEN];
+
+                snprintf(message, sizeof(message), "Unknown option '-%c'.", optopt);
+                usage(argv[0], EXIT_FAILURE, message);
+            }
+            default:
+            {
+                usage(argv[0], EXIT_FAILURE, NULL);
+            }
+        }
+    }
+
+    if(optind + 2 != argc)
+    {
+        usage(argv[0], EXIT_FAILURE, "The ip address and port are required.");
+    }
+    parse_steps(argv[0], steps, cfg);
+    cfg->port = (in_port_t)bench_parse_number(argv[0], argv[optind + 1], UINT16_MAX, usage);
+    bench_convert_address(argv[optind], cfg->port, &cfg->addr, &cfg->addr_len);
+}
+
+// Parses "1000,10000,50000,100000"; every step has to be larger than the one before
+static void parse_steps(const char *binary_name, char *steps, struct ScaleConfig *cfg)
+{
+    char *save = NULL;
+
+    for(char *item = strtok_r(steps, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save))
+    {
+        int step = (int)bench_parse_number(binary_name, item, MAX_SESSIONS, usage);
+
+        if(cfg->step_count == MAX_STEPS || step == 0 || (cfg->step_count > 0 && step <= cfg->steps[cfg->step_count - 1]))
+        {
+            usage(binary_name, EXIT_FAILURE, "Steps are up to 16 increasing connection counts.");
+        }
+        cfg->steps[cfg->step_count++] = step;
+    }
+    if(cfg->step_count == 0)
+    {
+        usage(binary_name, EXIT_FAILURE, "At least one step is required.");
+    }
+}
+
+// ----- Error Handling -----
+
+_Noreturn static void usage(const char *program_name, int exit_code, const char *message)
+{
+    if(message)
+    {
+        fprintf(stderr, "%s\n", message);
+    }
+
+    fprintf(stderr, "Usage: %s [-h] [-s steps] [-a percent] [-r msg/s] [-H seconds] [-S bytes] [-p pid] [-l bytes] [-o report.json] <ip address> <port>\n", program_name);
+    fputs("Options:\n", stderr);
+    fputs(" -h Display this help message\n", stderr);
+    fputs(" -s Connection counts to ramp through (default 1000,10000,50000,100000)\n", stderr);
+    fputs(" -a Percent of connections that send room messages (default 10)\n", stderr);
+    fputs(" -r Messages per second over all sending connections (default 100)\n", stderr);
+    fputs(" -H Seconds to hold each step before measuring it (default 5)\n", stderr);
+    fputs(" -S Message payload in bytes (default 64)\n", stderr);
+    fputs(" -p Server pid (default: the process listening on the port)\n", stderr);
+    fputs(" -l Fail if the server's RSS per connection goes over this many bytes\n", stderr);
+    fputs(" -o Also write the results to this file as JSON\n", stderr);
+    exit(exit_code);
+}
+
+// ----- Network Handling -----
+
+// Starts a non-blocking connect; towards 127.0.0.1 the source address rotates so ephemeral ports do not run out
+static int session_open(struct ScaleSession *session, int index)
+{
+    const struct sockaddr_in *target = (const struct sockaddr_in *)&config.addr;
+    struct epoll_event        event;
+    int                       fd = socket(config.addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+
+    if(fd == -1)
+    {
+        perror("socket");
+        return -1;
+    }
+    if(config.addr.ss_family == AF_INET && ntohl(target->sin_addr.s_addr) == INADDR_LOOPBACK)
+    {
+        struct sockaddr_in source;
+        int                opt = 1;
+
+        memset(&source, 0, sizeof(source));
+        source.sin_family      = AF_INET;
+        source.sin_addr.s_addr = htonl(INADDR_LOOPBACK + (uint32_t)(index / SOURCE_PORTS));
+        setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &opt, sizeof(opt));
+        if(bind(fd, (struct sockaddr *)&source, sizeof(source)) == -1)
+        {
+            perror("bind");
+            close(fd);
+            return -1;
+        }
+    }
+
+    session->connect_ns = bench_now_ns();
+    if(connect(fd, (const struct sockaddr *)&config.addr, config.addr_len) == -1 && errno != EINPROGRESS)
+    {
+        perror("connect");
+        close(fd);
+        return -1;
+    }
+
+    // A failed connect shows up as EPOLLERR, and the welcome as EPOLLIN, so reading is all there is to watch
+    memset(&event, 0, sizeof(event));
+    event.events   = EPOLLIN;
+    event.data.ptr = session;
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+    {
+        perror("epoll_ctl");
+        close(fd);
+        return -1;
+    }
+    session->fd        = fd;
+    session->state     = SESSION_WAITING;
+    session->input_len = 0;
+    return 0;
+}
+
+static void session_close(struct ScaleSession *session, struct ScaleSample *sample)
+{
+    if(session->state == SESSION_WAITING)
+    {
+        sample->failed++;
+        waiting--;
+    }
+    else if(session->state == SESSION_JOINED)
+    {
+        sample->joined--;
+        sample->failed++;
+    }
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, session->fd, NULL);
+    close(session->fd);
+    session->fd    = -1;
+    session->state = SESSION_CLOSED;
+}
+
+// Looks at the start of the first frame to settle a new connection; after that, reads and discards
+static void session_read(struct ScaleSession *session, struct ScaleSample *sample, uint64_t now)
+{
+    char discard[MAX_CONTENT + HEADER_SIZE];
+
+    for(;;)
+    {
+        ssize_t bytes;
+
+        if(session->state == SESSION_WAITING)
+        {
+            bytes = recv(session->fd, session->input + session->input_len, (size_t)(FIRST_FRAME_SIZE - session->input_len), 0);
+        }
+        else
+        {
+            bytes = recv(session->fd, discard, sizeof(discard), 0);
+        }
+        if(bytes == 0 || (bytes == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        {
+            session_close(session, sample);
+            return;
+        }
+        if(bytes == -1)
+        {
+            return;
+        }
+        if(session->state != SESSION_WAITING)
+        {
+            continue;
+        }
+
+        session->input_len = (uint8_t)(session->input_len + bytes);
+        if(session->input_len < FIRST_FRAME_SIZE)
+        {
+            continue;
+        }
+        if(memcmp(session->input + HEADER_SIZE, WELCOME_PREFIX, strlen(WELCOME_PREFIX)) != 0)
+        {
+            // Rejected connections are counted as such; anything else unexpected as failed
+            if(memcmp(session->input + HEADER_SIZE, SERVER_FULL_PREFIX, strlen(SERVER_FULL_PREFIX)) == 0)
+            {
+                sample->rejected++;
+                sample->failed--;
+            }
+            session_close(session, sample);
+            return;
+        }
+        waiting--;
+        session->state = SESSION_JOINED;
+        sample->joined++;
+        histogram_record(&sample->accept, now - session->connect_ns);
+    }
+}
+
+static void poll_sessions(int timeout_ms, struct ScaleSample *sample)
+{
+    struct epoll_event events[EPOLL_BATCH];
+    int                ready_count = epoll_wait(epoll_fd, events, EPOLL_BATCH, timeout_ms);
+    uint64_t           now         = bench_now_ns();
+
+    for(int e = 0; e < ready_count; ++e)
+    {
+        struct ScaleSession *session = (struct ScaleSession *)events[e].data.ptr;
+
+        if(session->fd != -1)
+        {
+            session_read(session, sample, now);
+        }
+    }
+}
+
+// ----- Ramp -----
+
+// Raises the descriptor limit as far as allowed; returns how many connections fit
+static int raise_fd_limit(void)
+{
+    struct rlimit limit;
+
+    if(getrlimit(RLIMIT_NOFILE, &limit) == -1)
+    {
+        return 0;
+    }
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if(getrlimit(RLIMIT_NOFILE, &limit) == -1 || limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur > MAX_SESSIONS + FD_SLACK)
+    {
+        return MAX_SESSIONS;
+    }
+    return limit.rlim_cur > FD_SLACK ? (int)(limit.rlim_cur - FD_SLACK) : 0;
+}
+
+// Opens connections until target have been tried, at most CONNECT_WINDOW awaiting their welcome at a time
+static int ramp_to(int target, struct ScaleSample *sample)
+{
+    uint64_t last_progress = bench_now_ns();
+
+    while(session_count < target || waiting > 0)
+    {
+        int before = waiting;
+
+        while(session_count < target && waiting < CONNECT_WINDOW)
+        {
+            if(session_open(&sessions[session_count], session_count) == -1)
+            {
+                return -1;
+            }
+            session_count++;
+            waiting++;
+        }
+        poll_sessions(1, sample);
+        if(waiting < before || session_count < target)
+        {
+            last_progress = bench_now_ns();
+        }
+        else if(bench_now_ns() - last_progress > SETTLE_TIMEOUT_MS * NANOS_PER_MILLI)
+        {
+            for(int i = 0; i < session_count; ++i)
+            {
+                if(sessions[i].state == SESSION_WAITING)
+                {
+                    session_close(&sessions[i], sample);
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+// Runs the step for hold_ms: the first active_percent of the joined connections send room messages, the rest idle
+static void hold(struct ScaleSample *sample)
+{
+    uint64_t start    = bench_now_ns();
+    uint64_t end      = start + config.hold_ms * NANOS_PER_MILLI;
+    uint64_t interval = config.rate > 0 ? NANOS_PER_SECOND / config.rate : 0;
+    uint64_t next_due = start;
+    int      active   = (int)((uint64_t)session_count * config.active_percent / 100);
+    int      next     = 0;
+    uint8_t  frame[HEADER_SIZE + MAX_CONTENT];
+
+    bench_frame_header(frame, config.payload);
+    memset(frame + HEADER_SIZE, 'x', config.payload);
+    if(interval == 0)
+    {
+        interval = 1;
+    }
+
+    for(;;)
+    {
+        uint64_t now = bench_now_ns();
+
+        if(now >= end)
+        {
+            break;
+        }
+        while(active > 0 && next_due <= now)
+        {
+            struct ScaleSession *session = NULL;
+
+            for(int tries = 0; tries < active && session == NULL; ++tries)
+            {
+                if(sessions[next].state == SESSION_JOINED)
+                {
+                    session = &sessions[next];
+                }
+                next = (next + 1) % active;
+            }
+            if(session == NULL)
+            {
+                break;
+            }
+            if(send(session->fd, frame, HEADER_SIZE + config.payload, MSG_DONTWAIT | MSG_NOSIGNAL) == (ssize_t)(HEADER_SIZE + config.payload))
+            {
+                sample->sent++;
+            }
+            else
+            {
+                sample->dropped++;
+            }
+            next_due += interval;
+        }
+        poll_sessions(1, sample);
+    }
+}
+
+// ----- Measurement -----
+
+// Every process holding a listening socket on the port: the wrapper and, with a pool, each chat worker
+// (SO_REUSEPORT gives every worker its own). Returns how many were found, at most max.
+static int find_server_pids(in_port_t port, long *pids, int max)
+{
+    static const char *const tables[] = {"/proc/net/tcp", "/proc/net/tcp6"};
+    char                     wanted[MAX_SERVER_PROCESSES][PATH_SIZE];
+    int                      sockets = 0;
+    char                     line[LINE_SIZE];
+    DIR                     *proc;
+    const struct dirent     *entry;
+    int                      found = 0;
+
+    for(size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); ++t)
+    {
+        FILE *file = fopen(tables[t], "re");
+
+        if(file == NULL)
+        {
+            continue;
+        }
+        while(sockets < MAX_SERVER_PROCESSES && fgets(line, sizeof(line), file) != NULL)
+        {
+            char          local[PATH_SIZE];
+            const char   *colon;
+            unsigned int  state;
+            unsigned long inode;
+
+            if(sscanf(line, " %*d: %63s %*s %x %*s %*s %*s %*d %*d %lu", local, &state, &inode) != 3 || state != TCP_LISTEN_STATE)
+            {
+                continue;
+            }
+            colon = strrchr(local, ':');
+            if(colon != NULL && strtoul(colon + 1, NULL, BASE_SIXTEEN) == port)
+            {
+                snprintf(wanted[sockets++], sizeof(wanted[0]), "socket:[%lu]", inode);
+            }
+        }
+        fclose(file);
+    }
+    if(sockets == 0)
+    {
+        return 0;
+    }
+
+    proc = opendir("/proc");
+    if(proc == NULL)
+    {
+        return 0;
+    }
+    while(found < max && (entry = readdir(proc)) != NULL)
+    {
+        char                 fd_path[PATH_SIZE + sizeof(entry->d_name)];
+        DIR                 *fds;
+        const struct dirent *fd_entry;
+        int                  holds = 0;
+
+        if(entry->d_name[0] < '0' || entry->d_name[0] > '9')
+        {
+            continue;
+        }
+        snprintf(fd_path, sizeof(fd_path), "/proc/%s/fd", entry->d_name);
+        fds = opendir(fd_path);
+        if(fds == NULL)
+        {
+            continue;
+        }
+        while(!holds && (fd_entry = readdir(fds)) != NULL)
+        {
+            char    link_path[PATH_SIZE + 2 * sizeof(entry->d_name)];
+            char    target[PATH_SIZE];
+            ssize_t length;
+
+            snprintf(link_path, sizeof(link_path), "/proc/%s/fd/%s", entry->d_name, fd_entry->d_name);
+            length = readlink(link_path, target, sizeof(target) - 1);
+            if(length <= 0)
+            {
+                continue;
+            }
+            target[length] = '\0';
+            for(int i = 0; i < sockets && !holds; ++i)
+            {
+                holds = strcmp(target, wanted[i]) == 0;
+            }
+        }
+        closedir(fds);
+        if(holds)
+        {
+            pids[found++] = strtol(entry->d_name, NULL, BASE_TEN);
+        }
+    }
+    closedir(proc);
+    return found;
+}
+
+// Reads "<field> <n> kB" from a /proc file; with after set, only past the first line containing it; -1 if absent
+static long long read_field_kb(const char *path, const char *field, const char *after)
+{
+    FILE     *file = fopen(path, "re");
+    char      line[LINE_SIZE];
+    long long value   = -1;
+    int       started = after == NULL;
+
+    if(file == NULL)
+    {
+        return -1;
+    }
+    while(value == -1 && fgets(line, sizeof(line), file) != NULL)
+    {
+        if(!started)
+        {
+            started = strstr(line, after) != NULL;
+        }
+        else if(strncmp(line, field, strlen(field)) == 0)
+        {
+            value = strtoll(line + strlen(field), NULL, BASE_TEN);
+        }
+    }
+    fclose(file);
+    return value;
+}
+
+// "TCP: inuse N orphan N tw N alloc N mem N", mem in pages
+static void read_tcp_sockstat(struct ScaleSample *sample)
+{
+    FILE     *file = fopen("/proc/net/sockstat", "re");
+    char      line[LINE_SIZE];
+    long long inuse;
+    long long pages;
+
+    sample->tcp_sockets   = -1;
+    sample->tcp_mem_bytes = -1;
+    if(file == NULL)
+    {
+        return;
+    }
+    while(fgets(line, sizeof(line), file) != NULL)
+    {
+        if(sscanf(line, "TCP: inuse %lld orphan %*d tw %*d alloc %*d mem %lld", &inuse, &pages) == 2)
+        {
+            sample->tcp_sockets   = inuse;
+            sample->tcp_mem_bytes = pages * sysconf(_SC_PAGESIZE);
+        }
+    }
+    fclose(file);
+}
+
+// Adds a /proc reading to a total that stays -1 until some process had it
+static void add_reading(long long *total, long long value)
+{
+    if(value >= 0)
+    {
+        *total = (*total < 0 ? 0 : *total) + value;
+    }
+}
+
+// Sums the server's processes; without -p they are looked up again each time, as the pool may have grown or shrunk
+static void take_sample(struct ScaleSample *sample)
+{
+    char path[PATH_SIZE];
+    long pids[MAX_SERVER_PROCESSES];
+    int  count = 1;
+
+    sample->rss_kb  = -1;
+    sample->heap_kb = -1;
+    sample->anon_kb = -1;
+    sample->threads = -1;
+    pids[0]         = config.server_pid;
+    if(config.server_pid == 0)
+    {
+        count = find_server_pids(config.port, pids, MAX_SERVER_PROCESSES);
+    }
+    sample->processes = count;
+    for(int i = 0; i < count; ++i)
+    {
+        snprintf(path, sizeof(path), "/proc/%ld/status", pids[i]);
+        add_reading(&sample->rss_kb, read_field_kb(path, "VmRSS:", NULL));
+
+        // Threads is a plain count, which the same parser reads fine
+        add_reading(&sample->threads, read_field_kb(path, "Threads:", NULL));
+        snprintf(path, sizeof(path), "/proc/%ld/smaps_rollup", pids[i]);
+        add_reading(&sample->anon_kb, read_field_kb(path, "Anonymous:", NULL));
+        snprintf(path, sizeof(path), "/proc/%ld/smaps", pids[i]);
+        add_reading(&sample->heap_kb, read_field_kb(path, "Rss:", "[heap]"));
+    }
+    read_tcp_sockstat(sample);
+}
+
+// RSS the server gained per connection it holds, against the baseline taken before the first connection
+static long long per_connection_bytes(const struct ScaleSample *sample, const struct ScaleSample *baseline)
+{
+    if(sample->joined == 0 || sample->rss_kb < 0 || baseline->rss_kb < 0)
+    {
+        return 0;
+    }
+    return (sample->rss_kb - baseline->rss_kb) * KIB / sample->joined;
+}
+
+static const char *format_kb(char *out, size_t size, long long kb)
+{
+    if(kb < 0)
+    {
+        snprintf(out, size, "n/a");
+    }
+    else
+    {
+        snprintf(out, size, "%.1fM", (double)kb * KIB / MIB);
+    }
+    return out;
+}
+
+static void print_sample(const struct ScaleSample *sample, const struct ScaleSample *baseline)
+{
+    char     rss[PATH_SIZE];
+    char     heap[PATH_SIZE];
+    char     anon[PATH_SIZE];
+    char     tcp_mem[PATH_SIZE];
+    uint64_t p50 = histogram_percentile(&sample->accept, 500);
+    uint64_t p99 = histogram_percentile(&sample->accept, 990);
+
+    printf("%10d %8d %8d %8d %10s %10s %10s %8lld %10s %10lld %12.1f %12.1f %12.1f\n",
+           sample->target,
+           sample->joined,
+           sample->rejected,
+           sample->failed,
+           format_kb(rss, sizeof(rss), sample->rss_kb),
+           format_kb(heap, sizeof(heap), sample->heap_kb),
+           format_kb(anon, sizeof(anon), sample->anon_kb),
+           sample->threads,
+           format_kb(tcp_mem, sizeof(tcp_mem), sample->tcp_mem_bytes < 0 ? -1 : sample->tcp_mem_bytes / KIB),
+           per_connection_bytes(sample, baseline),
+           (double)p50 / (double)NANOS_PER_MICRO,
+           (double)p99 / (double)NANOS_PER_MICRO,
+           (double)sample->accept.max / (double)NANOS_PER_MICRO);
+}
+
+static void write_report(const struct ScaleSample *samples, int count, const struct ScaleSample *baseline, const char *stop_reason)
+{
+    FILE *file = fopen(config.report_path, "we");
+
+    if(file == NULL)
+    {
+        perror(config.report_path);
+        return;
+    }
+    fprintf(file, "{\n  \"tool\": \"connscale\",\n  \"server_pid\": %ld,\n  \"server_processes\": %d,\n  \"active_percent\": %u,\n  \"rate\": %" PRIu64 ",\n  \"hold_seconds\": %" PRIu64 ",\n  \"payload\": %zu,\n",
+            config.server_pid,
+            baseline->processes,
+            config.active_percent,
+            config.rate,
+            config.hold_ms / 1000,
+            config.payload);
+    fprintf(file, "  \"baseline\": {\"rss_kb\": %lld, \"heap_kb\": %lld, \"anon_kb\": %lld, \"threads\": %lld, \"tcp_sockets\": %lld, \"tcp_mem_bytes\": %lld},\n",
+            baseline->rss_kb,
+            baseline->heap_kb,
+            baseline->anon_kb,
+            baseline->threads,
+            baseline->tcp_sockets,
+            baseline->tcp_mem_bytes);
+    fprintf(file, "  \"steps\": [");
+    for(int s = 0; s < count; ++s)
+    {
+        const struct ScaleSample *sample = &samples[s];
+
+        fprintf(file,
+                "%s\n    {\"target\": %d, \"joined\": %d, \"rejected\": %d, \"failed\": %d, \"processes\": %d, \"rss_kb\": %lld, \"heap_kb\": %lld, \"anon_kb\": %lld, \"threads\": %lld, "
+                "\"tcp_sockets\": %lld, \"tcp_mem_bytes\": %lld, \"rss_per_connection\": %lld, \"sent\": %" PRIu64 ", \"dropped\": %" PRIu64 ", "
+                "\"accept_p50_ns\": %" PRIu64 ", \"accept_p99_ns\": %" PRIu64 ", \"accept_max_ns\": %" PRIu64 "}",
+                s == 0 ? "" : ",",
+                sample->target,
+                sample->joined,
+                sample->rejected,
+                sample->failed,
+                sample->processes,
+                sample->rss_kb,
+                sample->heap_kb,
+                sample->anon_kb,
+                sample->threads,
+                sample->tcp_sockets,
+                sample->tcp_mem_bytes,
+                per_connection_bytes(sample, baseline),
+                sample->sent,
+                sample->dropped,
+                histogram_percentile(&sample->accept, 500),
+                histogram_percentile(&sample->accept, 990),
+                sample->accept.max);
+    }
+    fprintf(file, "\n  ],\n  \"stopped\": ");
+    if(stop_reason != NULL)
+    {
+        fprintf(file, "\"%s\"\n}\n", stop_reason);
+    }
+    else
+    {
+        fprintf(file, "null\n}\n");
+    }
+    fclose(file);
+}
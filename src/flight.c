@@ -0,0 +1,309 @@
+#include "../include/flight.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FLIGHT_MAX_THREADS 64
+#define FLIGHT_PATH_SIZE 256
+#define FLIGHT_NANOS_PER_SECOND 1000000000ULL
+#define FLIGHT_FILE_MODE 0644
+
+struct FlightRing
+{
+    struct FlightRecord *records;
+    _Atomic uint64_t     head;    // only the owning thread stores; a dump may read it at any time
+    long                 tid;
+};
+
+struct FlightArgLabels
+{
+    const char *name;
+    const char *a;    // NULL when the argument is unused
+    const char *b;
+};
+
+static const struct FlightArgLabels flight_labels[FLIGHT_EVENT_COUNT] = {
+    {"start",          "port",     NULL        },
+    {"accept",         "slot",     "population"},
+    {"reject",         NULL,       "population"},
+    {"disconnect",     "slot",     "bytes_in"  },
+    {"command",        NULL,       NULL        },
+    {"room_message",   "seq",      "bytes"     },
+    {"direct_message", "to_fd",    "bytes"     },
+    {"resume",         "slot",     "from_seq"  },
+    {"send_error",     "slot",     "errno"     },
+    {"throttled",      "slot",     "frames_in" },
+    {"delivery_skip",  "seq",      NULL        },
+    {"wal_wait",       "seq",      "staged"    },
+    {"stop",           NULL,       "population"},
+    {"stall",          "ms",       NULL        },
+};
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables)
+static struct FlightRing *flight_rings[FLIGHT_MAX_THREADS];
+static _Atomic uint32_t   flight_ring_count = 0;
+static pthread_mutex_t    flight_mutex      = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t           flight_capacity   = 0;
+static char               flight_path[FLIGHT_PATH_SIZE];
+static uint64_t           flight_clock_start;
+static uint64_t           flight_ns_start;
+static int64_t            flight_wall_start_ns;
+
+static _Thread_local struct FlightRing *flight_ring        = NULL;
+static _Thread_local int                flight_unavailable = 0;
+
+// NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables)
+
+static uint64_t flight_timespec_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * FLIGHT_NANOS_PER_SECOND + (uint64_t)ts.tv_nsec;
+}
+
+// The time stamp counter where there is one (a few cycles), CLOCK_MONOTONIC elsewhere
+static uint64_t flight_clock(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return flight_timespec_ns(CLOCK_MONOTONIC);
+#endif
+}
+
+// Function to set where dumps go and how many events each thread keeps (a power of two)
+int flight_init(const char *path, uint32_t events_per_thread)
+{
+    if(events_per_thread == 0 || (events_per_thread & (events_per_thread - 1)) != 0 || strlen(path) >= sizeof(flight_path))
+    {
+        fprintf(stderr, "flight_init: bad path or ring size\n");
+        return -1;
+    }
+    strcpy(flight_path, path);
+    flight_capacity      = events_per_thread;
+    flight_clock_start   = flight_clock();
+    flight_ns_start      = flight_timespec_ns(CLOCK_MONOTONIC);
+    flight_wall_start_ns = (int64_t)flight_timespec_ns(CLOCK_REALTIME);
+    return 0;
+}
+
+static struct FlightRing *flight_register_thread(void)
+{
+    struct FlightRing *ring;
+    uint32_t           count;
+
+    pthread_mutex_lock(&flight_mutex);
+    count = atomic_load_explicit(&flight_ring_count, memory_order_relaxed);
+    if(count == FLIGHT_MAX_THREADS || flight_capacity == 0)
+    {
+        pthread_mutex_unlock(&flight_mutex);
+        return NULL;
+    }
+    ring = (struct FlightRing *)calloc(1, sizeof(struct FlightRing));
+    if(ring != NULL)
+    {
+        ring->records = (struct FlightRecord *)calloc(flight_capacity, sizeof(struct FlightRecord));
+        if(ring->records == NULL)
+        {
+            free(ring);
+            ring = NULL;
+        }
+    }
+    if(ring == NULL)
+    {
+        perror("flight: calloc");
+        pthread_mutex_unlock(&flight_mutex);
+        return NULL;
+    }
+    ring->tid           = syscall(SYS_gettid);
+    flight_rings[count] = ring;
+
+    // A dump only looks at rings it has seen counted, so the slot has to be filled first
+    atomic_store_explicit(&flight_ring_count, count + 1, memory_order_release);
+    pthread_mutex_unlock(&flight_mutex);
+    return ring;
+}
+
+// Function to append one event to this thread's ring, overwriting the oldest
+void flight_record(enum FlightEvent event, int fd, int64_t a, int64_t b)
+{
+    struct FlightRecord *record;
+    uint64_t             head;
+
+    if(flight_ring == NULL)
+    {
+        if(flight_unavailable)
+        {
+            return;
+        }
+        flight_ring        = flight_register_thread();
+        flight_unavailable = flight_ring == NULL;
+        if(flight_ring == NULL)
+        {
+            return;
+        }
+    }
+
+    head          = atomic_load_explicit(&flight_ring->head, memory_order_relaxed);
+    record        = &flight_ring->records[head & (flight_capacity - 1)];
+    record->clock = flight_clock();
+    record->event = (uint16_t)event;
+    record->fd    = fd;
+    record->a     = a;
+    record->b     = b;
+    atomic_store_explicit(&flight_ring->head, head + 1, memory_order_release);
+}
+
+// Packs the first 8 characters of a command name into an event argument
+int64_t flight_pack_name(const char *name)
+{
+    char    packed[sizeof(int64_t)] = {0};
+    int64_t value;
+
+    for(size_t i = 0; i < sizeof(packed) && name[i] != '\0'; ++i)
+    {
+        packed[i] = name[i];
+    }
+    memcpy(&value, packed, sizeof(value));
+    return value;
+}
+
+static int flight_write_all(int fd, const void *data, size_t len)
+{
+    const char *bytes = (const char *)data;
+
+    while(len > 0)
+    {
+        ssize_t written = write(fd, bytes, len);
+
+        if(written == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        bytes += written;
+        len -= (size_t)written;
+    }
+    return 0;
+}
+
+// Function to write every ring to the dump file; async-signal-safe, so usable from any signal handler
+int flight_dump(int signum)
+{
+    struct FlightDumpHeader header;
+    uint32_t                threads     = atomic_load_explicit(&flight_ring_count, memory_order_acquire);
+    int                     saved_errno = errno;
+    int                     result      = 0;
+    int                     fd;
+
+    if(flight_capacity == 0)
+    {
+        return -1;
+    }
+    fd = open(flight_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, FLIGHT_FILE_MODE);
+    if(fd == -1)
+    {
+        errno = saved_errno;
+        return -1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FLIGHT_MAGIC, sizeof(header.magic));
+    header.version           = FLIGHT_VERSION;
+    header.threads           = threads;
+    header.events_per_thread = flight_capacity;
+    header.signal            = signum;
+    header.pid               = (int64_t)getpid();
+    header.clock_start       = flight_clock_start;
+    header.ns_start          = flight_ns_start;
+    header.clock_dump        = flight_clock();
+    header.ns_dump           = flight_timespec_ns(CLOCK_MONOTONIC);
+    header.wall_start_ns     = flight_wall_start_ns;
+    if(flight_write_all(fd, &header, sizeof(header)) == -1)
+    {
+        result = -1;
+    }
+
+    // Threads keep recording meanwhile; the decoder drops records torn by that
+    for(uint32_t t = 0; t < threads && result == 0; ++t)
+    {
+        const struct FlightRing  *ring = flight_rings[t];
+        struct FlightThreadHeader thread_header;
+
+        thread_header.tid  = ring->tid;
+        thread_header.head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if(flight_write_all(fd, &thread_header, sizeof(thread_header)) == -1 || flight_write_all(fd, ring->records, flight_capacity * sizeof(struct FlightRecord)) == -1)
+        {
+            result = -1;
+        }
+    }
+
+    if(close(fd) == -1)
+    {
+        result = -1;
+    }
+    errno = saved_errno;
+    return result;
+}
+
+const char *flight_event_name(uint16_t event)
+{
+    return event < FLIGHT_EVENT_COUNT ? flight_labels[event].name : "unknown";
+}
+
+// Function to describe an event's arguments, e.g. "slot 3 population 4"
+size_t flight_format_args(char *out, size_t size, const struct FlightRecord *record)
+{
+    const struct FlightArgLabels *labels;
+    int                           written = 0;
+
+    if(size == 0)
+    {
+        return 0;
+    }
+    out[0] = '\0';
+    if(record->event >= FLIGHT_EVENT_COUNT)
+    {
+        written = snprintf(out, size, "a %" PRId64 " b %" PRId64, record->a, record->b);
+    }
+    else if(record->event == FLIGHT_COMMAND)
+    {
+        char name[sizeof(int64_t) + 1] = {0};
+
+        memcpy(name, &record->a, sizeof(record->a));
+        written = snprintf(out, size, "/%s", name);
+    }
+    else
+    {
+        labels = &flight_labels[record->event];
+        if(labels->a != NULL && labels->b != NULL)
+        {
+            written = snprintf(out, size, "%s %" PRId64 " %s %" PRId64, labels->a, record->a, labels->b, record->b);
+        }
+        else if(labels->a != NULL)
+        {
+            written = snprintf(out, size, "%s %" PRId64, labels->a, record->a);
+        }
+        else if(labels->b != NULL)
+        {
+            written = snprintf(out, size, "%s %" PRId64, labels->b, record->b);
+        }
+    }
+    if(written < 0)
+    {
+        return 0;
+    }
+    return (size_t)written < size ? (size_t)written : size - 1;
+}
@@ -0,0 +1,168 @@
+#include "../include/flight.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Reads a flight recorder dump and prints its events, oldest first, across all threads
+
+#define NANOS_PER_SECOND INT64_C(1000000000)
+#define NANOS_PER_MICRO INT64_C(1000)
+#define ARGS_SIZE 128
+#define TIME_SIZE 64
+
+struct DecodedEvent
+{
+    int64_t             ns;    // CLOCK_MONOTONIC
+    int64_t             tid;
+    struct FlightRecord record;
+};
+
+static int compare_events(const void *lhs, const void *rhs)
+{
+    const struct DecodedEvent *left  = (const struct DecodedEvent *)lhs;
+    const struct DecodedEvent *right = (const struct DecodedEvent *)rhs;
+
+    if(left->ns != right->ns)
+    {
+        return left->ns < right->ns ? -1 : 1;
+    }
+    return 0;
+}
+
+// Turns a flight_clock() reading into CLOCK_MONOTONIC nanoseconds using the two reference points in the header
+static int64_t clock_to_ns(const struct FlightDumpHeader *header, uint64_t clock)
+{
+    long double ticks = (long double)(header->clock_dump - header->clock_start);
+    long double nanos = (long double)(header->ns_dump - header->ns_start);
+    long double scale = ticks > 0 ? nanos / ticks : 1.0L;
+
+    return (int64_t)header->ns_start + (int64_t)(((long double)clock - (long double)header->clock_start) * scale);
+}
+
+// Writes the UTC date and time with microseconds; a date that does not fit leaves out empty
+static void format_wall_time(char *out, size_t size, int64_t wall_ns)
+{
+    time_t    seconds = (time_t)(wall_ns / NANOS_PER_SECOND);
+    struct tm tm;
+    size_t    len;
+    int       written;
+
+    gmtime_r(&seconds, &tm);
+    len = strftime(out, size, "%Y-%m-%d %H:%M:%S", &tm);
+    if(len == 0)
+    {
+        out[0] = '\0';
+        return;
+    }
+    written = snprintf(out + len, size - len, ".%06lld", (long long)(wall_ns % NANOS_PER_SECOND / NANOS_PER_MICRO));
+    if(written < 0 || (size_t)written >= size - len)
+    {
+        out[len] = '\0';    // keep the whole seconds rather than a cut fraction
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    FILE                   *file;
+    struct FlightDumpHeader header;
+    struct DecodedEvent    *events;
+    size_t                  count = 0;
+    struct FlightRecord    *ring;
+    char                    when[TIME_SIZE];
+
+    if(argc != 2)
+    {
+        fprintf(stderr, "Usage: %s <groupchat-flight-PORT.bin>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    file = fopen(argv[1], "rbe");
+    if(file == NULL)
+    {
+        perror("fopen");
+        return EXIT_FAILURE;
+    }
+    if(fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, FLIGHT_MAGIC, sizeof(header.magic)) != 0 || header.version != FLIGHT_VERSION || header.events_per_thread == 0)
+    {
+        fprintf(stderr, "%s: not a flight recorder dump\n", argv[1]);
+        fclose(file);
+        return EXIT_FAILURE;
+    }
+
+    events = (struct DecodedEvent *)calloc((size_t)header.threads * header.events_per_thread + 1, sizeof(struct DecodedEvent));
+    ring   = (struct FlightRecord *)calloc(header.events_per_thread, sizeof(struct FlightRecord));
+    if(events == NULL || ring == NULL)
+    {
+        perror("calloc");
+        free(events);
+        free(ring);
+        fclose(file);
+        return EXIT_FAILURE;
+    }
+
+    for(uint32_t t = 0; t < header.threads; ++t)
+    {
+        struct FlightThreadHeader thread_header;
+        uint64_t                  oldest;
+
+        if(fread(&thread_header, sizeof(thread_header), 1, file) != 1 || fread(ring, sizeof(struct FlightRecord), header.events_per_thread, file) != header.events_per_thread)
+        {
+            fprintf(stderr, "%s: truncated after %u of %u threads\n", argv[1], t, header.threads);
+            break;
+        }
+
+        // The oldest slot may have been overwritten while the dump ran, so it is left out
+        oldest = thread_header.head > header.events_per_thread ? thread_header.head - header.events_per_thread + 1 : 0;
+        for(uint64_t i = oldest; i < thread_header.head; ++i)
+        {
+            const struct FlightRecord *record = &ring[i % header.events_per_thread];
+
+            if(record->clock == 0 || record->event >= FLIGHT_EVENT_COUNT)
+            {
+                continue;
+            }
+            events[count].ns     = clock_to_ns(&header, record->clock);
+            events[count].tid    = thread_header.tid;
+            events[count].record = *record;
+            count++;
+        }
+    }
+    fclose(file);
+    qsort(events, count, sizeof(struct DecodedEvent), compare_events);
+
+    format_wall_time(when, sizeof(when), header.wall_start_ns + (int64_t)(header.ns_dump - header.ns_start));
+    printf("Flight recorder dump of pid %" PRId64 " at %s UTC", header.pid, when);
+    if(header.signal != 0)
+    {
+        printf(" on signal %d (%s)", header.signal, strsignal(header.signal));
+    }
+    printf(": %zu events from %u threads\n", count, header.threads);
+
+    for(size_t i = 0; i < count; ++i)
+    {
+        char    args[ARGS_SIZE];
+        int64_t before_dump = (int64_t)header.ns_dump - events[i].ns;
+
+        // Recorded while the dump was being written
+        if(before_dump < 0)
+        {
+            before_dump = 0;
+        }
+        format_wall_time(when, sizeof(when), header.wall_start_ns + (events[i].ns - (int64_t)header.ns_start));
+        flight_format_args(args, sizeof(args), &events[i].record);
+        printf("%s  -%" PRId64 ".%06" PRId64 "s  tid %-7" PRId64 " %-15s fd %-4d %s\n",
+               when,
+               before_dump / NANOS_PER_SECOND,
+               before_dump % NANOS_PER_SECOND / NANOS_PER_MICRO,
+               events[i].tid,
+               flight_event_name(events[i].record.event),
+               events[i].record.fd,
+               args);
+    }
+
+    free(ring);
+    free(events);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,121 @@
+#include "../include/handoff.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define HANDOFF_MILLIS_PER_SECOND 1000
+#define HANDOFF_MICROS_PER_MILLI 1000
+
+// Function to make a connected pair of handoff endpoints
+int handoff_channel(int fds[2])
+{
+    if(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) == -1)
+    {
+        perror("handoff_channel: socketpair");
+        return -1;
+    }
+    return 0;
+}
+
+int handoff_set_timeout(int channel, int timeout_ms)
+{
+    struct timeval timeout;
+
+    timeout.tv_sec  = timeout_ms / HANDOFF_MILLIS_PER_SECOND;
+    timeout.tv_usec = (suseconds_t)(timeout_ms % HANDOFF_MILLIS_PER_SECOND) * HANDOFF_MICROS_PER_MILLI;
+    return setsockopt(channel, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+}
+
+// Function to send one record; fd -1 sends no descriptor. The descriptor stays open on this side.
+int handoff_send(int channel, uint32_t kind, const void *payload, size_t len, int fd)
+{
+    struct msghdr   msg;
+    struct iovec    iov[2];
+    struct cmsghdr *cmsg;
+    char            control[CMSG_SPACE(sizeof(int))];
+
+    if(len > HANDOFF_RECORD_MAX)
+    {
+        fprintf(stderr, "handoff_send: record too large\n");
+        return -1;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    iov[0].iov_base = &kind;
+    iov[0].iov_len  = sizeof(kind);
+    iov[1].iov_base = (void *)(uintptr_t)payload;
+    iov[1].iov_len  = len;
+    msg.msg_iov     = iov;
+    msg.msg_iovlen  = len > 0 ? 2 : 1;
+    if(fd != -1)
+    {
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+        cmsg               = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level   = SOL_SOCKET;
+        cmsg->cmsg_type    = SCM_RIGHTS;
+        cmsg->cmsg_len     = CMSG_LEN(sizeof(fd));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(fd));
+    }
+
+    if(sendmsg(channel, &msg, MSG_NOSIGNAL) == -1)
+    {
+        perror("handoff_send: sendmsg");
+        return -1;
+    }
+    return 0;
+}
+
+// Function to receive one record into payload; *fd is the descriptor that came with it, or -1.
+// Returns the payload length, or -1 on a closed channel, a timeout or a malformed record.
+ssize_t handoff_recv(int channel, uint32_t *kind, void *payload, size_t size, int *fd)
+{
+    struct msghdr   msg;
+    struct iovec    iov[2];
+    struct cmsghdr *cmsg;
+    char            control[CMSG_SPACE(sizeof(int))];
+    ssize_t         received;
+
+    *fd = -1;
+    memset(&msg, 0, sizeof(msg));
+    iov[0].iov_base    = kind;
+    iov[0].iov_len     = sizeof(*kind);
+    iov[1].iov_base    = payload;
+    iov[1].iov_len     = size;
+    msg.msg_iov        = iov;
+    msg.msg_iovlen     = 2;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+
+    do
+    {
+        received = recvmsg(channel, &msg, MSG_CMSG_CLOEXEC);
+    } while(received == -1 && errno == EINTR);
+
+    for(cmsg = CMSG_FIRSTHDR(&msg); received > 0 && cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+        {
+            memcpy(fd, CMSG_DATA(cmsg), sizeof(*fd));
+        }
+    }
+
+    if(received < (ssize_t)sizeof(*kind) || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) != 0)
+    {
+        if(received == -1)
+        {
+            perror("handoff_recv: recvmsg");
+        }
+        if(*fd != -1)
+        {
+            close(*fd);
+            *fd = -1;
+        }
+        return -1;
+    }
+    return received - (ssize_t)sizeof(*kind);
+}
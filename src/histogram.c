@@ -0,0 +1,97 @@
+#include "../include/histogram.h"
+#include <string.h>
+
+// Bucket of a value: exact below HISTOGRAM_SUB_BUCKETS, then HISTOGRAM_SUB_BUCKETS per power of two
+uint32_t histogram_bucket(uint64_t value)
+{
+    uint32_t exponent;
+
+    if(value < HISTOGRAM_SUB_BUCKETS)
+    {
+        return (uint32_t)value;
+    }
+    exponent = 63U - (uint32_t)__builtin_clzll(value);
+    return (exponent - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS + (uint32_t)((value >> (exponent - HISTOGRAM_SUB_BUCKET_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+// Largest value that falls in a bucket
+uint64_t histogram_bucket_top(uint32_t bucket)
+{
+    uint32_t exponent;
+    uint64_t sub;
+
+    if(bucket < HISTOGRAM_SUB_BUCKETS)
+    {
+        return bucket;
+    }
+    exponent = bucket / HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKET_BITS - 1;
+    sub      = HISTOGRAM_SUB_BUCKETS + bucket % HISTOGRAM_SUB_BUCKETS;
+    return ((sub + 1) << (exponent - HISTOGRAM_SUB_BUCKET_BITS)) - 1;
+}
+
+void histogram_reset(struct Histogram *histogram)
+{
+    memset(histogram, 0, sizeof(*histogram));
+    histogram->min = UINT64_MAX;
+}
+
+void histogram_record(struct Histogram *histogram, uint64_t value)
+{
+    histogram->buckets[histogram_bucket(value)]++;
+    histogram->count++;
+    histogram->sum += value;
+    if(value < histogram->min)
+    {
+        histogram->min = value;
+    }
+    if(value > histogram->max)
+    {
+        histogram->max = value;
+    }
+}
+
+void histogram_merge(struct Histogram *into, const struct Histogram *from)
+{
+    for(uint32_t b = 0; b < HISTOGRAM_BUCKETS; ++b)
+    {
+        into->buckets[b] += from->buckets[b];
+    }
+    into->count += from->count;
+    into->sum += from->sum;
+    if(from->min < into->min)
+    {
+        into->min = from->min;
+    }
+    if(from->max > into->max)
+    {
+        into->max = from->max;
+    }
+}
+
+// Function to get the value at a percentile given in tenths of a percent (990 = p99); 0 when empty
+uint64_t histogram_percentile(const struct Histogram *histogram, uint32_t permille)
+{
+    uint64_t rank = (histogram->count * permille + 999) / 1000;
+    uint64_t seen = 0;
+
+    if(histogram->count == 0)
+    {
+        return 0;
+    }
+    for(uint32_t b = 0; b < HISTOGRAM_BUCKETS; ++b)
+    {
+        seen += histogram->buckets[b];
+        if(histogram->buckets[b] != 0 && seen >= rank)
+        {
+            uint64_t top = histogram_bucket_top(b);
+
+            return top < histogram->max ? top : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+uint64_t histogram_mean(const struct Histogram *histogram)
+{
+    return histogram->count > 0 ? histogram->sum / histogram->count : 0;
+}
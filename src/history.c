@@ -0,0 +1,268 @@
+#include "../include/history.h"
+#include "../include/metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define HISTORY_NANOS_PER_SECOND 1000000000ULL
+
+struct HistoryEntry
+{
+    uint64_t seq;
+    uint64_t stamp_ns;
+    size_t   offset;
+    size_t   len;
+    size_t   header_len;
+};
+
+// The valid bytes are either one run [oldest.offset, head) or, after a wrap,
+// an older run [oldest.offset, wrap_end) followed by [0, head).
+// NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables)
+static uint8_t             *history_data     = NULL;
+static size_t               history_capacity = 0;
+static size_t               history_head     = 0;
+static size_t               history_wrap_end = 0;
+static struct HistoryEntry *history_entries  = NULL;
+static size_t               history_max      = 0;
+static size_t               history_first    = 0;
+static size_t               history_count    = 0;
+static size_t               history_used     = 0;
+static uint64_t             history_evicted  = 0;
+
+// NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables)
+
+static uint64_t history_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * HISTORY_NANOS_PER_SECOND + (uint64_t)ts.tv_nsec;
+}
+
+// Function to allocate the ring up front; nothing is allocated after this
+int history_init(size_t capacity_bytes, size_t max_entries)
+{
+    history_data    = (uint8_t *)malloc(capacity_bytes);
+    history_entries = (struct HistoryEntry *)calloc(max_entries, sizeof(struct HistoryEntry));
+    if(history_data == NULL || history_entries == NULL)
+    {
+        perror("history_init: allocation failed");
+        history_free();
+        return -1;
+    }
+
+    history_capacity = capacity_bytes;
+    history_max      = max_entries;
+    history_head     = 0;
+    history_wrap_end = 0;
+    history_first    = 0;
+    history_count    = 0;
+    history_used     = 0;
+    return 0;
+}
+
+void history_free(void)
+{
+    free(history_data);
+    free(history_entries);
+    history_data     = NULL;
+    history_entries  = NULL;
+    history_capacity = 0;
+    history_max      = 0;
+    history_count    = 0;
+}
+
+static const struct HistoryEntry *history_oldest(void)
+{
+    return &history_entries[history_first];
+}
+
+static void history_evict_oldest(void)
+{
+    history_used -= history_entries[history_first].len;
+    history_first = (history_first + 1) % history_max;
+    history_count--;
+    history_evicted++;
+    metrics_add(METRIC_HISTORY_EVICTIONS, 1);
+}
+
+// Function to remember one encoded room frame
+void history_append(uint64_t seq, const uint8_t *header, size_t header_len, const char *payload, size_t payload_len)
+{
+    struct HistoryEntry *entry;
+    size_t               len = header_len + payload_len;
+
+    if(history_data == NULL || len > history_capacity)
+    {
+        return;
+    }
+
+    // No room before the end: drop what is left of the previous lap and start over at 0
+    if(history_head + len > history_capacity)
+    {
+        while(history_count > 0 && history_oldest()->offset >= history_head)
+        {
+            history_evict_oldest();
+        }
+        history_wrap_end = history_head;
+        history_head     = 0;
+    }
+
+    // Make room for the frame itself and for its index entry
+    while(history_count > 0 && history_oldest()->offset >= history_head && history_oldest()->offset < history_head + len)
+    {
+        history_evict_oldest();
+    }
+    if(history_count == history_max)
+    {
+        history_evict_oldest();
+    }
+
+    memcpy(history_data + history_head, header, header_len);
+    memcpy(history_data + history_head + header_len, payload, payload_len);
+
+    entry           = &history_entries[(history_first + history_count) % history_max];
+    entry->seq        = seq;
+    entry->stamp_ns   = history_now_ns();
+    entry->offset     = history_head;
+    entry->len        = len;
+    entry->header_len = header_len;
+    history_count++;
+    history_used += len;
+    history_head += len;
+}
+
+static const struct HistoryEntry *history_at(size_t index)
+{
+    return &history_entries[(history_first + index) % history_max];
+}
+
+// Describes entries first..last (indices from the oldest) as up to two byte ranges inside the ring
+static void history_describe(size_t first, size_t last, struct iovec iov[HISTORY_SEGMENTS], int *iov_count)
+{
+    const struct HistoryEntry *start = history_at(first);
+    const struct HistoryEntry *end   = history_at(last);
+
+    iov[0].iov_base = history_data + start->offset;
+    if(start->offset <= end->offset)
+    {
+        iov[0].iov_len = end->offset + end->len - start->offset;
+        *iov_count     = 1;
+    }
+    else
+    {
+        iov[0].iov_len  = history_wrap_end - start->offset;
+        iov[1].iov_base = history_data;
+        iov[1].iov_len  = end->offset + end->len;
+        *iov_count      = 2;
+    }
+}
+
+// Index one past the newest entry numbered last_seq or lower
+static size_t history_end_at(uint64_t last_seq)
+{
+    size_t end = history_count;
+
+    while(end > 0 && history_at(end - 1)->seq > last_seq)
+    {
+        end--;
+    }
+    return end;
+}
+
+// Function to select the newest frames up to last_seq (at most max_messages, none older than max_age_seconds).
+// Returns how many frames were selected; first_seq gets the sequence number of the first.
+size_t history_select(size_t max_messages, uint64_t max_age_seconds, uint64_t last_seq, struct iovec iov[HISTORY_SEGMENTS], int *iov_count, uint64_t *first_seq)
+{
+    uint64_t cutoff = 0;
+    uint64_t now    = history_now_ns();
+    size_t   end    = history_end_at(last_seq);
+    size_t   start  = end;
+
+    *iov_count = 0;
+    if(max_age_seconds * HISTORY_NANOS_PER_SECOND < now)
+    {
+        cutoff = now - max_age_seconds * HISTORY_NANOS_PER_SECOND;
+    }
+
+    while(start > 0 && end - start < max_messages && history_at(start - 1)->stamp_ns >= cutoff)
+    {
+        start--;
+    }
+    if(start == end)
+    {
+        return 0;
+    }
+    *first_seq = history_at(start)->seq;
+    history_describe(start, end - 1, iov, iov_count);
+    return end - start;
+}
+
+// Function to select every remembered frame numbered first_seq..last_seq
+size_t history_select_range(uint64_t first_seq, uint64_t last_seq, struct iovec iov[HISTORY_SEGMENTS], int *iov_count)
+{
+    size_t end   = history_end_at(last_seq);
+    size_t start = end;
+
+    *iov_count = 0;
+    while(start > 0 && history_at(start - 1)->seq >= first_seq)
+    {
+        start--;
+    }
+    if(start == end)
+    {
+        return 0;
+    }
+    history_describe(start, end - 1, iov, iov_count);
+    return end - start;
+}
+
+// Function to copy the content of frame seq (without its header) into out, if it is still remembered
+int history_lookup(uint64_t seq, char *out, size_t out_size)
+{
+    size_t low  = 0;
+    size_t high = history_count;
+
+    // Entries are in sequence order, but appends may have been skipped
+    while(low < high)
+    {
+        size_t                     mid   = low + (high - low) / 2;
+        const struct HistoryEntry *entry = &history_entries[(history_first + mid) % history_max];
+
+        if(entry->seq < seq)
+        {
+            low = mid + 1;
+        }
+        else if(entry->seq > seq)
+        {
+            high = mid;
+        }
+        else
+        {
+            size_t len = entry->len - entry->header_len;
+            if(len >= out_size)
+            {
+                len = out_size - 1;
+            }
+            memcpy(out, history_data + entry->offset + entry->header_len, len);
+            out[len] = '\0';
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void history_get_stats(struct HistoryStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->capacity_bytes = history_capacity;
+    stats->used_bytes     = history_used;
+    stats->entries        = history_count;
+    stats->evicted        = history_evicted;
+    if(history_count > 0)
+    {
+        stats->oldest_seq = history_entries[history_first].seq;
+        stats->newest_seq = history_entries[(history_first + history_count - 1) % history_max].seq;
+    }
+}
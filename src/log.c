@@ -0,0 +1,673 @@
+#include "../include/log.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_RING_BYTES (1U << 20)    // per thread, power of two
+#define LOG_MAX_THREADS 64
+#define LOG_MAX_ARGS 8
+#define LOG_MAX_STRING 2048           // longer string arguments are cut
+#define LOG_SPEC_SIZE 32
+#define LOG_OUTPUT_BYTES (64 * 1024)
+#define LOG_LINE_BYTES 4096
+#define LOG_IDLE_SLEEP_NS 1000000L    // consumer poll interval when every ring is empty
+#define LOG_NANOS_PER_SECOND 1000000000ULL
+#define LOG_CACHE_LINE 64
+#define LOG_SKIP_TO_START 0           // record format of a wrap marker
+
+enum LogArgClass
+{
+    LOG_ARG_NONE,    // %%
+    LOG_ARG_SIGNED,
+    LOG_ARG_UNSIGNED,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_STRING,
+    LOG_ARG_POINTER
+};
+
+enum LogArgLength
+{
+    LOG_LEN_INT,
+    LOG_LEN_LONG,
+    LOG_LEN_LLONG,
+    LOG_LEN_SIZE,
+    LOG_LEN_MAX,
+    LOG_LEN_PTRDIFF
+};
+
+struct LogSpec
+{
+    const char       *start;    // the '%'
+    size_t            len;      // through the conversion character
+    enum LogArgClass  arg_class;
+    enum LogArgLength length;
+    size_t            precision;    // ".N" of a string conversion, else LOG_MAX_STRING
+};
+
+struct LogRecord
+{
+    uint32_t    size;    // whole record including strings, multiple of 8
+    uint8_t     level;
+    uint8_t     nargs;
+    uint64_t    stamp_ns;
+    const char *format;    // NULL marks the rest of the ring as unused (wrap)
+    uint64_t    args[LOG_MAX_ARGS];
+    // string arguments follow; a string arg holds (offset << 32) | length
+};
+
+struct LogRing
+{
+    _Alignas(LOG_CACHE_LINE) _Atomic uint64_t head;    // written by the owning thread
+    _Alignas(LOG_CACHE_LINE) _Atomic uint64_t tail;    // written by the consumer
+    _Alignas(LOG_CACHE_LINE) uint8_t data[LOG_RING_BYTES];
+};
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables)
+static struct LogRing        *log_rings[LOG_MAX_THREADS];
+static _Atomic int            log_ring_count = 0;
+static pthread_mutex_t        log_register_mutex = PTHREAD_MUTEX_INITIALIZER;
+static _Thread_local struct LogRing *log_thread_ring = NULL;
+static _Atomic int            log_running   = 0;
+static _Atomic int            log_min_level = LOG_LEVEL_DEBUG;
+static _Atomic uint64_t       log_drop_count = 0;
+static pthread_t              log_thread;
+
+// NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables)
+
+static uint64_t log_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * LOG_NANOS_PER_SECOND + (uint64_t)ts.tv_nsec;
+}
+
+// Parses the conversion at p (just past text, pointing at '%'); returns the character after it
+static const char *log_parse_spec(const char *p, struct LogSpec *spec)
+{
+    spec->start     = p++;
+    spec->length    = LOG_LEN_INT;
+    spec->arg_class = LOG_ARG_NONE;
+    spec->precision = LOG_MAX_STRING;
+
+    while(*p != '\0' && strchr("-+ #0", *p) != NULL)
+    {
+        p++;
+    }
+    while(*p >= '0' && *p <= '9')
+    {
+        p++;
+    }
+    if(*p == '.')
+    {
+        spec->precision = 0;
+        for(p++; *p >= '0' && *p <= '9'; p++)
+        {
+            if(spec->precision < LOG_MAX_STRING)
+            {
+                spec->precision = spec->precision * 10 + (size_t)(*p - '0');
+            }
+        }
+        if(spec->precision > LOG_MAX_STRING)
+        {
+            spec->precision = LOG_MAX_STRING;
+        }
+    }
+
+    switch(*p)
+    {
+        case 'h':
+            p += (p[1] == 'h') ? 2 : 1;
+            break;
+        case 'l':
+            spec->length = (p[1] == 'l') ? LOG_LEN_LLONG : LOG_LEN_LONG;
+            p += (p[1] == 'l') ? 2 : 1;
+            break;
+        case 'z':
+            spec->length = LOG_LEN_SIZE;
+            p++;
+            break;
+        case 'j':
+            spec->length = LOG_LEN_MAX;
+            p++;
+            break;
+        case 't':
+            spec->length = LOG_LEN_PTRDIFF;
+            p++;
+            break;
+        default:
+            break;
+    }
+
+    switch(*p)
+    {
+        case 'd':
+        case 'i':
+        case 'c':
+            spec->arg_class = LOG_ARG_SIGNED;
+            break;
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+            spec->arg_class = LOG_ARG_UNSIGNED;
+            break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            spec->arg_class = LOG_ARG_DOUBLE;
+            break;
+        case 's':
+            spec->arg_class = LOG_ARG_STRING;
+            break;
+        case 'p':
+            spec->arg_class = LOG_ARG_POINTER;
+            break;
+        default:
+            break;
+    }
+    if(*p != '\0')
+    {
+        p++;
+    }
+    spec->len = (size_t)(p - spec->start);
+    return p;
+}
+
+static uint64_t log_fetch_signed(va_list *ap, enum LogArgLength length)
+{
+    switch(length)
+    {
+        case LOG_LEN_LONG:
+            return (uint64_t)va_arg(*ap, long);
+        case LOG_LEN_LLONG:
+            return (uint64_t)va_arg(*ap, long long);
+        case LOG_LEN_SIZE:
+            return (uint64_t)va_arg(*ap, ssize_t);
+        case LOG_LEN_MAX:
+            return (uint64_t)va_arg(*ap, intmax_t);
+        case LOG_LEN_PTRDIFF:
+            return (uint64_t)va_arg(*ap, ptrdiff_t);
+        case LOG_LEN_INT:
+        default:
+            return (uint64_t)(int64_t)va_arg(*ap, int);
+    }
+}
+
+static uint64_t log_fetch_unsigned(va_list *ap, enum LogArgLength length)
+{
+    switch(length)
+    {
+        case LOG_LEN_LONG:
+            return va_arg(*ap, unsigned long);
+        case LOG_LEN_LLONG:
+            return va_arg(*ap, unsigned long long);
+        case LOG_LEN_SIZE:
+            return va_arg(*ap, size_t);
+        case LOG_LEN_MAX:
+            return va_arg(*ap, uintmax_t);
+        case LOG_LEN_PTRDIFF:
+            return (uint64_t)va_arg(*ap, ptrdiff_t);
+        case LOG_LEN_INT:
+        default:
+            return va_arg(*ap, unsigned int);
+    }
+}
+
+static struct LogRing *log_register_thread(void)
+{
+    struct LogRing *ring;
+    int             index;
+
+    pthread_mutex_lock(&log_register_mutex);
+    index = atomic_load_explicit(&log_ring_count, memory_order_relaxed);
+    if(index == LOG_MAX_THREADS)
+    {
+        pthread_mutex_unlock(&log_register_mutex);
+        return NULL;
+    }
+    ring = (struct LogRing *)aligned_alloc(LOG_CACHE_LINE, sizeof(struct LogRing));
+    if(ring != NULL)
+    {
+        atomic_init(&ring->head, 0);
+        atomic_init(&ring->tail, 0);
+        log_rings[index] = ring;
+        atomic_store_explicit(&log_ring_count, index + 1, memory_order_release);
+    }
+    pthread_mutex_unlock(&log_register_mutex);
+    return ring;
+}
+
+// Reserves size contiguous bytes in the ring, wrapping with a marker if needed; NULL when full
+static struct LogRecord *log_reserve(struct LogRing *ring, uint32_t size, uint64_t *new_head)
+{
+    uint64_t head     = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t tail     = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t   position = (size_t)(head & (LOG_RING_BYTES - 1));
+    size_t   to_end   = LOG_RING_BYTES - position;
+    uint64_t needed   = size;
+
+    // A record never straddles the end; the tail of the ring is skipped instead
+    if(to_end < size)
+    {
+        needed += to_end;
+    }
+    if(LOG_RING_BYTES - (head - tail) < needed)
+    {
+        return NULL;
+    }
+
+    if(to_end < size)
+    {
+        if(to_end >= sizeof(struct LogRecord))
+        {
+            struct LogRecord *marker = (struct LogRecord *)(void *)(ring->data + position);
+            marker->size             = (uint32_t)to_end;
+            marker->format           = LOG_SKIP_TO_START;
+        }
+        head += to_end;
+        position = 0;
+    }
+    *new_head = head + size;
+    return (struct LogRecord *)(void *)(ring->data + position);
+}
+
+// Function to record a log line; formatting happens later on the logger thread
+void log_write(enum LogLevel level, const char *format, ...)
+{
+    struct LogRecord *record;
+    struct LogRing   *ring;
+    const char       *strings[LOG_MAX_ARGS];
+    size_t            string_len[LOG_MAX_ARGS];
+    uint64_t          args[LOG_MAX_ARGS];
+    uint64_t          new_head;
+    size_t            string_bytes = 0;
+    size_t            offset;
+    uint8_t           nargs = 0;
+    uint32_t          size;
+    va_list           ap;
+
+    if((int)level < atomic_load_explicit(&log_min_level, memory_order_relaxed))
+    {
+        return;
+    }
+
+    if(!atomic_load_explicit(&log_running, memory_order_acquire))
+    {
+        va_start(ap, format);
+        vfprintf(level >= LOG_LEVEL_WARN ? stderr : stdout, format, ap);
+        va_end(ap);
+        return;
+    }
+
+    ring = log_thread_ring;
+    if(ring == NULL)
+    {
+        ring = log_register_thread();
+        log_thread_ring = ring;
+        if(ring == NULL)
+        {
+            atomic_fetch_add_explicit(&log_drop_count, 1, memory_order_relaxed);
+            return;
+        }
+    }
+
+    // Capture the arguments in binary form, as the format says they are
+    va_start(ap, format);
+    for(const char *p = format; *p != '\0' && nargs < LOG_MAX_ARGS;)
+    {
+        struct LogSpec spec;
+
+        if(*p != '%')
+        {
+            p++;
+            continue;
+        }
+        p = log_parse_spec(p, &spec);
+        strings[nargs] = NULL;
+        switch(spec.arg_class)
+        {
+            case LOG_ARG_SIGNED:
+                args[nargs++] = log_fetch_signed(&ap, spec.length);
+                break;
+            case LOG_ARG_UNSIGNED:
+                args[nargs++] = log_fetch_unsigned(&ap, spec.length);
+                break;
+            case LOG_ARG_DOUBLE:
+            {
+                double value = va_arg(ap, double);
+                memcpy(&args[nargs++], &value, sizeof(value));
+                break;
+            }
+            case LOG_ARG_POINTER:
+                args[nargs++] = (uint64_t)(uintptr_t)va_arg(ap, void *);
+                break;
+            case LOG_ARG_STRING:
+            {
+                const char *value = va_arg(ap, const char *);
+                strings[nargs]    = value != NULL ? value : "(null)";
+                string_len[nargs] = strnlen(strings[nargs], spec.precision);
+                string_bytes += string_len[nargs];
+                nargs++;
+                break;
+            }
+            case LOG_ARG_NONE:
+            default:
+                break;
+        }
+    }
+    va_end(ap);
+
+    size   = (uint32_t)((sizeof(struct LogRecord) + string_bytes + 7) & ~(size_t)7);
+    record = log_reserve(ring, size, &new_head);
+    if(record == NULL)
+    {
+        atomic_fetch_add_explicit(&log_drop_count, 1, memory_order_relaxed);
+        return;
+    }
+
+    record->size     = size;
+    record->level    = (uint8_t)level;
+    record->nargs    = nargs;
+    record->stamp_ns = log_now_ns();
+    record->format   = format;
+    offset           = 0;
+    for(uint8_t i = 0; i < nargs; ++i)
+    {
+        if(strings[i] != NULL)
+        {
+            memcpy((uint8_t *)(record + 1) + offset, strings[i], string_len[i]);
+            args[i] = ((uint64_t)offset << 32) | string_len[i];
+            offset += string_len[i];
+        }
+        record->args[i] = args[i];
+    }
+
+    atomic_store_explicit(&ring->head, new_head, memory_order_release);
+}
+
+// Format strings are the call sites' literals, already checked by the compiler there
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+
+// Formats one conversion with its captured argument
+static int log_format_arg(char *out, size_t size, const struct LogSpec *spec, uint64_t arg, const struct LogRecord *record)
+{
+    char sub[LOG_SPEC_SIZE];
+
+    if(spec->len >= sizeof(sub))
+    {
+        return 0;
+    }
+    memcpy(sub, spec->start, spec->len);
+    sub[spec->len] = '\0';
+
+    switch(spec->arg_class)
+    {
+        case LOG_ARG_SIGNED:
+            switch(spec->length)
+            {
+                case LOG_LEN_LONG:
+                    return snprintf(out, size, sub, (long)arg);
+                case LOG_LEN_LLONG:
+                    return snprintf(out, size, sub, (long long)arg);
+                case LOG_LEN_SIZE:
+                    return snprintf(out, size, sub, (ssize_t)arg);
+                case LOG_LEN_MAX:
+                    return snprintf(out, size, sub, (intmax_t)arg);
+                case LOG_LEN_PTRDIFF:
+                    return snprintf(out, size, sub, (ptrdiff_t)arg);
+                case LOG_LEN_INT:
+                default:
+                    return snprintf(out, size, sub, (int)arg);
+            }
+        case LOG_ARG_UNSIGNED:
+            switch(spec->length)
+            {
+                case LOG_LEN_LONG:
+                    return snprintf(out, size, sub, (unsigned long)arg);
+                case LOG_LEN_LLONG:
+                    return snprintf(out, size, sub, (unsigned long long)arg);
+                case LOG_LEN_SIZE:
+                    return snprintf(out, size, sub, (size_t)arg);
+                case LOG_LEN_MAX:
+                    return snprintf(out, size, sub, (uintmax_t)arg);
+                case LOG_LEN_PTRDIFF:
+                    return snprintf(out, size, sub, (ptrdiff_t)arg);
+                case LOG_LEN_INT:
+                default:
+                    return snprintf(out, size, sub, (unsigned int)arg);
+            }
+        case LOG_ARG_DOUBLE:
+        {
+            double value;
+            memcpy(&value, &arg, sizeof(value));
+            return snprintf(out, size, sub, value);
+        }
+        case LOG_ARG_POINTER:
+            return snprintf(out, size, sub, (void *)(uintptr_t)arg);
+        case LOG_ARG_STRING:
+        {
+            // The copy is already cut to the precision; swap it for the copied length, which needs no terminator
+            const char *text = (const char *)(record + 1) + (arg >> 32);
+            int         len  = (int)(arg & UINT32_MAX);
+            char        with_precision[LOG_SPEC_SIZE];
+            const char *dot  = strchr(sub, '.');
+            int         keep = dot != NULL ? (int)(dot - sub) : (int)(spec->len - 1);
+
+            snprintf(with_precision, sizeof(with_precision), "%.*s.*s", keep, sub);
+            return snprintf(out, size, with_precision, len, text);
+        }
+        case LOG_ARG_NONE:
+        default:
+            return snprintf(out, size, "%%");
+    }
+}
+
+#pragma GCC diagnostic pop
+
+// Renders a record into line; returns its length
+static size_t log_format_record(const struct LogRecord *record, char *line, size_t size)
+{
+    size_t  used = 0;
+    uint8_t arg  = 0;
+
+    for(const char *p = record->format; *p != '\0' && used + 1 < size;)
+    {
+        struct LogSpec spec;
+        int            written;
+
+        if(*p != '%')
+        {
+            line[used++] = *p++;
+            continue;
+        }
+        p = log_parse_spec(p, &spec);
+        if(spec.arg_class != LOG_ARG_NONE && arg == record->nargs)
+        {
+            break;
+        }
+        written = log_format_arg(line + used, size - used, &spec, spec.arg_class == LOG_ARG_NONE ? 0 : record->args[arg], record);
+        if(spec.arg_class != LOG_ARG_NONE)
+        {
+            arg++;
+        }
+        if(written > 0)
+        {
+            used += (size_t)written < size - used ? (size_t)written : size - used - 1;
+        }
+    }
+    return used;
+}
+
+static void log_flush(int fd, const char *buffer, size_t *len)
+{
+    size_t written = 0;
+
+    while(written < *len)
+    {
+        ssize_t result = write(fd, buffer + written, *len - written);
+        if(result <= 0)
+        {
+            break;
+        }
+        written += (size_t)result;
+    }
+    *len = 0;
+}
+
+// Oldest unread record of a ring, skipping wrap markers; NULL when empty
+static const struct LogRecord *log_peek(struct LogRing *ring)
+{
+    for(;;)
+    {
+        uint64_t                tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        uint64_t                head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        size_t                  position;
+        const struct LogRecord *record;
+
+        if(tail == head)
+        {
+            return NULL;
+        }
+        position = (size_t)(tail & (LOG_RING_BYTES - 1));
+        if(LOG_RING_BYTES - position < sizeof(struct LogRecord))
+        {
+            atomic_store_explicit(&ring->tail, tail + (LOG_RING_BYTES - position), memory_order_release);
+            continue;
+        }
+        record = (const struct LogRecord *)(const void *)(ring->data + position);
+        if(record->format == LOG_SKIP_TO_START)
+        {
+            atomic_store_explicit(&ring->tail, tail + record->size, memory_order_release);
+            continue;
+        }
+        return record;
+    }
+}
+
+// Writes out everything currently in the rings, oldest first across threads; returns records written
+static size_t log_drain(char *out, char *err, size_t *out_len, size_t *err_len)
+{
+    char   line[LOG_LINE_BYTES];
+    size_t drained = 0;
+    int    rings   = atomic_load_explicit(&log_ring_count, memory_order_acquire);
+
+    for(;;)
+    {
+        const struct LogRecord *oldest       = NULL;
+        int                     oldest_index = -1;
+        size_t                  len;
+
+        for(int i = 0; i < rings; ++i)
+        {
+            const struct LogRecord *record = log_peek(log_rings[i]);
+            if(record != NULL && (oldest == NULL || record->stamp_ns < oldest->stamp_ns))
+            {
+                oldest       = record;
+                oldest_index = i;
+            }
+        }
+        if(oldest == NULL)
+        {
+            break;
+        }
+
+        len = log_format_record(oldest, line, sizeof(line));
+        if(oldest->level >= LOG_LEVEL_WARN)
+        {
+            if(*err_len + len > LOG_OUTPUT_BYTES)
+            {
+                log_flush(STDERR_FILENO, err, err_len);
+            }
+            memcpy(err + *err_len, line, len);
+            *err_len += len;
+        }
+        else
+        {
+            if(*out_len + len > LOG_OUTPUT_BYTES)
+            {
+                log_flush(STDOUT_FILENO, out, out_len);
+            }
+            memcpy(out + *out_len, line, len);
+            *out_len += len;
+        }
+        atomic_fetch_add_explicit(&log_rings[oldest_index]->tail, oldest->size, memory_order_release);
+        drained++;
+    }
+
+    log_flush(STDOUT_FILENO, out, out_len);
+    log_flush(STDERR_FILENO, err, err_len);
+    return drained;
+}
+
+static void *log_consumer(void *arg)
+{
+    static char     out[LOG_OUTPUT_BYTES];
+    static char     err[LOG_OUTPUT_BYTES];
+    size_t          out_len = 0;
+    size_t          err_len = 0;
+    struct timespec idle    = {0, LOG_IDLE_SLEEP_NS};
+
+    (void)arg;
+    while(atomic_load_explicit(&log_running, memory_order_acquire))
+    {
+        if(log_drain(out, err, &out_len, &err_len) == 0)
+        {
+            nanosleep(&idle, NULL);
+        }
+    }
+
+    // Whatever was logged before log_stop
+    log_drain(out, err, &out_len, &err_len);
+    return NULL;
+}
+
+// Function to start the logger thread; output printed with stdio before this is flushed first
+void log_start(void)
+{
+    if(atomic_load_explicit(&log_running, memory_order_relaxed))
+    {
+        return;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    atomic_store_explicit(&log_running, 1, memory_order_release);
+    if(pthread_create(&log_thread, NULL, log_consumer, NULL) != 0)
+    {
+        perror("log_start: pthread_create");
+        atomic_store_explicit(&log_running, 0, memory_order_release);
+    }
+}
+
+// Function to write out everything still queued and go back to printing synchronously
+void log_stop(void)
+{
+    if(!atomic_exchange_explicit(&log_running, 0, memory_order_acq_rel))
+    {
+        return;
+    }
+    pthread_join(log_thread, NULL);
+}
+
+void log_set_level(enum LogLevel level)
+{
+    atomic_store_explicit(&log_min_level, (int)level, memory_order_relaxed);
+}
+
+uint64_t log_dropped(void)
+{
+    return atomic_load_explicit(&log_drop_count, memory_order_relaxed);
+}
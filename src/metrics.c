@@ -0,0 +1,576 @@
+// For memfd_create (GNU), which backs the shared stats pages
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+#include "../include/metrics.h"
+#include <inttypes.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define METRICS_NANOS_PER_MILLI 1000000ULL
+#define METRICS_READ_ATTEMPTS 1000    // a writer killed mid-publish leaves the page odd for good
+
+struct MetricsHistogram
+{
+    _Atomic uint64_t count;
+    _Atomic uint64_t sum;
+    _Atomic uint64_t max;
+    _Atomic uint64_t buckets[METRICS_BUCKETS];
+};
+
+struct MetricsRegistry
+{
+    _Atomic uint64_t        counters[METRIC_COUNTER_COUNT];
+    _Atomic int64_t         gauges[METRIC_GAUGE_COUNT];
+    struct MetricsHistogram histograms[METRIC_HISTOGRAM_COUNT];
+};
+
+// The page shared with the wrapper: a seqlock around a copy of the registry
+struct MetricsPage
+{
+    _Atomic uint32_t       sequence;    // odd while the chat server is rewriting the snapshot
+    _Atomic uint64_t       published_ns;
+    struct MetricsRegistry snapshot;
+};
+
+static const char *const counter_names[METRIC_COUNTER_COUNT] = {
+    "frames_in",
+    "bytes_in",
+    "frames_out",
+    "bytes_out",
+    "replayed_frames",
+    "broadcasts",
+    "direct_messages",
+    "connections_accepted",
+    "connections_rejected",
+    "send_failures",
+    "delivery_skips",
+    "history_evictions",
+    "search_evictions",
+    "loop_stalls",
+    "relayed_in",
+    "relay_skips",
+    "coalesce_batched_ticks",
+    "coalesce_queued_frames",
+    "coalesce_writes",
+    "copy_sends",
+    "copy_bytes",
+    "zerocopy_sends",
+    "zerocopy_bytes",
+    "zerocopy_completions",
+    "zerocopy_kernel_copied",
+    "zerocopy_fallbacks",
+};
+
+static const char *const gauge_names[METRIC_GAUGE_COUNT] = {
+    "connections",
+    "output_queued_bytes",
+    "wal_staged_bytes",
+};
+
+static const char *const histogram_names[METRIC_HISTOGRAM_COUNT] = {
+    "dispatch_ns",
+    "broadcast_ns",
+    "wal_commit_ns",
+    "loop_busy_ns",
+    "kernel_rx_to_app_ns",
+    "app_to_kernel_tx_ns",
+    "kernel_tx_queue_ns",
+    "kernel_tx_to_ack_ns",
+};
+
+// Percentiles reported for each histogram, in tenths of a percent
+static const uint32_t reported_permille[] = {500, 900, 990, 999};
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables)
+static struct MetricsRegistry live;
+static struct MetricsPage    *pages            = NULL;    // one per chat server process
+static int                    page_count       = 0;
+static int                    pages_fd         = -1;    // the memfd behind pages, for a successor that execs
+static struct MetricsPage    *page             = NULL;    // the one this process publishes to
+static int                    recording        = 0;
+static _Atomic int            live_changed     = 0;    // something was recorded since the last publish
+static uint64_t               publish_interval = 0;
+static uint64_t               last_publish_ns  = 0;
+
+// NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables)
+
+static void metrics_bump(_Atomic uint64_t *value, uint64_t amount)
+{
+    atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+static void metrics_copy(struct MetricsRegistry *to, const struct MetricsRegistry *from)
+{
+    for(int i = 0; i < METRIC_COUNTER_COUNT; ++i)
+    {
+        atomic_store_explicit(&to->counters[i], atomic_load_explicit(&from->counters[i], memory_order_relaxed), memory_order_relaxed);
+    }
+    for(int i = 0; i < METRIC_GAUGE_COUNT; ++i)
+    {
+        atomic_store_explicit(&to->gauges[i], atomic_load_explicit(&from->gauges[i], memory_order_relaxed), memory_order_relaxed);
+    }
+    for(int i = 0; i < METRIC_HISTOGRAM_COUNT; ++i)
+    {
+        const struct MetricsHistogram *source = &from->histograms[i];
+        struct MetricsHistogram       *target = &to->histograms[i];
+
+        atomic_store_explicit(&target->count, atomic_load_explicit(&source->count, memory_order_relaxed), memory_order_relaxed);
+        atomic_store_explicit(&target->sum, atomic_load_explicit(&source->sum, memory_order_relaxed), memory_order_relaxed);
+        atomic_store_explicit(&target->max, atomic_load_explicit(&source->max, memory_order_relaxed), memory_order_relaxed);
+        for(size_t b = 0; b < METRICS_BUCKETS; ++b)
+        {
+            atomic_store_explicit(&target->buckets[b], atomic_load_explicit(&source->buckets[b], memory_order_relaxed), memory_order_relaxed);
+        }
+    }
+}
+
+// Adds from into to; histogram maxima are combined, not added
+static void metrics_merge(struct MetricsRegistry *to, const struct MetricsRegistry *from)
+{
+    for(int i = 0; i < METRIC_COUNTER_COUNT; ++i)
+    {
+        metrics_bump(&to->counters[i], atomic_load_explicit(&from->counters[i], memory_order_relaxed));
+    }
+    for(int i = 0; i < METRIC_GAUGE_COUNT; ++i)
+    {
+        atomic_store_explicit(&to->gauges[i], atomic_load_explicit(&to->gauges[i], memory_order_relaxed) + atomic_load_explicit(&from->gauges[i], memory_order_relaxed), memory_order_relaxed);
+    }
+    for(int i = 0; i < METRIC_HISTOGRAM_COUNT; ++i)
+    {
+        const struct MetricsHistogram *source = &from->histograms[i];
+        struct MetricsHistogram       *target = &to->histograms[i];
+        uint64_t                       max    = atomic_load_explicit(&source->max, memory_order_relaxed);
+
+        metrics_bump(&target->count, atomic_load_explicit(&source->count, memory_order_relaxed));
+        metrics_bump(&target->sum, atomic_load_explicit(&source->sum, memory_order_relaxed));
+        if(max > atomic_load_explicit(&target->max, memory_order_relaxed))
+        {
+            atomic_store_explicit(&target->max, max, memory_order_relaxed);
+        }
+        for(size_t b = 0; b < METRICS_BUCKETS; ++b)
+        {
+            metrics_bump(&target->buckets[b], atomic_load_explicit(&source->buckets[b], memory_order_relaxed));
+        }
+    }
+}
+
+// Reads a consistent copy of one shared snapshot into out and when it was published (0 = never).
+// Returns -1 if no consistent copy could be had.
+static int metrics_read_page(const struct MetricsPage *from, struct MetricsRegistry *out, uint64_t *published)
+{
+    for(int attempt = 0; attempt < METRICS_READ_ATTEMPTS; ++attempt)
+    {
+        uint32_t before = atomic_load_explicit(&from->sequence, memory_order_acquire);
+
+        if(before & 1U)
+        {
+            sched_yield();
+            continue;
+        }
+        metrics_copy(out, &from->snapshot);
+        *published = atomic_load_explicit(&from->published_ns, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        if(atomic_load_explicit(&from->sequence, memory_order_relaxed) == before)
+        {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Sums every page into out (which must start zeroed); *published is the newest publish time (0 = none yet),
+// as an idle process has nothing new to publish.
+// Pages that cannot be read are left out; returns how many were read.
+static int metrics_read_all(struct MetricsRegistry *out, uint64_t *published)
+{
+    struct MetricsRegistry snapshot;
+    uint64_t               page_published;
+    int                    read = 0;
+
+    *published = 0;
+    for(int i = 0; i < page_count; ++i)
+    {
+        if(metrics_read_page(&pages[i], &snapshot, &page_published) == -1)
+        {
+            continue;
+        }
+        metrics_merge(out, &snapshot);
+        if(page_published > *published)
+        {
+            *published = page_published;
+        }
+        read++;
+    }
+    return read;
+}
+
+static void metrics_close_fd(void)
+{
+    if(pages_fd != -1)
+    {
+        close(pages_fd);
+        pages_fd = -1;
+    }
+}
+
+// Function to map a shared stats page per chat server process; called before forking so every process sees them
+int metrics_init(int count)
+{
+    void  *mapping;
+    size_t size;
+
+    if(pages != NULL)
+    {
+        return 0;
+    }
+    if(count < 1)
+    {
+        count = 1;
+    }
+    size     = (size_t)count * sizeof(struct MetricsPage);
+    pages_fd = memfd_create("groupchat-metrics", MFD_CLOEXEC);
+    if(pages_fd == -1 || ftruncate(pages_fd, (off_t)size) == -1)
+    {
+        perror("metrics_init: memfd");
+        metrics_close_fd();
+        return -1;
+    }
+    mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, pages_fd, 0);
+    if(mapping == MAP_FAILED)
+    {
+        perror("metrics_init: mmap");
+        metrics_close_fd();
+        return -1;
+    }
+    pages      = (struct MetricsPage *)mapping;
+    page_count = count;
+    return 0;
+}
+
+// Function to map the pages another process made with metrics_init, passed as fd (a hot restart's successor
+// that exec'd a new build); takes fd over
+int metrics_attach(int fd, int count)
+{
+    struct stat st;
+    void       *mapping;
+    size_t      size = (size_t)count * sizeof(struct MetricsPage);
+
+    if(pages != NULL || count < 1 || fstat(fd, &st) == -1 || (size_t)st.st_size != size)
+    {
+        fprintf(stderr, "metrics_attach: not this build's stats pages\n");
+        close(fd);
+        return -1;
+    }
+    mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(mapping == MAP_FAILED)
+    {
+        perror("metrics_attach: mmap");
+        close(fd);
+        return -1;
+    }
+    pages      = (struct MetricsPage *)mapping;
+    page_count = count;
+    pages_fd   = fd;
+    return 0;
+}
+
+// The memfd behind the pages, or -1
+int metrics_fd(void)
+{
+    return pages_fd;
+}
+
+int metrics_page_count(void)
+{
+    return page_count;
+}
+
+size_t metrics_page_size(void)
+{
+    return sizeof(struct MetricsPage);
+}
+
+// Function to pick the page this process publishes to (a pool worker's index); before metrics_start
+void metrics_use_page(int index)
+{
+    if(pages != NULL && index >= 0 && index < page_count)
+    {
+        page = &pages[index];
+    }
+}
+
+// Function to clear the page of a chat server process that is gone, so its connections stop counting
+void metrics_reset_page(int index)
+{
+    struct MetricsPage *target;
+    uint32_t            sequence;
+
+    if(pages == NULL || index < 0 || index >= page_count)
+    {
+        return;
+    }
+    target   = &pages[index];
+    sequence = (atomic_load_explicit(&target->sequence, memory_order_relaxed) + 1U) | 1U;
+    atomic_store_explicit(&target->sequence, sequence, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memset(&target->snapshot, 0, sizeof(target->snapshot));
+    atomic_store_explicit(&target->published_ns, 0, memory_order_relaxed);
+    atomic_store_explicit(&target->sequence, sequence + 1U, memory_order_release);
+}
+
+// Function to start recording in this process, publishing to the page at most once per interval
+void metrics_start(uint64_t publish_interval_ns)
+{
+    if(metrics_init(1) == -1)
+    {
+        return;
+    }
+    if(page == NULL)
+    {
+        page = &pages[0];
+    }
+    memset(&live, 0, sizeof(live));
+
+    // A previous chat server may have died half way through a publish
+    atomic_store_explicit(&page->sequence, (atomic_load_explicit(&page->sequence, memory_order_relaxed) + 1U) & ~1U, memory_order_relaxed);
+    publish_interval = publish_interval_ns;
+    last_publish_ns  = 0;
+    recording        = 1;
+    atomic_store_explicit(&live_changed, 1, memory_order_relaxed);
+}
+
+// Function to copy the live registry to the shared page if the interval has passed.
+// Returns 1 while there are changes the page does not show yet, 0 once it is current.
+int metrics_publish(uint64_t now_ns)
+{
+    uint32_t sequence;
+
+    if(!recording || !atomic_load_explicit(&live_changed, memory_order_relaxed))
+    {
+        return 0;
+    }
+    if(now_ns - last_publish_ns < publish_interval)
+    {
+        return 1;
+    }
+
+    atomic_store_explicit(&live_changed, 0, memory_order_relaxed);
+    sequence = atomic_load_explicit(&page->sequence, memory_order_relaxed);
+    atomic_store_explicit(&page->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    metrics_copy(&page->snapshot, &live);
+    atomic_store_explicit(&page->published_ns, now_ns, memory_order_relaxed);
+    atomic_store_explicit(&page->sequence, sequence + 2, memory_order_release);
+    last_publish_ns = now_ns;
+    return 0;
+}
+
+// Function to publish right away, whatever the interval (before a hot restart's successor takes over the page)
+void metrics_publish_now(uint64_t now_ns)
+{
+    if(recording)
+    {
+        last_publish_ns = now_ns - publish_interval;
+        atomic_store_explicit(&live_changed, 1, memory_order_relaxed);
+        metrics_publish(now_ns);
+    }
+}
+
+// Function to carry on from the totals on this process's page, as its predecessor left them; after metrics_start
+void metrics_adopt_page(void)
+{
+    uint64_t published;
+
+    if(recording && metrics_read_page(page, &live, &published) == -1)
+    {
+        memset(&live, 0, sizeof(live));
+    }
+}
+
+void metrics_add(enum MetricCounter counter, uint64_t amount)
+{
+    if(recording)
+    {
+        metrics_bump(&live.counters[counter], amount);
+        atomic_store_explicit(&live_changed, 1, memory_order_relaxed);
+    }
+}
+
+void metrics_set(enum MetricGauge gauge, int64_t value)
+{
+    if(recording)
+    {
+        atomic_store_explicit(&live.gauges[gauge], value, memory_order_relaxed);
+        atomic_store_explicit(&live_changed, 1, memory_order_relaxed);
+    }
+}
+
+// Function to read one gauge, summed over the shared pages as last published; -1 if none can be read
+int64_t metrics_gauge(enum MetricGauge gauge)
+{
+    struct MetricsRegistry total;
+    uint64_t               published;
+
+    memset(&total, 0, sizeof(total));
+    if(pages == NULL || metrics_read_all(&total, &published) == 0)
+    {
+        return -1;
+    }
+    return atomic_load_explicit(&total.gauges[gauge], memory_order_relaxed);
+}
+
+// Function to read the load of one chat server process (a pool worker's index) from its page; -1 if it
+// cannot be read or has not published yet
+int metrics_load(int index, struct MetricsLoad *out)
+{
+    struct MetricsRegistry snapshot;
+    uint64_t               published;
+
+    if(pages == NULL || index < 0 || index >= page_count || metrics_read_page(&pages[index], &snapshot, &published) == -1 || published == 0)
+    {
+        return -1;
+    }
+    out->connections     = atomic_load_explicit(&snapshot.gauges[METRIC_CONNECTIONS], memory_order_relaxed);
+    out->loop_iterations = atomic_load_explicit(&snapshot.histograms[METRIC_LOOP_BUSY_NS].count, memory_order_relaxed);
+    out->loop_busy_ns    = atomic_load_explicit(&snapshot.histograms[METRIC_LOOP_BUSY_NS].sum, memory_order_relaxed);
+    out->loop_stalls     = atomic_load_explicit(&snapshot.counters[METRIC_LOOP_STALLS], memory_order_relaxed);
+    return 0;
+}
+
+void metrics_record(enum MetricHistogram histogram, uint64_t value)
+{
+    struct MetricsHistogram *h;
+
+    if(!recording)
+    {
+        return;
+    }
+    h = &live.histograms[histogram];
+    metrics_bump(&h->buckets[histogram_bucket(value)], 1);
+    metrics_bump(&h->count, 1);
+    metrics_bump(&h->sum, value);
+    if(value > atomic_load_explicit(&h->max, memory_order_relaxed))
+    {
+        atomic_store_explicit(&h->max, value, memory_order_relaxed);
+    }
+    atomic_store_explicit(&live_changed, 1, memory_order_relaxed);
+}
+
+// Appends to out at *used, never past size
+static void metrics_append(char *out, size_t size, size_t *used, const char *format, ...) __attribute__((format(printf, 4, 5)));
+
+static void metrics_append(char *out, size_t size, size_t *used, const char *format, ...)
+{
+    va_list ap;
+    int     written;
+
+    if(*used >= size)
+    {
+        return;
+    }
+    va_start(ap, format);
+    written = vsnprintf(out + *used, size - *used, format, ap);
+    va_end(ap);
+    if(written > 0)
+    {
+        *used += (size_t)written < size - *used ? (size_t)written : size - *used - 1;
+    }
+}
+
+static void metrics_format_histogram(const struct MetricsHistogram *h, const char *name, char *out, size_t size, size_t *used)
+{
+    uint64_t buckets[METRICS_BUCKETS];
+    uint64_t total  = 0;
+    uint64_t count  = atomic_load_explicit(&h->count, memory_order_relaxed);
+    uint64_t sum    = atomic_load_explicit(&h->sum, memory_order_relaxed);
+    uint64_t max    = atomic_load_explicit(&h->max, memory_order_relaxed);
+    size_t   bucket = 0;
+    uint64_t seen   = 0;
+    uint64_t value;
+
+    for(size_t i = 0; i < METRICS_BUCKETS; ++i)
+    {
+        buckets[i] = atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+        total += buckets[i];
+    }
+
+    metrics_append(out, size, used, "%s count=%" PRIu64 " mean=%" PRIu64, name, count, count > 0 ? sum / count : 0);
+    for(size_t p = 0; p < sizeof(reported_permille) / sizeof(reported_permille[0]); ++p)
+    {
+        uint64_t rank = (total * reported_permille[p] + 999) / 1000;
+
+        while(bucket < METRICS_BUCKETS && (seen + buckets[bucket] < rank || buckets[bucket] == 0))
+        {
+            seen += buckets[bucket];
+            bucket++;
+        }
+        value = total > 0 && bucket < METRICS_BUCKETS ? histogram_bucket_top((uint32_t)bucket) : 0;
+        if(value > max)
+        {
+            value = max;
+        }
+        if(reported_permille[p] % 10 == 0)
+        {
+            metrics_append(out, size, used, " p%u=%" PRIu64, reported_permille[p] / 10, value);
+        }
+        else
+        {
+            metrics_append(out, size, used, " p%u.%u=%" PRIu64, reported_permille[p] / 10, reported_permille[p] % 10, value);
+        }
+    }
+    metrics_append(out, size, used, " max=%" PRIu64 "\n", max);
+}
+
+// Function to render the last published snapshot, one metric per line; returns its length
+size_t metrics_format(char *out, size_t size, uint64_t now_ns)
+{
+    struct MetricsRegistry  snapshot;
+    struct MetricsRegistry *registry = &snapshot;
+    size_t                  used     = 0;
+    uint64_t                published;
+
+    if(size == 0)
+    {
+        return 0;
+    }
+    out[0] = '\0';
+    memset(&snapshot, 0, sizeof(snapshot));
+    if(pages == NULL || metrics_read_all(&snapshot, &published) == 0)
+    {
+        metrics_append(out, size, &used, "STATS unavailable\n");
+        return used;
+    }
+
+    metrics_append(out, size, &used, "STATS\n");
+    metrics_append(out, size, &used, "age_ms %" PRId64 "\n", published == 0 ? (int64_t)-1 : (int64_t)((now_ns - published) / METRICS_NANOS_PER_MILLI));
+    if(page_count > 1)
+    {
+        // Totals below are over every worker; this is how the connections are spread
+        metrics_append(out, size, &used, "workers %d\nworker_connections", page_count);
+        for(int i = 0; i < page_count; ++i)
+        {
+            metrics_append(out, size, &used, " %" PRId64, atomic_load_explicit(&pages[i].snapshot.gauges[METRIC_CONNECTIONS], memory_order_relaxed));
+        }
+        metrics_append(out, size, &used, "\n");
+    }
+    for(int i = 0; i < METRIC_COUNTER_COUNT; ++i)
+    {
+        metrics_append(out, size, &used, "%s %" PRIu64 "\n", counter_names[i], atomic_load_explicit(&registry->counters[i], memory_order_relaxed));
+    }
+    for(int i = 0; i < METRIC_GAUGE_COUNT; ++i)
+    {
+        metrics_append(out, size, &used, "%s %" PRId64 "\n", gauge_names[i], atomic_load_explicit(&registry->gauges[i], memory_order_relaxed));
+    }
+    for(int i = 0; i < METRIC_HISTOGRAM_COUNT; ++i)
+    {
+        metrics_format_histogram(&registry->histograms[i], histogram_names[i], out, size, &used);
+    }
+    return used;
+}
@@ -0,0 +1,553 @@
+// Microbenchmarks for the group chat server's hot paths: framing over a
+// socketpair, frame parsing, broadcast encoding, command dispatch, the
+// shared-memory transport (attached like a co-located bot, echoed by a
+// server thread), and the per-user lookups (set_username, direct_message,
+// send_user_list, room broadcast) at several populations. The server functions run for real
+// against clients admitted over loopback TCP; whatever they send is drained
+// between rounds, outside the timed region. Results go to stdout as JSON.
+
+#include "../include/coalesce.h"
+#include "../include/histogram.h"
+#include "../include/history.h"
+#include "../include/log.h"
+#include "../include/protocol.h"
+#include "../include/search_index.h"
+#include "../include/server.h"
+#include "../include/session.h"
+#include "../include/shm_ring.h"
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#define BENCH_ROUNDS 25
+#define BENCH_ROUND_NS (500 * NANOS_PER_MICRO)    // batches grow until one round takes this long
+#define BENCH_FD_SLACK 64
+#define BENCH_SOURCE_PORTS 16384    // connections per loopback source address
+#define BENCH_SMALL_PAYLOAD 64
+#define BENCH_LARGE_PAYLOAD 1000
+#define BENCH_DRAIN_SIZE (64 * 1024)
+#define BENCH_SHM_PORT 0    // no TCP server has port 0, so its shared-memory socket path is never a live server's
+
+struct BenchContext
+{
+    int               users;         // clients admitted so far, named u0, u1, ...
+    int              *server_fds;    // what admit_client got
+    int              *peer_fds;      // our end of each connection
+    int               pair[2];       // socketpair for the framing benchmarks
+    int               listen_fd;
+    char              payload[BUFFER_SIZE];
+    size_t            payload_len;
+    char              frame[BUFFER_SIZE + PROTOCOL_HEADER_SIZE];
+    char              command[MESSAGE_SIZE];
+    struct ShmChannel shm;    // attached like a co-located bot; a thread echoes on the server's end
+    int               shm_listen_fd;
+    pthread_t         shm_echo_thread;
+    uint64_t          shm_pending;    // pipelined frames whose echo has not been read yet
+};
+
+typedef void (*bench_op)(struct BenchContext *ctx, uint64_t iteration);
+typedef void (*bench_drain)(struct BenchContext *ctx);
+
+// Population levels for the per-user benchmarks
+static const int user_levels[] = {32, 1024, 100000};
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+static int first_result = 1;
+
+static uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * (uint64_t)NANOS_PER_SECOND + (uint64_t)ts.tv_nsec;
+}
+
+static void drain_fd(int fd)
+{
+    char    buffer[BENCH_DRAIN_SIZE];
+    ssize_t received;
+
+    do
+    {
+        received = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    } while(received > 0);
+}
+
+static void drain_first(struct BenchContext *ctx)
+{
+    coalesce_end_tick();
+    drain_fd(ctx->peer_fds[0]);
+}
+
+static void drain_last(struct BenchContext *ctx)
+{
+    coalesce_end_tick();
+    drain_fd(ctx->peer_fds[ctx->users - 1]);
+}
+
+static void drain_all(struct BenchContext *ctx)
+{
+    coalesce_end_tick();
+    for(int i = 0; i < ctx->users; ++i)
+    {
+        drain_fd(ctx->peer_fds[i]);
+    }
+}
+
+static void drain_shm(struct BenchContext *ctx)
+{
+    char    buffer[BUFFER_SIZE];
+    uint8_t version;
+
+    for(; ctx->shm_pending > 0; ctx->shm_pending--)
+    {
+        if(shm_channel_recv(&ctx->shm, &version, buffer, sizeof(buffer)) <= 0)
+        {
+            ctx->shm_pending = 0;
+            return;
+        }
+    }
+}
+
+static void print_result_start(const char *name, int users, size_t bytes)
+{
+    printf("%s\n    {\"name\": \"%s\", \"users\": %d, \"bytes\": %zu", first_result ? "" : ",", name, users, bytes);
+    first_result = 0;
+}
+
+// Times op in rounds of a calibrated batch size (at most max_batch, so the drain keeps up) and prints one JSON result
+static void run_benchmark(struct BenchContext *ctx, const char *name, int users, size_t bytes, bench_op op, bench_drain drain, uint64_t max_batch)
+{
+    struct Histogram per_op;
+    uint64_t         batch      = 1;
+    uint64_t         iteration  = 0;
+    uint64_t         total_ns   = 0;
+    uint64_t         total_ops  = 0;
+    uint64_t         round_ns   = 0;
+
+    // Grow the batch until a round is long enough to time reliably
+    while(batch < max_batch)
+    {
+        uint64_t start = bench_now_ns();
+
+        for(uint64_t i = 0; i < batch; ++i)
+        {
+            op(ctx, iteration++);
+        }
+        round_ns = bench_now_ns() - start;
+        if(drain != NULL)
+        {
+            drain(ctx);
+        }
+        if(round_ns >= BENCH_ROUND_NS)
+        {
+            break;
+        }
+        batch *= 2;
+    }
+    if(batch > max_batch)
+    {
+        batch = max_batch;
+    }
+
+    histogram_reset(&per_op);
+    for(int round = 0; round < BENCH_ROUNDS; ++round)
+    {
+        uint64_t start = bench_now_ns();
+
+        for(uint64_t i = 0; i < batch; ++i)
+        {
+            op(ctx, iteration++);
+        }
+        round_ns = bench_now_ns() - start;
+        if(drain != NULL)
+        {
+            drain(ctx);
+        }
+        total_ns += round_ns;
+        total_ops += batch;
+        histogram_record(&per_op, round_ns / batch);
+    }
+
+    print_result_start(name, users, bytes);
+    printf(", \"batch\": %" PRIu64 ", \"ops\": %" PRIu64 ", \"ns_per_op\": %.1f, \"p50_ns\": %" PRIu64 ", \"p99_ns\": %" PRIu64 ", \"min_ns\": %" PRIu64 "}",
+           batch,
+           total_ops,
+           (double)total_ns / (double)total_ops,
+           histogram_percentile(&per_op, 500),
+           histogram_percentile(&per_op, 990),
+           per_op.min);
+}
+
+static void print_skipped(const char *name, int users, const char *reason)
+{
+    print_result_start(name, users, 0);
+    printf(", \"skipped\": \"%s\"}", reason);
+}
+
+// ----- Benchmarked operations -----
+
+static void op_frame_roundtrip(struct BenchContext *ctx, uint64_t iteration)
+{
+    char    buffer[BUFFER_SIZE];
+    uint8_t version;
+
+    (void)iteration;
+    send_with_protocol(ctx->pair[0], PROTOCOL_VERSION, ctx->payload);
+    read_with_protocol(ctx->pair[1], &version, buffer, sizeof(buffer));
+}
+
+// One frame to the server end of the shared-memory channel and its echo back
+static void op_shm_roundtrip(struct BenchContext *ctx, uint64_t iteration)
+{
+    char    buffer[BUFFER_SIZE];
+    uint8_t version;
+
+    (void)iteration;
+    shm_channel_send(&ctx->shm, PROTOCOL_VERSION, ctx->payload);
+    shm_channel_recv(&ctx->shm, &version, buffer, sizeof(buffer));
+}
+
+// Frames sent back to back while the echo thread keeps up; the echoes are read by drain_shm
+static void op_shm_pipelined(struct BenchContext *ctx, uint64_t iteration)
+{
+    (void)iteration;
+    if(shm_channel_send(&ctx->shm, PROTOCOL_VERSION, ctx->payload) == 0)
+    {
+        ctx->shm_pending++;
+    }
+}
+
+static void op_parse_frame(struct BenchContext *ctx, uint64_t iteration)
+{
+    char    buffer[BUFFER_SIZE];
+    uint8_t version;
+    size_t  consumed;
+
+    (void)iteration;
+    parse_frame((const uint8_t *)ctx->frame, PROTOCOL_HEADER_SIZE + ctx->payload_len, &version, buffer, sizeof(buffer), &consumed);
+}
+
+// What handle_message does to a room message before the fan-out: format it and encode its header
+static void op_broadcast_encode(struct BenchContext *ctx, uint64_t iteration)
+{
+    char    message[MESSAGE_SIZE];
+    uint8_t header[PROTOCOL_HEADER_SIZE];
+    size_t  length;
+
+    length = (size_t)snprintf(message, sizeof(message), ROOM_MESSAGE_FORMAT, iteration, "u0", ctx->payload);
+    encode_header(header, PROTOCOL_VERSION, (uint16_t)length);
+    __asm__ volatile("" : : "r"(header), "r"(message) : "memory");
+}
+
+static void op_unknown_command(struct BenchContext *ctx, uint64_t iteration)
+{
+    (void)iteration;
+    handle_message("/zz", ctx->server_fds[0]);
+}
+
+// Alternates between two free names, so every call scans the whole table and renames
+static void op_set_username(struct BenchContext *ctx, uint64_t iteration)
+{
+    set_username(ctx->server_fds[0], (iteration & 1U) != 0 ? "/u benchA" : "/u benchB");
+}
+
+// Whispers to the last user admitted, the far end of the lookup
+static void op_direct_message(struct BenchContext *ctx, uint64_t iteration)
+{
+    (void)iteration;
+    direct_message(ctx->server_fds[0], ctx->command);
+}
+
+static void op_send_user_list(struct BenchContext *ctx, uint64_t iteration)
+{
+    (void)iteration;
+    send_user_list(ctx->server_fds[0]);
+}
+
+static void op_broadcast(struct BenchContext *ctx, uint64_t iteration)
+{
+    (void)iteration;
+    handle_message(ctx->payload, ctx->server_fds[0]);
+}
+
+// ----- Setup -----
+
+static void set_payload(struct BenchContext *ctx, size_t len)
+{
+    memset(ctx->payload, 'x', len);
+    ctx->payload[len] = '\0';
+    ctx->payload_len  = len;
+    encode_header((uint8_t *)ctx->frame, PROTOCOL_VERSION, (uint16_t)len);
+    memcpy(ctx->frame + PROTOCOL_HEADER_SIZE, ctx->payload, len);
+}
+
+// Connects over loopback TCP (rotating the source address, so ports do not run out) and admits the server side
+static int add_user(struct BenchContext *ctx)
+{
+    struct sockaddr_storage listen_addr;
+    struct sockaddr_in      source;
+    socklen_t               addr_len = sizeof(listen_addr);
+    int                     index    = ctx->users;
+    int                     peer;
+    int                     server_fd;
+    char                    rename[BUFFER_SIZE];
+
+    if(getsockname(ctx->listen_fd, (struct sockaddr *)&listen_addr, &addr_len) == -1)
+    {
+        perror("getsockname");
+        return -1;
+    }
+    memset(&source, 0, sizeof(source));
+    source.sin_family      = AF_INET;
+    source.sin_addr.s_addr = htonl(INADDR_LOOPBACK + 1U + (uint32_t)(index / BENCH_SOURCE_PORTS));
+
+    peer = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(peer == -1 || bind(peer, (struct sockaddr *)&source, sizeof(source)) == -1 || connect(peer, (struct sockaddr *)&listen_addr, addr_len) == -1)
+    {
+        perror("add_user: connect");
+        if(peer != -1)
+        {
+            close(peer);
+        }
+        return -1;
+    }
+    server_fd = accept(ctx->listen_fd, NULL, NULL);
+    if(server_fd == -1)
+    {
+        perror("add_user: accept");
+        close(peer);
+        return -1;
+    }
+
+    admit_client(server_fd);
+    ctx->server_fds[index] = server_fd;
+    ctx->peer_fds[index]   = peer;
+    ctx->users++;
+    snprintf(rename, sizeof(rename), "/u u%d", index);
+    set_username(server_fd, rename);
+    coalesce_end_tick();
+    drain_fd(peer);
+    return 0;
+}
+
+static int open_listener(struct BenchContext *ctx)
+{
+    struct sockaddr_in addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ctx->listen_fd       = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(ctx->listen_fd == -1 || bind(ctx->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(ctx->listen_fd, SOMAXCONN) == -1)
+    {
+        perror("open_listener");
+        return -1;
+    }
+    return 0;
+}
+
+// The server's end of the shared-memory channel: echoes every frame until the client detaches
+static void *shm_echo(void *arg)
+{
+    const int        *listen_fd = (const int *)arg;
+    struct ShmChannel channel;
+    char              buffer[BUFFER_SIZE];
+    uint8_t           version;
+
+    if(shm_channel_accept(*listen_fd, &channel) == -1)
+    {
+        return NULL;
+    }
+    while(shm_channel_recv(&channel, &version, buffer, sizeof(buffer)) > 0)
+    {
+        shm_channel_send(&channel, version, buffer);
+    }
+    shm_channel_close(&channel);
+    return NULL;
+}
+
+// Attaches to a shared-memory listener through the same handshake a co-located bot goes through
+static int open_shm_channel(struct BenchContext *ctx)
+{
+    char path[SHM_SOCKET_PATH_SIZE];
+
+    ctx->shm_listen_fd = shm_listener_create(BENCH_SHM_PORT);
+    if(ctx->shm_listen_fd == -1)
+    {
+        return -1;
+    }
+    if(pthread_create(&ctx->shm_echo_thread, NULL, shm_echo, &ctx->shm_listen_fd) != 0)
+    {
+        shm_listener_close(ctx->shm_listen_fd, BENCH_SHM_PORT);
+        ctx->shm_listen_fd = -1;
+        return -1;
+    }
+    snprintf(path, sizeof(path), SHM_SOCKET_PATH_FORMAT, BENCH_SHM_PORT);
+    if(shm_channel_attach(path, &ctx->shm) == -1)
+    {
+        shutdown(ctx->shm_listen_fd, SHUT_RDWR);    // wakes the echo thread if it is still in accept
+        pthread_join(ctx->shm_echo_thread, NULL);
+        shm_listener_close(ctx->shm_listen_fd, BENCH_SHM_PORT);
+        ctx->shm_listen_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+static void close_shm_channel(struct BenchContext *ctx)
+{
+    if(ctx->shm_listen_fd == -1)
+    {
+        return;
+    }
+    shm_channel_close(&ctx->shm);
+    pthread_join(ctx->shm_echo_thread, NULL);
+    shm_listener_close(ctx->shm_listen_fd, BENCH_SHM_PORT);
+    ctx->shm_listen_fd = -1;
+}
+
+// Runs the shared-memory benchmarks at the current payload; the pipelined batch stays within one ring
+static void run_shm_benchmarks(struct BenchContext *ctx)
+{
+    uint64_t in_flight = SHM_RING_CAPACITY / (SHM_FRAME_HEADER_SIZE + ctx->payload_len) / 2;
+
+    if(ctx->shm_listen_fd == -1)
+    {
+        print_skipped("shm_channel_roundtrip", 0, "no shared-memory channel");
+        print_skipped("shm_channel_pipelined", 0, "no shared-memory channel");
+        return;
+    }
+    run_benchmark(ctx, "shm_channel_roundtrip", 0, ctx->payload_len, op_shm_roundtrip, NULL, UINT64_MAX);
+    run_benchmark(ctx, "shm_channel_pipelined", 0, ctx->payload_len, op_shm_pipelined, drain_shm, in_flight);
+}
+
+// Raises the descriptor limit as far as allowed; returns how many users fit
+static int max_users_for_fds(void)
+{
+    struct rlimit limit;
+
+    if(getrlimit(RLIMIT_NOFILE, &limit) == -1)
+    {
+        return 0;
+    }
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if(getrlimit(RLIMIT_NOFILE, &limit) == -1 || limit.rlim_cur == RLIM_INFINITY)
+    {
+        return INT32_MAX;
+    }
+    return limit.rlim_cur > BENCH_FD_SLACK ? (int)((limit.rlim_cur - BENCH_FD_SLACK) / 2) : 0;
+}
+
+static void run_user_benchmarks(struct BenchContext *ctx, int level, int fd_users)
+{
+    static const char *const names[] = {"set_username", "direct_message", "send_user_list", "broadcast"};
+    char                     reason[BUFFER_SIZE];
+
+    if(level > MAX_CLIENTS || level > fd_users)
+    {
+        if(level > MAX_CLIENTS)
+        {
+            snprintf(reason, sizeof(reason), "MAX_CLIENTS is %d; build with -DMAX_CLIENTS=%d", MAX_CLIENTS, level);
+        }
+        else
+        {
+            snprintf(reason, sizeof(reason), "needs %d file descriptors", 2 * level + BENCH_FD_SLACK);
+        }
+        for(size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+        {
+            print_skipped(names[i], level, reason);
+        }
+        return;
+    }
+
+    while(ctx->users < level)
+    {
+        if(add_user(ctx) == -1)
+        {
+            return;
+        }
+    }
+    snprintf(ctx->command, sizeof(ctx->command), "/w u%d %s", ctx->users - 1, ctx->payload);
+
+    run_benchmark(ctx, "set_username", level, 0, op_set_username, drain_first, 4096);
+    run_benchmark(ctx, "direct_message", level, ctx->payload_len, op_direct_message, drain_last, 4096);
+    run_benchmark(ctx, "send_user_list", level, 0, op_send_user_list, drain_first, 1024);
+    run_benchmark(ctx, "broadcast", level, ctx->payload_len, op_broadcast, drain_all, 64);
+}
+
+int main(void)
+{
+    struct BenchContext ctx;
+    int                 fd_users = max_users_for_fds();
+    int                 max_level = 0;
+
+    memset(&ctx, 0, sizeof(ctx));
+    log_set_level(LOG_LEVEL_WARN);
+    for(size_t i = 0; i < sizeof(user_levels) / sizeof(user_levels[0]); ++i)
+    {
+        if(user_levels[i] <= MAX_CLIENTS && user_levels[i] <= fd_users && user_levels[i] > max_level)
+        {
+            max_level = user_levels[i];
+        }
+    }
+
+    ctx.server_fds = (int *)calloc((size_t)max_level + 1, sizeof(int));
+    ctx.peer_fds   = (int *)calloc((size_t)max_level + 1, sizeof(int));
+    if(ctx.server_fds == NULL || ctx.peer_fds == NULL || open_listener(&ctx) == -1 || socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, ctx.pair) == -1)
+    {
+        perror("microbench setup");
+        return EXIT_FAILURE;
+    }
+    allocate_client_buffers();
+    history_init(HISTORY_CAPACITY_BYTES, HISTORY_MAX_ENTRIES);
+    session_init(SESSION_MAX, (uint64_t)SESSION_TTL_SECONDS * (uint64_t)NANOS_PER_SECOND);
+    search_index_init(SEARCH_MEMORY_BYTES, SEARCH_BLOCK_MESSAGES);
+    if(open_shm_channel(&ctx) == -1)
+    {
+        fprintf(stderr, "Continuing without the shared-memory benchmarks\n");
+    }
+
+    printf("{\n  \"tool\": \"microbench\",\n  \"max_clients\": %d,\n  \"rounds\": %d,\n  \"results\": [", MAX_CLIENTS, BENCH_ROUNDS);
+
+    set_payload(&ctx, BENCH_SMALL_PAYLOAD);
+    run_benchmark(&ctx, "send_read_with_protocol", 0, ctx.payload_len, op_frame_roundtrip, NULL, UINT64_MAX);
+    run_benchmark(&ctx, "parse_frame", 0, ctx.payload_len, op_parse_frame, NULL, UINT64_MAX);
+    run_benchmark(&ctx, "broadcast_encode", 0, ctx.payload_len, op_broadcast_encode, NULL, UINT64_MAX);
+    run_shm_benchmarks(&ctx);
+    set_payload(&ctx, BENCH_LARGE_PAYLOAD);
+    run_benchmark(&ctx, "send_read_with_protocol", 0, ctx.payload_len, op_frame_roundtrip, NULL, UINT64_MAX);
+    run_benchmark(&ctx, "parse_frame", 0, ctx.payload_len, op_parse_frame, NULL, UINT64_MAX);
+    run_benchmark(&ctx, "broadcast_encode", 0, ctx.payload_len, op_broadcast_encode, NULL, UINT64_MAX);
+    run_shm_benchmarks(&ctx);
+    close_shm_channel(&ctx);
+
+    set_payload(&ctx, BENCH_SMALL_PAYLOAD);
+    if(add_user(&ctx) == 0)
+    {
+        run_benchmark(&ctx, "handle_message_command", 1, 0, op_unknown_command, drain_first, 4096);
+    }
+    for(size_t i = 0; i < sizeof(user_levels) / sizeof(user_levels[0]); ++i)
+    {
+        run_user_benchmarks(&ctx, user_levels[i], fd_users);
+    }
+    printf("\n  ]\n}\n");
+
+    for(int i = 0; i < ctx.users; ++i)
+    {
+        release_client(i);
+        close(ctx.peer_fds[i]);
+    }
+    close(ctx.pair[0]);
+    close(ctx.pair[1]);
+    close(ctx.listen_fd);
+    search_index_free();
+    session_free();
+    history_free();
+    free_client_buffers();
+    free(ctx.server_fds);
+    free(ctx.peer_fds);
+    return EXIT_SUCCESS;
+}
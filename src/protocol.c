@@ -1,9 +1,25 @@
 #include "../include/protocol.h"
+#include "../include/coalesce.h"
+#include "../include/log.h"
+#include "../include/metrics.h"
+#include "../include/probes.h"
+#include "../include/trace.h"
+#include "../include/shm_ring.h"
+#include "../include/timestamping.h"
+#include "../include/transport.h"
+#include <errno.h>
+#include <sys/uio.h>
 
 // Function to send a single byte
 ssize_t send_byte(int sockfd, uint8_t byte)
 {
-    return send(sockfd, &byte, sizeof(byte), 0);
+    ssize_t sent = transport_send(sockfd, &byte, sizeof(byte), 0);
+
+    if(sent > 0)
+    {
+        timestamping_note_send(sockfd, (size_t)sent, 0);
+    }
+    return sent;
 }
 
 // Function to send a 16-bit integer in network byte order
@@ -11,13 +27,37 @@ ssize_t send_uint16(int sockfd, uint16_t value)
 {
     //    uint16_t net_value = htons(value);    // Convert to network byte order
     uint16_t net_value = ntohs(value);    // Convert to network byte order
-    return send(sockfd, &net_value, sizeof(net_value), 0);
+    ssize_t  sent      = transport_send(sockfd, &net_value, sizeof(net_value), 0);
+
+    if(sent > 0)
+    {
+        timestamping_note_send(sockfd, (size_t)sent, 0);
+    }
+    return sent;
+}
+
+// Function to encode the 3-byte protocol header
+void encode_header(uint8_t header[PROTOCOL_HEADER_SIZE], uint8_t version, uint16_t content_size)
+{
+    uint16_t net_size = htons(content_size);
+
+    header[0] = version;
+    memcpy(&header[1], &net_size, sizeof(net_size));
 }
 
 // Function to send the protocol header
 int send_header(int sockfd, uint8_t version, uint16_t content_size)
 {
-    if(send_byte(sockfd, version) == -1 || send_uint16(sockfd, content_size) == -1)
+    uint8_t header[PROTOCOL_HEADER_SIZE];
+    ssize_t sent;
+
+    encode_header(header, version, content_size);
+    sent = transport_send(sockfd, header, sizeof(header), MSG_NOSIGNAL);
+    if(sent > 0)
+    {
+        timestamping_note_send(sockfd, (size_t)sent, 0);
+    }
+    if(sent != (ssize_t)sizeof(header))
     {
         return -1;
     }
@@ -27,41 +67,134 @@ int send_header(int sockfd, uint8_t version, uint16_t content_size)
 // Function to send message with protocol header and content
 int send_with_protocol(int sockfd, uint8_t version, const char *message)
 {
-    uint16_t content_size = (uint16_t)strlen(message);
-    ssize_t  sent_bytes;
+    uint16_t           content_size = (uint16_t)strlen(message);
+    uint8_t            header[PROTOCOL_HEADER_SIZE];
+    struct iovec       iov[2];
+    struct msghdr      msg;
+    ssize_t            sent_bytes;
+    uint64_t           enqueue_ns;
+    int                queued;
+    uint64_t           trace_id = trace_current();
+    uint64_t           start    = trace_id != 0 ? trace_now_ns() : 0;
+    struct ShmChannel *channel  = shm_transport_lookup(sockfd);
+
+    // Local clients attached over shared memory get the same frame through their ring
+    if(channel != NULL)
+    {
+        if(shm_channel_send(channel, version, message) == -1)
+        {
+            return -1;
+        }
+        if(trace_id != 0)
+        {
+            trace_record(trace_id, TRACE_FLUSH, start, trace_now_ns(), sockfd);
+        }
+        metrics_add(METRIC_FRAMES_OUT, 1);
+        metrics_add(METRIC_BYTES_OUT, PROTOCOL_HEADER_SIZE + content_size);
+        GROUPCHAT_PROBE(send_done, sockfd, PROTOCOL_HEADER_SIZE + content_size, -1);
+        return 0;
+    }
 
-    printf("snd header| ver: %u, size: %u\n", version, content_size);
+    LOG_DEBUG("snd header| ver: %u, size: %u\n", version, content_size);
     //    printf("Message content: %s\n", message);
 
-    // Send protocol header first
-    if(send_header(sockfd, version, content_size) == -1)
+    encode_header(header, version, content_size);
+
+    // Group chat connections may batch this frame with others from the same loop iteration
+    queued = coalesce_submit(sockfd, header, sizeof(header), message, content_size);
+    if(queued == -1)
     {
-        perror("send_with_protocol: send_header failed");
         return -1;
     }
+    if(queued == 1)
+    {
+        metrics_add(METRIC_FRAMES_OUT, 1);
+        metrics_add(METRIC_BYTES_OUT, sizeof(header) + content_size);
+        return 0;
+    }
+
+    // Header and content leave in a single segment
+    iov[0].iov_base = header;
+    iov[0].iov_len  = sizeof(header);
+    iov[1].iov_base = (void *)(uintptr_t)message;
+    iov[1].iov_len  = content_size;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = 2;
 
-    // Send message content
-    sent_bytes = send(sockfd, message, content_size, 0);
-    if(sent_bytes < 0 || (uint16_t)sent_bytes != content_size)
+    enqueue_ns = timestamping_active(sockfd) ? timestamping_now_ns() : 0;
+    sent_bytes = transport_sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+    if(sent_bytes > 0)
+    {
+        timestamping_note_send(sockfd, (size_t)sent_bytes, enqueue_ns);
+    }
+    if(sent_bytes < 0 || (size_t)sent_bytes != sizeof(header) + content_size)
     {
         perror("send_with_protocol: send failed");
         return -1;
     }
 
+    metrics_add(METRIC_FRAMES_OUT, 1);
+    metrics_add(METRIC_BYTES_OUT, (uint64_t)sent_bytes);
+    GROUPCHAT_PROBE(send_done, sockfd, sent_bytes, -1);
+    if(trace_id != 0)
+    {
+        trace_record(trace_id, TRACE_FLUSH, start, trace_now_ns(), sockfd);
+    }
+    return 0;
+}
+
+// Function to send pre-encoded frames from several buffers, retrying short writes
+int send_iov_all(int sockfd, struct iovec *iov, int iov_count)
+{
+    struct msghdr msg;
+    uint64_t      enqueue_ns = timestamping_active(sockfd) ? timestamping_now_ns() : 0;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = (size_t)iov_count;
+
+    while(msg.msg_iovlen > 0)
+    {
+        ssize_t sent = transport_sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+        if(sent < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            perror("send_iov_all: sendmsg failed");
+            return -1;
+        }
+        timestamping_note_send(sockfd, (size_t)sent, enqueue_ns);
+
+        // Skip past what was written
+        while(msg.msg_iovlen > 0 && (size_t)sent >= msg.msg_iov->iov_len)
+        {
+            sent -= (ssize_t)msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if(msg.msg_iovlen > 0)
+        {
+            msg.msg_iov->iov_base = (uint8_t *)msg.msg_iov->iov_base + sent;
+            msg.msg_iov->iov_len -= (size_t)sent;
+        }
+    }
     return 0;
 }
 
 // Function to read a single byte
 ssize_t recv_byte(int sockfd, uint8_t *byte)
 {
-    return recv(sockfd, byte, sizeof(*byte), 0);
+    return transport_recv(sockfd, byte, sizeof(*byte), 0);
 }
 
 // Function to read a 16-bit integer in network byte order
 ssize_t recv_uint16(int sockfd, uint16_t *value)
 {
     uint16_t net_value;
-    ssize_t  result = recv(sockfd, &net_value, sizeof(net_value), 0);
+    ssize_t  result = transport_recv(sockfd, &net_value, sizeof(net_value), 0);
     if(result > 0)
     {
         *value = ntohs(net_value);    // Convert from network byte order
@@ -83,11 +216,23 @@ int read_header(int sockfd, uint8_t *version, uint16_t *content_size)
 // read_with_protocol function
 ssize_t read_with_protocol(int sockfd, uint8_t *version, char *buffer, size_t buffer_size)
 {
-    uint16_t content_size = 0;
-    ssize_t  bytes_received;
+    uint16_t           content_size = 0;
+    ssize_t            bytes_received;
+    int                header_status;
+    struct ShmChannel *channel = shm_transport_lookup(sockfd);
+
+    if(channel != NULL)
+    {
+        bytes_received = shm_channel_recv(channel, version, buffer, buffer_size);
+        if(bytes_received > 0 && buffer[bytes_received - 1] == '\n')
+        {
+            buffer[bytes_received - 1] = '\0';
+        }
+        return bytes_received;
+    }
 
     // Read the protocol header
-    int header_status = read_header(sockfd, version, &content_size);
+    header_status = read_header(sockfd, version, &content_size);
     if(header_status == -1)
     {
         perror("read_with_protocol: read_header failed");
@@ -95,16 +240,17 @@ ssize_t read_with_protocol(int sockfd, uint8_t *version, char *buffer, size_t bu
     }
 
     // Log the incoming header information
-    printf("rcv header| ver: %u, size: %u\n", *version, content_size);
+    LOG_DEBUG("rcv header| ver: %u, size: %u\n", *version, content_size);
+    GROUPCHAT_PROBE(frame_header, sockfd, content_size, -1);
 
     if(content_size >= buffer_size)
     {
-        fprintf(stderr, "Buffer too small for incoming message\n");
+        LOG_WARN("Buffer too small for incoming message\n");
         return -1;
     }
 
     // Read the actual message content
-    bytes_received = recv(sockfd, buffer, content_size, 0);
+    bytes_received = transport_recv(sockfd, buffer, content_size, 0);
     if(bytes_received <= 0)
     {
         perror("read_with_protocol: recv failed");
@@ -113,6 +259,7 @@ ssize_t read_with_protocol(int sockfd, uint8_t *version, char *buffer, size_t bu
 
     // Null-terminate the received message
     buffer[bytes_received] = '\0';
+    GROUPCHAT_PROBE(frame_decode, sockfd, bytes_received, -1);
 
     // Trim newline character if present at the end
     if(buffer[bytes_received - 1] == '\n')
@@ -122,3 +269,43 @@ ssize_t read_with_protocol(int sockfd, uint8_t *version, char *buffer, size_t bu
 
     return bytes_received;
 }
+
+// Function to pull one complete frame out of a connection's input buffer.
+// Returns 1 once a frame was copied into buffer, 0 if it is not complete yet, or -1 if it does not fit.
+int parse_frame(const uint8_t *data, size_t len, uint8_t *version, char *buffer, size_t buffer_size, size_t *consumed)
+{
+    uint16_t content_size;
+    uint16_t net_size;
+
+    if(len < PROTOCOL_HEADER_SIZE)
+    {
+        return 0;
+    }
+
+    memcpy(&net_size, &data[1], sizeof(net_size));
+    content_size = ntohs(net_size);
+    if(content_size >= buffer_size)
+    {
+        LOG_WARN("Buffer too small for incoming message\n");
+        return -1;
+    }
+    if(len < (size_t)PROTOCOL_HEADER_SIZE + content_size)
+    {
+        return 0;
+    }
+
+    *version = data[0];
+    memcpy(buffer, &data[PROTOCOL_HEADER_SIZE], content_size);
+    buffer[content_size] = '\0';
+    *consumed            = (size_t)PROTOCOL_HEADER_SIZE + content_size;
+
+    LOG_DEBUG("rcv header| ver: %u, size: %u\n", *version, content_size);
+
+    // Trim newline character if present at the end
+    if(content_size > 0 && buffer[content_size - 1] == '\n')
+    {
+        buffer[content_size - 1] = '\0';
+    }
+
+    return 1;
+}
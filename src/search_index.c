@@ -0,0 +1,434 @@
+#include "../include/search_index.h"
+#include "../include/metrics.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SEARCH_MAX_BLOCKS 256
+#define SEARCH_INITIAL_SLOTS 1024    // per block hash table, power of two
+#define SEARCH_INITIAL_POSTINGS 8
+#define SEARCH_VARINT_MAX 5          // bytes for one uint32 delta
+#define SEARCH_WORK_LIMIT 4000000    // postings a single query may decode
+#define SEARCH_FNV_OFFSET 14695981039346656037ULL
+#define SEARCH_FNV_PRIME 1099511628211ULL
+
+struct SearchTerm
+{
+    uint64_t hash;
+    char    *term;         // NULL marks an empty slot
+    uint8_t *postings;     // varint deltas of (seq - block first_seq)
+    uint32_t len;
+    uint32_t cap;
+    uint32_t count;
+    uint32_t last;         // last offset added, for the next delta
+};
+
+struct SearchBlock
+{
+    struct SearchTerm *slots;
+    size_t             slot_count;
+    size_t             term_count;
+    uint64_t           first_seq;
+    uint32_t           messages;    // offsets 0..messages-1 are in this block
+    size_t             bytes;
+};
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables)
+static struct SearchBlock *search_blocks[SEARCH_MAX_BLOCKS];    // ring, oldest at search_first
+static size_t              search_first        = 0;
+static size_t              search_count        = 0;
+static size_t              search_budget       = 0;
+static uint32_t            search_block_limit  = 0;
+static size_t              search_memory       = 0;
+static uint64_t            search_messages     = 0;
+static uint64_t            search_evicted      = 0;
+static uint32_t           *search_scratch      = NULL;    // block_messages offsets each
+static uint32_t           *search_scratch_next = NULL;
+
+// NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables)
+
+static uint64_t search_hash(const char *term)
+{
+    uint64_t hash = SEARCH_FNV_OFFSET;
+
+    for(const char *c = term; *c != '\0'; ++c)
+    {
+        hash = (hash ^ (uint8_t)*c) * SEARCH_FNV_PRIME;
+    }
+    return hash;
+}
+
+// Copies the next lowercase alphanumeric word into term; returns a pointer past it, or NULL at the end
+static const char *search_next_term(const char *text, char term[SEARCH_MAX_TERM + 1])
+{
+    size_t len = 0;
+
+    while(*text != '\0' && !isalnum((unsigned char)*text))
+    {
+        text++;
+    }
+    if(*text == '\0')
+    {
+        return NULL;
+    }
+    while(isalnum((unsigned char)*text))
+    {
+        if(len < SEARCH_MAX_TERM)
+        {
+            term[len++] = (char)tolower((unsigned char)*text);
+        }
+        text++;
+    }
+    term[len] = '\0';
+    return text;
+}
+
+static struct SearchBlock *search_block_create(uint64_t first_seq)
+{
+    struct SearchBlock *block = (struct SearchBlock *)calloc(1, sizeof(struct SearchBlock));
+
+    if(block == NULL)
+    {
+        return NULL;
+    }
+    block->slots = (struct SearchTerm *)calloc(SEARCH_INITIAL_SLOTS, sizeof(struct SearchTerm));
+    if(block->slots == NULL)
+    {
+        free(block);
+        return NULL;
+    }
+    block->slot_count = SEARCH_INITIAL_SLOTS;
+    block->first_seq  = first_seq;
+    block->bytes      = sizeof(struct SearchBlock) + SEARCH_INITIAL_SLOTS * sizeof(struct SearchTerm);
+    return block;
+}
+
+static void search_block_destroy(struct SearchBlock *block)
+{
+    for(size_t i = 0; i < block->slot_count; ++i)
+    {
+        free(block->slots[i].term);
+        free(block->slots[i].postings);
+    }
+    free(block->slots);
+    free(block);
+}
+
+static struct SearchTerm *search_block_find(const struct SearchBlock *block, const char *term, uint64_t hash)
+{
+    size_t mask = block->slot_count - 1;
+
+    for(size_t i = hash & mask;; i = (i + 1) & mask)
+    {
+        struct SearchTerm *slot = &block->slots[i];
+        if(slot->term == NULL || (slot->hash == hash && strcmp(slot->term, term) == 0))
+        {
+            return slot;
+        }
+    }
+}
+
+// Doubles the hash table once it is half full
+static int search_block_grow(struct SearchBlock *block)
+{
+    struct SearchTerm *old_slots = block->slots;
+    size_t             old_count = block->slot_count;
+
+    block->slots = (struct SearchTerm *)calloc(old_count * 2, sizeof(struct SearchTerm));
+    if(block->slots == NULL)
+    {
+        block->slots = old_slots;
+        return -1;
+    }
+    block->slot_count = old_count * 2;
+    block->bytes += old_count * sizeof(struct SearchTerm);
+
+    for(size_t i = 0; i < old_count; ++i)
+    {
+        if(old_slots[i].term != NULL)
+        {
+            *search_block_find(block, old_slots[i].term, old_slots[i].hash) = old_slots[i];
+        }
+    }
+    free(old_slots);
+    return 0;
+}
+
+static int search_postings_append(struct SearchBlock *block, struct SearchTerm *entry, uint32_t offset)
+{
+    uint32_t delta = entry->count == 0 ? offset : offset - entry->last;
+
+    if(entry->len + SEARCH_VARINT_MAX > entry->cap)
+    {
+        uint32_t cap      = entry->cap == 0 ? SEARCH_INITIAL_POSTINGS : entry->cap * 2;
+        uint8_t *postings = (uint8_t *)realloc(entry->postings, cap);
+        if(postings == NULL)
+        {
+            return -1;
+        }
+        block->bytes += cap - entry->cap;
+        entry->postings = postings;
+        entry->cap      = cap;
+    }
+
+    while(delta >= 0x80)
+    {
+        entry->postings[entry->len++] = (uint8_t)(delta | 0x80);
+        delta >>= 7;
+    }
+    entry->postings[entry->len++] = (uint8_t)delta;
+    entry->last                   = offset;
+    entry->count++;
+    return 0;
+}
+
+// Decodes a whole posting list into offsets; returns how many were written
+static uint32_t search_postings_decode(const struct SearchTerm *entry, uint32_t *offsets)
+{
+    uint32_t value = 0;
+    uint32_t n     = 0;
+    uint32_t i     = 0;
+
+    while(i < entry->len)
+    {
+        uint32_t delta = 0;
+        int      shift = 0;
+
+        while(entry->postings[i] & 0x80)
+        {
+            delta |= (uint32_t)(entry->postings[i++] & 0x7F) << shift;
+            shift += 7;
+        }
+        delta |= (uint32_t)entry->postings[i++] << shift;
+        value       = n == 0 ? delta : value + delta;
+        offsets[n++] = value;
+    }
+    return n;
+}
+
+static void search_evict_oldest(void)
+{
+    struct SearchBlock *block = search_blocks[search_first];
+
+    search_memory -= block->bytes;
+    search_messages -= block->messages;
+    search_block_destroy(block);
+    search_blocks[search_first] = NULL;
+    search_first                = (search_first + 1) % SEARCH_MAX_BLOCKS;
+    search_count--;
+    search_evicted++;
+    metrics_add(METRIC_SEARCH_EVICTIONS, 1);
+}
+
+// Function to set the memory budget and how many messages go in one block
+int search_index_init(size_t memory_budget, uint32_t block_messages)
+{
+    search_scratch      = (uint32_t *)malloc(block_messages * sizeof(uint32_t));
+    search_scratch_next = (uint32_t *)malloc(block_messages * sizeof(uint32_t));
+    if(search_scratch == NULL || search_scratch_next == NULL)
+    {
+        perror("search_index_init: malloc");
+        search_index_free();
+        return -1;
+    }
+    search_budget      = memory_budget;
+    search_block_limit = block_messages;
+    return 0;
+}
+
+void search_index_free(void)
+{
+    while(search_count > 0)
+    {
+        search_evict_oldest();
+    }
+    free(search_scratch);
+    free(search_scratch_next);
+    search_scratch      = NULL;
+    search_scratch_next = NULL;
+    search_block_limit  = 0;
+}
+
+// Function to index one room message; seq must grow from call to call
+void search_index_add(uint64_t seq, const char *text)
+{
+    struct SearchBlock *block = search_count > 0 ? search_blocks[(search_first + search_count - 1) % SEARCH_MAX_BLOCKS] : NULL;
+    char                term[SEARCH_MAX_TERM + 1];
+    uint32_t            offset;
+    size_t              bytes_before;
+
+    if(search_block_limit == 0)
+    {
+        return;
+    }
+
+    // Start a new block when the current one is full
+    if(block == NULL || seq - block->first_seq >= search_block_limit)
+    {
+        if(search_count == SEARCH_MAX_BLOCKS)
+        {
+            search_evict_oldest();
+        }
+        block = search_block_create(seq);
+        if(block == NULL)
+        {
+            perror("search_index_add: calloc");
+            return;
+        }
+        search_blocks[(search_first + search_count) % SEARCH_MAX_BLOCKS] = block;
+        search_count++;
+        search_memory += block->bytes;
+    }
+
+    offset       = (uint32_t)(seq - block->first_seq);
+    bytes_before = block->bytes;
+    while((text = search_next_term(text, term)) != NULL)
+    {
+        uint64_t           hash = search_hash(term);
+        struct SearchTerm *entry;
+
+        if(term[0] == '\0')
+        {
+            continue;
+        }
+        if((block->term_count + 1) * 2 > block->slot_count && search_block_grow(block) == -1)
+        {
+            break;
+        }
+
+        entry = search_block_find(block, term, hash);
+        if(entry->term == NULL)
+        {
+            entry->term = strdup(term);
+            if(entry->term == NULL)
+            {
+                break;
+            }
+            entry->hash = hash;
+            block->term_count++;
+            block->bytes += strlen(term) + 1;
+        }
+        else if(entry->count > 0 && entry->last == offset)
+        {
+            continue;    // word repeated within the message
+        }
+        if(search_postings_append(block, entry, offset) == -1)
+        {
+            break;
+        }
+    }
+    block->messages = offset + 1;
+    search_messages++;
+    search_memory += block->bytes - bytes_before;
+
+    // Stay within budget, but never drop the block being written
+    while(search_memory > search_budget && search_count > 1)
+    {
+        search_evict_oldest();
+    }
+}
+
+// Function to find the newest messages containing every word of the query, leaving out those numbered below
+// oldest_seq. Writes up to max_results sequence numbers, newest first, and returns how many.
+size_t search_index_query(const char *query, uint64_t *results, size_t max_results, uint64_t oldest_seq)
+{
+    char     terms[SEARCH_MAX_QUERY_TERMS][SEARCH_MAX_TERM + 1];
+    uint64_t hashes[SEARCH_MAX_QUERY_TERMS];
+    size_t   term_count = 0;
+    size_t   found      = 0;
+    size_t   work       = 0;
+
+    while(term_count < SEARCH_MAX_QUERY_TERMS && (query = search_next_term(query, terms[term_count])) != NULL)
+    {
+        hashes[term_count] = search_hash(terms[term_count]);
+        term_count++;
+    }
+    if(term_count == 0 || search_block_limit == 0)
+    {
+        return 0;
+    }
+
+    for(size_t b = search_count; b > 0 && found < max_results && work < SEARCH_WORK_LIMIT; --b)
+    {
+        const struct SearchBlock *block = search_blocks[(search_first + b - 1) % SEARCH_MAX_BLOCKS];
+        const struct SearchTerm  *lists[SEARCH_MAX_QUERY_TERMS];
+        size_t                    shortest = 0;
+        uint32_t                  matches;
+        int                       missing = 0;
+
+        if(block->first_seq + block->messages <= oldest_seq)
+        {
+            break;    // this block and the older ones are past what can be shown
+        }
+        for(size_t t = 0; t < term_count; ++t)
+        {
+            lists[t] = search_block_find(block, terms[t], hashes[t]);
+            if(lists[t]->term == NULL)
+            {
+                missing = 1;
+                break;
+            }
+            if(lists[t]->count < lists[shortest]->count)
+            {
+                shortest = t;
+            }
+        }
+        if(missing)
+        {
+            continue;
+        }
+
+        // Start from the rarest term and keep only offsets every other term also has
+        matches = search_postings_decode(lists[shortest], search_scratch);
+        work += matches;
+        for(size_t t = 0; t < term_count && matches > 0; ++t)
+        {
+            uint32_t other_count;
+            uint32_t kept = 0;
+            uint32_t j    = 0;
+
+            if(t == shortest)
+            {
+                continue;
+            }
+            other_count = search_postings_decode(lists[t], search_scratch_next);
+            work += other_count;
+            for(uint32_t i = 0; i < matches; ++i)
+            {
+                while(j < other_count && search_scratch_next[j] < search_scratch[i])
+                {
+                    j++;
+                }
+                if(j < other_count && search_scratch_next[j] == search_scratch[i])
+                {
+                    search_scratch[kept++] = search_scratch[i];
+                }
+            }
+            matches = kept;
+        }
+
+        while(matches > 0 && found < max_results && block->first_seq + search_scratch[matches - 1] >= oldest_seq)
+        {
+            results[found++] = block->first_seq + search_scratch[--matches];
+        }
+    }
+    return found;
+}
+
+void search_index_get_stats(struct SearchStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->memory_bytes   = search_memory;
+    stats->blocks         = search_count;
+    stats->messages       = search_messages;
+    stats->evicted_blocks = search_evicted;
+    for(size_t b = 0; b < search_count; ++b)
+    {
+        stats->terms += search_blocks[(search_first + b) % SEARCH_MAX_BLOCKS]->term_count;
+    }
+    if(search_count > 0)
+    {
+        stats->oldest_seq = search_blocks[search_first]->first_seq;
+    }
+}
@@ -0,0 +1,120 @@
+#include "../include/sequencer.h"
+#include "../include/flight.h"
+#include "../include/metrics.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+static _Atomic uint64_t room_seq = 0;
+
+// Function to assign the next room sequence number (starts at 1)
+uint64_t sequencer_next(void)
+{
+    return atomic_fetch_add_explicit(&room_seq, 1, memory_order_relaxed) + 1;
+}
+
+uint64_t sequencer_last(void)
+{
+    return atomic_load_explicit(&room_seq, memory_order_relaxed);
+}
+
+// Function to continue numbering after last_seq (e.g. recovered from the write-ahead log)
+void sequencer_restore(uint64_t last_seq)
+{
+    atomic_store_explicit(&room_seq, last_seq, memory_order_relaxed);
+}
+
+void delivery_order_init(struct DeliveryOrder *order, uint64_t next_seq)
+{
+    memset(order, 0, sizeof(*order));
+    pthread_mutex_init(&order->lock, NULL);
+    order->next_seq = next_seq;
+}
+
+// Drops anything still held back and starts the recipient over at next_seq
+void delivery_order_reset(struct DeliveryOrder *order, uint64_t next_seq)
+{
+    pthread_mutex_lock(&order->lock);
+    for(int i = 0; i < SEQUENCER_WINDOW; ++i)
+    {
+        free(order->held[i].message);
+        order->held[i].message = NULL;
+    }
+    order->next_seq = next_seq;
+    order->skipped  = 0;
+    pthread_mutex_unlock(&order->lock);
+}
+
+// Sends every held frame that is now next in line
+static void delivery_order_drain(struct DeliveryOrder *order, SequencedSend send, int recipient)
+{
+    while(1)
+    {
+        struct HeldFrame *slot = &order->held[order->next_seq % SEQUENCER_WINDOW];
+
+        if(slot->message == NULL || slot->seq != order->next_seq)
+        {
+            return;
+        }
+        send(recipient, slot->message, NULL);
+        free(slot->message);
+        slot->message = NULL;
+        order->next_seq++;
+    }
+}
+
+// Hands one sequenced frame to a recipient; it is sent only after every earlier frame
+void delivery_order_submit(struct DeliveryOrder *order, uint64_t seq, const char *message, SequencedSend send, int recipient, void *ctx)
+{
+    pthread_mutex_lock(&order->lock);
+
+    // Already given up on this one
+    if(seq < order->next_seq)
+    {
+        pthread_mutex_unlock(&order->lock);
+        return;
+    }
+
+    // The hole in front of us is older than the window: send what we have and skip the rest
+    if(seq - order->next_seq >= SEQUENCER_WINDOW)
+    {
+        uint64_t new_next = seq - SEQUENCER_WINDOW + 1;
+
+        while(order->next_seq < new_next)
+        {
+            struct HeldFrame *slot = &order->held[order->next_seq % SEQUENCER_WINDOW];
+
+            if(slot->message != NULL && slot->seq == order->next_seq)
+            {
+                send(recipient, slot->message, NULL);
+                free(slot->message);
+                slot->message = NULL;
+            }
+            else
+            {
+                order->skipped++;
+                metrics_add(METRIC_DELIVERY_SKIPS, 1);
+                flight_record(FLIGHT_DELIVERY_SKIP, -1, (int64_t)order->next_seq, 0);
+            }
+            order->next_seq++;
+        }
+    }
+
+    if(seq == order->next_seq)
+    {
+        send(recipient, message, ctx);
+        order->next_seq++;
+        delivery_order_drain(order, send, recipient);
+    }
+    else
+    {
+        struct HeldFrame *slot = &order->held[seq % SEQUENCER_WINDOW];
+
+        free(slot->message);
+        slot->seq     = seq;
+        slot->message = strdup(message);
+    }
+
+    pthread_mutex_unlock(&order->lock);
+}
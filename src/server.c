@@ -1,102 +1,743 @@
 #include "../include/server.h"
+#include "../include/chat_pool.h"
+#include "../include/coalesce.h"
+#include "../include/flight.h"
+#include "../include/handoff.h"
+#include "../include/history.h"
+#include "../include/log.h"
+#include "../include/metrics.h"
+#include "../include/probes.h"
 #include "../include/protocol.h"
+#include "../include/search_index.h"
+#include "../include/session.h"
+#include "../include/shm_ring.h"
+#include "../include/timestamping.h"
+#include "../include/trace.h"
+#include "../include/transport.h"
+#include "../include/wal.h"
+#include "../include/watchdog.h"
+#include "../include/zerocopy.h"
+#include <netinet/tcp.h>
+#include <stddef.h>
+
+static void apply_relayed_message(const struct ChatRelayMessage *message);
+static void admit_polled_client(int client_socket);
+
+// The signal that asked for a clean stop (SIGTERM from the server manager), dumped on the way out
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+static volatile sig_atomic_t group_chat_stop_signal = 0;
+
+// When the frame being dispatched was read off its connection (0 outside dispatch)
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+static uint64_t dispatch_recv_ns = 0;
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
 
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wcast-function-type-strict"
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * (uint64_t)NANOS_PER_SECOND + (uint64_t)ts.tv_nsec;
+}
 
-void *handle_client(const void *arg)
+// Sends the join history to a client that turned out not to be resuming
+static void finish_join(struct ClientInfo *client, const char *first_frame)
 {
-#pragma clang diagnostic pop
-    const struct ClientInfo *client_info     = (const struct ClientInfo *)arg;
-    int                      client_socket   = client_info->client_socket;
-    int                      client_index    = client_info->client_index;
-    const char              *client_username = client_info->username;
+    if(client->join_replay_ns != 0 && (first_frame == NULL || strncmp(first_frame, "/resume", strlen("/resume")) != 0))
+    {
+        client->join_replay_ns = 0;
+        replay_history(client->client_socket, client->join_seq);
+    }
+}
 
-    while(1)
+// Finishes joins whose grace period ran out; returns how long select may sleep before the next one (or NULL)
+static struct timeval *finish_due_joins(struct timeval *wait)
+{
+    uint64_t now  = transport_now_ns();
+    uint64_t next = 0;
+
+    for(int i = 0; i < MAX_CLIENTS; ++i)
+    {
+        if(clients[i].client_socket <= 0 || clients[i].join_replay_ns == 0)
+        {
+            continue;
+        }
+        if(clients[i].join_replay_ns <= now)
+        {
+            finish_join(&clients[i], NULL);
+        }
+        else if(next == 0 || clients[i].join_replay_ns < next)
+        {
+            next = clients[i].join_replay_ns;
+        }
+    }
+    if(next == 0)
+    {
+        return NULL;
+    }
+    wait->tv_sec  = (time_t)((next - now) / (uint64_t)NANOS_PER_SECOND);
+    wait->tv_usec = (suseconds_t)((next - now) % (uint64_t)NANOS_PER_SECOND / NANOS_PER_MICRO);
+    return wait;
+}
+
+// Handles one complete frame (size bytes of content) from a client and records how long that took;
+// sends made for a sampled frame (trace_id != 0) are traced under its id
+static void dispatch_frame(struct ClientInfo *client, const char *buffer, size_t size, uint64_t trace_id)
+{
+    int      client_socket = client->client_socket;
+    uint64_t start         = monotonic_ns();
+    uint64_t end;
+
+    LOG_DEBUG("Received from %s: %s\n", client->username, buffer);
+    GROUPCHAT_PROBE(dispatch, client_socket, size, client->client_index);
+    trace_set_current(trace_id);
+    dispatch_recv_ns = client->input_recv_ns;
+    finish_join(client, buffer);
+    handle_message(buffer, client_socket);
+    dispatch_recv_ns = 0;
+    trace_set_current(0);
+    end = monotonic_ns();
+    metrics_record(METRIC_DISPATCH_NS, end - start);
+    if(trace_id != 0)
+    {
+        trace_record(trace_id, TRACE_DISPATCH, start, end, client_socket);
+    }
+}
+
+// Reads and dispatches the client's frames within its per-iteration budget.
+// Returns CLIENT_IDLE once it has drained, CLIENT_THROTTLED if the budget ran out first, CLIENT_GONE on disconnect.
+int handle_client_input(int client_index)
+{
+    struct ClientInfo *client        = &clients[client_index];
+    int                client_socket = client->client_socket;
+    struct ShmChannel *channel       = shm_transport_lookup(client_socket);
+    char               buffer[BUFFER_SIZE];
+    uint8_t            version;
+    size_t             offset     = 0;
+    size_t             bytes      = 0;
+    int                frames     = 0;
+    int                status     = CLIENT_THROTTLED;
+    size_t             consumed   = 0;
+    uint64_t           trace_id   = 0;    // the next frame to complete is sampled
+    uint64_t           recv_start = 0;
+    uint64_t           recv_end   = 0;
+
+    if(channel != NULL)
     {
-        char    buffer[BUFFER_SIZE];
-        uint8_t version;
+        char    probe;
         ssize_t bytes_received;
 
-        // Read the message with protocol
-        bytes_received = read_with_protocol(client_socket, &version, buffer, BUFFER_SIZE);
+        while(frames < READ_BUDGET_FRAMES && bytes < READ_BUDGET_BYTES)
+        {
+            // The ring hands over whole frames, so receiving and decoding are one step here
+            trace_id       = trace_sample();
+            recv_start     = trace_id != 0 ? trace_now_ns() : 0;
+            bytes_received = shm_channel_try_recv(channel, &version, buffer, BUFFER_SIZE);
+            if(bytes_received <= 0)
+            {
+                status = CLIENT_IDLE;
+                break;
+            }
+            client->input_recv_ns = transport_now_ns();
+            if(trace_id != 0)
+            {
+                trace_record(trace_id, TRACE_RECV, recv_start, trace_now_ns(), client_socket);
+            }
+            frames++;
+            bytes += (size_t)bytes_received + PROTOCOL_HEADER_SIZE;
+            GROUPCHAT_PROBE(frame_decode, client_socket, bytes_received, client_index);
+            dispatch_frame(client, buffer, (size_t)bytes_received, trace_id);
+        }
+        client->frames_in += (uint64_t)frames;
+        client->bytes_in += bytes;
+        metrics_add(METRIC_FRAMES_IN, (uint64_t)frames);
+        metrics_add(METRIC_BYTES_IN, bytes);
+
+        // The control socket only ever becomes readable when the local client goes away
+        if(transport_recv(client_socket, &probe, sizeof(probe), MSG_DONTWAIT) == 0)
+        {
+            return CLIENT_GONE;
+        }
+        return status;
+    }
+
+    while(frames < READ_BUDGET_FRAMES)
+    {
+        ssize_t  bytes_received;
+        size_t   room;
+        uint64_t decode_start;
+        uint64_t kernel_rx_ns = 0;
+        int      parsed;
+
+        // Sample the frame at the front; its recv is only timed if it has not fully arrived yet
+        if(trace_id == 0)
+        {
+            trace_id   = trace_sample();
+            recv_start = 0;
+            recv_end   = 0;
+        }
+        decode_start = trace_id != 0 ? trace_now_ns() : 0;
+        parsed       = parse_frame(client->input + offset, client->input_len - offset, &version, buffer, BUFFER_SIZE, &consumed);
+
+        if(parsed == 1)
+        {
+            offset += consumed;
+            frames++;
+            if(trace_id != 0)
+            {
+                if(recv_end != 0)
+                {
+                    trace_record(trace_id, TRACE_RECV, recv_start, recv_end, client_socket);
+                }
+                trace_record(trace_id, TRACE_DECODE, decode_start, trace_now_ns(), client_socket);
+            }
+            if(client->input_kernel_rx_ns != 0)
+            {
+                metrics_record(METRIC_KERNEL_RX_TO_APP_NS, monotonic_ns() - client->input_kernel_rx_ns);
+            }
+            GROUPCHAT_PROBE(frame_decode, client_socket, consumed - PROTOCOL_HEADER_SIZE, client_index);
+            dispatch_frame(client, buffer, consumed - PROTOCOL_HEADER_SIZE, trace_id);
+            trace_id = 0;
+            continue;
+        }
+        if(parsed == -1)
+        {
+            return CLIENT_GONE;
+        }
+        if(bytes >= READ_BUDGET_BYTES)
+        {
+            break;
+        }
+
+        // Keep the partial frame at the front and read more behind it
+        memmove(client->input, client->input + offset, client->input_len - offset);
+        client->input_len -= offset;
+        offset = 0;
 
-        if(bytes_received <= 0)
+        room = CLIENT_INPUT_SIZE - client->input_len;
+        if(room > READ_BUDGET_BYTES - bytes)
+        {
+            room = READ_BUDGET_BYTES - bytes;
+        }
+        recv_start     = trace_id != 0 ? trace_now_ns() : 0;
+        if(TIMESTAMPING_ENABLED)
+        {
+            bytes_received = timestamping_recv(client_socket, client->input + client->input_len, room, MSG_DONTWAIT, &kernel_rx_ns);
+        }
+        else
+        {
+            bytes_received = transport_recv(client_socket, client->input + client->input_len, room, MSG_DONTWAIT);
+        }
+        recv_end       = trace_id != 0 ? trace_now_ns() : 0;
+        if(bytes_received == 0)
+        {
+            return CLIENT_GONE;
+        }
+        if(bytes_received < 0)
         {
-            printf("%s left the chat.\n", client_username);
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                return CLIENT_GONE;
+            }
+            status = CLIENT_IDLE;
             break;
         }
+        client->input_len += (size_t)bytes_received;
+        client->input_recv_ns = transport_now_ns();
+        if(kernel_rx_ns != 0)
+        {
+            client->input_kernel_rx_ns = kernel_rx_ns;
+        }
+        bytes += (size_t)bytes_received;
+    }
 
-        // Null-terminate the message (if not already done by read_with_protocol)
-        buffer[bytes_received] = '\0';
+    memmove(client->input, client->input + offset, client->input_len - offset);
+    client->input_len -= offset;
+    client->frames_in += (uint64_t)frames;
+    client->bytes_in += bytes;
+    metrics_add(METRIC_FRAMES_IN, (uint64_t)frames);
+    metrics_add(METRIC_BYTES_IN, bytes);
+    return status;
+}
 
-        // Process the message
-        printf("Received from %s: %s\n", client_username, buffer);
-        handle_message(buffer, client_socket);
+// Services one client and charges the wall-clock and CPU time it took to that client
+static int service_client(int client_index)
+{
+    struct ClientInfo *client = &clients[client_index];
+    struct timespec    wall_start;
+    struct timespec    cpu_start;
+    struct timespec    wall_end;
+    struct timespec    cpu_end;
+    int                status;
+
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+    status = handle_client_input(client_index);
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+
+    client->busy_ns += (uint64_t)((wall_end.tv_sec - wall_start.tv_sec) * NANOS_PER_SECOND + (wall_end.tv_nsec - wall_start.tv_nsec));
+    client->cpu_ns += (uint64_t)((cpu_end.tv_sec - cpu_start.tv_sec) * NANOS_PER_SECOND + (cpu_end.tv_nsec - cpu_start.tv_nsec));
+    if(status == CLIENT_THROTTLED)
+    {
+        client->throttled++;
+    }
+    return status;
+}
+
+// Moves the throttled clients to the back of the service order, keeping their relative order
+static void rotate_service_order(const int *throttled, int throttled_count)
+{
+    int order[MAX_CLIENTS];
+    int count = 0;
+
+    for(int p = 0; p < MAX_CLIENTS; ++p)
+    {
+        int keep = 1;
+        for(int t = 0; t < throttled_count; ++t)
+        {
+            if(service_order[p] == throttled[t])
+            {
+                keep = 0;
+                break;
+            }
+        }
+        if(keep)
+        {
+            order[count++] = service_order[p];
+        }
+    }
+    for(int t = 0; t < throttled_count; ++t)
+    {
+        order[count++] = throttled[t];
+    }
+    memcpy(service_order, order, sizeof(order));
+}
+
+// Passes this worker's clients to its hot restart successor on channel: where it stopped in the relay, the
+// shared-memory listener and every TCP client with its socket and unparsed input. The resume sessions stay
+// where they are, in the pool's shared table. Shared-memory clients cannot be moved; they are let go and
+// reconnect.
+static void hand_off(int channel, int shm_listen_fd)
+{
+    struct HandoffBegin  begin;
+    struct ClientHandoff record;
+    int                  handed = 0;
+
+    // Whatever is queued goes out first; the successor recovers the room log from disk and takes over the stats
+    coalesce_end_tick();
+    wal_close();
+    metrics_publish_now(monotonic_ns());
+
+    begin.ring_position = chat_pool_position();
+    begin.room_seq      = sequencer_last();
+    if(handoff_send(channel, HANDOFF_BEGIN, &begin, sizeof(begin), -1) == -1)
+    {
+        return;
+    }
+    if(shm_listen_fd != -1)
+    {
+        handoff_send(channel, HANDOFF_LISTENER, NULL, 0, shm_listen_fd);
+    }
+
+    for(int i = 0; i < MAX_CLIENTS; ++i)
+    {
+        if(clients[i].client_socket == 0)
+        {
+            continue;
+        }
+        if(shm_transport_lookup(clients[i].client_socket) != NULL)
+        {
+            session_detach(i);
+            continue;
+        }
+
+        memset(&record, 0, offsetof(struct ClientHandoff, input));
+        record.client_index      = i;
+        record.throttled_pending = clients[i].throttled_pending;
+        snprintf(record.username, sizeof(record.username), "%s", clients[i].username);
+        record.join_replay_ns = clients[i].join_replay_ns;
+        record.join_seq       = clients[i].join_seq;
+        record.next_seq       = clients[i].order.next_seq;
+        record.frames_in      = clients[i].frames_in;
+        record.bytes_in       = clients[i].bytes_in;
+        record.busy_ns        = clients[i].busy_ns;
+        record.cpu_ns         = clients[i].cpu_ns;
+        record.throttled      = clients[i].throttled;
+        record.ts_bytes_sent  = timestamping_bytes_sent(clients[i].client_socket);
+        record.input_len      = (uint32_t)clients[i].input_len;
+        memcpy(record.input, clients[i].input, clients[i].input_len);
+        if(handoff_send(channel, HANDOFF_CLIENT, &record, offsetof(struct ClientHandoff, input) + clients[i].input_len, clients[i].client_socket) == 0)
+        {
+            handed++;
+        }
+        else
+        {
+            session_detach(i);
+        }
+    }
+    handoff_send(channel, HANDOFF_END, NULL, 0, -1);
+    LOG_INFO("Handed %d client(s) over to the restarted worker\n", handed);
+}
+
+// Puts a client the predecessor handed over back in its slot, as it was
+static int adopt_client(const struct ClientHandoff *record, size_t len, int client_socket)
+{
+    int i = record->client_index;
+
+    if(i < 0 || i >= MAX_CLIENTS || clients[i].client_socket != 0 || record->input_len > CLIENT_INPUT_SIZE || len != offsetof(struct ClientHandoff, input) + record->input_len)
+    {
+        return -1;
     }
 
-    // Cleanup when the client disconnects
-    close(client_socket);
-    client_count--;
-    printf("Population: %d/%d\n", client_count, MAX_CLIENTS);
-    fflush(stdout);
     pthread_mutex_lock(&clients_mutex);
-    clients[client_index].client_socket = 0;
+    clients[i].client_socket      = client_socket;
+    clients[i].client_index       = i;
+    clients[i].input_len          = record->input_len;
+    clients[i].input_recv_ns      = 0;
+    clients[i].input_kernel_rx_ns = 0;
+    clients[i].throttled_pending  = record->throttled_pending;
+    clients[i].join_replay_ns     = record->join_replay_ns;
+    clients[i].join_seq           = record->join_seq;
+    clients[i].frames_in          = record->frames_in;
+    clients[i].bytes_in           = record->bytes_in;
+    clients[i].busy_ns            = record->busy_ns;
+    clients[i].cpu_ns             = record->cpu_ns;
+    clients[i].throttled          = record->throttled;
+    memcpy(clients[i].input, record->input, record->input_len);
+    snprintf(clients[i].username, MAX_USERNAME_SIZE, "%s", record->username);
+    delivery_order_reset(&clients[i].order, record->next_seq);
+    client_count++;
     pthread_mutex_unlock(&clients_mutex);
 
-    pthread_exit(NULL);
+    metrics_set(METRIC_CONNECTIONS, client_count);
+    chat_pool_name_set(i, clients[i].username);
+    flight_record(FLIGHT_ACCEPT, client_socket, i, client_count);
+    coalesce_register(client_socket);
+    if(ZEROCOPY_ENABLED)
+    {
+        zerocopy_enable(client_socket);
+    }
+    if(TIMESTAMPING_ENABLED)
+    {
+        timestamping_adopt(client_socket, record->ts_bytes_sent);
+    }
+    return 0;
+}
+
+// Takes over what the predecessor passes on channel, up to its end record; returns the shared-memory
+// listener it passed, or -1
+static int adopt_handoff(int channel)
+{
+    struct ClientHandoff record;
+    uint32_t             kind;
+    ssize_t              len;
+    int                  fd;
+    int                  shm_listen_fd = -1;
+    int                  adopted       = 0;
+
+    while((len = handoff_recv(channel, &kind, &record, sizeof(record), &fd)) != -1 && kind != HANDOFF_END)
+    {
+        if(kind == HANDOFF_LISTENER && fd != -1)
+        {
+            shm_listen_fd = fd;
+            fd            = -1;
+        }
+        else if(kind == HANDOFF_CLIENT && fd != -1 && adopt_client(&record, (size_t)len, fd) == 0)
+        {
+            adopted++;
+            fd = -1;
+        }
+        else if(kind == HANDOFF_CLIENT && record.client_index >= 0 && record.client_index < MAX_CLIENTS && clients[record.client_index].client_socket == 0)
+        {
+            // Its session is still marked as held by this worker's slot
+            session_detach(record.client_index);
+        }
+        if(fd != -1)
+        {
+            close(fd);
+        }
+    }
+    LOG_INFO("Took over %d client(s) from the previous worker\n", adopted);
+    return shm_listen_fd;
+}
+
+// Admits the connections already queued on a draining worker's listen socket, then closes it. One the kernel
+// queues between the last accept and the close is reset, unless net.ipv4.tcp_migrate_req moves it to another
+// worker (see README).
+static void stop_accepting(int server_socket)
+{
+    struct sockaddr_storage client_addr;
+    socklen_t               client_addr_len;
+    fd_set                  readfds;
+    struct timeval          no_wait;
+    int                     client_socket;
+
+    while(1)
+    {
+        FD_ZERO(&readfds);
+        FD_SET(server_socket, &readfds);
+        memset(&no_wait, 0, sizeof(no_wait));
+        if(select(server_socket + 1, &readfds, NULL, NULL, &no_wait) != 1)
+        {
+            break;
+        }
+        client_addr_len = sizeof(client_addr);
+        client_socket   = socket_accept_connection(server_socket, &client_addr, &client_addr_len);
+        if(client_socket == -1)
+        {
+            break;
+        }
+        admit_polled_client(client_socket);
+    }
+    socket_close(server_socket);
+    LOG_INFO("Draining: no longer accepting, %d client(s) left\n", client_count);
 }
 
-void start_groupChat_server(struct sockaddr_storage *addr, in_port_t port, int sm_socket, int pipe_write_fd)
+void start_groupChat_server(struct sockaddr_storage *addr, in_port_t port, int sm_socket)
 {
     int                     server_socket;
     struct sockaddr_storage client_addr;
     socklen_t               client_addr_len;
-    pthread_t               tid;
-    uint8_t                 version = PROTOCOL_VERSION;
+    uint8_t                 version       = PROTOCOL_VERSION;
+    int                     shm_listen_fd = -1;
+    int                     throttled[MAX_CLIENTS];
+    int                     throttled_count = 0;
+    int                     stats_pending   = 1;
+    uint64_t                iteration_start = 0;
+    uint64_t                iteration_end;
+    struct ZeroCopyStats    zc_stats;
+    struct WalStats         wal_stats;
+    char                    flight_path[BUFFER_SIZE];
+    int                     worker       = chat_pool_worker();
+    int                     relay_fd     = chat_pool_event_fd();
+    int                     handoff_fd   = chat_pool_handoff_fd();
+    int                     successor_fd = -1;
+    struct HandoffBegin     begin;
+    uint32_t                begin_kind;
+    int                     begin_fd;
+
+    // A pool worker accepts on the socket the wrapper opened for it; the other workers share the port
+    if(worker >= 0)
+    {
+        server_socket = chat_pool_listen_socket();
+        snprintf(flight_path, sizeof(flight_path), FLIGHT_WORKER_FILE_FORMAT, (unsigned int)port, worker);
+    }
+    else
+    {
+        server_socket = socket_create(addr->ss_family, SOCK_STREAM, 0);
+        socket_bind(server_socket, addr, port);
+        start_listening(server_socket, BASE_TEN);
+        snprintf(flight_path, sizeof(flight_path), FLIGHT_FILE_FORMAT, (unsigned int)port);
+    }
 
-    server_socket = socket_create(addr->ss_family, SOCK_STREAM, 0);
-    socket_bind(server_socket, addr, port);
-    start_listening(server_socket, BASE_TEN);
+    // A hot restart's successor goes on once its predecessor has stopped serving and closed the room log
+    if(handoff_fd != -1)
+    {
+        handoff_set_timeout(handoff_fd, HANDOFF_TIMEOUT_MS);
+        if(handoff_recv(handoff_fd, &begin_kind, &begin, sizeof(begin), &begin_fd) != (ssize_t)sizeof(begin) || begin_kind != HANDOFF_BEGIN)
+        {
+            fprintf(stderr, "No handoff from the previous worker, starting afresh\n");
+            chat_pool_handoff_done();
+            handoff_fd = -1;
+        }
+    }
+    flight_init(flight_path, FLIGHT_EVENTS_PER_THREAD);
+    flight_record(FLIGHT_START, server_socket, port, 0);
     group_chat_setup_signal_handler();
+    log_start();
+    metrics_start(METRICS_PUBLISH_INTERVAL_MS * NANOS_PER_MILLI);
+    if(handoff_fd != -1)
+    {
+        metrics_adopt_page();
+    }
+    trace_init(TRACE_SAMPLE_INTERVAL, TRACE_SPANS_PER_THREAD);
+    if(watchdog_start(WATCHDOG_THRESHOLD_MS * NANOS_PER_MILLI, WATCHDOG_INTERVAL_MS * NANOS_PER_MILLI) == -1)
+    {
+        LOG_WARN("Continuing without the event loop watchdog\n");
+    }
+
+    // The shared-memory socket path and the room log are per port, so in a pool only worker 0 has them
+    if(SHM_TRANSPORT_ENABLED && worker <= 0 && handoff_fd == -1)
+    {
+        shm_listen_fd = shm_listener_create(port);
+    }
+
+    if(history_init(HISTORY_CAPACITY_BYTES, HISTORY_MAX_ENTRIES) == -1)
+    {
+        LOG_WARN("Continuing without room history\n");
+    }
+
+    // A pool shares one table, so a token works on any worker; one that starts afresh lets go of the sessions
+    // its crashed predecessor's clients held
+    if(chat_pool_sessions() != NULL)
+    {
+        session_share(chat_pool_sessions(), worker, (uint64_t)SESSION_TTL_SECONDS * (uint64_t)NANOS_PER_SECOND);
+        if(handoff_fd == -1)
+        {
+            session_detach_all();
+        }
+    }
+    else if(session_init(SESSION_MAX, (uint64_t)SESSION_TTL_SECONDS * (uint64_t)NANOS_PER_SECOND) == -1)
+    {
+        LOG_WARN("Continuing without resume tokens\n");
+    }
+
+    if(search_index_init(SEARCH_MEMORY_BYTES, SEARCH_BLOCK_MESSAGES) == -1)
+    {
+        LOG_WARN("Continuing without /search\n");
+    }
 
-    // Allocate memory for usernames
+    if(WAL_ENABLED && worker <= 0)
+    {
+        char     wal_directory[BUFFER_SIZE];
+        uint64_t last_seq;
+
+        snprintf(wal_directory, sizeof(wal_directory), WAL_DIRECTORY_FORMAT, (unsigned int)port);
+        if(wal_open(wal_directory, WAL_SEGMENT_BYTES, WAL_MAX_SEGMENTS, WAL_COMMIT_INTERVAL_MS, WAL_COMMIT_MESSAGES, recover_history_frame, &last_seq) == -1)
+        {
+            LOG_WARN("Continuing without the write-ahead log\n");
+        }
+        else
+        {
+            sequencer_restore(last_seq);
+            LOG_INFO("Recovered room log up to message #%" PRIu64 "\n", last_seq);
+        }
+    }
+
+    // Worker 0 owns the log; the others take no message until it has said where the numbering goes on
+    if(worker == 0)
+    {
+        chat_pool_restore_seq(sequencer_last());
+    }
+    else if(worker > 0)
+    {
+        chat_pool_await_seq(&group_chat_exit_flag);
+    }
+
+    allocate_client_buffers();
     for(int i = 0; i < MAX_CLIENTS; ++i)
     {
-        clients[i].username = malloc(MAX_USERNAME_SIZE);
-        if(clients[i].username == NULL)
+        service_order[i] = i;
+    }
+    if(handoff_fd != -1)
+    {
+        chat_pool_attach_at(apply_relayed_message, begin.ring_position);
+        if(sequencer_last() < begin.room_seq)
         {
-            perror("Memory allocation failed");
-            free_usernames();
-            exit(EXIT_FAILURE);
+            sequencer_restore(begin.room_seq);
         }
+        shm_listen_fd = adopt_handoff(handoff_fd);
+        chat_pool_handoff_done();
+        chat_pool_drain(apply_relayed_message);
+    }
+    else if(worker >= 0)
+    {
+        chat_pool_attach(apply_relayed_message);
     }
 
     while(!group_chat_exit_flag)
     {
-        int    max_sd;
-        int    activity;
-        fd_set readfds;
+        int            max_sd;
+        int            activity;
+        fd_set         readfds;
+        struct timeval no_wait;
+        struct timeval join_wait;
+        struct timeval publish_wait;
+        struct timeval *timeout;
+        int             pool_control_fd = chat_pool_control_fd();
         memset(&readfds, 0, sizeof(readfds));
-        FD_SET(server_socket, &readfds);
         FD_SET(STDIN_FILENO, &readfds);
         FD_SET(sm_socket, &readfds);
-        FD_SET(pipe_write_fd, &readfds);
-        max_sd = server_socket;
+        max_sd = sm_socket > STDIN_FILENO ? sm_socket : STDIN_FILENO;
+        if(server_socket != -1)
+        {
+            FD_SET(server_socket, &readfds);
+            if(server_socket > max_sd)
+            {
+                max_sd = server_socket;
+            }
+        }
+        if(shm_listen_fd != -1)
+        {
+            FD_SET(shm_listen_fd, &readfds);
+            if(shm_listen_fd > max_sd)
+            {
+                max_sd = shm_listen_fd;
+            }
+        }
+        if(relay_fd != -1)
+        {
+            FD_SET(relay_fd, &readfds);
+            if(relay_fd > max_sd)
+            {
+                max_sd = relay_fd;
+            }
+        }
+        if(pool_control_fd != -1)
+        {
+            FD_SET(pool_control_fd, &readfds);
+            if(pool_control_fd > max_sd)
+            {
+                max_sd = pool_control_fd;
+            }
+        }
         for(int i = 0; i < MAX_CLIENTS; ++i)
         {
             if(clients[i].client_socket > 0)    // Check if the client socket is valid
             {
+                const struct ShmChannel *channel = shm_transport_lookup(clients[i].client_socket);
+
                 FD_SET(clients[i].client_socket, &readfds);
                 if(clients[i].client_socket > max_sd)
                 {
                     max_sd = clients[i].client_socket;
                 }
+                if(channel != NULL)
+                {
+                    FD_SET(channel->rx_event_fd, &readfds);
+                    if(channel->rx_event_fd > max_sd)
+                    {
+                        max_sd = channel->rx_event_fd;
+                    }
+                }
+            }
+        }
+
+        // Wait for activity on one of the sockets; don't sleep while a throttled client still has input,
+        // past the end of a joiner's resume grace period, or for long with unpublished stats
+        memset(&no_wait, 0, sizeof(no_wait));
+        timeout = finish_due_joins(&join_wait);
+        if(stats_pending && (timeout == NULL || timeout->tv_sec > 0 || timeout->tv_usec > METRICS_PUBLISH_INTERVAL_MS * MICROS_PER_MILLI))
+        {
+            publish_wait.tv_sec  = 0;
+            publish_wait.tv_usec = METRICS_PUBLISH_INTERVAL_MS * MICROS_PER_MILLI;
+            timeout              = &publish_wait;
+        }
+        watchdog_idle();
+        activity        = select(max_sd + 1, &readfds, NULL, NULL, throttled_count > 0 ? &no_wait : timeout);
+        iteration_start = monotonic_ns();
+        watchdog_busy(iteration_start);
+
+        if(trace_export_flag)
+        {
+            char trace_path[BUFFER_SIZE];
+
+            trace_export_flag = 0;
+            watchdog_operation("trace export", -1);
+            if(worker >= 0)
+            {
+                snprintf(trace_path, sizeof(trace_path), TRACE_WORKER_FILE_FORMAT, (unsigned int)port, worker);
+            }
+            else
+            {
+                snprintf(trace_path, sizeof(trace_path), TRACE_FILE_FORMAT, (unsigned int)port);
+            }
+            if(trace_export(trace_path) == 0)
+            {
+                LOG_INFO("Message traces written to %s\n", trace_path);
             }
         }
 
-        // Wait for activity on one of the sockets
-        activity = select(max_sd + 1, &readfds, NULL, NULL, NULL);
         if(activity == -1)
         {
             //             perror("select");
@@ -104,15 +745,11 @@ void start_groupChat_server(struct sockaddr_storage *addr, in_port_t port, int s
         }
 
         // New connection
-        if(FD_ISSET(server_socket, &readfds))
+        if(server_socket != -1 && FD_ISSET(server_socket, &readfds))
         {
-            uint16_t           content_size;
-            int                client_socket;
-            int                client_index = -1;
-            struct ClientInfo *client_info;
-            char               welcome_message[BUFFER_SIZE];
-            ssize_t            bytes_written;
+            int client_socket;
 
+            watchdog_operation("accept", server_socket);
             client_addr_len = sizeof(client_addr);
             client_socket   = socket_accept_connection(server_socket, &client_addr, &client_addr_len);
 
@@ -122,124 +759,567 @@ void start_groupChat_server(struct sockaddr_storage *addr, in_port_t port, int s
                 continue;    // Continue listening for connections
             }
 
-            pthread_mutex_lock(&clients_mutex);
+            LOG_INFO("\nNew connection from %s:%d\n", inet_ntoa(((struct sockaddr_in *)&client_addr)->sin_addr), ntohs(((struct sockaddr_in *)&client_addr)->sin_port));
+            admit_polled_client(client_socket);
+        }
 
-            for(int i = 0; i < MAX_CLIENTS; ++i)
+        // New local client over shared memory
+        if(shm_listen_fd != -1 && FD_ISSET(shm_listen_fd, &readfds))
+        {
+            struct ShmChannel *channel = (struct ShmChannel *)malloc(sizeof(struct ShmChannel));
+            int                control_fd;
+
+            if(channel == NULL)
             {
-                if(clients[i].client_socket == 0)
-                {
-                    client_index = i;
-                    client_count++;
-                    break;
-                }
+                perror("Memory allocation failed");
+                continue;
             }
 
-            if(client_index == -1)
+            watchdog_operation("shared-memory accept", shm_listen_fd);
+            control_fd = shm_channel_accept(shm_listen_fd, channel);
+            if(control_fd == -1)
             {
-                const char *rejection_message = SERVER_FULL;
-                // Use send_with_protocol to include the protocol header
-                if(send_with_protocol(client_socket, version, rejection_message) == -1)
-                {
-                    perror("Error sending rejection message");
-                }
-                close(client_socket);
-                pthread_mutex_unlock(&clients_mutex);
-                continue;    // Continue listening for connections
+                free(channel);
+                continue;
+            }
+
+            LOG_INFO("\nNew shared-memory connection\n");
+            shm_transport_register(control_fd, channel);
+            admit_polled_client(control_fd);
+        }
+
+        // Room messages and whispers from the other pool workers
+        if(relay_fd != -1 && FD_ISSET(relay_fd, &readfds))
+        {
+            watchdog_operation("relay", relay_fd);
+            chat_pool_drain(apply_relayed_message);
+        }
+
+        // Hot restart: the clients go to the successor as they are, so stop serving them here. Draining:
+        // the port is left to the other workers, and this one stops once its clients are gone.
+        if(pool_control_fd != -1 && FD_ISSET(pool_control_fd, &readfds))
+        {
+            int request = chat_pool_take_control(&successor_fd);
+
+            if(request == CHAT_POOL_CONTROL_HANDOFF)
+            {
+                break;
+            }
+            if(request == CHAT_POOL_CONTROL_DRAIN && server_socket != -1)
+            {
+                watchdog_operation("drain", server_socket);
+                stop_accepting(server_socket);
+                server_socket = -1;
+            }
+        }
+
+        // Client traffic, in service order; anyone who uses up their budget goes to the back
+        throttled_count = 0;
+        for(int p = 0; p < MAX_CLIENTS; ++p)
+        {
+            const struct ShmChannel *channel;
+            int                      i             = service_order[p];
+            int                      client_socket = clients[i].client_socket;
+            int                      status;
+
+            if(client_socket <= 0)
+            {
+                continue;
+            }
+
+            channel = shm_transport_lookup(client_socket);
+            if(!clients[i].throttled_pending && !FD_ISSET(client_socket, &readfds) && (channel == NULL || !FD_ISSET(channel->rx_event_fd, &readfds)))
+            {
+                continue;
+            }
+
+            watchdog_operation("service client", client_socket);
+
+            // Collect finished zero-copy sends and TX timestamps before the socket is read
+            if(zerocopy_pending(client_socket))
+            {
+                zerocopy_reap(client_socket);
+            }
+            if(TIMESTAMPING_ENABLED)
+            {
+                timestamping_reap(client_socket);
             }
 
-            printf("\nNew connection from %s:%d, assigned to Client%d\n", inet_ntoa(((struct sockaddr_in *)&client_addr)->sin_addr), ntohs(((struct sockaddr_in *)&client_addr)->sin_port), client_index + 1);
-            printf("Population: %d/%d\n", client_count, MAX_CLIENTS);
+            status                       = service_client(i);
+            clients[i].throttled_pending = status == CLIENT_THROTTLED;
+            if(status == CLIENT_THROTTLED)
+            {
+                throttled[throttled_count++] = i;
+                flight_record(FLIGHT_THROTTLED, client_socket, i, (int64_t)clients[i].frames_in);
+            }
+            else if(status == CLIENT_GONE)
+            {
+                LOG_INFO("%s left the chat. (frames: %" PRIu64 ", bytes: %" PRIu64 ", busy: %" PRIu64 "us, cpu: %" PRIu64 "us, throttled: %" PRIu64 ")\n",
+                         clients[i].username,
+                         clients[i].frames_in,
+                         clients[i].bytes_in,
+                         clients[i].busy_ns / NANOS_PER_MICRO,
+                         clients[i].cpu_ns / NANOS_PER_MICRO,
+                         clients[i].throttled);
+                GROUPCHAT_PROBE(connection_close, client_socket, clients[i].bytes_in, i);
+                flight_record(FLIGHT_DISCONNECT, client_socket, i, (int64_t)clients[i].bytes_in);
+                release_client(i);
+                LOG_INFO("Population: %d/%d\n", client_count, MAX_CLIENTS);
+            }
+        }
+        if(throttled_count > 0)
+        {
+            rotate_service_order(throttled, throttled_count);
+        }
 
-            // Send the updated client count to the admin server
-            bytes_written = write(pipe_write_fd, &client_count, sizeof(client_count));
+        // Everything produced during this iteration goes out now
+        watchdog_operation("flush output", -1);
+        coalesce_end_tick();
+        iteration_end = monotonic_ns();
+        metrics_record(METRIC_LOOP_BUSY_NS, iteration_end - iteration_start);
+        stats_pending = metrics_publish(iteration_end);
+        if(server_socket == -1 && client_count == 0)
+        {
+            LOG_INFO("Drained, leaving the port to the other workers\n");
+            break;
+        }
+    }
 
-            if(bytes_written != sizeof(client_count))
+    flight_record(FLIGHT_STOP, server_socket, 0, client_count);
+    if(group_chat_stop_signal != 0)
+    {
+        flight_dump(group_chat_stop_signal);
+    }
+    if(successor_fd != -1)
+    {
+        watchdog_operation("hand off", successor_fd);
+        hand_off(successor_fd, shm_listen_fd);
+        close(successor_fd);
+    }
+    else
+    {
+        for(int i = 0; i < MAX_CLIENTS; ++i)
+        {
+            if(clients[i].client_socket != 0)
             {
-                perror("Failed to write client count to pipe");
+                if(send_with_protocol(clients[i].client_socket, version, SHUTDOWN_MESSAGE) == -1)
+                {
+                    perror("Error sending shutdown message with protocol");
+                }
             }
-            printf("client count sending to wrapper: %d\n", client_count);
+        }
+    }
+
+    // Everything queued is written out before the summary below
+    watchdog_stop();
+    log_stop();
+    zerocopy_get_stats(&zc_stats);
+    printf("Broadcast sends: %" PRIu64 " copied (%" PRIu64 " bytes), %" PRIu64 " zero-copy (%" PRIu64 " bytes, %" PRIu64 " completed, %" PRIu64 " copied by kernel, %" PRIu64 " fallbacks)\n",
+           zc_stats.copy_sends,
+           zc_stats.copy_bytes,
+           zc_stats.zerocopy_sends,
+           zc_stats.zerocopy_bytes,
+           zc_stats.completions,
+           zc_stats.kernel_copied,
+           zc_stats.fallbacks);
+    if(WAL_ENABLED)
+    {
+        wal_get_stats(&wal_stats);
+        printf("Room log: %" PRIu64 " frames in %" PRIu64 " commits (largest %" PRIu64 "), %" PRIu64 " bytes, %" PRIu64 " segments (%" PRIu64 " deleted), %" PRIu64 " loop waits\n",
+               wal_stats.frames,
+               wal_stats.commits,
+               wal_stats.max_batch,
+               wal_stats.bytes,
+               wal_stats.segments,
+               wal_stats.deleted_segments,
+               wal_stats.appender_waits);
+    }
+    if(TIMESTAMPING_ENABLED)
+    {
+        struct TimestampingStats ts_stats;
+
+        timestamping_get_stats(&ts_stats);
+        printf("Kernel timestamps: %" PRIu64 " RX, %" PRIu64 " TX for %" PRIu64 " sends (%" PRIu64 " sends untimed, pending list full)\n",
+               ts_stats.rx_timestamps,
+               ts_stats.tx_timestamps,
+               ts_stats.sends_tracked,
+               ts_stats.sends_untracked);
+    }
+
+    // Close server socket; a pool worker's is still the wrapper's, which forks the replacement onto it
+    if(worker < 0)
+    {
+        shutdown(server_socket, SHUT_RDWR);
+    }
+    if(server_socket != -1)
+    {
+        socket_close(server_socket);
+    }
+    if(successor_fd != -1 && shm_listen_fd != -1)
+    {
+        close(shm_listen_fd);    // the successor listens on it now
+    }
+    else
+    {
+        shm_listener_close(shm_listen_fd, port);
+    }
+    wal_close();
+    search_index_free();
+    session_free();
+    history_free();
+    free_client_buffers();
+}
+
+// Tells a connection there is no room for it and closes it
+static void reject_client(int client_socket)
+{
+    // Use send_with_protocol to include the protocol header
+    if(send_with_protocol(client_socket, PROTOCOL_VERSION, SERVER_FULL) == -1)
+    {
+        perror("Error sending rejection message");
+    }
+    shm_transport_release(client_socket);
+    transport_close(client_socket);
+    metrics_add(METRIC_CONNECTIONS_REJECTED, 1);
+    flight_record(FLIGHT_REJECT, client_socket, 0, client_count);
+}
+
+// Admits a connection the event loop accepted; it select()s on every client, so a descriptor past FD_SETSIZE
+// is turned away like a full server
+static void admit_polled_client(int client_socket)
+{
+    if(client_socket >= FD_SETSIZE)
+    {
+        reject_client(client_socket);
+        return;
+    }
+    admit_client(client_socket);
+}
+
+// Takes a connected client (TCP or shared-memory), assigns it a slot and greets it
+int admit_client(int client_socket)
+{
+    int      client_index = -1;
+    char     welcome_message[BUFFER_SIZE];
+    char     token_message[BUFFER_SIZE];
+    char     token[SESSION_TOKEN_LENGTH + 1];
+    int      opt     = 1;
+    uint8_t  version = PROTOCOL_VERSION;
+    uint16_t number;
+
+    pthread_mutex_lock(&clients_mutex);
+
+    for(int i = 0; i < MAX_CLIENTS; ++i)
+    {
+        if(clients[i].client_socket == 0)
+        {
+            client_index = i;
+            client_count++;
+            break;
+        }
+    }
+
+    if(client_index == -1)
+    {
+        pthread_mutex_unlock(&clients_mutex);
+        reject_client(client_socket);
+        return 0;
+    }
+
+    // Default names stay unique across pool workers
+    number = (uint16_t)((chat_pool_worker() > 0 ? chat_pool_worker() * MAX_CLIENTS : 0) + client_index + 1);
+
+    GROUPCHAT_PROBE(connection_accept, client_socket, client_count, client_index);
+    flight_record(FLIGHT_ACCEPT, client_socket, client_index, client_count);
+    LOG_INFO("Assigned to Client%u\n", (unsigned int)number);
+    LOG_INFO("Population: %d/%d\n", client_count, MAX_CLIENTS);
+
+    // The wrapper picks the new count up from the stats page
+    metrics_add(METRIC_CONNECTIONS_ACCEPTED, 1);
+    metrics_set(METRIC_CONNECTIONS, client_count);
+
+    clients[client_index].client_socket      = client_socket;
+    clients[client_index].client_index       = client_index;
+    clients[client_index].input_len          = 0;
+    clients[client_index].input_recv_ns      = 0;
+    clients[client_index].input_kernel_rx_ns = 0;
+    clients[client_index].frames_in          = 0;
+    clients[client_index].bytes_in           = 0;
+    clients[client_index].busy_ns            = 0;
+    clients[client_index].cpu_ns             = 0;
+    clients[client_index].throttled          = 0;
+    clients[client_index].throttled_pending  = 0;
+    delivery_order_reset(&clients[client_index].order, sequencer_last() + 1);
+    snprintf(clients[client_index].username, MAX_USERNAME_SIZE, "Client%u", (unsigned int)number);
+    chat_pool_name_set(client_index, clients[client_index].username);
+
+    pthread_mutex_unlock(&clients_mutex);
+
+    // TCP clients: frames already leave in one write, so skip Nagle and let the coalescing layer batch
+    if(shm_transport_lookup(client_socket) == NULL)
+    {
+        if(transport_setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt)) == -1)
+        {
+            perror("setsockopt TCP_NODELAY");
+        }
+        coalesce_register(client_socket);
+        if(ZEROCOPY_ENABLED)
+        {
+            zerocopy_enable(client_socket);
+        }
+        if(TIMESTAMPING_ENABLED)
+        {
+            timestamping_enable(client_socket);
+        }
+    }
+
+    // Create the welcome message
+    sprintf(welcome_message, "%s%s!\n\n", WELCOME_MESSAGE, clients[client_index].username);
+
+    // Send the welcome message and the command list with protocol header
+    if(send_with_protocol(client_socket, version, welcome_message) == -1 || send_with_protocol(client_socket, version, COMMAND_LIST) == -1)
+    {
+        perror("Error sending welcome message");
+        release_client(client_index);
+        return -1;
+    }
+
+    if(session_create(client_index, clients[client_index].username, token) == 0)
+    {
+        snprintf(token_message, sizeof(token_message), RESUME_TOKEN_FORMAT, token);
+        if(send_with_protocol(client_socket, version, token_message) == -1)
+        {
+            perror("Error sending resume token");
+        }
+    }
+
+    // Hold the history back briefly: a reconnecting client sends /resume first and only needs what it missed
+    clients[client_index].join_seq       = sequencer_last();
+    clients[client_index].join_replay_ns = transport_now_ns() + SESSION_RESUME_GRACE_MS * NANOS_PER_MILLI;
+    return 0;
+}
+
+// Catches a new client up on the room traffic from before it joined (up to last_seq)
+void replay_history(int client_socket, uint64_t last_seq)
+{
+    struct iovec iov[HISTORY_SEGMENTS];
+    int          iov_count;
+    uint64_t     first_seq;
+
+    if(history_select(HISTORY_REPLAY_MESSAGES, HISTORY_REPLAY_SECONDS, last_seq, iov, &iov_count, &first_seq) > 0)
+    {
+        replay_range(client_socket, first_seq, last_seq);
+    }
+}
+
+// Sends the remembered room frames first_seq..last_seq, with one write straight out of the history ring
+void replay_range(int client_socket, uint64_t first_seq, uint64_t last_seq)
+{
+    struct iovec       iov[HISTORY_SEGMENTS];
+    int                iov_count;
+    struct ShmChannel *channel = shm_transport_lookup(client_socket);
+
+    if(last_seq >= first_seq)
+    {
+        metrics_add(METRIC_REPLAYED_FRAMES, last_seq - first_seq + 1);
+    }
+
+    if(channel != NULL)
+    {
+        if(history_select_range(first_seq, last_seq, iov, &iov_count) > 0 && shm_channel_send_raw(channel, iov, iov_count) == -1)
+        {
+            perror("Error replaying history");
+        }
+        return;
+    }
+
+    // Frames already queued for this client go first
+    coalesce_flush(client_socket);
+
+    // Whatever is already in the log goes file-to-socket; the ring only covers the uncommitted tail
+    if(WAL_ENABLED)
+    {
+        uint64_t next_seq = wal_replay(client_socket, first_seq, last_seq);
+        if(next_seq > first_seq)
+        {
+            first_seq = next_seq;
+        }
+    }
+
+    if(first_seq <= last_seq && history_select_range(first_seq, last_seq, iov, &iov_count) > 0 && send_iov_all(client_socket, iov, iov_count) == -1)
+    {
+        perror("Error replaying history");
+    }
+}
+
+// Puts a frame recovered from the write-ahead log back into the in-memory history
+void recover_history_frame(uint64_t seq, const uint8_t *frame, size_t len)
+{
+    char        content[MESSAGE_SIZE];
+    size_t      content_len = len - PROTOCOL_HEADER_SIZE;
+    const char *body;
+
+    history_append(seq, frame, PROTOCOL_HEADER_SIZE, (const char *)frame + PROTOCOL_HEADER_SIZE, content_len);
+
+    // Only the text after "[All #n] name: " was indexed originally
+    if(content_len >= sizeof(content))
+    {
+        content_len = sizeof(content) - 1;
+    }
+    memcpy(content, frame + PROTOCOL_HEADER_SIZE, content_len);
+    content[content_len] = '\0';
+    body                 = strstr(content, ": ");
+    search_index_add(seq, body != NULL ? body + 2 : content);
+}
+
+// Closes a client's connection and frees its slot
+void release_client(int client_index)
+{
+    pthread_mutex_lock(&clients_mutex);
+    coalesce_release(clients[client_index].client_socket);
+    zerocopy_release(clients[client_index].client_socket);
+    timestamping_release(clients[client_index].client_socket);
+    shm_transport_release(clients[client_index].client_socket);
+    session_detach(client_index);
+    chat_pool_name_set(client_index, "");
+    transport_close(clients[client_index].client_socket);
+    clients[client_index].client_socket  = 0;
+    clients[client_index].join_replay_ns = 0;
+    client_count--;
+    metrics_set(METRIC_CONNECTIONS, client_count);
+    pthread_mutex_unlock(&clients_mutex);
+}
+
+// Answers /ping [token] right away with when the server read the frame and when it replied,
+// so the client can split its round trip into time inside the server and time on the network
+static void send_pong(int sender_fd, const char *buffer)
+{
+    char     token[PING_TOKEN_SIZE] = "-";
+    char     response[BUFFER_SIZE];
+    uint64_t recv_ns = dispatch_recv_ns != 0 ? dispatch_recv_ns : transport_now_ns();
 
-            fflush(stdout);
+    sscanf(buffer, "/ping %31s", token);
+    snprintf(response, sizeof(response), PONG_FORMAT, token, recv_ns, transport_now_ns());
+    if(send_with_protocol(sender_fd, PROTOCOL_VERSION, response) == -1)
+    {
+        perror("Error sending pong with protocol");
+        return;
+    }
 
-            clients[client_index].client_socket = client_socket;
-            clients[client_index].client_index  = client_index;
-            snprintf(clients[client_index].username, MAX_USERNAME_SIZE, "Client%d", client_index + 1);
+    // A queued pong would report a send time that is not when it left
+    coalesce_flush(sender_fd);
+}
+
+// Numbers, stores and fans out one room message to every client of this process
+static void broadcast_room_message(uint64_t seq, const char *sender_name, const char *text, int sender_fd)
+{
+    char                   message_with_sender[MESSAGE_SIZE];
+    uint8_t                header[PROTOCOL_HEADER_SIZE];
+    size_t                 content_size;
+    struct ZeroCopyBuffer *shared_frame = NULL;
+    uint8_t                version      = PROTOCOL_VERSION;
+    uint64_t               start        = monotonic_ns();
+
+    snprintf(message_with_sender, sizeof(message_with_sender), ROOM_MESSAGE_FORMAT, seq, sender_name, text);
+
+    pthread_mutex_lock(&clients_mutex);
 
-            pthread_mutex_unlock(&clients_mutex);
+    // Keep the encoded frame for joiners; large frames are also handed to every socket without a per-recipient copy
+    content_size = strlen(message_with_sender);
+    encode_header(header, version, (uint16_t)content_size);
+    flight_record(FLIGHT_ROOM_MESSAGE, sender_fd, (int64_t)seq, (int64_t)content_size);
+    history_append(seq, header, sizeof(header), message_with_sender, content_size);
+    search_index_add(seq, text);
+    if(WAL_ENABLED)
+    {
+        wal_append(seq, header, sizeof(header), message_with_sender, content_size);
+    }
+    if(ZEROCOPY_ENABLED && PROTOCOL_HEADER_SIZE + content_size >= ZEROCOPY_THRESHOLD)
+    {
+        shared_frame = zerocopy_buffer_create(header, sizeof(header), message_with_sender, content_size);
+    }
 
-            // Create the welcome message
-            sprintf(welcome_message, "%s%s!\n\n", WELCOME_MESSAGE, clients[client_index].username);
-            content_size = (uint16_t)strlen(welcome_message);
+    // The sender gets it too, so everyone sees where their message landed in the room order
+    for(int i = 0; i < MAX_CLIENTS; ++i)
+    {
+        if(clients[i].client_socket != 0)
+        {
+            delivery_order_submit(&clients[i].order, seq, message_with_sender, send_room_frame, i, shared_frame);
+        }
+    }
+    zerocopy_buffer_put(shared_frame);
+    pthread_mutex_unlock(&clients_mutex);
+    metrics_record(METRIC_BROADCAST_NS, monotonic_ns() - start);
+}
 
-            // Send the welcome message with protocol header
-            if(send_header(client_socket, version, content_size) == -1)
-            {
-                perror("Error sending welcome header");
-                close(client_socket);
-                return;
-            }
-            if(send(client_socket, welcome_message, content_size, 0) == -1)
-            {
-                perror("Error sending welcome message");
-                close(client_socket);
-                return;
-            }
+// Applies one message from the pool's relay ring: room messages in order (this worker's own included),
+// whispers for a local client that another worker took
+static void apply_relayed_message(const struct ChatRelayMessage *message)
+{
+    uint64_t last = sequencer_last();
+    char     sent_message[MESSAGE_SIZE];
 
-            // Send the command list with protocol header
-            content_size = strlen(COMMAND_LIST);
-            if(send_header(client_socket, version, content_size) == -1)
-            {
-                perror("Error sending command list header");
-                close(client_socket);
-                return;
-            }
-            if(send(client_socket, COMMAND_LIST, content_size, 0) == -1)
+    if(message->kind == CHAT_RELAY_DIRECT)
+    {
+        if(message->origin == chat_pool_worker())
+        {
+            return;
+        }
+        for(int i = 0; i < MAX_CLIENTS; i++)
+        {
+            if(clients[i].client_socket != 0 && strcmp(clients[i].username, message->target) == 0)
             {
-                perror("Error sending command list");
-                close(client_socket);
+                snprintf(sent_message, sizeof(sent_message), "[Direct] %s: %s", message->sender, message->text);
+                if(send_with_protocol(clients[i].client_socket, PROTOCOL_VERSION, sent_message) == -1)
+                {
+                    perror("Error sending direct message");
+                }
+                metrics_add(METRIC_RELAYED_IN, 1);
                 return;
             }
-
-            // Create a new thread to handle the client
-            client_info = &clients[client_index];    // Pass the address of the struct in the array
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wcast-function-type"
-            if(pthread_create(&tid, NULL, (void *(*)(void *))handle_client, (void *)client_info) != 0)
-            {
-                perror("Thread creation failed");
-                close(client_socket);
-                continue;
-            }
-#pragma clang diagnostic pop
-            pthread_detach(tid);
         }
+        return;
     }
 
-    for(int i = 0; i < MAX_CLIENTS; ++i)
+    // Already in the recovered room log
+    if(message->seq <= last)
     {
-        if(clients[i].client_socket != 0)
+        return;
+    }
+
+    // Messages the relay skipped will never come: nobody's delivery order may wait for them
+    if(message->seq > last + 1)
+    {
+        for(int i = 0; i < MAX_CLIENTS; ++i)
         {
-            if(send_with_protocol(clients[i].client_socket, version, SHUTDOWN_MESSAGE) == -1)
+            if(clients[i].client_socket != 0)
             {
-                perror("Error sending shutdown message with protocol");
+                delivery_order_reset(&clients[i].order, message->seq);
             }
         }
     }
-
-    // Close server socket
-    shutdown(server_socket, SHUT_RDWR);
-    socket_close(server_socket);
-    free_usernames();
+    sequencer_restore(message->seq);
+    broadcast_room_message(message->seq, message->sender, message->text, -1);
+    metrics_add(message->origin == chat_pool_worker() ? METRIC_BROADCASTS : METRIC_RELAYED_IN, 1);
 }
 
 void handle_message(const char *buffer, int sender_fd)
 {
-    uint8_t version = PROTOCOL_VERSION;
+    uint8_t version  = PROTOCOL_VERSION;
+    size_t  ping_len = strlen("/ping");
+
+    // Probes skip the command parsing below so they measure the loop, not the dispatch
+    if(strncmp(buffer, "/ping", ping_len) == 0 && (buffer[ping_len] == '\0' || buffer[ping_len] == ' ' || buffer[ping_len] == '\n'))
+    {
+        send_pong(sender_fd, buffer);
+        return;
+    }
     if(buffer[0] == '/')
     {
         // Extract command
         char command[BUFFER_SIZE];
         sscanf(buffer, "/%19s", command);
+        flight_record(FLIGHT_COMMAND, sender_fd, flight_pack_name(command), 0);
 
         // Check command and call corresponding function
         if(strcmp(command, "h") == 0)
@@ -261,6 +1341,14 @@ void handle_message(const char *buffer, int sender_fd)
         {
             direct_message(sender_fd, buffer);
         }
+        else if(strcmp(command, "search") == 0)
+        {
+            search_history(sender_fd, buffer);
+        }
+        else if(strcmp(command, "resume") == 0)
+        {
+            resume_session(sender_fd, buffer);
+        }
         else
         {
             if(send_with_protocol(sender_fd, version, COMMAND_NOT_FOUND) == -1)
@@ -271,32 +1359,80 @@ void handle_message(const char *buffer, int sender_fd)
     }
     else
     {
-        char message_with_sender[MESSAGE_SIZE];
+        const char *sender_name = "";
 
         for(int i = 0; i < MAX_CLIENTS; ++i)
         {
             if(clients[i].client_socket == sender_fd)
             {
-                sprintf(message_with_sender, "[All] %s: %s", clients[i].username, buffer);
+                sender_name = clients[i].username;
                 break;
             }
         }
 
-        pthread_mutex_lock(&clients_mutex);
+        // In a pool the number comes from the shared ring, and this worker broadcasts when it applies it, like the others
+        if(chat_pool_worker() >= 0)
+        {
+            chat_pool_append(CHAT_RELAY_ROOM, sender_name, "", buffer);
+            chat_pool_drain(apply_relayed_message);
+        }
+        else
+        {
+            broadcast_room_message(sequencer_next(), sender_name, buffer, sender_fd);
+            metrics_add(METRIC_BROADCASTS, 1);
+        }
+    }
+}
+
+// Sends one room frame to a client; ctx is the shared zero-copy frame when there is one
+void send_room_frame(int client_index, const char *message, void *ctx)
+{
+    struct ZeroCopyBuffer *shared_frame  = (struct ZeroCopyBuffer *)ctx;
+    int                    client_socket = clients[client_index].client_socket;
+    int                    result;
 
-        for(int i = 0; i < MAX_CLIENTS; ++i)
+    if(shared_frame != NULL && shm_transport_lookup(client_socket) == NULL)
+    {
+        uint64_t trace_id = trace_current();
+        uint64_t start    = trace_id != 0 ? trace_now_ns() : 0;
+
+        // Anything already queued for this client has to go first
+        coalesce_flush(client_socket);
+        result = zerocopy_send(client_socket, shared_frame);
+        if(result != -1)
         {
-            if(clients[i].client_socket != 0 && clients[i].client_socket != sender_fd)
-            {
-                // Use the send_with_protocol function to send the message
-                if(send_with_protocol(clients[i].client_socket, version, message_with_sender) == -1)
-                {
-                    // Handle the error case here if needed
-                    fprintf(stderr, "Error sending message to client %d\n", i);
-                }
-            }
+            metrics_add(METRIC_FRAMES_OUT, 1);
+            metrics_add(METRIC_BYTES_OUT, PROTOCOL_HEADER_SIZE + strlen(message));
         }
-        pthread_mutex_unlock(&clients_mutex);
+        if(trace_id != 0)
+        {
+            trace_record(trace_id, TRACE_FLUSH, start, trace_now_ns(), client_socket);
+        }
+    }
+    else
+    {
+        // Use the send_with_protocol function to send the message
+        result = send_with_protocol(client_socket, PROTOCOL_VERSION, message);
+        zerocopy_note_copy(PROTOCOL_HEADER_SIZE + strlen(message));
+    }
+
+    if(result == -1)
+    {
+        flight_record(FLIGHT_SEND_ERROR, client_socket, client_index, errno);
+        metrics_add(METRIC_SEND_FAILURES, 1);
+        LOG_ERROR("Error sending message to client %d\n", client_index);
+    }
+}
+
+// Adds a user on another pool worker to a /ul reply
+static void append_pool_user(const char *name, int worker, void *ctx)
+{
+    char *user_list = (char *)ctx;
+
+    if(worker != chat_pool_worker())
+    {
+        strncat(user_list, name, BUFFER_SIZE - strlen(user_list) - 1);
+        strncat(user_list, "\n", BUFFER_SIZE - strlen(user_list) - 1);
     }
 }
 
@@ -326,6 +1462,7 @@ void send_user_list(int sender_fd)
             strncat(user_list, "\n", sizeof(user_list) - strlen(user_list) - 1);    // Add newline character
         }
     }
+    chat_pool_names_visit(append_pool_user, user_list);
 
     // Send user_list to the sender_fd with protocol
     if(send_with_protocol(sender_fd, version, user_list) == -1)
@@ -366,12 +1503,24 @@ void set_username(int sender_fd, const char *buffer)
         }
     }
 
+    // Names are unique across the pool's workers too
+    if(chat_pool_name_find(username) >= 0)
+    {
+        if(send_with_protocol(sender_fd, version, USERNAME_FAILURE) == -1)
+        {
+            perror("Error sending username failure message with protocol");
+        }
+        return;
+    }
+
     for(int i = 0; i < MAX_CLIENTS; i++)
     {
         if(sender_fd == clients[i].client_socket)
         {
             strncpy(clients[i].username, username, MAX_USERNAME_SIZE - 1);    // Use strncpy to prevent overflow
             clients[i].username[MAX_USERNAME_SIZE - 1] = '\0';                // Ensure null termination
+            session_rename(i, clients[i].username);
+            chat_pool_name_set(i, clients[i].username);
             break;
         }
     }
@@ -428,10 +1577,21 @@ void direct_message(int sender_fd, const char *buffer)
             {
                 perror("Error sending direct message");
             }
+            metrics_add(METRIC_DIRECT_MESSAGES, 1);
+            flight_record(FLIGHT_DIRECT_MESSAGE, sender_fd, clients[i].client_socket, (int64_t)strlen(sent_message));
             return;
         }
     }
 
+    // The receiver may be on another pool worker, which delivers it when it applies the relay
+    if(chat_pool_name_find(receiver) >= 0)
+    {
+        chat_pool_append(CHAT_RELAY_DIRECT, clients[sender_id].username, receiver, message);
+        metrics_add(METRIC_DIRECT_MESSAGES, 1);
+        flight_record(FLIGHT_DIRECT_MESSAGE, sender_fd, -1, (int64_t)strlen(message));
+        return;
+    }
+
     // Use send_with_protocol to send the invalid receiver message
     if(send_with_protocol(sender_fd, version, INVALID_RECEIVER) == -1)
     {
@@ -439,7 +1599,194 @@ void direct_message(int sender_fd, const char *buffer)
     }
 }
 
-void free_usernames(void)
+// Lists the newest room messages containing every word of the query
+void search_history(int sender_fd, const char *buffer)
+{
+    const char         *query = buffer + strlen("/search");
+    uint64_t            results[SEARCH_MAX_RESULTS];
+    size_t              found;
+    size_t              shown = 0;
+    char                reply[BUFFER_SIZE];
+    char                texts[SEARCH_MAX_RESULTS][BUFFER_SIZE - BASE_TEN];    // leaves room for the "[Search] " prefix
+    uint8_t             version = PROTOCOL_VERSION;
+    struct HistoryStats history_stats;
+    uint64_t            oldest;
+
+    if(strspn(query, " \t\n") == strlen(query))
+    {
+        if(send_with_protocol(sender_fd, version, INVALID_NUM_ARGS) == -1)
+        {
+            perror("Error sending invalid number of arguments message");
+        }
+        return;
+    }
+
+    // Only messages whose text is still at hand count: the history ring, and the room log when there is one
+    history_get_stats(&history_stats);
+    oldest = history_stats.entries > 0 ? history_stats.oldest_seq : sequencer_last() + 1;
+    if(WAL_ENABLED && wal_oldest_seq() < oldest)
+    {
+        oldest = wal_oldest_seq();
+    }
+    found = search_index_query(query, results, SEARCH_MAX_RESULTS, oldest);
+    for(size_t i = 0; i < found; ++i)
+    {
+        if(history_lookup(results[i], texts[shown], sizeof(texts[shown])) == 0 || (WAL_ENABLED && wal_lookup(results[i], texts[shown], sizeof(texts[shown])) == 0))
+        {
+            shown++;
+        }
+    }
+
+    snprintf(reply, sizeof(reply), "[Search] %zu newest match(es) for:%s\n", shown, query);
+    if(send_with_protocol(sender_fd, version, reply) == -1)
+    {
+        perror("Error sending search results");
+        return;
+    }
+
+    // One frame per hit
+    for(size_t i = 0; i < shown; ++i)
+    {
+        snprintf(reply, sizeof(reply), "[Search] %.*s\n", (int)(sizeof(texts[i]) - 1), texts[i]);
+        if(send_with_protocol(sender_fd, version, reply) == -1)
+        {
+            perror("Error sending search results");
+            return;
+        }
+    }
+}
+
+// Gives a reconnecting client its old session back and sends only the room frames it missed
+void resume_session(int sender_fd, const char *buffer)
+{
+    char           command[BASE_TEN];
+    char           token[SESSION_TOKEN_LENGTH + 1];
+    char           response[BUFFER_SIZE];
+    uint64_t       last_seq;
+    uint64_t       first_seq;
+    uint64_t       newest = sequencer_last();
+    int            client_index;
+    int            previous;
+    int            name_taken = 0;
+    struct Session session;
+    uint8_t        version = PROTOCOL_VERSION;
+
+    for(client_index = 0; client_index < MAX_CLIENTS; client_index++)
+    {
+        if(clients[client_index].client_socket == sender_fd)
+        {
+            break;
+        }
+    }
+    if(client_index == MAX_CLIENTS)
+    {
+        return;
+    }
+
+    if(sscanf(buffer, "/%9s %32s %" SCNu64, command, token, &last_seq) != 3)
+    {
+        if(send_with_protocol(sender_fd, version, INVALID_NUM_ARGS) == -1)
+        {
+            perror("Error sending invalid number of arguments message");
+        }
+        return;
+    }
+
+    // In a pool the token may come from any worker; the session table is shared
+    if(session_take(token, client_index, &session, &previous) == -1)
+    {
+        if(send_with_protocol(sender_fd, version, RESUME_FAILURE) == -1)
+        {
+            perror("Error sending resume failure message");
+        }
+        return;
+    }
+
+    // The old connection may not have noticed the drop yet. On another pool worker it stays until it does, and
+    // keeps the name meanwhile.
+    if(previous != -1)
+    {
+        LOG_INFO("%s resumed on a new connection\n", clients[previous].username);
+        release_client(previous);
+    }
+    clients[client_index].join_replay_ns = 0;
+
+    // Take the old name back unless someone else, here or on another pool worker, picked it up in the meantime
+    for(int i = 0; i < MAX_CLIENTS; i++)
+    {
+        if(i != client_index && clients[i].client_socket != 0 && strcmp(clients[i].username, session.username) == 0)
+        {
+            name_taken = 1;
+            break;
+        }
+    }
+    if(chat_pool_name_find(session.username) >= 0 && strcmp(clients[client_index].username, session.username) != 0)
+    {
+        name_taken = 1;
+    }
+    if(name_taken)
+    {
+        session_rename(client_index, clients[client_index].username);
+    }
+    else
+    {
+        strncpy(clients[client_index].username, session.username, MAX_USERNAME_SIZE - 1);
+        clients[client_index].username[MAX_USERNAME_SIZE - 1] = '\0';
+    }
+    chat_pool_name_set(client_index, clients[client_index].username);
+
+    LOG_INFO("%s resumed after message #%" PRIu64 "\n", clients[client_index].username, last_seq);
+    snprintf(response, sizeof(response), "%s%s!\n", RESUME_SUCCESS, clients[client_index].username);
+    if(send_with_protocol(sender_fd, version, response) == -1)
+    {
+        perror("Error sending resume message");
+        return;
+    }
+
+    // The token sent at connect belonged to the session just discarded
+    snprintf(response, sizeof(response), RESUME_TOKEN_FORMAT, session.token);
+    if(send_with_protocol(sender_fd, version, response) == -1)
+    {
+        perror("Error sending resume token");
+        return;
+    }
+
+    // Only what was missed before this connection joined (it has had everything since live), and never more
+    // than the history ring could hold
+    if(clients[client_index].join_seq < newest)
+    {
+        newest = clients[client_index].join_seq;
+    }
+    first_seq = last_seq + 1;
+    if(newest >= HISTORY_MAX_ENTRIES && first_seq < newest - HISTORY_MAX_ENTRIES + 1)
+    {
+        first_seq = newest - HISTORY_MAX_ENTRIES + 1;
+    }
+    flight_record(FLIGHT_RESUME, sender_fd, client_index, (int64_t)first_seq);
+    if(first_seq <= newest)
+    {
+        replay_range(sender_fd, first_seq, newest);
+    }
+}
+
+// Allocates every slot's username and input buffers and its delivery order; exits when out of memory
+void allocate_client_buffers(void)
+{
+    for(int i = 0; i < MAX_CLIENTS; ++i)
+    {
+        clients[i].username = calloc(1, MAX_USERNAME_SIZE);
+        clients[i].input    = malloc(CLIENT_INPUT_SIZE);
+        if(clients[i].username == NULL || clients[i].input == NULL)
+        {
+            perror("Memory allocation failed");
+            free_client_buffers();
+            exit(EXIT_FAILURE);
+        }
+        delivery_order_init(&clients[i].order, 1);
+    }
+}
+
+void free_client_buffers(void)
 {
     for(int i = 0; i < MAX_CLIENTS; ++i)
     {
@@ -448,6 +1795,8 @@ void free_usernames(void)
             free(clients[i].username);
             clients[i].username = NULL;    // Optional: Set the pointer to NULL after freeing
         }
+        free(clients[i].input);
+        clients[i].input = NULL;
     }
 }
 
@@ -615,7 +1964,7 @@ int socket_accept_connection(int server_fd, struct sockaddr_storage *client_addr
     char client_service[NI_MAXSERV];
 
     errno     = 0;
-    client_fd = accept(server_fd, (struct sockaddr *)client_addr, client_addr_len);
+    client_fd = transport_accept(server_fd, (struct sockaddr *)client_addr, client_addr_len);
 
     if(client_fd == -1)
     {
@@ -654,8 +2003,35 @@ void group_chat_sigint_handler(int signum)
     group_chat_exit_flag = 1;
 }
 
+void group_chat_trace_handler(int signum)
+{
+    (void)signum;
+    trace_export_flag = 1;
+}
+
+// Dumps the flight recorder straight from the handler, so it works even with the event loop stuck
+void group_chat_flight_handler(int signum)
+{
+    flight_dump(signum);
+}
+
+// Stops the event loop like SIGINT, but leaves a flight dump behind once it has
+void group_chat_term_handler(int signum)
+{
+    group_chat_stop_signal = signum;
+    group_chat_exit_flag   = 1;
+}
+
+// Dumps the flight recorder on the way down; SA_RESETHAND restored the default action for the re-raise
+void group_chat_fatal_handler(int signum)
+{
+    flight_dump(signum);
+    raise(signum);
+}
+
 void group_chat_setup_signal_handler(void)
 {
+    static const int fatal_signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
     struct sigaction sa;
 
     memset(&sa, 0, sizeof(sa));
@@ -677,4 +2053,71 @@ void group_chat_setup_signal_handler(void)
         perror("sigaction");
         exit(EXIT_FAILURE);
     }
+
+#if defined(__clang__)
+    #pragma clang diagnostic push
+    #pragma clang diagnostic ignored "-Wdisabled-macro-expansion"
+#endif
+    sa.sa_handler = group_chat_trace_handler;
+#if defined(__clang__)
+    #pragma clang diagnostic pop
+#endif
+
+    if(sigaction(SIGUSR2, &sa, NULL) == -1)
+    {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+
+#if defined(__clang__)
+    #pragma clang diagnostic push
+    #pragma clang diagnostic ignored "-Wdisabled-macro-expansion"
+#endif
+    sa.sa_handler = group_chat_flight_handler;
+#if defined(__clang__)
+    #pragma clang diagnostic pop
+#endif
+
+    sa.sa_flags = SA_RESTART;
+    if(sigaction(SIGUSR1, &sa, NULL) == -1)
+    {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+
+    // The server manager's /q arrives as SIGTERM: shut down the normal way, flushing the room log and the summary
+#if defined(__clang__)
+    #pragma clang diagnostic push
+    #pragma clang diagnostic ignored "-Wdisabled-macro-expansion"
+#endif
+    sa.sa_handler = group_chat_term_handler;
+#if defined(__clang__)
+    #pragma clang diagnostic pop
+#endif
+
+    sa.sa_flags = 0;
+    if(sigaction(SIGTERM, &sa, NULL) == -1)
+    {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+
+#if defined(__clang__)
+    #pragma clang diagnostic push
+    #pragma clang diagnostic ignored "-Wdisabled-macro-expansion"
+#endif
+    sa.sa_handler = group_chat_fatal_handler;
+#if defined(__clang__)
+    #pragma clang diagnostic pop
+#endif
+
+    sa.sa_flags = (int)SA_RESETHAND;
+    for(size_t i = 0; i < sizeof(fatal_signals) / sizeof(fatal_signals[0]); ++i)
+    {
+        if(sigaction(fatal_signals[i], &sa, NULL) == -1)
+        {
+            perror("sigaction");
+            exit(EXIT_FAILURE);
+        }
+    }
 }
@@ -0,0 +1,308 @@
+#include "../include/session.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <time.h>
+
+#define SESSION_NANOS_PER_SECOND 1000000000ULL
+
+// The table, in a pool shared by every worker (session_table_init in the wrapper, session_share in each worker)
+struct SessionTable
+{
+    pthread_mutex_t lock;    // robust and process-shared
+    int32_t         count;
+    struct Session  sessions[];
+};
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables)
+static struct SessionTable *table          = NULL;
+static int                  table_private  = 0;    // allocated by session_init rather than shared
+static int32_t              session_worker = -1;
+static uint64_t             session_ttl    = 0;
+
+// NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables)
+
+static uint64_t session_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * SESSION_NANOS_PER_SECOND + (uint64_t)ts.tv_nsec;
+}
+
+// Takes the table lock; a worker that died holding it may have left one session half written, which is
+// harmless (its token no longer matches anything, and the slot is reused once it expires)
+static int session_lock(void)
+{
+    if(table == NULL)
+    {
+        return -1;
+    }
+    if(pthread_mutex_lock(&table->lock) == EOWNERDEAD)
+    {
+        pthread_mutex_consistent(&table->lock);
+    }
+    return 0;
+}
+
+static void session_unlock(void)
+{
+    pthread_mutex_unlock(&table->lock);
+}
+
+size_t session_table_size(int max_sessions)
+{
+    return sizeof(struct SessionTable) + (size_t)max_sessions * sizeof(struct Session);
+}
+
+// Function to set up a table in zeroed memory of session_table_size bytes, shared or not
+int session_table_init(void *memory, int max_sessions)
+{
+    struct SessionTable *init = (struct SessionTable *)memory;
+    pthread_mutexattr_t  attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    if(pthread_mutex_init(&init->lock, &attr) != 0)
+    {
+        pthread_mutexattr_destroy(&attr);
+        return -1;
+    }
+    pthread_mutexattr_destroy(&attr);
+    init->count = max_sessions;
+    return 0;
+}
+
+int session_init(int max_sessions, uint64_t ttl_ns)
+{
+    struct SessionTable *private_table = (struct SessionTable *)calloc(1, session_table_size(max_sessions));
+
+    if(private_table == NULL)
+    {
+        perror("session_init: calloc");
+        return -1;
+    }
+    if(session_table_init(private_table, max_sessions) == -1)
+    {
+        free(private_table);
+        return -1;
+    }
+    table          = private_table;
+    table_private  = 1;
+    session_worker = -1;
+    session_ttl    = ttl_ns;
+    return 0;
+}
+
+// Function to use a pool's shared table (see chat_pool.h) as this worker
+int session_share(void *shared, int worker, uint64_t ttl_ns)
+{
+    if(shared == NULL)
+    {
+        return -1;
+    }
+    table          = (struct SessionTable *)shared;
+    table_private  = 0;
+    session_worker = worker;
+    session_ttl    = ttl_ns;
+    return 0;
+}
+
+void session_free(void)
+{
+    if(table_private)
+    {
+        pthread_mutex_destroy(&table->lock);
+        free(table);
+    }
+    table         = NULL;
+    table_private = 0;
+}
+
+// Caller holds the lock: the session of this process's client, or NULL
+static struct Session *session_of_client(int client_index)
+{
+    for(int i = 0; i < table->count; ++i)
+    {
+        struct Session *session = &table->sessions[i];
+
+        if(session->token[0] != '\0' && session->client_index == client_index && session->worker == session_worker)
+        {
+            return session;
+        }
+    }
+    return NULL;
+}
+
+// Caller holds the lock: picks a free slot, else an expired one, else the detached session closest to expiring
+static struct Session *session_slot(void)
+{
+    struct Session *victim = NULL;
+    uint64_t        now    = session_now_ns();
+
+    for(int i = 0; i < table->count; ++i)
+    {
+        struct Session *session = &table->sessions[i];
+
+        if(session->token[0] == '\0' || (session->client_index == -1 && session->expires_ns <= now))
+        {
+            return session;
+        }
+        if(session->client_index == -1 && (victim == NULL || session->expires_ns < victim->expires_ns))
+        {
+            victim = session;
+        }
+    }
+    return victim;
+}
+
+// Function to open a session for a newly joined client and copy its token (SESSION_TOKEN_LENGTH + 1 bytes) to
+// token; -1 if the table is full of live clients
+int session_create(int client_index, const char *username, char *token)
+{
+    static const char hex[] = "0123456789abcdef";
+    uint8_t           random_bytes[SESSION_TOKEN_LENGTH / 2];
+    struct Session   *session;
+
+    if(getrandom(random_bytes, sizeof(random_bytes), 0) != (ssize_t)sizeof(random_bytes))
+    {
+        perror("session_create: getrandom");
+        return -1;
+    }
+    if(session_lock() == -1)
+    {
+        return -1;
+    }
+
+    // A session still marked as held by this slot outlived its client (e.g. one lost in a hot restart)
+    session = session_of_client(client_index);
+    if(session != NULL)
+    {
+        session->client_index = -1;
+        session->expires_ns   = session_now_ns() + session_ttl;
+    }
+    session = session_slot();
+    if(session == NULL)
+    {
+        session_unlock();
+        return -1;
+    }
+
+    for(size_t i = 0; i < sizeof(random_bytes); ++i)
+    {
+        session->token[2 * i]     = hex[random_bytes[i] >> 4];
+        session->token[2 * i + 1] = hex[random_bytes[i] & 0xF];
+    }
+    session->token[SESSION_TOKEN_LENGTH] = '\0';
+    snprintf(session->username, sizeof(session->username), "%s", username);
+    session->worker       = session_worker;
+    session->client_index = client_index;
+    session->expires_ns   = 0;
+    memcpy(token, session->token, SESSION_TOKEN_LENGTH + 1);
+    session_unlock();
+    return 0;
+}
+
+// Function to hand the session with token to client_index, which gives up the session it got at join. The
+// session as it now is goes to *taken; if one of this process's clients still held it, that client's index
+// goes to *previous (else -1), and the caller lets it go. A client still holding it on another pool worker is
+// just cut loose from it. Returns -1 if there is no such session, it expired, or the client already has it.
+int session_take(const char *token, int client_index, struct Session *taken, int *previous)
+{
+    struct Session *session = NULL;
+    struct Session *own;
+    uint64_t        now = session_now_ns();
+
+    if(strlen(token) != SESSION_TOKEN_LENGTH || session_lock() == -1)
+    {
+        return -1;
+    }
+    for(int i = 0; i < table->count; ++i)
+    {
+        if(table->sessions[i].token[0] != '\0' && strcmp(table->sessions[i].token, token) == 0)
+        {
+            session = &table->sessions[i];
+            break;
+        }
+    }
+    if(session == NULL || (session->client_index == -1 && session->expires_ns <= now) || (session->client_index == client_index && session->worker == session_worker))
+    {
+        session_unlock();
+        return -1;
+    }
+
+    *previous = (session->client_index != -1 && session->worker == session_worker) ? session->client_index : -1;
+    own       = session_of_client(client_index);
+    if(own != NULL)
+    {
+        memset(own, 0, sizeof(*own));
+        own->client_index = -1;
+    }
+    session->worker       = session_worker;
+    session->client_index = client_index;
+    session->expires_ns   = 0;
+    *taken                = *session;
+    session_unlock();
+    return 0;
+}
+
+// Function to keep a departed client's session around for the resume window
+void session_detach(int client_index)
+{
+    struct Session *session;
+
+    if(session_lock() == -1)
+    {
+        return;
+    }
+    session = session_of_client(client_index);
+    if(session != NULL)
+    {
+        session->client_index = -1;
+        session->expires_ns   = session_now_ns() + session_ttl;
+    }
+    session_unlock();
+}
+
+// Function to detach every session this process's clients held, for a pool worker that starts afresh where
+// one died: its clients are gone, and their sessions would otherwise never expire
+void session_detach_all(void)
+{
+    uint64_t expires = session_now_ns() + session_ttl;
+
+    if(session_lock() == -1)
+    {
+        return;
+    }
+    for(int i = 0; i < table->count; ++i)
+    {
+        struct Session *session = &table->sessions[i];
+
+        if(session->token[0] != '\0' && session->client_index != -1 && session->worker == session_worker)
+        {
+            session->client_index = -1;
+            session->expires_ns   = expires;
+        }
+    }
+    session_unlock();
+}
+
+void session_rename(int client_index, const char *username)
+{
+    struct Session *session;
+
+    if(session_lock() == -1)
+    {
+        return;
+    }
+    session = session_of_client(client_index);
+    if(session != NULL)
+    {
+        snprintf(session->username, sizeof(session->username), "%s", username);
+    }
+    session_unlock();
+}
@@ -0,0 +1,482 @@
+// memfd_create is a GNU extension; the build passes -D_GNU_SOURCE, a bare compile does not
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+#include "../include/shm_ring.h"
+#include "../include/log.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define SHM_RING_MASK (SHM_RING_CAPACITY - 1U)
+#define SHM_PASSED_FDS 3
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+static _Atomic(struct ShmChannel *) shm_routes[FD_SETSIZE];
+
+static void shm_ring_copy_in(struct ShmRing *ring, uint32_t position, const void *src, size_t len)
+{
+    uint32_t offset = position & SHM_RING_MASK;
+    size_t   first  = SHM_RING_CAPACITY - offset;
+
+    if(first > len)
+    {
+        first = len;
+    }
+    memcpy(&ring->data[offset], src, first);
+    memcpy(ring->data, (const uint8_t *)src + first, len - first);
+}
+
+static void shm_ring_copy_out(const struct ShmRing *ring, uint32_t position, void *dst, size_t len)
+{
+    uint32_t offset = position & SHM_RING_MASK;
+    size_t   first  = SHM_RING_CAPACITY - offset;
+
+    if(first > len)
+    {
+        first = len;
+    }
+    memcpy(dst, &ring->data[offset], first);
+    memcpy((uint8_t *)dst + first, ring->data, len - first);
+}
+
+// Function to append one frame; *was_empty tells the caller whether the consumer needs a wakeup
+int shm_ring_push(struct ShmRing *ring, uint8_t version, const char *message, uint16_t content_size, int *was_empty)
+{
+    uint8_t  header[SHM_FRAME_HEADER_SIZE];
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    uint32_t need = (uint32_t)SHM_FRAME_HEADER_SIZE + content_size;
+
+    if(SHM_RING_CAPACITY - (head - tail) < need)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    header[0] = version;
+    header[1] = (uint8_t)(content_size >> 8);
+    header[2] = (uint8_t)(content_size & 0xFFU);
+    shm_ring_copy_in(ring, head, header, sizeof(header));
+    shm_ring_copy_in(ring, head + SHM_FRAME_HEADER_SIZE, message, content_size);
+
+    // seq_cst on both sides of the head/tail handshake so either the consumer sees the
+    // new frame before it sleeps or we see that it had drained up to our old head.
+    atomic_store_explicit(&ring->head, head + need, memory_order_seq_cst);
+    *was_empty = atomic_load_explicit(&ring->tail, memory_order_seq_cst) == head;
+    return 0;
+}
+
+// Function to take one frame; returns 0 when the ring is empty
+ssize_t shm_ring_pop(struct ShmRing *ring, uint8_t *version, char *buffer, size_t buffer_size)
+{
+    uint8_t  header[SHM_FRAME_HEADER_SIZE];
+    uint16_t content_size;
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_seq_cst);
+
+    if(head == tail)
+    {
+        return 0;
+    }
+
+    shm_ring_copy_out(ring, tail, header, sizeof(header));
+    *version     = header[0];
+    content_size = (uint16_t)((header[1] << 8) | header[2]);
+
+    if(content_size >= buffer_size)
+    {
+        // Drop the frame so the ring stays in sync
+        atomic_store_explicit(&ring->tail, tail + SHM_FRAME_HEADER_SIZE + content_size, memory_order_seq_cst);
+        LOG_WARN("Buffer too small for incoming message\n");
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    shm_ring_copy_out(ring, tail + SHM_FRAME_HEADER_SIZE, buffer, content_size);
+    buffer[content_size] = '\0';
+    atomic_store_explicit(&ring->tail, tail + SHM_FRAME_HEADER_SIZE + content_size, memory_order_seq_cst);
+
+    return content_size;
+}
+
+int shm_listener_create(in_port_t port)
+{
+    struct sockaddr_un addr;
+    int                listen_fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), SHM_SOCKET_PATH_FORMAT, port);
+    unlink(addr.sun_path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listen_fd == -1)
+    {
+        perror("shm_listener_create: socket");
+        return -1;
+    }
+
+    // Linux creates the socket file with the socket's own mode, so it is never reachable with the default one
+    if(fchmod(listen_fd, SHM_SOCKET_MODE) == -1 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || chmod(addr.sun_path, SHM_SOCKET_MODE) == -1 ||
+       listen(listen_fd, SOMAXCONN) == -1)
+    {
+        perror("shm_listener_create: bind/listen");
+        close(listen_fd);
+        return -1;
+    }
+
+    LOG_INFO("Shared-memory transport on %s\n", addr.sun_path);
+    return listen_fd;
+}
+
+void shm_listener_close(int listen_fd, in_port_t port)
+{
+    char path[SHM_SOCKET_PATH_SIZE];
+
+    if(listen_fd < 0)
+    {
+        return;
+    }
+    close(listen_fd);
+    snprintf(path, sizeof(path), SHM_SOCKET_PATH_FORMAT, port);
+    unlink(path);
+}
+
+// Server side: accept a local client, build its rings and hand it the fds
+int shm_channel_accept(int listen_fd, struct ShmChannel *channel)
+{
+    struct msghdr   msg;
+    struct iovec    iov;
+    struct cmsghdr *cmsg;
+    char            control[CMSG_SPACE(sizeof(int) * SHM_PASSED_FDS)];
+    int             fds[SHM_PASSED_FDS];
+    char            tag       = 'S';
+    int             memfd     = -1;
+    int             client_fd = accept(listen_fd, NULL, NULL);
+
+    if(client_fd == -1)
+    {
+        perror("shm_channel_accept: accept");
+        return -1;
+    }
+
+    memset(channel, 0, sizeof(*channel));
+    channel->tx_event_fd = -1;
+    channel->rx_event_fd = -1;
+
+    memfd = memfd_create("groupchat-shm", MFD_CLOEXEC);
+    if(memfd == -1 || ftruncate(memfd, (off_t)sizeof(struct ShmRegion)) == -1)
+    {
+        perror("shm_channel_accept: memfd");
+        goto fail;
+    }
+
+    channel->region = mmap(NULL, sizeof(struct ShmRegion), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if(channel->region == MAP_FAILED)
+    {
+        channel->region = NULL;
+        perror("shm_channel_accept: mmap");
+        goto fail;
+    }
+
+    channel->tx_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    channel->rx_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(channel->tx_event_fd == -1 || channel->rx_event_fd == -1)
+    {
+        perror("shm_channel_accept: eventfd");
+        goto fail;
+    }
+
+    channel->tx         = &channel->region->to_client;
+    channel->rx         = &channel->region->to_server;
+    channel->control_fd = client_fd;
+
+    // Client gets: region, its rx wakeup (our tx), its tx wakeup (our rx)
+    fds[0] = memfd;
+    fds[1] = channel->tx_event_fd;
+    fds[2] = channel->rx_event_fd;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    iov.iov_base       = &tag;
+    iov.iov_len        = sizeof(tag);
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+    cmsg               = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level   = SOL_SOCKET;
+    cmsg->cmsg_type    = SCM_RIGHTS;
+    cmsg->cmsg_len     = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if(sendmsg(client_fd, &msg, MSG_NOSIGNAL) == -1)
+    {
+        perror("shm_channel_accept: sendmsg");
+        goto fail;
+    }
+
+    close(memfd);
+    return client_fd;
+
+fail:
+    if(memfd != -1)
+    {
+        close(memfd);
+    }
+    channel->control_fd = client_fd;
+    shm_channel_close(channel);
+    return -1;
+}
+
+// Client side: connect to the server's Unix socket and map the rings it hands back
+int shm_channel_attach(const char *path, struct ShmChannel *channel)
+{
+    struct sockaddr_un addr;
+    struct msghdr      msg;
+    struct iovec       iov;
+    struct cmsghdr    *cmsg;
+    char               control[CMSG_SPACE(sizeof(int) * SHM_PASSED_FDS)];
+    int                fds[SHM_PASSED_FDS];
+    char               tag;
+    int                fd;
+
+    memset(channel, 0, sizeof(*channel));
+    channel->tx_event_fd = -1;
+    channel->rx_event_fd = -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        perror("shm_channel_attach: connect");
+        if(fd != -1)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    channel->control_fd = fd;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base       = &tag;
+    iov.iov_len        = sizeof(tag);
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsg = NULL;
+    if(recvmsg(fd, &msg, MSG_CMSG_CLOEXEC) > 0)
+    {
+        cmsg = CMSG_FIRSTHDR(&msg);
+    }
+    if(cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+    {
+        fprintf(stderr, "shm_channel_attach: server did not pass the ring descriptors\n");
+        shm_channel_close(channel);
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    channel->region = mmap(NULL, sizeof(struct ShmRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    close(fds[0]);
+    channel->rx_event_fd = fds[1];
+    channel->tx_event_fd = fds[2];
+    if(channel->region == MAP_FAILED)
+    {
+        channel->region = NULL;
+        perror("shm_channel_attach: mmap");
+        shm_channel_close(channel);
+        return -1;
+    }
+
+    channel->tx = &channel->region->to_server;
+    channel->rx = &channel->region->to_client;
+    return 0;
+}
+
+void shm_channel_close(struct ShmChannel *channel)
+{
+    if(channel->region != NULL)
+    {
+        munmap(channel->region, sizeof(struct ShmRegion));
+        channel->region = NULL;
+    }
+    if(channel->tx_event_fd != -1)
+    {
+        close(channel->tx_event_fd);
+        channel->tx_event_fd = -1;
+    }
+    if(channel->rx_event_fd != -1)
+    {
+        close(channel->rx_event_fd);
+        channel->rx_event_fd = -1;
+    }
+    if(channel->control_fd > 0)
+    {
+        close(channel->control_fd);
+        channel->control_fd = -1;
+    }
+}
+
+int shm_channel_send(struct ShmChannel *channel, uint8_t version, const char *message)
+{
+    uint64_t one          = 1;
+    int      was_empty    = 0;
+    uint16_t content_size = (uint16_t)strlen(message);
+
+    if(shm_ring_push(channel->tx, version, message, content_size, &was_empty) == -1)
+    {
+        return -1;
+    }
+
+    if(was_empty && write(channel->tx_event_fd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+    {
+        perror("shm_channel_send: eventfd write");
+    }
+    return 0;
+}
+
+// Pushes bytes that are already framed (e.g. replayed history) in one go
+int shm_channel_send_raw(struct ShmChannel *channel, const struct iovec *iov, int iov_count)
+{
+    struct ShmRing *ring  = channel->tx;
+    uint64_t        one   = 1;
+    uint32_t        total = 0;
+    uint32_t        head  = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t        tail  = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    uint32_t        position;
+
+    for(int i = 0; i < iov_count; ++i)
+    {
+        total += (uint32_t)iov[i].iov_len;
+    }
+    if(SHM_RING_CAPACITY - (head - tail) < total)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    position = head;
+    for(int i = 0; i < iov_count; ++i)
+    {
+        shm_ring_copy_in(ring, position, iov[i].iov_base, iov[i].iov_len);
+        position += (uint32_t)iov[i].iov_len;
+    }
+
+    atomic_store_explicit(&ring->head, head + total, memory_order_seq_cst);
+    if(atomic_load_explicit(&ring->tail, memory_order_seq_cst) == head && write(channel->tx_event_fd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+    {
+        perror("shm_channel_send_raw: eventfd write");
+    }
+    return 0;
+}
+
+// Non-blocking receive for event loops; returns -1 with errno EAGAIN when the ring is drained
+ssize_t shm_channel_try_recv(struct ShmChannel *channel, uint8_t *version, char *buffer, size_t buffer_size)
+{
+    uint64_t counter;
+    ssize_t  result = shm_ring_pop(channel->rx, version, buffer, buffer_size);
+
+    if(result != 0)
+    {
+        return result;
+    }
+
+    // Clear the wakeup, then look again so a frame pushed in between is not missed
+    if(read(channel->rx_event_fd, &counter, sizeof(counter)) == -1 && errno != EAGAIN)
+    {
+        return -1;
+    }
+    result = shm_ring_pop(channel->rx, version, buffer, buffer_size);
+    if(result == 0)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    return result;
+}
+
+// Blocking receive; returns 0 once the peer has closed its control socket
+ssize_t shm_channel_recv(struct ShmChannel *channel, uint8_t *version, char *buffer, size_t buffer_size)
+{
+    while(1)
+    {
+        struct pollfd pfds[2];
+        ssize_t       result = shm_channel_try_recv(channel, version, buffer, buffer_size);
+
+        if(result != -1 || errno != EAGAIN)
+        {
+            return result;
+        }
+
+        pfds[0].fd     = channel->rx_event_fd;
+        pfds[0].events = POLLIN;
+        pfds[1].fd     = channel->control_fd;
+        pfds[1].events = POLLIN;
+        if(poll(pfds, 2, -1) == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+
+        if(pfds[1].revents != 0 && !(pfds[0].revents & POLLIN))
+        {
+            char probe;
+            if(recv(channel->control_fd, &probe, sizeof(probe), MSG_DONTWAIT) <= 0)
+            {
+                return 0;
+            }
+        }
+    }
+}
+
+void shm_transport_register(int fd, struct ShmChannel *channel)
+{
+    if(fd >= 0 && fd < FD_SETSIZE)
+    {
+        atomic_store_explicit(&shm_routes[fd], channel, memory_order_release);
+    }
+}
+
+struct ShmChannel *shm_transport_lookup(int fd)
+{
+    if(fd < 0 || fd >= FD_SETSIZE)
+    {
+        return NULL;
+    }
+    return atomic_load_explicit(&shm_routes[fd], memory_order_acquire);
+}
+
+// Unregisters and tears down the channel bound to fd, if any; the fd itself is closed by the caller
+void shm_transport_release(int fd)
+{
+    struct ShmChannel *channel = shm_transport_lookup(fd);
+
+    if(channel == NULL)
+    {
+        return;
+    }
+
+    atomic_store_explicit(&shm_routes[fd], NULL, memory_order_release);
+    channel->control_fd = -1;
+    shm_channel_close(channel);
+    free(channel);
+}
@@ -0,0 +1,478 @@
+#include "../include/sim_transport.h"
+#include "../include/transport.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SIM_QUEUE_INITIAL 4096
+#define SIM_PORT_BASE 1024
+#define SIM_PORT_RANGE 60000
+
+struct SimQueue
+{
+    uint8_t *data;
+    size_t   start;    // unread bytes are data[start, start + len)
+    size_t   len;
+    size_t   capacity;
+};
+
+struct SimConnection
+{
+    struct SimQueue to_server;
+    struct SimQueue to_client;
+    int             in_use;
+    int             accepted;
+    int             client_closed;
+    int             server_closed;
+    int             dirty;    // on the list sim_discard_all walks
+};
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables)
+static struct SimConnection *sim_connections = NULL;
+static int                   sim_max         = 0;
+static int                  *sim_free_ids;    // stack of unused ids, lowest on top
+static int                   sim_free_count = 0;
+static int                  *sim_backlog;    // ring of connected ids waiting for accept
+static int                   sim_backlog_head  = 0;
+static int                   sim_backlog_count = 0;
+static int                  *sim_dirty_ids;
+static int                   sim_dirty_count = 0;
+static uint64_t              sim_clock       = 0;
+
+// NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables)
+
+// ----- Queues -----
+
+// Appends up to len bytes, fewer once the queue nears SIM_QUEUE_LIMIT; returns how many went in (0 sets errno)
+static size_t sim_queue_push(struct SimQueue *queue, const void *data, size_t len)
+{
+    size_t room = SIM_QUEUE_LIMIT - queue->len;
+
+    if(len == 0)
+    {
+        return 0;
+    }
+    if(room == 0)
+    {
+        errno = EAGAIN;
+        return 0;
+    }
+    if(len > room)
+    {
+        len = room;
+    }
+    if(queue->start + queue->len + len > queue->capacity)
+    {
+        memmove(queue->data, queue->data + queue->start, queue->len);
+        queue->start = 0;
+    }
+    if(queue->len + len > queue->capacity)
+    {
+        size_t   capacity = queue->capacity > 0 ? queue->capacity : SIM_QUEUE_INITIAL;
+        uint8_t *grown;
+
+        while(capacity < queue->len + len)
+        {
+            capacity *= 2;
+        }
+        grown = (uint8_t *)realloc(queue->data, capacity);
+        if(grown == NULL)
+        {
+            errno = ENOMEM;
+            return 0;
+        }
+        queue->data     = grown;
+        queue->capacity = capacity;
+    }
+    memcpy(queue->data + queue->start + queue->len, data, len);
+    queue->len += len;
+    return len;
+}
+
+static size_t sim_queue_pop(struct SimQueue *queue, void *buffer, size_t len)
+{
+    if(len > queue->len)
+    {
+        len = queue->len;
+    }
+    if(buffer != NULL)
+    {
+        memcpy(buffer, queue->data + queue->start, len);
+    }
+    queue->start += len;
+    queue->len -= len;
+    if(queue->len == 0)
+    {
+        queue->start = 0;
+    }
+    return len;
+}
+
+// ----- Connections -----
+
+// The connection behind a server-side descriptor, or NULL if fd is not one of ours
+static struct SimConnection *sim_lookup(int fd)
+{
+    int id = fd - SIM_FD_BASE - 1;
+
+    if(fd <= SIM_FD_BASE || id >= sim_max || !sim_connections[id].in_use || !sim_connections[id].accepted || sim_connections[id].server_closed)
+    {
+        return NULL;
+    }
+    return &sim_connections[id];
+}
+
+static int sim_owns(int fd)
+{
+    return fd >= SIM_FD_BASE;
+}
+
+// Frees the slot once both ends are closed (a hang-up before accept still goes through accept); the queue buffers are kept
+static void sim_release(int id)
+{
+    struct SimConnection *connection = &sim_connections[id];
+
+    if(!connection->client_closed || !connection->server_closed)
+    {
+        return;
+    }
+    connection->in_use              = 0;
+    connection->to_server.start     = 0;
+    connection->to_server.len       = 0;
+    connection->to_client.start     = 0;
+    connection->to_client.len       = 0;
+    sim_free_ids[sim_free_count++] = id;
+}
+
+static void sim_mark_dirty(int id)
+{
+    if(!sim_connections[id].dirty)
+    {
+        sim_connections[id].dirty       = 1;
+        sim_dirty_ids[sim_dirty_count++] = id;
+    }
+}
+
+// ----- Transport implementation -----
+
+static ssize_t sim_send(int fd, const void *data, size_t len, int flags)
+{
+    struct SimConnection *connection;
+    size_t                written;
+
+    if(!sim_owns(fd))
+    {
+        return transport_kernel()->send(fd, data, len, flags);
+    }
+    connection = sim_lookup(fd);
+    if(connection == NULL)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    if(connection->client_closed)
+    {
+        errno = EPIPE;
+        return -1;
+    }
+    written = sim_queue_push(&connection->to_client, data, len);
+    if(written == 0 && len > 0)
+    {
+        return -1;
+    }
+    sim_mark_dirty((int)(connection - sim_connections));
+    return (ssize_t)written;
+}
+
+static ssize_t sim_sendmsg(int fd, const struct msghdr *msg, int flags)
+{
+    struct SimConnection *connection;
+    size_t                total = 0;
+
+    if(!sim_owns(fd))
+    {
+        return transport_kernel()->sendmsg(fd, msg, flags);
+    }
+    connection = sim_lookup(fd);
+    if(connection == NULL)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    if(connection->client_closed)
+    {
+        errno = EPIPE;
+        return -1;
+    }
+    for(size_t i = 0; i < msg->msg_iovlen; ++i)
+    {
+        size_t written = sim_queue_push(&connection->to_client, msg->msg_iov[i].iov_base, msg->msg_iov[i].iov_len);
+
+        total += written;
+        if(written < msg->msg_iov[i].iov_len)
+        {
+            break;
+        }
+    }
+    if(total == 0 && msg->msg_iovlen > 0 && msg->msg_iov[0].iov_len > 0)
+    {
+        return -1;
+    }
+    sim_mark_dirty((int)(connection - sim_connections));
+    return (ssize_t)total;
+}
+
+static ssize_t sim_recv(int fd, void *buffer, size_t len, int flags)
+{
+    struct SimConnection *connection;
+    size_t                received;
+
+    if(!sim_owns(fd))
+    {
+        return transport_kernel()->recv(fd, buffer, len, flags);
+    }
+    connection = sim_lookup(fd);
+    if(connection == NULL)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    received = sim_queue_pop(&connection->to_server, buffer, len);
+    if(received == 0 && len > 0)
+    {
+        if(connection->client_closed)
+        {
+            return 0;
+        }
+        errno = EAGAIN;
+        return -1;
+    }
+    return (ssize_t)received;
+}
+
+// Hands out the oldest connection waiting on SIM_LISTEN_FD, with a made-up loopback peer address
+static int sim_accept(int fd, struct sockaddr *addr, socklen_t *addr_len)
+{
+    struct sockaddr_in peer;
+    int                id;
+
+    if(!sim_owns(fd))
+    {
+        return transport_kernel()->accept(fd, addr, addr_len);
+    }
+    if(fd != SIM_LISTEN_FD)
+    {
+        errno = ENOTSOCK;
+        return -1;
+    }
+    if(sim_backlog_count == 0)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    id               = sim_backlog[sim_backlog_head];
+    sim_backlog_head = (sim_backlog_head + 1) % sim_max;
+    sim_backlog_count--;
+    sim_connections[id].accepted = 1;
+
+    if(addr != NULL && addr_len != NULL)
+    {
+        memset(&peer, 0, sizeof(peer));
+        peer.sin_family      = AF_INET;
+        peer.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        peer.sin_port        = htons((uint16_t)(SIM_PORT_BASE + id % SIM_PORT_RANGE));
+        memcpy(addr, &peer, *addr_len < sizeof(peer) ? *addr_len : sizeof(peer));
+        *addr_len = sizeof(peer);
+    }
+    return SIM_FD_BASE + 1 + id;
+}
+
+static int sim_setsockopt(int fd, int level, int option, const void *value, socklen_t len)
+{
+    if(!sim_owns(fd))
+    {
+        return transport_kernel()->setsockopt(fd, level, option, value, len);
+    }
+    return 0;
+}
+
+static int sim_close(int fd)
+{
+    struct SimConnection *connection;
+
+    if(!sim_owns(fd))
+    {
+        return transport_kernel()->close(fd);
+    }
+    if(fd == SIM_LISTEN_FD)
+    {
+        return 0;
+    }
+    connection = sim_lookup(fd);
+    if(connection == NULL)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    connection->server_closed = 1;
+    sim_release((int)(connection - sim_connections));
+    return 0;
+}
+
+static uint64_t sim_now_ns(void)
+{
+    return sim_clock;
+}
+
+static const struct Transport sim_transport = {
+    .name       = "sim",
+    .send       = sim_send,
+    .sendmsg    = sim_sendmsg,
+    .recv       = sim_recv,
+    .accept     = sim_accept,
+    .setsockopt = sim_setsockopt,
+    .close      = sim_close,
+    .now_ns     = sim_now_ns,
+};
+
+// ----- Driver side -----
+
+// Function to allocate room for max_connections simultaneous connections and route server I/O here
+int sim_transport_init(int max_connections)
+{
+    if(max_connections <= 0)
+    {
+        return -1;
+    }
+    sim_connections = (struct SimConnection *)calloc((size_t)max_connections, sizeof(struct SimConnection));
+    sim_free_ids    = (int *)calloc((size_t)max_connections, sizeof(int));
+    sim_backlog     = (int *)calloc((size_t)max_connections, sizeof(int));
+    sim_dirty_ids   = (int *)calloc((size_t)max_connections, sizeof(int));
+    if(sim_connections == NULL || sim_free_ids == NULL || sim_backlog == NULL || sim_dirty_ids == NULL)
+    {
+        perror("sim_transport_init: calloc");
+        sim_transport_free();
+        return -1;
+    }
+    sim_max = max_connections;
+    for(int i = 0; i < max_connections; ++i)
+    {
+        sim_free_ids[i] = max_connections - 1 - i;
+    }
+    sim_free_count    = max_connections;
+    sim_backlog_head  = 0;
+    sim_backlog_count = 0;
+    sim_dirty_count   = 0;
+    sim_clock         = 0;
+    transport_install(&sim_transport);
+    return 0;
+}
+
+void sim_transport_free(void)
+{
+    transport_install(NULL);
+    for(int i = 0; i < sim_max; ++i)
+    {
+        free(sim_connections[i].to_server.data);
+        free(sim_connections[i].to_client.data);
+    }
+    free(sim_connections);
+    free(sim_free_ids);
+    free(sim_backlog);
+    free(sim_dirty_ids);
+    sim_connections = NULL;
+    sim_free_ids    = NULL;
+    sim_backlog     = NULL;
+    sim_dirty_ids   = NULL;
+    sim_max         = 0;
+}
+
+// Function to open a connection; the server sees it on its next accept of SIM_LISTEN_FD
+int sim_connect(void)
+{
+    struct SimConnection *connection;
+    int                   id;
+
+    if(sim_free_count == 0)
+    {
+        errno = ECONNREFUSED;
+        return -1;
+    }
+    id         = sim_free_ids[--sim_free_count];
+    connection = &sim_connections[id];
+
+    connection->in_use        = 1;
+    connection->accepted      = 0;
+    connection->client_closed = 0;
+    connection->server_closed = 0;
+    sim_backlog[(sim_backlog_head + sim_backlog_count) % sim_max] = id;
+    sim_backlog_count++;
+    return id;
+}
+
+int sim_server_fd(int client)
+{
+    return sim_connections[client].accepted && !sim_connections[client].server_closed ? SIM_FD_BASE + 1 + client : -1;
+}
+
+// Function to write bytes the server will read from this client; returns -1 if the server is gone or the queue is full
+int sim_client_send(int client, const void *data, size_t len)
+{
+    struct SimConnection *connection = &sim_connections[client];
+
+    if(connection->server_closed || sim_queue_push(&connection->to_server, data, len) != len)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+ssize_t sim_client_recv(int client, void *buffer, size_t len)
+{
+    return (ssize_t)sim_queue_pop(&sim_connections[client].to_client, buffer, len);
+}
+
+size_t sim_client_discard(int client)
+{
+    struct SimQueue *queue = &sim_connections[client].to_client;
+
+    return sim_queue_pop(queue, NULL, queue->len);
+}
+
+size_t sim_discard_all(void)
+{
+    size_t bytes = 0;
+
+    for(int i = 0; i < sim_dirty_count; ++i)
+    {
+        sim_connections[sim_dirty_ids[i]].dirty = 0;
+        bytes += sim_client_discard(sim_dirty_ids[i]);
+    }
+    sim_dirty_count = 0;
+    return bytes;
+}
+
+// Function to hang up; the server's next recv on the connection returns 0
+void sim_client_close(int client)
+{
+    sim_connections[client].client_closed = 1;
+    sim_release(client);
+}
+
+int sim_client_closed(int client)
+{
+    return sim_connections[client].server_closed;
+}
+
+uint64_t sim_clock_now(void)
+{
+    return sim_clock;
+}
+
+void sim_clock_advance(uint64_t ns)
+{
+    sim_clock += ns;
+}
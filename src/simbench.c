@@ -0,0 +1,422 @@
+// Kernel-free benchmark of the group chat server's own CPU cost. Every
+// client is a simulated connection (sim_transport.h), so joins, frame
+// reads, dispatch, fan-out and leaves run the server's real code paths
+// without a single syscall on the connection path. The workload is
+// seeded and the clock is virtual, which makes everything but the CPU
+// time exactly repeatable: the bytes delivered per operation are the
+// same on every run. Results go to stdout as JSON.
+
+#include "../include/coalesce.h"
+#include "../include/histogram.h"
+#include "../include/history.h"
+#include "../include/log.h"
+#include "../include/protocol.h"
+#include "../include/search_index.h"
+#include "../include/server.h"
+#include "../include/session.h"
+#include "../include/sim_transport.h"
+#include "../include/transport.h"
+#include <time.h>
+
+#define SIMBENCH_BLOCK 64    // operations per timed block; output is drained between blocks
+#define SIMBENCH_OP_NS (10 * NANOS_PER_MICRO)    // virtual time per operation
+#define SIMBENCH_NAME_SIZE 16
+#define UNKNOWN_OPTION_MESSAGE_LEN 24
+
+enum SimOp
+{
+    SIM_OP_BROADCAST,
+    SIM_OP_DIRECT,
+    SIM_OP_RENAME,
+    SIM_OP_LIST,
+    SIM_OP_COUNT
+};
+
+struct SimResult
+{
+    uint64_t         ops;
+    uint64_t         cpu_ns;
+    uint64_t         bytes_out;    // everything the server sent while these operations ran
+    struct Histogram per_op;       // CPU ns per operation, one sample per block
+};
+
+struct SimBench
+{
+    int      clients;
+    uint64_t ops;    // per operation type
+    size_t   payload;
+    uint64_t seed;
+    uint64_t rng;
+    int     *renamed;    // per client: 0 while named s<i>, 1 while named t<i>
+    char    *queued;     // per client: has frames waiting in this block
+    int     *senders;    // clients with frames waiting, in the order they were queued
+    int      sender_count;
+};
+
+static const char *const op_names[SIM_OP_COUNT] = {"broadcast", "w", "u", "ul"};
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+static int first_result = 1;
+
+_Noreturn static void usage(const char *program_name, int exit_code, const char *message)
+{
+    if(message)
+    {
+        fprintf(stderr, "%s\n", message);
+    }
+
+    fprintf(stderr, "Usage: %s [-h] [-c clients] [-n operations] [-s bytes] [-S seed]\n", program_name);
+    fputs("Options:\n", stderr);
+    fputs(" -h Display this help message\n", stderr);
+    fprintf(stderr, " -c Simulated clients (default and at most MAX_CLIENTS, %d in this build)\n", MAX_CLIENTS);
+    fputs(" -n Operations of each kind (default 20000)\n", stderr);
+    fputs(" -s Room message and /w payload in bytes (default 64)\n", stderr);
+    fputs(" -S Random seed (default 1)\n", stderr);
+    exit(exit_code);
+}
+
+static uint64_t parse_number(const char *binary_name, const char *str, uint64_t max)
+{
+    char     *endptr;
+    uintmax_t parsed_value;
+
+    errno        = 0;
+    parsed_value = strtoumax(str, &endptr, BASE_TEN);
+    if(errno != 0 || *endptr != '\0' || endptr == str)
+    {
+        usage(binary_name, EXIT_FAILURE, "Invalid number.");
+    }
+    if(parsed_value > max)
+    {
+        usage(binary_name, EXIT_FAILURE, "Number out of range.");
+    }
+    return (uint64_t)parsed_value;
+}
+
+static void parse_arguments(int argc, char *argv[], struct SimBench *bench)
+{
+    int opt;
+
+    bench->clients = MAX_CLIENTS;
+    bench->ops     = 20000;
+    bench->payload = 64;
+    bench->seed    = 1;
+    opterr         = 0;
+
+    while((opt = getopt(argc, argv, "hc:n:s:S:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'h':
+            {
+                usage(argv[0], EXIT_SUCCESS, NULL);
+            }
+            case 'c':
+            {
+                bench->clients = (int)parse_number(argv[0], optarg, INT32_MAX);
+                break;
+            }
+            case 'n':
+            {
+                bench->ops = parse_number(argv[0], optarg, UINT32_MAX);
+                break;
+            }
+            case 's':
+            {
+                bench->payload = (size_t)parse_number(argv[0], optarg, BUFFER_SIZE - 2 * SIMBENCH_NAME_SIZE);
+                break;
+            }
+            case 'S':
+            {
+                bench->seed = parse_number(argv[0], optarg, UINT64_MAX);
+                break;
+            }
+            case '?':
+            {
+                char message[UNKNOWN_OPTION_MESSAGE_LEN];
+
+                snprintf(message, sizeof(message), "Unknown option '-%c'.", optopt);
+                usage(argv[0], EXIT_FAILURE, message);
+            }
+            default:
+            {
+                usage(argv[0], EXIT_FAILURE, NULL);
+            }
+        }
+    }
+    if(optind != argc)
+    {
+        usage(argv[0], EXIT_FAILURE, "No positional arguments are taken.");
+    }
+    if(bench->clients < 2 || bench->clients > MAX_CLIENTS)
+    {
+        fprintf(stderr, "Between 2 and MAX_CLIENTS (%d) clients; build with -DMAX_CLIENTS=N for more\n", MAX_CLIENTS);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static uint64_t cpu_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * (uint64_t)NANOS_PER_SECOND + (uint64_t)ts.tv_nsec;
+}
+
+// xorshift64*
+static uint64_t next_random(struct SimBench *bench)
+{
+    bench->rng ^= bench->rng >> 12;
+    bench->rng ^= bench->rng << 25;
+    bench->rng ^= bench->rng >> 27;
+    return bench->rng * UINT64_C(0x2545F4914F6CDD1D);
+}
+
+static void result_reset(struct SimResult *result)
+{
+    memset(result, 0, sizeof(*result));
+    histogram_reset(&result->per_op);
+}
+
+static void result_add_block(struct SimResult *result, uint64_t ops, uint64_t cpu_ns)
+{
+    result->ops += ops;
+    result->cpu_ns += cpu_ns;
+    histogram_record(&result->per_op, cpu_ns / ops);
+    result->bytes_out += sim_discard_all();
+}
+
+static void print_result(const char *name, const struct SimResult *result)
+{
+    printf("%s\n    {\"name\": \"%s\", \"ops\": %" PRIu64 ", \"cpu_ns_per_op\": %.1f, \"p50_ns\": %" PRIu64 ", \"p99_ns\": %" PRIu64 ", \"bytes_out\": %" PRIu64 "}",
+           first_result ? "" : ",",
+           name,
+           result->ops,
+           result->ops > 0 ? (double)result->cpu_ns / (double)result->ops : 0.0,
+           histogram_percentile(&result->per_op, 500),
+           histogram_percentile(&result->per_op, 990),
+           result->bytes_out);
+    first_result = 0;
+}
+
+// Frames content into the client's connection and remembers to service it in this block
+static void queue_frame(struct SimBench *bench, int client, const char *content)
+{
+    uint8_t header[PROTOCOL_HEADER_SIZE];
+    size_t  len = strlen(content);
+
+    encode_header(header, PROTOCOL_VERSION, (uint16_t)len);
+    if(sim_client_send(client, header, sizeof(header)) == -1 || sim_client_send(client, content, len) == -1)
+    {
+        fprintf(stderr, "simbench: client %d's queue is full\n", client);
+        exit(EXIT_FAILURE);
+    }
+    if(!bench->queued[client])
+    {
+        bench->queued[client]                 = 1;
+        bench->senders[bench->sender_count++] = client;
+    }
+}
+
+// What the event loop does for readable clients: read and dispatch until each has drained, then flush
+static void service_senders(struct SimBench *bench)
+{
+    for(int i = 0; i < bench->sender_count; ++i)
+    {
+        int client = bench->senders[i];
+        int status;
+
+        do
+        {
+            status = handle_client_input(client);
+        } while(status == CLIENT_THROTTLED);
+        bench->queued[client] = 0;
+    }
+    bench->sender_count = 0;
+    coalesce_end_tick();
+}
+
+static void name_of(const struct SimBench *bench, int client, char *out, size_t size)
+{
+    snprintf(out, size, "%c%d", bench->renamed[client] ? 't' : 's', client);
+}
+
+static void build_operation(struct SimBench *bench, enum SimOp op, int sender, const char *payload, char *out, size_t size)
+{
+    char name[SIMBENCH_NAME_SIZE];
+
+    switch(op)
+    {
+        case SIM_OP_BROADCAST:
+        {
+            snprintf(out, size, "%s", payload);
+            break;
+        }
+        case SIM_OP_DIRECT:
+        {
+            name_of(bench, (int)(next_random(bench) % (uint64_t)bench->clients), name, sizeof(name));
+            snprintf(out, size, "/w %s %s", name, payload);
+            break;
+        }
+        case SIM_OP_RENAME:
+        {
+            bench->renamed[sender] = !bench->renamed[sender];
+            name_of(bench, sender, name, sizeof(name));
+            snprintf(out, size, "/u %s", name);
+            break;
+        }
+        case SIM_OP_LIST:
+        case SIM_OP_COUNT:
+        default:
+        {
+            snprintf(out, size, "/ul");
+            break;
+        }
+    }
+}
+
+// Clients connect in order, so client i is accepted into slot i of the empty table
+static void run_joins(struct SimBench *bench, struct SimResult *result)
+{
+    struct sockaddr_storage addr;
+    socklen_t               addr_len;
+
+    for(int done = 0; done < bench->clients;)
+    {
+        int      block = bench->clients - done < SIMBENCH_BLOCK ? bench->clients - done : SIMBENCH_BLOCK;
+        uint64_t start;
+
+        for(int i = 0; i < block; ++i)
+        {
+            sim_connect();
+        }
+        start = cpu_now_ns();
+        for(int i = 0; i < block; ++i)
+        {
+            addr_len = sizeof(addr);
+            admit_client(socket_accept_connection(SIM_LISTEN_FD, &addr, &addr_len));
+        }
+        result_add_block(result, (uint64_t)block, cpu_now_ns() - start);
+        done += block;
+    }
+
+    // Past the resume grace period, every client's first frame sends it the room history
+    sim_clock_advance(SESSION_RESUME_GRACE_MS * NANOS_PER_MILLI);
+    for(int i = 0; i < bench->clients; ++i)
+    {
+        char command[SIMBENCH_NAME_SIZE + 4];
+        char name[SIMBENCH_NAME_SIZE];
+
+        name_of(bench, i, name, sizeof(name));
+        snprintf(command, sizeof(command), "/u %s", name);
+        queue_frame(bench, i, command);
+    }
+    service_senders(bench);
+    sim_discard_all();
+}
+
+static void run_operations(struct SimBench *bench, enum SimOp op, const char *payload, struct SimResult *result)
+{
+    char content[MESSAGE_SIZE];    // -s keeps real operations under BUFFER_SIZE
+
+    for(uint64_t done = 0; done < bench->ops;)
+    {
+        uint64_t block = bench->ops - done < SIMBENCH_BLOCK ? bench->ops - done : SIMBENCH_BLOCK;
+        uint64_t start;
+
+        for(uint64_t i = 0; i < block; ++i)
+        {
+            int sender = (int)(next_random(bench) % (uint64_t)bench->clients);
+
+            build_operation(bench, op, sender, payload, content, sizeof(content));
+            queue_frame(bench, sender, content);
+        }
+        start = cpu_now_ns();
+        service_senders(bench);
+        result_add_block(result, block, cpu_now_ns() - start);
+        sim_clock_advance(block * SIMBENCH_OP_NS);
+        done += block;
+    }
+}
+
+// Every client hangs up; the server notices on its next read, as in the event loop
+static void run_leaves(struct SimBench *bench, struct SimResult *result)
+{
+    for(int done = 0; done < bench->clients;)
+    {
+        int      block = bench->clients - done < SIMBENCH_BLOCK ? bench->clients - done : SIMBENCH_BLOCK;
+        uint64_t start;
+
+        for(int i = done; i < done + block; ++i)
+        {
+            sim_client_close(i);
+        }
+        start = cpu_now_ns();
+        for(int i = done; i < done + block; ++i)
+        {
+            if(handle_client_input(i) == CLIENT_GONE)
+            {
+                release_client(i);
+            }
+        }
+        result_add_block(result, (uint64_t)block, cpu_now_ns() - start);
+        done += block;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    struct SimBench  bench;
+    struct SimResult result;
+    char             payload[BUFFER_SIZE];
+
+    memset(&bench, 0, sizeof(bench));
+    parse_arguments(argc, argv, &bench);
+    bench.rng     = bench.seed != 0 ? bench.seed : 1;
+    bench.renamed = (int *)calloc((size_t)bench.clients, sizeof(int));
+    bench.queued  = (char *)calloc((size_t)bench.clients, sizeof(char));
+    bench.senders = (int *)calloc((size_t)bench.clients, sizeof(int));
+    if(bench.renamed == NULL || bench.queued == NULL || bench.senders == NULL || sim_transport_init(bench.clients) == -1)
+    {
+        perror("simbench setup");
+        return EXIT_FAILURE;
+    }
+    memset(payload, 'x', bench.payload);
+    payload[bench.payload] = '\0';
+
+    log_set_level(LOG_LEVEL_WARN);
+    allocate_client_buffers();
+    history_init(HISTORY_CAPACITY_BYTES, HISTORY_MAX_ENTRIES);
+    session_init(SESSION_MAX, (uint64_t)SESSION_TTL_SECONDS * (uint64_t)NANOS_PER_SECOND);
+    search_index_init(SEARCH_MEMORY_BYTES, SEARCH_BLOCK_MESSAGES);
+
+    printf("{\n  \"tool\": \"simbench\",\n  \"transport\": \"%s\",\n  \"clients\": %d,\n  \"payload\": %zu,\n  \"seed\": %" PRIu64 ",\n  \"results\": [",
+           transport_name(),
+           bench.clients,
+           bench.payload,
+           bench.seed);
+
+    result_reset(&result);
+    run_joins(&bench, &result);
+    print_result("join", &result);
+    for(int op = 0; op < SIM_OP_COUNT; ++op)
+    {
+        result_reset(&result);
+        run_operations(&bench, (enum SimOp)op, payload, &result);
+        print_result(op_names[op], &result);
+    }
+    result_reset(&result);
+    run_leaves(&bench, &result);
+    print_result("leave", &result);
+    printf("\n  ]\n}\n");
+
+    search_index_free();
+    session_free();
+    history_free();
+    free_client_buffers();
+    sim_transport_free();
+    free(bench.renamed);
+    free(bench.queued);
+    free(bench.senders);
+    return EXIT_SUCCESS;
+}
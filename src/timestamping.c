@@ -0,0 +1,313 @@
+#include "../include/timestamping.h"
+#include "../include/metrics.h"
+#include "../include/transport.h"
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <linux/errqueue.h>    // after time.h: needs struct timespec
+#include <linux/net_tstamp.h>
+
+#define TIMESTAMPING_CONTROL_SIZE 256
+#define NANOS_PER_SECOND 1000000000ULL
+
+#ifdef SOF_TIMESTAMPING_OPT_ID_TCP
+    #define TIMESTAMPING_OPT_ID_FLAGS (SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_ID_TCP)
+#else
+    #define TIMESTAMPING_OPT_ID_FLAGS SOF_TIMESTAMPING_OPT_ID
+#endif
+
+struct TimestampSend
+{
+    uint32_t id;            // offset of the send's last byte, as the kernel reports it
+    uint64_t enqueue_ns;    // when the application queued the bytes
+    uint64_t sched_ns;
+    uint64_t sent_ns;
+};
+
+struct TimestampSocket
+{
+    uint32_t             bytes_sent;    // since timestamping was enabled, modulo 2^32 like the kernel's ids
+    int                  head;
+    int                  count;
+    struct TimestampSend pending[TIMESTAMPING_MAX_PENDING];
+};
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables)
+static struct TimestampSocket  *timestamp_sockets[FD_SETSIZE];
+static struct TimestampingStats timestamping_stats;
+
+// NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables)
+
+static uint64_t timespec_ns(const struct timespec *ts)
+{
+    return (uint64_t)ts->tv_sec * NANOS_PER_SECOND + (uint64_t)ts->tv_nsec;
+}
+
+uint64_t timestamping_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return timespec_ns(&ts);
+}
+
+// Software timestamps are CLOCK_REALTIME; returns what to subtract to move them onto CLOCK_MONOTONIC
+static int64_t realtime_offset_ns(void)
+{
+    struct timespec realtime;
+    struct timespec monotonic;
+
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    clock_gettime(CLOCK_MONOTONIC, &monotonic);
+    return (int64_t)(timespec_ns(&realtime) - timespec_ns(&monotonic));
+}
+
+static void record_stage(enum MetricHistogram histogram, uint64_t from_ns, uint64_t to_ns)
+{
+    if(from_ns != 0 && to_ns >= from_ns)
+    {
+        metrics_record(histogram, to_ns - from_ns);
+    }
+}
+
+// Turns on RX and TX software timestamps for a client socket; call it before anything is sent on it
+int timestamping_enable(int fd)
+{
+    unsigned int flags = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SCHED | SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_TX_ACK |
+                         SOF_TIMESTAMPING_OPT_TSONLY | TIMESTAMPING_OPT_ID_FLAGS;
+
+    if(fd < 0 || fd >= FD_SETSIZE)
+    {
+        return -1;
+    }
+
+    if(setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == -1)
+    {
+        perror("setsockopt SO_TIMESTAMPING");
+        return -1;
+    }
+
+    timestamp_sockets[fd] = (struct TimestampSocket *)calloc(1, sizeof(struct TimestampSocket));
+    if(timestamp_sockets[fd] == NULL)
+    {
+        perror("timestamping_enable: calloc");
+        return -1;
+    }
+    return 0;
+}
+
+// Turns timestamping on for a socket a hot restart's predecessor already timestamped: the kernel keeps
+// counting OPT_ID offsets from where it was enabled there, so the offsets go on from bytes_sent
+int timestamping_adopt(int fd, uint32_t bytes_sent)
+{
+    if(timestamping_enable(fd) == -1)
+    {
+        return -1;
+    }
+    timestamp_sockets[fd]->bytes_sent = bytes_sent;
+    return 0;
+}
+
+// Bytes sent on a timestamped socket since it was first enabled, modulo 2^32; 0 if it is not timestamped
+uint32_t timestamping_bytes_sent(int fd)
+{
+    return timestamping_active(fd) ? timestamp_sockets[fd]->bytes_sent : 0;
+}
+
+// Forgets the socket; timestamps still queued for it go away with the socket
+void timestamping_release(int fd)
+{
+    if(fd < 0 || fd >= FD_SETSIZE || timestamp_sockets[fd] == NULL)
+    {
+        return;
+    }
+
+    free(timestamp_sockets[fd]);
+    timestamp_sockets[fd] = NULL;
+}
+
+int timestamping_active(int fd)
+{
+    return fd >= 0 && fd < FD_SETSIZE && timestamp_sockets[fd] != NULL;
+}
+
+// recv() that also returns when the newest packet read arrived (0 if the kernel did not say)
+ssize_t timestamping_recv(int fd, void *buffer, size_t len, int flags, uint64_t *kernel_rx_ns)
+{
+    struct msghdr   msg;
+    struct iovec    iov;
+    struct cmsghdr *cmsg;
+    char            control[TIMESTAMPING_CONTROL_SIZE];
+    ssize_t         received;
+
+    *kernel_rx_ns = 0;
+    if(!timestamping_active(fd))
+    {
+        return transport_recv(fd, buffer, len, flags);
+    }
+
+    iov.iov_base = buffer;
+    iov.iov_len  = len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+
+    received = recvmsg(fd, &msg, flags);
+    if(received <= 0)
+    {
+        return received;
+    }
+
+    for(cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        const struct scm_timestamping *stamps;
+
+        if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_TIMESTAMPING)
+        {
+            continue;
+        }
+        stamps = (const struct scm_timestamping *)(const void *)CMSG_DATA(cmsg);
+        if(stamps->ts[0].tv_sec != 0 || stamps->ts[0].tv_nsec != 0)
+        {
+            *kernel_rx_ns = timespec_ns(&stamps->ts[0]) - (uint64_t)realtime_offset_ns();
+            timestamping_stats.rx_timestamps++;
+        }
+    }
+    return received;
+}
+
+// Counts bytes written to a timestamped socket and remembers when they were queued, to match their TX timestamps
+void timestamping_note_send(int fd, size_t bytes, uint64_t enqueue_ns)
+{
+    struct TimestampSocket *ts_socket;
+    struct TimestampSend   *send;
+
+    if(!timestamping_active(fd) || bytes == 0)
+    {
+        return;
+    }
+
+    ts_socket = timestamp_sockets[fd];
+    ts_socket->bytes_sent += (uint32_t)bytes;
+    if(enqueue_ns == 0)
+    {
+        return;
+    }
+
+    // A peer that stopped acknowledging leaves the list full; later sends go untimed until it drains
+    if(ts_socket->count == TIMESTAMPING_MAX_PENDING)
+    {
+        timestamping_stats.sends_untracked++;
+        return;
+    }
+
+    send             = &ts_socket->pending[(ts_socket->head + ts_socket->count) % TIMESTAMPING_MAX_PENDING];
+    send->id         = ts_socket->bytes_sent - 1;
+    send->enqueue_ns = enqueue_ns;
+    send->sched_ns   = 0;
+    send->sent_ns    = 0;
+    ts_socket->count++;
+    timestamping_stats.sends_tracked++;
+}
+
+// Applies one TX timestamp to the send it belongs to
+static void timestamping_match(struct TimestampSocket *ts_socket, uint32_t type, uint32_t id, uint64_t kernel_ns)
+{
+    for(int i = 0; i < ts_socket->count; ++i)
+    {
+        struct TimestampSend *send = &ts_socket->pending[(ts_socket->head + i) % TIMESTAMPING_MAX_PENDING];
+
+        if(send->id != id)
+        {
+            continue;
+        }
+        if(type == SCM_TSTAMP_SCHED)
+        {
+            send->sched_ns = kernel_ns;
+        }
+        else if(type == SCM_TSTAMP_SND)
+        {
+            send->sent_ns = kernel_ns;
+            record_stage(METRIC_APP_TO_KERNEL_TX_NS, send->enqueue_ns, kernel_ns);
+            record_stage(METRIC_KERNEL_TX_QUEUE_NS, send->sched_ns, kernel_ns);
+        }
+        else if(type == SCM_TSTAMP_ACK)
+        {
+            record_stage(METRIC_KERNEL_TX_TO_ACK_NS, send->sent_ns, kernel_ns);
+        }
+        break;
+    }
+
+    // Acknowledged data is done with, including sends whose own timestamps the kernel merged away
+    if(type == SCM_TSTAMP_ACK)
+    {
+        while(ts_socket->count > 0 && (int32_t)(id - ts_socket->pending[ts_socket->head].id) >= 0)
+        {
+            ts_socket->head = (ts_socket->head + 1) % TIMESTAMPING_MAX_PENDING;
+            ts_socket->count--;
+        }
+    }
+}
+
+// Drains the socket's error queue of TX timestamps
+void timestamping_reap(int fd)
+{
+    struct TimestampSocket *ts_socket;
+    int64_t                 offset;
+
+    if(!timestamping_active(fd))
+    {
+        return;
+    }
+
+    ts_socket = timestamp_sockets[fd];
+    offset    = realtime_offset_ns();
+    for(;;)
+    {
+        struct msghdr                   msg;
+        char                            control[TIMESTAMPING_CONTROL_SIZE];
+        struct cmsghdr                 *cmsg;
+        const struct scm_timestamping  *stamps = NULL;
+        const struct sock_extended_err *serr   = NULL;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+        if(recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+        {
+            return;
+        }
+
+        for(cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING)
+            {
+                stamps = (const struct scm_timestamping *)(const void *)CMSG_DATA(cmsg);
+            }
+            else if((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) || (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+            {
+                serr = (const struct sock_extended_err *)(const void *)CMSG_DATA(cmsg);
+            }
+        }
+
+        if(stamps == NULL || serr == NULL || serr->ee_errno != ENOMSG || serr->ee_origin != SO_EE_ORIGIN_TIMESTAMPING)
+        {
+            continue;
+        }
+        timestamping_stats.tx_timestamps++;
+        timestamping_match(ts_socket, serr->ee_info, serr->ee_data, timespec_ns(&stamps->ts[0]) - (uint64_t)offset);
+    }
+}
+
+void timestamping_get_stats(struct TimestampingStats *stats)
+{
+    *stats = timestamping_stats;
+}
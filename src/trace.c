@@ -0,0 +1,202 @@
+#include "../include/trace.h"
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TRACE_MAX_THREADS 64
+#define TRACE_NANOS_PER_SECOND 1000000000ULL
+#define TRACE_NANOS_PER_MICRO 1000U
+
+struct TraceSpan
+{
+    uint64_t trace_id;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    int32_t  fd;
+    uint32_t stage;
+};
+
+struct TraceBuffer
+{
+    struct TraceSpan *spans;
+    uint64_t          written;    // total spans recorded; the newest capacity of them are kept
+    long              tid;
+};
+
+static const char *const stage_names[TRACE_STAGE_COUNT] = {
+    "recv",
+    "decode",
+    "dispatch",
+    "enqueue",
+    "flush",
+};
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables)
+static struct TraceBuffer *trace_buffers[TRACE_MAX_THREADS];
+static int                 trace_buffer_count = 0;
+static pthread_mutex_t     trace_mutex        = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t            trace_interval     = 0;
+static uint32_t            trace_capacity     = 0;
+static _Atomic uint64_t    trace_next_id      = 1;
+
+static _Thread_local struct TraceBuffer *trace_buffer    = NULL;
+static _Thread_local uint32_t            trace_countdown = 0;
+static _Thread_local uint64_t            trace_active    = 0;
+
+// NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables)
+
+// Function to set the sample rate (one frame in sample_interval, 0 = off) and per-thread buffer size
+void trace_init(uint32_t sample_interval, uint32_t spans_per_thread)
+{
+    trace_interval = sample_interval;
+    trace_capacity = spans_per_thread;
+}
+
+// Function to decide whether the next frame is traced; returns its trace id, or 0
+uint64_t trace_sample(void)
+{
+    if(trace_interval == 0)
+    {
+        return 0;
+    }
+    if(trace_countdown > 0)
+    {
+        trace_countdown--;
+        return 0;
+    }
+    trace_countdown = trace_interval - 1;
+    return atomic_fetch_add_explicit(&trace_next_id, 1, memory_order_relaxed);
+}
+
+uint64_t trace_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * TRACE_NANOS_PER_SECOND + (uint64_t)ts.tv_nsec;
+}
+
+static struct TraceBuffer *trace_register_thread(void)
+{
+    struct TraceBuffer *buffer;
+
+    pthread_mutex_lock(&trace_mutex);
+    if(trace_buffer_count == TRACE_MAX_THREADS || trace_capacity == 0)
+    {
+        pthread_mutex_unlock(&trace_mutex);
+        return NULL;
+    }
+    buffer = (struct TraceBuffer *)calloc(1, sizeof(struct TraceBuffer));
+    if(buffer != NULL)
+    {
+        buffer->spans = (struct TraceSpan *)calloc(trace_capacity, sizeof(struct TraceSpan));
+        if(buffer->spans == NULL)
+        {
+            free(buffer);
+            buffer = NULL;
+        }
+    }
+    if(buffer == NULL)
+    {
+        perror("trace: calloc");
+        pthread_mutex_unlock(&trace_mutex);
+        return NULL;
+    }
+    buffer->tid                         = syscall(SYS_gettid);
+    trace_buffers[trace_buffer_count++] = buffer;
+    pthread_mutex_unlock(&trace_mutex);
+    return buffer;
+}
+
+// Function to record one stage of a traced frame in this thread's buffer
+void trace_record(uint64_t trace_id, enum TraceStage stage, uint64_t start_ns, uint64_t end_ns, int fd)
+{
+    struct TraceSpan *span;
+
+    if(trace_id == 0)
+    {
+        return;
+    }
+    if(trace_buffer == NULL)
+    {
+        trace_buffer = trace_register_thread();
+        if(trace_buffer == NULL)
+        {
+            return;
+        }
+    }
+
+    span           = &trace_buffer->spans[trace_buffer->written % trace_capacity];
+    span->trace_id = trace_id;
+    span->start_ns = start_ns;
+    span->end_ns   = end_ns;
+    span->fd       = fd;
+    span->stage    = (uint32_t)stage;
+    trace_buffer->written++;
+}
+
+// The frame this thread is handling right now; sends made meanwhile belong to its trace
+void trace_set_current(uint64_t trace_id)
+{
+    trace_active = trace_id;
+}
+
+uint64_t trace_current(void)
+{
+    return trace_active;
+}
+
+// Function to write every buffered span to path as Chrome trace JSON
+int trace_export(const char *path)
+{
+    FILE *file  = fopen(path, "we");
+    int   first = 1;
+
+    if(file == NULL)
+    {
+        perror("trace_export: fopen");
+        return -1;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    pthread_mutex_lock(&trace_mutex);
+    for(int b = 0; b < trace_buffer_count; ++b)
+    {
+        const struct TraceBuffer *buffer = trace_buffers[b];
+        uint64_t                  oldest = buffer->written > trace_capacity ? buffer->written - trace_capacity : 0;
+
+        for(uint64_t i = oldest; i < buffer->written; ++i)
+        {
+            const struct TraceSpan *span     = &buffer->spans[i % trace_capacity];
+            uint64_t                duration = span->end_ns > span->start_ns ? span->end_ns - span->start_ns : 0;
+
+            fprintf(file,
+                    "%s\n{\"name\":\"%s\",\"cat\":\"message\",\"ph\":\"X\",\"pid\":%ld,\"tid\":%ld,\"ts\":%" PRIu64 ".%03" PRIu64 ",\"dur\":%" PRIu64 ".%03" PRIu64 ",\"args\":{\"trace\":%" PRIu64 ",\"fd\":%d}}",
+                    first ? "" : ",",
+                    stage_names[span->stage],
+                    (long)getpid(),
+                    buffer->tid,
+                    span->start_ns / TRACE_NANOS_PER_MICRO,
+                    span->start_ns % TRACE_NANOS_PER_MICRO,
+                    duration / TRACE_NANOS_PER_MICRO,
+                    duration % TRACE_NANOS_PER_MICRO,
+                    span->trace_id,
+                    span->fd);
+            first = 0;
+        }
+    }
+    pthread_mutex_unlock(&trace_mutex);
+    fprintf(file, "\n]}\n");
+
+    if(fclose(file) == EOF)
+    {
+        perror("trace_export: fclose");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include "../include/transport.h"
+#include <time.h>
+#include <unistd.h>
+
+#define TRANSPORT_NANOS_PER_SECOND UINT64_C(1000000000)
+
+static uint64_t kernel_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * TRANSPORT_NANOS_PER_SECOND + (uint64_t)ts.tv_nsec;
+}
+
+static const struct Transport kernel_transport = {
+    .name       = "kernel",
+    .send       = send,
+    .sendmsg    = sendmsg,
+    .recv       = recv,
+    .accept     = accept,
+    .setsockopt = setsockopt,
+    .close      = close,
+    .now_ns     = kernel_now_ns,
+};
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+static const struct Transport *transport_current = &kernel_transport;
+
+const struct Transport *transport_kernel(void)
+{
+    return &kernel_transport;
+}
+
+// Function to route connection I/O through another implementation; not thread-safe, call it before serving
+void transport_install(const struct Transport *transport)
+{
+    transport_current = transport != NULL ? transport : &kernel_transport;
+}
+
+const char *transport_name(void)
+{
+    return transport_current->name;
+}
+
+ssize_t transport_send(int fd, const void *data, size_t len, int flags)
+{
+    return transport_current->send(fd, data, len, flags);
+}
+
+ssize_t transport_sendmsg(int fd, const struct msghdr *msg, int flags)
+{
+    return transport_current->sendmsg(fd, msg, flags);
+}
+
+ssize_t transport_recv(int fd, void *buffer, size_t len, int flags)
+{
+    return transport_current->recv(fd, buffer, len, flags);
+}
+
+int transport_accept(int fd, struct sockaddr *addr, socklen_t *addr_len)
+{
+    return transport_current->accept(fd, addr, addr_len);
+}
+
+int transport_setsockopt(int fd, int level, int option, const void *value, socklen_t len)
+{
+    return transport_current->setsockopt(fd, level, option, value, len);
+}
+
+int transport_close(int fd)
+{
+    return transport_current->close(fd);
+}
+
+uint64_t transport_now_ns(void)
+{
+    return transport_current->now_ns();
+}
@@ -0,0 +1,747 @@
+#include "../include/wal.h"
+#include "../include/flight.h"
+#include "../include/log.h"
+#include "../include/metrics.h"
+#include "../include/protocol.h"
+#include "../include/timestamping.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WAL_STAGING_BYTES (512 * 1024)    // per buffer; the loop fills one while the writer drains the other
+#define WAL_DIRECTORY_SIZE 256
+#define WAL_PATH_SIZE (WAL_DIRECTORY_SIZE + 64)
+#define WAL_RECOVER_SEGMENTS 2    // newest segments fed back to the caller at startup
+#define WAL_NANOS_PER_MILLI 1000000L
+#define WAL_NANOS_PER_SECOND 1000000000L
+
+struct WalSegment
+{
+    uint64_t first_seq;
+    uint64_t frames;    // written to the file so far
+    size_t   bytes;
+};
+
+struct WalBatch
+{
+    uint8_t *data;
+    size_t   len;
+    uint64_t first_seq;
+    uint64_t frames;
+};
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables)
+static pthread_mutex_t    wal_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t     wal_wake;     // writer: a batch is ready or we are stopping
+static pthread_cond_t     wal_space;    // appender: the staging buffer was swapped out
+static pthread_t          wal_thread;
+static int                wal_running = 0;
+static int                wal_stop    = 0;
+static int                wal_force   = 0;
+static struct WalBatch    wal_staging;
+static struct WalBatch    wal_writing;
+static struct timespec    wal_batch_started;
+static char               wal_directory[WAL_DIRECTORY_SIZE];
+static size_t             wal_segment_bytes;
+static size_t             wal_max_segments;    // 0: no limit
+static long               wal_interval_ms;
+static size_t             wal_commit_frames;
+static struct WalSegment *wal_segments      = NULL;
+static size_t             wal_segment_count = 0;
+static size_t             wal_segment_cap   = 0;
+static int                wal_active_fd     = -1;    // writer thread only once running
+static struct WalStats    wal_stats;
+
+// NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables)
+
+static void wal_segment_path(char *path, size_t size, uint64_t first_seq)
+{
+    snprintf(path, size, "%s/wal-%020" PRIu64 ".log", wal_directory, first_seq);
+}
+
+static int wal_compare_segments(const void *a, const void *b)
+{
+    uint64_t first  = ((const struct WalSegment *)a)->first_seq;
+    uint64_t second = ((const struct WalSegment *)b)->first_seq;
+    return (first > second) - (first < second);
+}
+
+// Caller holds wal_mutex (or is still single-threaded)
+static struct WalSegment *wal_push_segment(uint64_t first_seq)
+{
+    if(wal_segment_count == wal_segment_cap)
+    {
+        size_t             cap      = wal_segment_cap == 0 ? 16 : wal_segment_cap * 2;
+        struct WalSegment *segments = (struct WalSegment *)realloc(wal_segments, cap * sizeof(struct WalSegment));
+        if(segments == NULL)
+        {
+            perror("wal: realloc");
+            return NULL;
+        }
+        wal_segments    = segments;
+        wal_segment_cap = cap;
+    }
+
+    wal_segments[wal_segment_count].first_seq = first_seq;
+    wal_segments[wal_segment_count].frames    = 0;
+    wal_segments[wal_segment_count].bytes     = 0;
+    wal_stats.segments++;
+    return &wal_segments[wal_segment_count++];
+}
+
+// Caller holds wal_mutex (or is still single-threaded): forgets the oldest segment if there are more than the
+// limit and returns 1 with its first sequence number, for the caller to unlink once the mutex is released
+static int wal_pop_oldest(uint64_t *first_seq)
+{
+    if(wal_max_segments == 0 || wal_segment_count <= wal_max_segments)
+    {
+        return 0;
+    }
+
+    *first_seq = wal_segments[0].first_seq;
+    memmove(wal_segments, wal_segments + 1, (wal_segment_count - 1) * sizeof(struct WalSegment));
+    wal_segment_count--;
+    wal_stats.deleted_segments++;
+    return 1;
+}
+
+static void wal_unlink_segment(uint64_t first_seq)
+{
+    char path[WAL_PATH_SIZE];
+
+    wal_segment_path(path, sizeof(path), first_seq);
+    if(unlink(path) == -1 && errno != ENOENT)
+    {
+        perror("wal: unlink old segment");
+    }
+}
+
+// Size of the wire frame at data, or 0 if it does not fit in len
+static size_t wal_frame_length(const uint8_t *data, size_t len)
+{
+    size_t frame_len;
+
+    if(len < PROTOCOL_HEADER_SIZE)
+    {
+        return 0;
+    }
+    frame_len = PROTOCOL_HEADER_SIZE + (((size_t)data[1] << 8) | data[2]);
+    return frame_len <= len ? frame_len : 0;
+}
+
+// Walks one segment through mmap, cuts off a torn tail and optionally hands every frame back
+static int wal_recover_segment(struct WalSegment *segment, WalRecoveredFrame on_frame)
+{
+    char        path[WAL_PATH_SIZE];
+    struct stat st;
+    uint8_t    *map    = NULL;
+    size_t      offset = 0;
+    size_t      size;
+    int         fd;
+
+    wal_segment_path(path, sizeof(path), segment->first_seq);
+    fd = open(path, O_RDWR | O_CLOEXEC);
+    if(fd == -1 || fstat(fd, &st) == -1)
+    {
+        perror("wal: open segment");
+        if(fd != -1)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+
+    size = (size_t)st.st_size;
+    if(size > 0)
+    {
+        map = (uint8_t *)mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        if(map == MAP_FAILED)
+        {
+            perror("wal: mmap segment");
+            close(fd);
+            return -1;
+        }
+    }
+
+    while(offset < size)
+    {
+        size_t frame_len = wal_frame_length(map + offset, size - offset);
+        if(frame_len == 0)
+        {
+            break;
+        }
+        if(on_frame != NULL)
+        {
+            on_frame(segment->first_seq + segment->frames, map + offset, frame_len);
+            wal_stats.recovered_frames++;
+        }
+        offset += frame_len;
+        segment->frames++;
+    }
+    segment->bytes = offset;
+
+    if(map != NULL)
+    {
+        munmap(map, size);
+    }
+
+    // A crash mid-write leaves a partial frame at the end
+    if(offset < size)
+    {
+        LOG_WARN("wal: dropping %zu torn bytes from %s\n", size - offset, path);
+        wal_stats.truncated_bytes += size - offset;
+        if(ftruncate(fd, (off_t)offset) == -1)
+        {
+            perror("wal: ftruncate");
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+static int wal_scan_directory(void)
+{
+    DIR                 *dir = opendir(wal_directory);
+    const struct dirent *entry;
+
+    if(dir == NULL)
+    {
+        perror("wal: opendir");
+        return -1;
+    }
+
+    while((entry = readdir(dir)) != NULL)
+    {
+        uint64_t first_seq;
+        int      consumed = 0;
+
+        if(sscanf(entry->d_name, "wal-%20" SCNu64 ".log%n", &first_seq, &consumed) == 1 && consumed > 0 && entry->d_name[consumed] == '\0')
+        {
+            if(wal_push_segment(first_seq) == NULL)
+            {
+                closedir(dir);
+                return -1;
+            }
+        }
+    }
+    closedir(dir);
+
+    qsort(wal_segments, wal_segment_count, sizeof(struct WalSegment), wal_compare_segments);
+    return 0;
+}
+
+// Makes a new segment visible on disk before frames are acknowledged from it
+static void wal_sync_directory(void)
+{
+    int dir_fd = open(wal_directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if(dir_fd != -1)
+    {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+}
+
+// Writer thread: appends the batch to the active segment, rotating first if needed
+static void wal_write_batch(const struct WalBatch *batch)
+{
+    struct WalSegment *active;
+    size_t             written = 0;
+    struct timespec    start;
+    struct timespec    end;
+    uint64_t           oldest;
+
+    pthread_mutex_lock(&wal_mutex);
+    active = wal_segment_count > 0 ? &wal_segments[wal_segment_count - 1] : NULL;
+    if(wal_active_fd == -1 || active == NULL || batch->first_seq != active->first_seq + active->frames || (active->bytes > 0 && active->bytes + batch->len > wal_segment_bytes))
+    {
+        char path[WAL_PATH_SIZE];
+
+        if(wal_active_fd != -1)
+        {
+            close(wal_active_fd);
+        }
+        wal_segment_path(path, sizeof(path), batch->first_seq);
+        wal_active_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR);
+        if(wal_active_fd == -1 || wal_push_segment(batch->first_seq) == NULL)
+        {
+            perror("wal: open new segment");
+            pthread_mutex_unlock(&wal_mutex);
+            return;
+        }
+        wal_sync_directory();
+
+        // Replay and /search go by wal_segments, so once a segment is out of it nobody opens the file again
+        while(wal_pop_oldest(&oldest))
+        {
+            pthread_mutex_unlock(&wal_mutex);
+            wal_unlink_segment(oldest);
+            pthread_mutex_lock(&wal_mutex);
+        }
+    }
+    pthread_mutex_unlock(&wal_mutex);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while(written < batch->len)
+    {
+        ssize_t result = write(wal_active_fd, batch->data + written, batch->len - written);
+        if(result == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            perror("wal: write");
+            return;
+        }
+        written += (size_t)result;
+    }
+    if(fdatasync(wal_active_fd) == -1)
+    {
+        perror("wal: fdatasync");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    metrics_record(METRIC_WAL_COMMIT_NS, (uint64_t)((end.tv_sec - start.tv_sec) * (time_t)WAL_NANOS_PER_SECOND + (end.tv_nsec - start.tv_nsec)));
+
+    // Replay may now read these frames back
+    pthread_mutex_lock(&wal_mutex);
+    active = &wal_segments[wal_segment_count - 1];
+    active->frames += batch->frames;
+    active->bytes += batch->len;
+    wal_stats.commits++;
+    wal_stats.bytes += batch->len;
+    if(batch->frames > wal_stats.max_batch)
+    {
+        wal_stats.max_batch = batch->frames;
+    }
+    pthread_mutex_unlock(&wal_mutex);
+}
+
+static void *wal_writer(void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&wal_mutex);
+    for(;;)
+    {
+        struct WalBatch swap;
+
+        // Wait until the batch is big enough, old enough, forced out, or we are stopping
+        while(!wal_stop && !wal_force && wal_staging.frames < wal_commit_frames)
+        {
+            if(wal_staging.frames == 0)
+            {
+                pthread_cond_wait(&wal_wake, &wal_mutex);
+            }
+            else
+            {
+                struct timespec deadline = wal_batch_started;
+
+                deadline.tv_nsec += wal_interval_ms * WAL_NANOS_PER_MILLI;
+                deadline.tv_sec += deadline.tv_nsec / WAL_NANOS_PER_SECOND;
+                deadline.tv_nsec %= WAL_NANOS_PER_SECOND;
+                if(pthread_cond_timedwait(&wal_wake, &wal_mutex, &deadline) == ETIMEDOUT)
+                {
+                    break;
+                }
+            }
+        }
+
+        if(wal_staging.frames == 0)
+        {
+            wal_force = 0;
+            pthread_cond_broadcast(&wal_space);
+            if(wal_stop)
+            {
+                break;
+            }
+            continue;
+        }
+
+        swap               = wal_writing;
+        wal_writing        = wal_staging;
+        wal_staging        = swap;
+        wal_staging.len    = 0;
+        wal_staging.frames = 0;
+        wal_force          = 0;
+        metrics_set(METRIC_WAL_STAGED_BYTES, 0);
+        pthread_cond_broadcast(&wal_space);
+        pthread_mutex_unlock(&wal_mutex);
+
+        wal_write_batch(&wal_writing);
+
+        pthread_mutex_lock(&wal_mutex);
+    }
+    pthread_mutex_unlock(&wal_mutex);
+    return NULL;
+}
+
+// Function to open (or create) the log, recover what is in it and start the writer
+int wal_open(const char *directory, size_t segment_bytes, size_t max_segments, long commit_interval_ms, size_t commit_frames, WalRecoveredFrame on_frame, uint64_t *last_seq)
+{
+    pthread_condattr_t attr;
+    uint64_t           oldest;
+
+    *last_seq = 0;
+    snprintf(wal_directory, sizeof(wal_directory), "%s", directory);
+    wal_segment_bytes = segment_bytes;
+    wal_max_segments  = max_segments;
+    wal_interval_ms   = commit_interval_ms;
+    wal_commit_frames = commit_frames;
+
+    if(mkdir(wal_directory, S_IRWXU) == -1 && errno != EEXIST)
+    {
+        perror("wal: mkdir");
+        return -1;
+    }
+    if(wal_scan_directory() == -1)
+    {
+        return -1;
+    }
+
+    // Left over from a bigger limit (or a crash between rotating and deleting): only the newest are read
+    while(wal_pop_oldest(&oldest))
+    {
+        wal_unlink_segment(oldest);
+    }
+
+    for(size_t i = 0; i < wal_segment_count; ++i)
+    {
+        WalRecoveredFrame callback = (i + WAL_RECOVER_SEGMENTS >= wal_segment_count) ? on_frame : NULL;
+        if(wal_recover_segment(&wal_segments[i], callback) == -1)
+        {
+            return -1;
+        }
+        if(wal_segments[i].frames > 0)
+        {
+            *last_seq = wal_segments[i].first_seq + wal_segments[i].frames - 1;
+        }
+    }
+
+    // Keep appending to the newest segment if it still has room
+    if(wal_segment_count > 0 && wal_segments[wal_segment_count - 1].bytes < wal_segment_bytes)
+    {
+        char path[WAL_PATH_SIZE];
+
+        wal_segment_path(path, sizeof(path), wal_segments[wal_segment_count - 1].first_seq);
+        wal_active_fd = open(path, O_WRONLY | O_APPEND | O_CLOEXEC);
+    }
+
+    wal_staging.data = (uint8_t *)malloc(WAL_STAGING_BYTES);
+    wal_writing.data = (uint8_t *)malloc(WAL_STAGING_BYTES);
+    if(wal_staging.data == NULL || wal_writing.data == NULL)
+    {
+        perror("wal: malloc");
+        wal_close();
+        return -1;
+    }
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wal_wake, &attr);
+    pthread_cond_init(&wal_space, &attr);
+    pthread_condattr_destroy(&attr);
+
+    wal_stop = 0;
+    if(pthread_create(&wal_thread, NULL, wal_writer, NULL) != 0)
+    {
+        perror("wal: pthread_create");
+        wal_close();
+        return -1;
+    }
+    wal_running = 1;
+    return 0;
+}
+
+// Function to commit whatever is still staged and shut the writer down
+void wal_close(void)
+{
+    if(wal_running)
+    {
+        pthread_mutex_lock(&wal_mutex);
+        wal_stop = 1;
+        pthread_cond_signal(&wal_wake);
+        pthread_mutex_unlock(&wal_mutex);
+        pthread_join(wal_thread, NULL);
+        pthread_cond_destroy(&wal_wake);
+        pthread_cond_destroy(&wal_space);
+        wal_running = 0;
+    }
+
+    if(wal_active_fd != -1)
+    {
+        close(wal_active_fd);
+        wal_active_fd = -1;
+    }
+    free(wal_staging.data);
+    free(wal_writing.data);
+    free(wal_segments);
+    memset(&wal_staging, 0, sizeof(wal_staging));
+    memset(&wal_writing, 0, sizeof(wal_writing));
+    wal_segments      = NULL;
+    wal_segment_count = 0;
+    wal_segment_cap   = 0;
+}
+
+// Function to log one room frame; only copies into the staging buffer unless the writer is behind
+void wal_append(uint64_t seq, const uint8_t *header, size_t header_len, const char *payload, size_t payload_len)
+{
+    size_t len = header_len + payload_len;
+
+    if(!wal_running || len > WAL_STAGING_BYTES)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&wal_mutex);
+
+    // Frames in a batch must be consecutive; a full buffer or a gap waits for the writer
+    while(wal_staging.len + len > WAL_STAGING_BYTES || (wal_staging.frames > 0 && seq != wal_staging.first_seq + wal_staging.frames))
+    {
+        wal_stats.appender_waits++;
+        flight_record(FLIGHT_WAL_WAIT, -1, (int64_t)seq, (int64_t)wal_staging.len);
+        wal_force = 1;
+        pthread_cond_signal(&wal_wake);
+        pthread_cond_wait(&wal_space, &wal_mutex);
+    }
+
+    memcpy(wal_staging.data + wal_staging.len, header, header_len);
+    memcpy(wal_staging.data + wal_staging.len + header_len, payload, payload_len);
+    wal_staging.len += len;
+    if(wal_staging.frames == 0)
+    {
+        wal_staging.first_seq = seq;
+        clock_gettime(CLOCK_MONOTONIC, &wal_batch_started);
+        pthread_cond_signal(&wal_wake);
+    }
+    wal_staging.frames++;
+    wal_stats.frames++;
+    metrics_set(METRIC_WAL_STAGED_BYTES, (int64_t)wal_staging.len);
+    if(wal_staging.frames == wal_commit_frames)
+    {
+        pthread_cond_signal(&wal_wake);
+    }
+
+    pthread_mutex_unlock(&wal_mutex);
+}
+
+// Byte offset of frame number skip in a segment, found by walking it through mmap
+static int wal_frame_offset(int fd, size_t bytes, uint64_t skip, off_t *offset)
+{
+    uint8_t *map;
+    size_t   position = 0;
+
+    if(skip == 0)
+    {
+        *offset = 0;
+        return 0;
+    }
+
+    map = (uint8_t *)mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED)
+    {
+        perror("wal: mmap for replay");
+        return -1;
+    }
+    for(uint64_t i = 0; i < skip && position < bytes; ++i)
+    {
+        size_t frame_len = wal_frame_length(map + position, bytes - position);
+        if(frame_len == 0)
+        {
+            break;
+        }
+        position += frame_len;
+    }
+    munmap(map, bytes);
+
+    *offset = (off_t)position;
+    return 0;
+}
+
+// Function to send the committed frames numbered first_seq..last_seq straight from the log files.
+// Returns the sequence number of the first frame it did not send. If sending fails part way, the stream may
+// end inside a frame, so the connection is shut down (the event loop then drops the client) and last_seq + 1
+// is returned so nothing more is sent to it.
+uint64_t wal_replay(int sockfd, uint64_t first_seq, uint64_t last_seq)
+{
+    uint64_t next_seq = first_seq;
+    int      started  = 0;    // some bytes are on the socket
+
+    if(!wal_running)
+    {
+        return first_seq;
+    }
+
+    for(;;)
+    {
+        struct WalSegment segment;
+        char              path[WAL_PATH_SIZE];
+        off_t             offset;
+        off_t             end;
+        uint64_t          end_seq;
+        int               found = 0;
+        int               fd;
+
+        // Looked up by sequence number each time: the writer may delete old segments meanwhile
+        pthread_mutex_lock(&wal_mutex);
+        for(size_t i = 0; i < wal_segment_count; ++i)
+        {
+            if(wal_segments[i].frames > 0 && wal_segments[i].first_seq + wal_segments[i].frames > next_seq)
+            {
+                segment = wal_segments[i];
+                found   = 1;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&wal_mutex);
+
+        if(!found || segment.first_seq > last_seq)
+        {
+            break;
+        }
+        end_seq = segment.first_seq + segment.frames;
+        if(end_seq > last_seq + 1)
+        {
+            end_seq = last_seq + 1;
+        }
+
+        wal_segment_path(path, sizeof(path), segment.first_seq);
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if(fd == -1)
+        {
+            perror("wal: open for replay");
+            break;
+        }
+        end = (off_t)segment.bytes;
+        if(wal_frame_offset(fd, segment.bytes, next_seq > segment.first_seq ? next_seq - segment.first_seq : 0, &offset) == -1 ||
+           (end_seq < segment.first_seq + segment.frames && wal_frame_offset(fd, segment.bytes, end_seq - segment.first_seq, &end) == -1))
+        {
+            close(fd);
+            break;
+        }
+
+        while(offset < end)
+        {
+            ssize_t sent = sendfile(sockfd, fd, &offset, (size_t)(end - offset));
+            if(sent <= 0)
+            {
+                if(sent == -1 && errno == EINTR)
+                {
+                    continue;
+                }
+                perror("wal: sendfile");
+                close(fd);
+                if(started)
+                {
+                    shutdown(sockfd, SHUT_RDWR);
+                    return last_seq + 1;
+                }
+                return next_seq;
+            }
+            started = 1;
+            timestamping_note_send(sockfd, (size_t)sent, 0);
+        }
+        close(fd);
+        next_seq = end_seq;
+    }
+    return next_seq;
+}
+
+// Function to tell the oldest message the log still has; UINT64_MAX when it is not open or empty
+uint64_t wal_oldest_seq(void)
+{
+    uint64_t oldest = UINT64_MAX;
+
+    if(!wal_running)
+    {
+        return oldest;
+    }
+    pthread_mutex_lock(&wal_mutex);
+    for(size_t i = 0; i < wal_segment_count; ++i)
+    {
+        if(wal_segments[i].frames > 0)
+        {
+            oldest = wal_segments[i].first_seq;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&wal_mutex);
+    return oldest;
+}
+
+// Function to copy the content of committed frame seq (no header) into out, NUL-terminated and cut to fit.
+// Returns -1 if the log does not have it.
+int wal_lookup(uint64_t seq, char *out, size_t out_size)
+{
+    struct WalSegment segment;
+    char              path[WAL_PATH_SIZE];
+    uint8_t           header[PROTOCOL_HEADER_SIZE];
+    off_t             offset;
+    size_t            len;
+    ssize_t           got;
+    int               found = 0;
+    int               fd;
+
+    if(!wal_running || out_size == 0)
+    {
+        return -1;
+    }
+    pthread_mutex_lock(&wal_mutex);
+    for(size_t i = 0; i < wal_segment_count; ++i)
+    {
+        if(wal_segments[i].frames > 0 && seq >= wal_segments[i].first_seq && seq < wal_segments[i].first_seq + wal_segments[i].frames)
+        {
+            segment = wal_segments[i];
+            found   = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&wal_mutex);
+    if(!found)
+    {
+        return -1;
+    }
+
+    wal_segment_path(path, sizeof(path), segment.first_seq);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd == -1)
+    {
+        return -1;
+    }
+    if(wal_frame_offset(fd, segment.bytes, seq - segment.first_seq, &offset) == -1 || pread(fd, header, sizeof(header), offset) != (ssize_t)sizeof(header))
+    {
+        close(fd);
+        return -1;
+    }
+    len = ((size_t)header[1] << 8) | header[2];
+    if(len >= out_size)
+    {
+        len = out_size - 1;
+    }
+    got = pread(fd, out, len, offset + PROTOCOL_HEADER_SIZE);
+    close(fd);
+    if(got != (ssize_t)len)
+    {
+        return -1;
+    }
+    out[len] = '\0';
+    return 0;
+}
+
+void wal_get_stats(struct WalStats *stats)
+{
+    pthread_mutex_lock(&wal_mutex);
+    *stats = wal_stats;
+    pthread_mutex_unlock(&wal_mutex);
+}
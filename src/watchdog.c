@@ -0,0 +1,194 @@
+#include "../include/watchdog.h"
+#include "../include/flight.h"
+#include "../include/log.h"
+#include "../include/metrics.h"
+#include <execinfo.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define WATCHDOG_STACK_DEPTH 32
+#define WATCHDOG_STACK_WAIT_MS 50    // how long to wait for the stalled thread to take its stack
+#define WATCHDOG_NANOS_PER_SECOND UINT64_C(1000000000)
+#define WATCHDOG_NANOS_PER_MILLI UINT64_C(1000000)
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables)
+static pthread_t             watchdog_thread;
+static pthread_t             watchdog_loop_thread;
+static _Atomic int           watchdog_running = 0;
+static uint64_t              watchdog_threshold;
+static uint64_t              watchdog_interval;
+static _Atomic uint64_t      watchdog_busy_since = 0;    // start of the running iteration, 0 while in select
+static _Atomic(const char *) watchdog_current    = NULL;
+static _Atomic int           watchdog_current_fd = -1;
+static void                 *watchdog_stack[WATCHDOG_STACK_DEPTH];
+static _Atomic int           watchdog_stack_frames = 0;    // set by the signal handler once the stack is taken
+
+// NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables)
+
+static uint64_t watchdog_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * WATCHDOG_NANOS_PER_SECOND + (uint64_t)ts.tv_nsec;
+}
+
+// Runs on the stalled thread: backtrace() only walks the stack once its library is loaded (see watchdog_start)
+static void watchdog_stack_handler(int signum)
+{
+    (void)signum;
+    atomic_store_explicit(&watchdog_stack_frames, backtrace(watchdog_stack, WATCHDOG_STACK_DEPTH), memory_order_release);
+}
+
+// Asks the loop thread for its stack and logs it; gives up if the thread does not respond in time
+static void watchdog_log_stack(void)
+{
+    struct timespec step = {0, (long)WATCHDOG_NANOS_PER_MILLI};
+    char          **symbols;
+    int             frames = 0;
+
+    atomic_store_explicit(&watchdog_stack_frames, 0, memory_order_relaxed);
+    if(pthread_kill(watchdog_loop_thread, SIGRTMIN) != 0)
+    {
+        return;
+    }
+    for(int waited = 0; waited < WATCHDOG_STACK_WAIT_MS && frames == 0; ++waited)
+    {
+        nanosleep(&step, NULL);
+        frames = atomic_load_explicit(&watchdog_stack_frames, memory_order_acquire);
+    }
+    if(frames == 0)
+    {
+        LOG_WARN("  (stack unavailable)\n");
+        return;
+    }
+
+    // Frame 0 is the handler itself, frame 1 the signal trampoline
+    symbols = backtrace_symbols(watchdog_stack, frames);
+    for(int i = 2; i < frames; ++i)
+    {
+        if(symbols != NULL)
+        {
+            LOG_WARN("  #%d %s\n", i - 2, symbols[i]);
+        }
+        else
+        {
+            LOG_WARN("  #%d %p\n", i - 2, watchdog_stack[i]);
+        }
+    }
+    free((void *)symbols);
+}
+
+static void *watchdog_main(void *arg)
+{
+    struct timespec interval;
+    uint64_t        reported = 0;    // start of the iteration last reported as stalled
+
+    (void)arg;
+    interval.tv_sec  = (time_t)(watchdog_interval / WATCHDOG_NANOS_PER_SECOND);
+    interval.tv_nsec = (long)(watchdog_interval % WATCHDOG_NANOS_PER_SECOND);
+    while(atomic_load_explicit(&watchdog_running, memory_order_acquire))
+    {
+        uint64_t    since;
+        uint64_t    now;
+        const char *operation;
+        int         fd;
+
+        nanosleep(&interval, NULL);
+        since = atomic_load_explicit(&watchdog_busy_since, memory_order_acquire);
+        now   = watchdog_now_ns();
+        if(since == 0 || since == reported || now < since || now - since < watchdog_threshold)
+        {
+            continue;
+        }
+
+        reported  = since;
+        operation = atomic_load_explicit(&watchdog_current, memory_order_relaxed);
+        fd        = atomic_load_explicit(&watchdog_current_fd, memory_order_relaxed);
+        metrics_add(METRIC_LOOP_STALLS, 1);
+        flight_record(FLIGHT_STALL, fd, (int64_t)((now - since) / WATCHDOG_NANOS_PER_MILLI), 0);
+        LOG_WARN("Event loop stalled: iteration running for %" PRIu64 " ms, in %s (fd %d)\n", (now - since) / WATCHDOG_NANOS_PER_MILLI, operation != NULL ? operation : "?", fd);
+        watchdog_log_stack();
+    }
+    return NULL;
+}
+
+// Function to start watching the calling thread's event loop
+int watchdog_start(uint64_t threshold_ns, uint64_t interval_ns)
+{
+    struct sigaction sa;
+    void            *warm_up[1];
+
+    if(atomic_load_explicit(&watchdog_running, memory_order_relaxed))
+    {
+        return 0;
+    }
+
+    // The first backtrace() loads libgcc, which must not happen inside the signal handler
+    backtrace(warm_up, 1);
+
+    memset(&sa, 0, sizeof(sa));
+#if defined(__clang__)
+    #pragma clang diagnostic push
+    #pragma clang diagnostic ignored "-Wdisabled-macro-expansion"
+#endif
+    sa.sa_handler = watchdog_stack_handler;
+#if defined(__clang__)
+    #pragma clang diagnostic pop
+#endif
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    if(sigaction(SIGRTMIN, &sa, NULL) == -1)
+    {
+        perror("watchdog: sigaction");
+        return -1;
+    }
+
+    watchdog_loop_thread = pthread_self();
+    watchdog_threshold   = threshold_ns;
+    watchdog_interval    = interval_ns;
+    atomic_store_explicit(&watchdog_running, 1, memory_order_release);
+    if(pthread_create(&watchdog_thread, NULL, watchdog_main, NULL) != 0)
+    {
+        perror("watchdog: pthread_create");
+        atomic_store_explicit(&watchdog_running, 0, memory_order_release);
+        return -1;
+    }
+    return 0;
+}
+
+void watchdog_stop(void)
+{
+    if(!atomic_exchange_explicit(&watchdog_running, 0, memory_order_acq_rel))
+    {
+        return;
+    }
+    pthread_join(watchdog_thread, NULL);
+}
+
+// Function to mark the start of a loop iteration (select returned)
+void watchdog_busy(uint64_t now_ns)
+{
+    atomic_store_explicit(&watchdog_busy_since, now_ns, memory_order_release);
+}
+
+// Function to mark the loop as waiting in select
+void watchdog_idle(void)
+{
+    atomic_store_explicit(&watchdog_busy_since, 0, memory_order_release);
+    atomic_store_explicit(&watchdog_current, "select", memory_order_relaxed);
+    atomic_store_explicit(&watchdog_current_fd, -1, memory_order_relaxed);
+}
+
+// Function to name what the loop is doing now; operation must be a string literal
+void watchdog_operation(const char *operation, int fd)
+{
+    atomic_store_explicit(&watchdog_current, operation, memory_order_relaxed);
+    atomic_store_explicit(&watchdog_current_fd, fd, memory_order_relaxed);
+}
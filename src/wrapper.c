@@ -1,8 +1,141 @@
 #include "../include/protocol.h"
+#include "../include/autoscale.h"
+#include "../include/chat_pool.h"
+#include "../include/metrics.h"
 #include "../include/server.h"
+#include <limits.h>
 #include <stdbool.h>
 
-int main(void)
+// The event loop select()s on every client; bigger MAX_CLIENTS builds are for microbench and simbench
+#if MAX_CLIENTS >= FD_SETSIZE
+    #error "MAX_CLIENTS must stay below FD_SETSIZE for the server"
+#endif
+
+// What a chat worker needs to listen on and serve the chat port
+struct ChatWorkerContext
+{
+    struct sockaddr_storage *addr;
+    in_port_t                port;
+    int                      sm_socket;
+};
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables)
+static struct ChatWorkerContext pool_worker_ctx;       // what the chat workers serve, for as long as they run
+static int                      server_running = 0;    // the chat workers are up
+
+// NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables)
+
+// Opens one worker's listen socket; every worker binds the same port and the kernel spreads connections
+static int open_worker_listener(void *ctx)
+{
+    const struct ChatWorkerContext *worker_ctx = (const struct ChatWorkerContext *)ctx;
+    int                             opt        = 1;
+    int                             sockfd     = socket_create(worker_ctx->addr->ss_family, SOCK_STREAM, 0);
+
+    if(setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1)
+    {
+        perror("setsockopt SO_REUSEPORT");
+        close(sockfd);
+        return -1;
+    }
+    socket_bind(sockfd, worker_ctx->addr, worker_ctx->port);
+    start_listening(sockfd, BASE_TEN);
+    return sockfd;
+}
+
+// Runs in a forked worker until the group chat server stops
+static void run_worker(int worker, void *ctx)
+{
+    const struct ChatWorkerContext *worker_ctx = (const struct ChatWorkerContext *)ctx;
+
+    metrics_use_page(worker);
+    start_groupChat_server(worker_ctx->addr, worker_ctx->port, worker_ctx->sm_socket);
+}
+
+// Starts the chat workers: all of them, or with autoscaling the minimum, after which their number follows the load
+static int start_workers(void)
+{
+    struct AutoscalePolicy policy;
+
+    if(CHAT_AUTOSCALE_MAX_WORKERS <= 0)
+    {
+        return chat_pool_start(open_worker_listener, run_worker, &pool_worker_ctx, chat_pool_size());
+    }
+
+    policy.min_workers       = CHAT_AUTOSCALE_MIN_WORKERS;
+    policy.max_workers       = chat_pool_size();
+    policy.up_connections    = CHAT_AUTOSCALE_UP_CONNECTIONS;
+    policy.down_connections  = CHAT_AUTOSCALE_DOWN_CONNECTIONS;
+    policy.up_busy_percent   = CHAT_AUTOSCALE_UP_BUSY_PERCENT;
+    policy.down_busy_percent = CHAT_AUTOSCALE_DOWN_BUSY_PERCENT;
+    policy.idle_ns           = (uint64_t)CHAT_AUTOSCALE_IDLE_MS * NANOS_PER_MILLI;
+    policy.cooldown_ns       = (uint64_t)CHAT_AUTOSCALE_COOLDOWN_MS * NANOS_PER_MILLI;
+    if(chat_pool_start(open_worker_listener, run_worker, &pool_worker_ctx, CHAT_AUTOSCALE_MIN_WORKERS) == -1)
+    {
+        return -1;
+    }
+    autoscale_init(&policy);
+    return 0;
+}
+
+// Runs a hot restart's successor in the freshly exec'd binary: takes the pool from the wrapper over the control
+// socket, then serves the port its listen socket is bound to, like a forked worker
+static int run_successor(const char *control_arg)
+{
+    struct sockaddr_storage  addr;
+    socklen_t                addr_len = sizeof(addr);
+    char                    *endptr;
+    long                     control = strtol(control_arg, &endptr, BASE_TEN);
+    int                      worker;
+
+    if(*endptr != '\0' || control < 0 || control > INT_MAX)
+    {
+        return EXIT_FAILURE;
+    }
+    worker = chat_pool_resume((int)control);
+    if(worker == -1 || getsockname(chat_pool_listen_socket(), (struct sockaddr *)&addr, &addr_len) == -1)
+    {
+        return EXIT_FAILURE;
+    }
+
+    pool_worker_ctx.addr      = &addr;
+    pool_worker_ctx.port      = ntohs(addr.ss_family == AF_INET6 ? ((struct sockaddr_in6 *)&addr)->sin6_port : ((struct sockaddr_in *)&addr)->sin_port);
+    pool_worker_ctx.sm_socket = STDIN_FILENO;
+    run_worker(worker, &pool_worker_ctx);
+    fflush(NULL);
+    return EXIT_SUCCESS;
+}
+
+// A drained worker closes its listen socket, and connections still in its backlog then are reset unless the kernel
+// moves them to another socket on the port; says so when it will not
+static void check_backlog_migration(void)
+{
+    FILE *sysctl  = fopen(TCP_MIGRATE_REQ_PATH, "r");
+    int   enabled = 0;
+
+    if(sysctl != NULL)
+    {
+        if(fscanf(sysctl, "%d", &enabled) != 1)
+        {
+            enabled = 0;
+        }
+        fclose(sysctl);
+    }
+    if(!enabled)
+    {
+        printf("net.ipv4.tcp_migrate_req is off: a worker that scales down resets connections still in its backlog.\n");
+    }
+}
+
+static uint64_t wrapper_now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * (uint64_t)NANOS_PER_SECOND + (uint64_t)now.tv_nsec;
+}
+
+int main(int argc, char *argv[])
 {
     in_port_t               port;
     char                   *address  = NULL;
@@ -12,6 +145,12 @@ int main(void)
     char                   *endptr;
     long                    choice;
 
+    // A hot restart's successor (chat_pool.h) starts this binary afresh
+    if(argc == 3 && strcmp(argv[1], CHAT_POOL_EXEC_ARG) == 0)
+    {
+        return run_successor(argv[2]);
+    }
+
     printf("****%s****\n", WELCOME_STARTUP);
     printf("1: %s\n", OPTION_NO_SM);
     printf("2: %s\n", OPTION_WITH_SM);
@@ -29,7 +168,7 @@ int main(void)
             handle_prompt(&address, &port_str);
             handle_arguments(address, port_str, &port);
             convert_address(address, &addr);
-            start_groupChat_server(&addr, port, 0, 0);
+            start_groupChat_server(&addr, port, 0);
 
             free(address);
             free(port_str);
@@ -58,33 +197,64 @@ void start_admin_server(struct sockaddr_storage *addr, in_port_t port)
     struct sockaddr_storage client_addr;
     socklen_t               client_addr_len;
     fd_set                  readfds;
-    int                     max_sd;
-    int                     pipe_fds[2];
-    int                     server_manager_socket = 0;
+    int                     workers = CHAT_WORKERS > 0 ? CHAT_WORKERS : (int)sysconf(_SC_NPROCESSORS_ONLN);
 
     server_socket = socket_create(addr->ss_family, SOCK_STREAM, 0);
     socket_bind(server_socket, addr, port);
     start_listening(server_socket, BASE_TEN);
     admin_setup_signal_handler();
 
-    // Create a pipe for communication between the admin server and the group chat server
-    // if(pipe2(pipe_fds, O_CLOEXEC) == -1)    // use incase D'Arcy template
-       if(pipe(pipe_fds) == -1) // use incase gcc
+    // Mapped before the chat workers are forked: they relay through the pool and each publishes its stats to a
+    // page. With autoscaling there is room for the most workers it may start.
+    if(CHAT_AUTOSCALE_MAX_WORKERS > 0)
     {
-        perror("pipe");
-        exit(EXIT_FAILURE);
+        workers = CHAT_AUTOSCALE_MAX_WORKERS;
+    }
+    if(chat_pool_init(workers, MAX_CLIENTS, SESSION_MAX) == -1)
+    {
+        fprintf(stderr, "Cannot set up the group chat workers\n");
+        close(server_socket);
+        return;
+    }
+    if(CHAT_AUTOSCALE_MAX_WORKERS > 0)
+    {
+        printf("Group chat runs on %d to %d worker(s), following the load.\n", CHAT_AUTOSCALE_MIN_WORKERS, chat_pool_size());
+    }
+    else
+    {
+        printf("Group chat runs on %d worker(s).\n", chat_pool_size());
+    }
+    if(metrics_init(chat_pool_size()) == -1)
+    {
+        fprintf(stderr, "Continuing without /stats\n");
     }
 
-    // Initialize the set of active sockets
-    FD_ZERO(&readfds);
-    FD_SET(server_socket, &readfds);
-    FD_SET(pipe_fds[0], &readfds);
-    max_sd = server_socket > pipe_fds[0] ? server_socket : pipe_fds[0];
+    // The chat workers serve [port + 1]; only the wrapper talks to the server manager. With autoscaling they start
+    // now, follow the load and keep running whether or not a server manager is connected.
+    pool_worker_ctx.addr      = addr;
+    pool_worker_ctx.port      = (in_port_t)(port + 1);
+    pool_worker_ctx.sm_socket = STDIN_FILENO;
+    if(CHAT_AUTOSCALE_MAX_WORKERS > 0)
+    {
+        check_backlog_migration();
+        if(start_workers() == 0)
+        {
+            printf("Group chat server started.\n");
+            server_running = 1;
+        }
+    }
 
     while(!admin_exit_flag)
     {
-        // Wait for activity on the server socket or the pipe
-        if(select(max_sd + 1, &readfds, NULL, NULL, NULL) < 0)
+        struct timeval sample_wait;
+
+        FD_ZERO(&readfds);
+        FD_SET(server_socket, &readfds);
+        sample_wait.tv_sec  = STATS_SAMPLE_INTERVAL_MS / MILLIS_PER_SECOND;
+        sample_wait.tv_usec = (suseconds_t)(STATS_SAMPLE_INTERVAL_MS % MILLIS_PER_SECOND * MICROS_PER_MILLI);
+
+        // Wait for a server manager, checking on the chat workers meanwhile
+        if(select(server_socket + 1, &readfds, NULL, NULL, server_running ? &sample_wait : NULL) < 0)
         {
             if(errno == EINTR)
             {
@@ -93,37 +263,27 @@ void start_admin_server(struct sockaddr_storage *addr, in_port_t port)
             perror("select");
             exit(EXIT_FAILURE);
         }
-
-        // Check if there is a new connection and no active server manager connection
-        if(FD_ISSET(server_socket, &readfds) && server_manager_socket == 0)
+        if(server_running)
         {
-            server_manager_socket = handle_new_server_manager(server_socket, &client_addr, &client_addr_len, pipe_fds, addr, port);
-            if(server_manager_socket > 0)
-            {
-                FD_SET(server_manager_socket, &readfds);
-                if(server_manager_socket > max_sd)
-                {
-                    max_sd = server_manager_socket;
-                }
-            }
+            chat_pool_supervise();
+            autoscale_tick(wrapper_now_ns());
         }
 
-        // Update the set of active sockets for the next iteration
-        FD_ZERO(&readfds);
-        FD_SET(server_socket, &readfds);
-        FD_SET(pipe_fds[0], &readfds);
-        if(server_manager_socket > 0)
+        // One server manager at a time: this returns once it has disconnected
+        if(FD_ISSET(server_socket, &readfds))
         {
-            FD_SET(server_manager_socket, &readfds);
+            client_addr_len = sizeof(client_addr);
+            handle_new_server_manager(server_socket, &client_addr, &client_addr_len, port);
         }
     }
 
     // Close the server socket and clean up
-    close(server_socket);
-    if(server_manager_socket > 0)
+    if(server_running)
     {
-        close(server_manager_socket);    // Close the server manager socket if it's still open
+        chat_pool_stop();
+        server_running = 0;
     }
+    close(server_socket);
 }
 
 void handle_prompt(char **address, char **port_str)
@@ -187,18 +347,16 @@ void admin_sigint_handler(int signum)
     admin_exit_flag = 1;
 }
 
-int handle_new_server_manager(int server_socket, struct sockaddr_storage *client_addr, socklen_t *client_addr_len, const int pipe_fds[2], struct sockaddr_storage *addr, in_port_t port)
+int handle_new_server_manager(int server_socket, struct sockaddr_storage *client_addr, socklen_t *client_addr_len, in_port_t port)
 {
-    char    passkey_buffer[TWO_FIFTY_SIX];
-    int     attempts        = 0;
-    bool    passkey_matched = false;
-    int     sm_socket       = accept(server_socket, (struct sockaddr *)client_addr, client_addr_len);
-    pid_t   pid             = 0;
-    uint8_t version         = PROTOCOL_VERSION;
-    char    msg[BUFFER_SIZE];
-    fd_set  readfds;
-    int     max_sd;
-    int     server_running = 0;
+    char                     passkey_buffer[TWO_FIFTY_SIX];
+    int                      attempts        = 0;
+    bool                     passkey_matched = false;
+    int                      sm_socket       = accept(server_socket, (struct sockaddr *)client_addr, client_addr_len);
+    uint8_t                  version         = PROTOCOL_VERSION;
+    char                     msg[BUFFER_SIZE];
+    fd_set                   readfds;
+    int64_t                  reported_count  = 0;
 
     if(sm_socket < 0)
     {
@@ -251,17 +409,30 @@ int handle_new_server_manager(int server_socket, struct sockaddr_storage *client
         close(sm_socket);
         return -1;
     }
-    // this uses magic to do its thang
-    max_sd = sm_socket > pipe_fds[0] ? sm_socket : pipe_fds[0];
+    // Workers already running (autoscaled ones run without a server manager) need no /s
+    if(server_running)
+    {
+        send_with_protocol(sm_socket, version, STARTING_SERVER_MSG);
+    }
 
-    // Listen for commands to start or stop the group chat server
+    // Listen for commands to start or stop the group chat server; while it runs, sample its stats pages and
+    // replace workers that died
     while(1)
     {
+        struct timeval sample_wait;
+
+        if(server_running)
+        {
+            chat_pool_supervise();
+            autoscale_tick(wrapper_now_ns());
+        }
+
         FD_ZERO(&readfds);
         FD_SET(sm_socket, &readfds);
-        FD_SET(pipe_fds[0], &readfds);
+        sample_wait.tv_sec  = STATS_SAMPLE_INTERVAL_MS / MILLIS_PER_SECOND;
+        sample_wait.tv_usec = (suseconds_t)(STATS_SAMPLE_INTERVAL_MS % MILLIS_PER_SECOND * MICROS_PER_MILLI);
 
-        if(select(max_sd + 1, &readfds, NULL, NULL, NULL) < 0)
+        if(select(sm_socket + 1, &readfds, NULL, NULL, server_running ? &sample_wait : NULL) < 0)
         {
             if(errno == EINTR)
             {
@@ -285,34 +456,25 @@ int handle_new_server_manager(int server_socket, struct sockaddr_storage *client
                 break;
             }
 
-            if((strcmp(command_buffer, "/s") == 0 && pid == 0) || (strcmp(command_buffer, "/s\n") == 0 && pid == 0))    // Start the server
+            if((strcmp(command_buffer, "/s") == 0 && !server_running) || (strcmp(command_buffer, "/s\n") == 0 && !server_running))    // Start the server
             {
                 send_with_protocol(sm_socket, version, STARTING_SERVER_MSG);
-                pid = fork();
-                if(pid == 0)
-                {
-                    close(pipe_fds[0]);
-                    start_groupChat_server(addr, port + 1, sm_socket, pipe_fds[1]);
-                    //                    close(pipe_fds[1]);
-                    //                    exit(EXIT_SUCCESS);
-                }
-                else if(pid > 0)
+                if(start_workers() == 0)
                 {
-                    //                    close(pipe_fds[1]);
                     printf("Group chat server started.\n");
+
+                    // turns on sampling of the stats pages
+                    server_running = 1;
+                    reported_count = 0;
                 }
                 else
                 {
                     perror("Failed to start group chat server");
                 }
-                // turns on the read from pipe
-                server_running = 1;
             }
-            else if((strcmp(command_buffer, "/q") == 0 && pid > 0) || (strcmp(command_buffer, "/q\n") == 0 && pid > 0))    // Stop the server
+            else if((strcmp(command_buffer, "/q") == 0 && server_running) || (strcmp(command_buffer, "/q\n") == 0 && server_running))    // Stop the server
             {
-                kill(pid, SIGTERM);
-                waitpid(pid, NULL, 0);
-                pid = 0;
+                chat_pool_stop();
                 printf(STOPPING_SERVER_MSG);
                 if(send_with_protocol(sm_socket, version, STOPPING_SERVER_MSG) == -1)
                 {
@@ -320,57 +482,93 @@ int handle_new_server_manager(int server_socket, struct sockaddr_storage *client
                 }
                 server_running = 0;
             }
+            else if(strcmp(command_buffer, "/trace") == 0 || strcmp(command_buffer, "/trace\n") == 0)    // Export message traces
+            {
+                if(server_running)
+                {
+                    chat_pool_signal(SIGUSR2);
+                    snprintf(msg, sizeof(msg), TRACE_POOL_REQUESTED_MSG, (unsigned int)(port + 1), chat_pool_size());
+                }
+                else
+                {
+                    snprintf(msg, sizeof(msg), TRACE_UNAVAILABLE_MSG);
+                }
+                if(send_with_protocol(sm_socket, version, msg) == -1)
+                {
+                    perror("Error sending trace reply with protocol");
+                }
+            }
+            else if(strcmp(command_buffer, "/stats") == 0 || strcmp(command_buffer, "/stats\n") == 0)    // Snapshot of the metrics
+            {
+                char   report[METRICS_REPORT_SIZE];
+                size_t used;
+
+                used = metrics_format(report, sizeof(report), wrapper_now_ns());
+                used += (size_t)snprintf(report + used, sizeof(report) - used, WORKER_RESTARTS_FORMAT, chat_pool_restarts());
+                if(CHAT_AUTOSCALE_MAX_WORKERS > 0 && used < sizeof(report))
+                {
+                    snprintf(report + used, sizeof(report) - used, AUTOSCALE_STATS_FORMAT, chat_pool_active(), autoscale_ups(), autoscale_downs());
+                }
+                if(send_with_protocol(sm_socket, version, report) == -1)
+                {
+                    perror("Error sending stats with protocol");
+                }
+            }
+            else if(strcmp(command_buffer, "/r") == 0 || strcmp(command_buffer, "/r\n") == 0)    // Hot restart the workers
+            {
+                if(server_running)
+                {
+                    snprintf(msg, sizeof(msg), HOT_RESTART_MSG, chat_pool_hot_restart(), chat_pool_size());
+                }
+                else
+                {
+                    snprintf(msg, sizeof(msg), HOT_RESTART_UNAVAILABLE_MSG);
+                }
+                if(send_with_protocol(sm_socket, version, msg) == -1)
+                {
+                    perror("Error sending restart reply with protocol");
+                }
+            }
             else
             {
                 printf("Unknown command: %s\n", command_buffer);
             }
         }
 
-        if(FD_ISSET(pipe_fds[0], &readfds) && server_running == 1)
+        if(server_running == 1)
         {
-            printf("is server running:%d", server_running);
-            read_from_pipe(pipe_fds[0], sm_socket);
+            report_client_count(sm_socket, &reported_count);
         }
     }
 
-    // Clean up before exiting
-    if(pid > 0)
+    // Clean up before exiting; an autoscaled pool runs on for the next server manager
+    if(server_running && CHAT_AUTOSCALE_MAX_WORKERS <= 0)
     {
-        kill(pid, SIGTERM);
-        waitpid(pid, NULL, 0);
+        chat_pool_stop();
+        server_running = 0;
     }
-    //    close(sm_socket);
-    return sm_socket;
+    close(sm_socket);
+    return 0;
 }
 
-ssize_t read_from_pipe(int pipe_fd, int server_manager_socket)
+// Tells the server manager the chat server's client count whenever it has changed since the last report
+void report_client_count(int server_manager_socket, int64_t *reported_count)
 {
-    int     received_client_count;
-    ssize_t bytes_read;
-
-    // Read the client count from the pipe
-    bytes_read = read(pipe_fd, &received_client_count, sizeof(received_client_count));
+    int64_t count = metrics_gauge(METRIC_CONNECTIONS);
 
-    if(bytes_read > 0)
+    if(count >= 0 && count != *reported_count)
     {
         uint8_t version                = PROTOCOL_VERSION;
         char    count_str[BUFFER_SIZE] = {0};
 
-        snprintf(count_str, BUFFER_SIZE, "/d %d", received_client_count);
+        snprintf(count_str, BUFFER_SIZE, "/d %" PRId64, count);
 
         // Send this information to the server manager with protocol
         if(send_with_protocol(server_manager_socket, version, count_str) == -1)
         {
             perror("Failed to send client count to server manager with protocol");
+            return;
         }
+        *reported_count = count;
     }
-    else if(bytes_read == 0)
-    {
-        printf("Group chat server closed the pipe.\n");
-    }
-    else
-    {
-        perror("Failed to read from pipe");
-    }
-    return bytes_read;
 }
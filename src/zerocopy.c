@@ -0,0 +1,258 @@
+#include "../include/zerocopy.h"
+#include "../include/metrics.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <linux/errqueue.h>    // after time.h: needs struct timespec
+
+#define ZEROCOPY_CONTROL_SIZE 128
+
+struct ZeroCopySocket
+{
+    uint32_t               next_id;     // id the kernel will give the next MSG_ZEROCOPY send
+    uint32_t               first_id;    // id of pending[head]
+    int                    head;
+    int                    count;
+    struct ZeroCopyBuffer *pending[ZEROCOPY_MAX_PENDING];
+};
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables)
+static struct ZeroCopySocket *zerocopy_sockets[FD_SETSIZE];
+static struct ZeroCopyStats   zerocopy_stats;
+
+// NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables)
+
+// Turns on SO_ZEROCOPY for a client socket; returns -1 if the kernel does not support it
+int zerocopy_enable(int fd)
+{
+    int opt = 1;
+
+    if(fd < 0 || fd >= FD_SETSIZE)
+    {
+        return -1;
+    }
+
+    if(setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &opt, sizeof(opt)) == -1)
+    {
+        perror("setsockopt SO_ZEROCOPY");
+        return -1;
+    }
+
+    zerocopy_sockets[fd] = (struct ZeroCopySocket *)calloc(1, sizeof(struct ZeroCopySocket));
+    if(zerocopy_sockets[fd] == NULL)
+    {
+        perror("zerocopy_enable: calloc");
+        return -1;
+    }
+    return 0;
+}
+
+// Drops every reference the socket still holds; completions for a closed socket never arrive
+void zerocopy_release(int fd)
+{
+    struct ZeroCopySocket *zc_socket;
+
+    if(fd < 0 || fd >= FD_SETSIZE || zerocopy_sockets[fd] == NULL)
+    {
+        return;
+    }
+
+    zc_socket = zerocopy_sockets[fd];
+    for(int i = 0; i < zc_socket->count; ++i)
+    {
+        zerocopy_buffer_put(zc_socket->pending[(zc_socket->head + i) % ZEROCOPY_MAX_PENDING]);
+    }
+    free(zc_socket);
+    zerocopy_sockets[fd] = NULL;
+}
+
+int zerocopy_pending(int fd)
+{
+    if(fd < 0 || fd >= FD_SETSIZE || zerocopy_sockets[fd] == NULL)
+    {
+        return 0;
+    }
+    return zerocopy_sockets[fd]->count;
+}
+
+// Encodes one frame into a buffer owned by the caller (one reference)
+struct ZeroCopyBuffer *zerocopy_buffer_create(const uint8_t *header, size_t header_len, const char *payload, size_t payload_len)
+{
+    struct ZeroCopyBuffer *buffer = (struct ZeroCopyBuffer *)malloc(sizeof(struct ZeroCopyBuffer) + header_len + payload_len);
+
+    if(buffer == NULL)
+    {
+        perror("zerocopy_buffer_create: malloc");
+        return NULL;
+    }
+
+    buffer->refs = 1;
+    buffer->len  = header_len + payload_len;
+    memcpy(buffer->data, header, header_len);
+    memcpy(buffer->data + header_len, payload, payload_len);
+    zerocopy_stats.buffers_pinned++;
+    return buffer;
+}
+
+void zerocopy_buffer_put(struct ZeroCopyBuffer *buffer)
+{
+    if(buffer != NULL && --buffer->refs == 0)
+    {
+        zerocopy_stats.buffers_pinned--;
+        free(buffer);
+    }
+}
+
+// Ordinary send of whatever is left of the frame from offset sent
+static int zerocopy_copy_send(int fd, const struct ZeroCopyBuffer *buffer, size_t sent)
+{
+    zerocopy_stats.fallbacks++;
+    metrics_add(METRIC_ZEROCOPY_FALLBACKS, 1);
+    while(sent < buffer->len)
+    {
+        ssize_t result = send(fd, buffer->data + sent, buffer->len - sent, MSG_NOSIGNAL);
+        if(result == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        sent += (size_t)result;
+    }
+    return 0;
+}
+
+// Sends the frame without copying it into the kernel; the socket keeps a reference per send call
+int zerocopy_send(int fd, struct ZeroCopyBuffer *buffer)
+{
+    struct ZeroCopySocket *zc_socket = (fd >= 0 && fd < FD_SETSIZE) ? zerocopy_sockets[fd] : NULL;
+    size_t                 sent      = 0;
+
+    if(zc_socket == NULL)
+    {
+        return zerocopy_copy_send(fd, buffer, 0);
+    }
+
+    // Make room by collecting finished sends first
+    if(zc_socket->count == ZEROCOPY_MAX_PENDING)
+    {
+        zerocopy_reap(fd);
+    }
+
+    while(sent < buffer->len)
+    {
+        ssize_t result;
+
+        // Still full: copy the remainder rather than block on completions
+        if(zc_socket->count == ZEROCOPY_MAX_PENDING)
+        {
+            return zerocopy_copy_send(fd, buffer, sent);
+        }
+
+        result = send(fd, buffer->data + sent, buffer->len - sent, MSG_ZEROCOPY | MSG_NOSIGNAL);
+        if(result == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            if(errno == ENOBUFS)
+            {
+                // Out of optmem for notifications; the rest goes by copy
+                return zerocopy_copy_send(fd, buffer, sent);
+            }
+            return -1;
+        }
+
+        buffer->refs++;
+        zc_socket->pending[(zc_socket->head + zc_socket->count) % ZEROCOPY_MAX_PENDING] = buffer;
+        if(zc_socket->count == 0)
+        {
+            zc_socket->first_id = zc_socket->next_id;
+        }
+        zc_socket->count++;
+        zc_socket->next_id++;
+        sent += (size_t)result;
+        zerocopy_stats.zerocopy_sends++;
+        zerocopy_stats.zerocopy_bytes += (uint64_t)result;
+        metrics_add(METRIC_ZEROCOPY_SENDS, 1);
+        metrics_add(METRIC_ZEROCOPY_BYTES, (uint64_t)result);
+    }
+    return 0;
+}
+
+// Drains the socket's error queue and unpins every buffer whose sends have completed
+void zerocopy_reap(int fd)
+{
+    struct ZeroCopySocket *zc_socket = (fd >= 0 && fd < FD_SETSIZE) ? zerocopy_sockets[fd] : NULL;
+
+    if(zc_socket == NULL)
+    {
+        return;
+    }
+
+    while(zc_socket->count > 0)
+    {
+        struct msghdr                   msg;
+        char                            control[ZEROCOPY_CONTROL_SIZE];
+        struct cmsghdr                 *cmsg;
+        const struct sock_extended_err *serr;
+        uint32_t                        lo;
+        uint32_t                        hi;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+        if(recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+        {
+            return;
+        }
+
+        for(cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            serr = (const struct sock_extended_err *)(const void *)CMSG_DATA(cmsg);
+            if(serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0)
+            {
+                continue;
+            }
+
+            // The kernel reports an inclusive range of completed send ids
+            lo = serr->ee_info;
+            hi = serr->ee_data;
+            while(zc_socket->count > 0 && (int32_t)(zc_socket->first_id - lo) >= 0 && (int32_t)(hi - zc_socket->first_id) >= 0)
+            {
+                zerocopy_buffer_put(zc_socket->pending[zc_socket->head]);
+                zc_socket->pending[zc_socket->head] = NULL;
+                zc_socket->head                     = (zc_socket->head + 1) % ZEROCOPY_MAX_PENDING;
+                zc_socket->count--;
+                zc_socket->first_id++;
+                zerocopy_stats.completions++;
+                metrics_add(METRIC_ZEROCOPY_COMPLETIONS, 1);
+                if(serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                {
+                    zerocopy_stats.kernel_copied++;
+                    metrics_add(METRIC_ZEROCOPY_KERNEL_COPIED, 1);
+                }
+            }
+        }
+    }
+}
+
+void zerocopy_note_copy(size_t bytes)
+{
+    zerocopy_stats.copy_sends++;
+    zerocopy_stats.copy_bytes += bytes;
+    metrics_add(METRIC_COPY_SENDS, 1);
+    metrics_add(METRIC_COPY_BYTES, bytes);
+}
+
+void zerocopy_get_stats(struct ZeroCopyStats *stats)
+{
+    *stats = zerocopy_stats;
+}